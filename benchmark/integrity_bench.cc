@@ -0,0 +1,131 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+// Cost of the CRC32C integrity check against the memcpy it rides along
+// with, per message size, and the throughput of IntegrityChannel over a
+// plain MemoryChannel.
+// Run with: ./bazel-bin/benchmark/integrity_bench [MB per size]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "network/base_channel.h"
+#include "network/integrity_channel.h"
+#include "network/mem_channel.h"
+#include "util/crc32c.h"
+
+using primihub::link::ChannelBase;
+using primihub::link::IntegrityChannel;
+using primihub::link::MemoryChannel;
+using primihub::link::retcode;
+
+namespace {
+template <typename Fn> double Seconds(size_t rounds, Fn fn) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < rounds; i++)
+    fn();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+// Streams megabytes of size byte messages, returns MB/s or 0 on failure.
+double Throughput(ChannelBase *client, ChannelBase *server, size_t size,
+                  size_t megabytes) {
+  std::string payload(size, 'p');
+  std::vector<char> recv_buf(size);
+  size_t count = std::max<size_t>(1, megabytes * 1024 * 1024 / size);
+  auto start = std::chrono::steady_clock::now();
+  auto sender = std::async(std::launch::async, [&]() {
+    for (size_t i = 0; i < count; i++) {
+      if (client->SendImpl(payload) != retcode::SUCCESS)
+        return false;
+    }
+    return true;
+  });
+  bool ok = true;
+  for (size_t i = 0; i < count && ok; i++)
+    ok = server->RecvImpl(recv_buf.data(), size) == retcode::SUCCESS;
+  ok = sender.get() && ok;
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  if (!ok)
+    return 0;
+  return static_cast<double>(count * size) / (1024 * 1024) / elapsed.count();
+}
+
+std::shared_ptr<ChannelBase> Endpoint(MemoryChannel::ChannelRole role,
+                                      const std::string &key, bool integrity) {
+  std::shared_ptr<ChannelBase> channel = std::make_shared<MemoryChannel>(role);
+  if (integrity)
+    channel = std::make_shared<IntegrityChannel>(channel);
+  channel->SetKey(key);
+  return channel;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  size_t megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 256;
+  size_t max_size = 64 * 1024 * 1024;
+  std::vector<char> src(max_size);
+  for (size_t i = 0; i < src.size(); i++)
+    src[i] = static_cast<char>(i * 131);
+  std::vector<char> dst(max_size);
+
+  printf("%10s  %11s  %11s  %11s  %11s  %9s\n", "size", "memcpy MB/s",
+         "crc32c MB/s", "table MB/s", "copy+crc", "overhead");
+  uint32_t sink = 0;
+  for (size_t size = 4096; size <= max_size; size *= 8) {
+    size_t rounds = std::max<size_t>(1, megabytes * 1024 * 1024 / size);
+    double copy = Seconds(rounds, [&]() {
+      memcpy(dst.data(), src.data(), size);
+      sink ^= static_cast<uint8_t>(dst[size - 1]);
+    });
+    double crc = Seconds(rounds, [&]() {
+      sink ^= primihub::Crc32c(src.data(), size);
+    });
+    double table = Seconds(std::max<size_t>(1, rounds / 8), [&]() {
+      sink ^= primihub::Crc32cPortable(src.data(), size);
+    }) * 8;
+    // What IntegrityChannel pays on each side: the copy into or out of the
+    // frame with the checksum folded in.
+    double fused = Seconds(rounds, [&]() {
+      sink ^= primihub::Crc32cCopy(dst.data(), src.data(), size);
+    });
+    double mb = static_cast<double>(rounds * size) / (1024 * 1024);
+    printf("%10zu  %11.1f  %11.1f  %11.1f  %11.1f  %8.1f%%\n", size,
+           mb / copy, mb / crc, mb / table, mb / fused,
+           100 * (fused - copy) / copy);
+  }
+
+  auto plain_client = Endpoint(MemoryChannel::CLIENT, "integrity_plain", false);
+  auto plain_server = Endpoint(MemoryChannel::SERVER, "integrity_plain", false);
+  auto checked_client = Endpoint(MemoryChannel::CLIENT, "integrity_crc", true);
+  auto checked_server = Endpoint(MemoryChannel::SERVER, "integrity_crc", true);
+  printf("\n%10s  %11s  %11s\n", "size", "plain MB/s", "checked MB/s");
+  for (size_t size = 4096; size <= max_size; size *= 8) {
+    double plain = Throughput(plain_client.get(), plain_server.get(), size,
+                              megabytes);
+    double checked = Throughput(checked_client.get(), checked_server.get(),
+                                size, megabytes);
+    printf("%10zu  %11.1f  %11.1f\n", size, plain, checked);
+  }
+  return sink == 0x12345678 ? 1 : 0;
+}
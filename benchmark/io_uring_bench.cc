@@ -0,0 +1,109 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+// Round trips per second of 64 byte messages over loopback TcpChannel forks,
+// with plain socket calls and with the io_uring backend, every fork pair
+// ping-pongs on its own two threads. Run with:
+//   ./bazel-bin/benchmark/io_uring_bench [rounds]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "network/channel_interface.h"
+#include "network/tcp_channel.h"
+
+using primihub::link::Channel;
+using primihub::link::TcpChannel;
+
+namespace {
+double RunRoundTrips(TcpChannel::IoBackend backend, int forks, int rounds,
+                     bool *io_uring) {
+  TcpChannel::Options options;
+  options.io_backend = backend;
+  auto server_impl = std::make_shared<TcpChannel>(TcpChannel::SERVER,
+                                                  "127.0.0.1", 0, options);
+  auto client_impl = std::make_shared<TcpChannel>(
+      TcpChannel::CLIENT, "127.0.0.1", server_impl->port(), options);
+  *io_uring = client_impl->usingIoUring();
+  auto server = std::make_shared<Channel>(server_impl, "io_uring_bench");
+  auto client = std::make_shared<Channel>(client_impl, "io_uring_bench");
+
+  std::vector<std::shared_ptr<Channel>> clients;
+  std::vector<std::shared_ptr<Channel>> servers;
+  for (int i = 0; i < forks; i++) {
+    clients.push_back(client->fork());
+    servers.push_back(server->fork());
+  }
+
+  std::string message(64, 'x');
+  std::atomic<bool> ok{true};
+  auto run = [&](bool initiator, std::shared_ptr<Channel> channel) {
+    std::string buf;
+    // The first round trip connects, it is not timed.
+    for (int round = 0; round <= rounds; round++) {
+      if (initiator) {
+        if (!channel->asyncSend(message).IsOK() ||
+            !channel->asyncRecv(buf).get().IsOK())
+          ok = false;
+      } else {
+        if (!channel->asyncRecv(buf).get().IsOK() ||
+            !channel->asyncSend(buf).IsOK())
+          ok = false;
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < forks; i++) {
+    threads.emplace_back(run, true, clients[i]);
+    threads.emplace_back(run, false, servers[i]);
+  }
+  for (auto &thread : threads)
+    thread.join();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  for (int i = 0; i < forks; i++) {
+    clients[i]->close();
+    servers[i]->close();
+  }
+  client->close();
+  server->close();
+  if (!ok)
+    return 0;
+  return static_cast<double>(forks) * (rounds + 1) / elapsed.count();
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? std::atoi(argv[1]) : 2000;
+  for (int forks : {1, 16, 64, 256}) {
+    bool io_uring = false;
+    double syscall_rate = RunRoundTrips(TcpChannel::IoBackend::kSyscall, forks,
+                                        rounds, &io_uring);
+    double uring_rate = RunRoundTrips(TcpChannel::IoBackend::kIoUring, forks,
+                                      rounds, &io_uring);
+    printf("forks=%3d  syscall %10.0f rt/s  io_uring %10.0f rt/s  x%.2f%s\n",
+           forks, syscall_rate, uring_rate,
+           syscall_rate > 0 ? uring_rate / syscall_rate : 0.0,
+           io_uring ? "" : "  (io_uring unavailable, fell back)");
+  }
+  return 0;
+}
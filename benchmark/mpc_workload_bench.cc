@@ -0,0 +1,380 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+// Synthetic protocol shapes replayed over Channel, to see how a transport
+// holds up under the traffic mix of real MPC runs rather than a single
+// message size:
+//   gates   many rounds of tiny symmetric exchanges, one per
+//           multiplication-gate layer
+//   ot      bulk OT-extension style transfers, the receiver sends its
+//           matrix and the sender answers with as much data
+//   fanout  every round sends on each of many forks, then receives on each
+// Each workload reports end-to-end time, rounds/s, MB/s and the CPU time
+// of both parties. Run with:
+//   ./bazel-bin/benchmark/mpc_workload_bench [--transport=mem,tcp,uds]
+//       [--workload=gates,ot,fanout] [--layers=2000] [--layer_bytes=256]
+//       [--ot_mb=256] [--ot_chunk_kb=4096] [--forks=64,512]
+//       [--fork_rounds=20] [--fork_bytes=64]
+// Another ChannelBase implementation is benchmarked by adding a factory
+// for it to Transports().
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "network/channel_interface.h"
+#include "network/mem_channel.h"
+#include "network/tcp_channel.h"
+#include "network/uds_channel.h"
+
+using primihub::link::Channel;
+using primihub::link::ChannelBase;
+using primihub::link::MemoryChannel;
+using primihub::link::TcpChannel;
+using primihub::link::UdsChannel;
+
+namespace {
+struct Config {
+  std::vector<std::string> transports{"mem"};
+  std::vector<std::string> workloads{"gates", "ot", "fanout"};
+  size_t layers{2000};
+  size_t layer_bytes{256};
+  size_t ot_mb{256};
+  size_t ot_chunk_kb{4096};
+  std::vector<size_t> forks{64, 512};
+  size_t fork_rounds{20};
+  size_t fork_bytes{64};
+};
+
+using Endpoints =
+    std::pair<std::shared_ptr<ChannelBase>, std::shared_ptr<ChannelBase>>;
+// Creates a connected (client, server) pair of transports, key tells runs
+// apart.
+using TransportFactory = std::function<Endpoints(const std::string &key)>;
+
+std::vector<std::pair<std::string, TransportFactory>> Transports() {
+  return {
+      {"mem",
+       [](const std::string &key) -> Endpoints {
+         return {std::make_shared<MemoryChannel>(MemoryChannel::CLIENT),
+                 std::make_shared<MemoryChannel>(MemoryChannel::SERVER)};
+       }},
+      {"tcp",
+       [](const std::string &key) -> Endpoints {
+         auto server = std::make_shared<TcpChannel>(TcpChannel::SERVER,
+                                                    "127.0.0.1", 0);
+         auto client = std::make_shared<TcpChannel>(
+             TcpChannel::CLIENT, "127.0.0.1", server->port());
+         return {client, server};
+       }},
+      {"uds",
+       [](const std::string &key) -> Endpoints {
+         std::string path =
+             "@mpc_workload_bench_" + std::to_string(getpid()) + "_" + key;
+         auto server = std::make_shared<UdsChannel>(UdsChannel::SERVER, path);
+         auto client = std::make_shared<UdsChannel>(UdsChannel::CLIENT, path);
+         return {client, server};
+       }},
+  };
+}
+
+double ThreadCpuSeconds() {
+  struct rusage usage;
+  getrusage(RUSAGE_THREAD, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+double ProcessCpuSeconds() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+struct Result {
+  bool ok{true};
+  double seconds{0};
+  size_t rounds{0};
+  size_t bytes{0};
+  // CPU time of the threads running each party, and of the whole process
+  // including transport helper threads.
+  double client_cpu{0};
+  double server_cpu{0};
+  double process_cpu{0};
+};
+
+// Runs the two parties of a workload on their own threads. A party gets
+// whether it is the client and returns false on a failed send or receive.
+Result RunParties(Channel *client, Channel *server,
+                  const std::function<bool(Channel *, bool)> &party) {
+  Result result;
+  std::atomic<bool> ok{true};
+  double cpu[2] = {0, 0};
+  double process_start = ProcessCpuSeconds();
+  auto start = std::chrono::steady_clock::now();
+  std::thread server_thread([&]() {
+    double cpu_start = ThreadCpuSeconds();
+    if (!party(server, false))
+      ok = false;
+    cpu[1] = ThreadCpuSeconds() - cpu_start;
+  });
+  double cpu_start = ThreadCpuSeconds();
+  if (!party(client, true))
+    ok = false;
+  cpu[0] = ThreadCpuSeconds() - cpu_start;
+  server_thread.join();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  result.ok = ok;
+  result.seconds = elapsed.count();
+  result.client_cpu = cpu[0];
+  result.server_cpu = cpu[1];
+  result.process_cpu = ProcessCpuSeconds() - process_start;
+  return result;
+}
+
+// Both parties send their shares of a gate layer, then receive the other
+// half: one round per layer.
+Result GateLayers(Channel *client, Channel *server, const Config &config) {
+  auto party = [&](Channel *channel, bool is_client) {
+    std::string shares(config.layer_bytes, is_client ? 'c' : 's');
+    std::string peer(config.layer_bytes, 0);
+    for (size_t layer = 0; layer < config.layers; layer++) {
+      if (!channel->send(shares.data(), shares.size()).IsOK() ||
+          !channel->recv(&peer[0], peer.size()).IsOK())
+        return false;
+      // The next layer depends on the opened values.
+      shares[layer % shares.size()] ^= peer[layer % peer.size()];
+    }
+    return true;
+  };
+  Result result = RunParties(client, server, party);
+  result.rounds = config.layers;
+  result.bytes = 2 * config.layers * config.layer_bytes;
+  return result;
+}
+
+// The OT receiver streams its matrix in chunks, the sender receives all of
+// it and answers with the same amount: two rounds of bulk data.
+Result OtExtension(Channel *client, Channel *server, const Config &config) {
+  size_t chunk = std::max<size_t>(1, config.ot_chunk_kb) * 1024;
+  size_t total = std::max<size_t>(1, config.ot_mb) * 1024 * 1024;
+  auto stream_out = [&](Channel *channel, const std::string &data) {
+    for (size_t sent = 0; sent < total; sent += chunk) {
+      size_t size = std::min(chunk, total - sent);
+      if (!channel->send(data.data(), size).IsOK())
+        return false;
+    }
+    return true;
+  };
+  auto stream_in = [&](Channel *channel, std::string *data) {
+    for (size_t received = 0; received < total; received += chunk) {
+      size_t size = std::min(chunk, total - received);
+      if (!channel->recv(&(*data)[0], size).IsOK())
+        return false;
+    }
+    return true;
+  };
+  auto party = [&](Channel *channel, bool is_client) {
+    std::string data(chunk, is_client ? 'u' : 'y');
+    if (is_client)
+      return stream_out(channel, data) && stream_in(channel, &data);
+    return stream_in(channel, &data) && stream_out(channel, data);
+  };
+  Result result = RunParties(client, server, party);
+  result.rounds = 2;
+  result.bytes = 2 * total;
+  return result;
+}
+
+// Every round sends a small message on each fork and then receives one on
+// each, like a protocol running many instances side by side.
+Result FanOut(Channel *client, Channel *server, size_t forks,
+              const Config &config) {
+  std::vector<std::shared_ptr<Channel>> client_forks;
+  std::vector<std::shared_ptr<Channel>> server_forks;
+  for (size_t i = 0; i < forks; i++) {
+    client_forks.push_back(client->fork());
+    server_forks.push_back(server->fork());
+  }
+  size_t rounds = 1;
+  auto party = [&](Channel *channel, bool is_client) {
+    auto &mine = is_client ? client_forks : server_forks;
+    std::string message(config.fork_bytes, is_client ? 'c' : 's');
+    std::string peer(config.fork_bytes, 0);
+    for (size_t round = 0; round < rounds; round++) {
+      for (auto &fork : mine) {
+        if (!fork->send(message.data(), message.size()).IsOK())
+          return false;
+      }
+      for (auto &fork : mine) {
+        if (!fork->recv(&peer[0], peer.size()).IsOK())
+          return false;
+      }
+    }
+    return true;
+  };
+  // The first round connects the forks of socket transports, it is not
+  // timed.
+  Result result = RunParties(client, server, party);
+  if (result.ok) {
+    rounds = config.fork_rounds;
+    result = RunParties(client, server, party);
+  }
+  for (size_t i = 0; i < forks; i++) {
+    client_forks[i]->close();
+    server_forks[i]->close();
+  }
+  result.rounds = config.fork_rounds;
+  result.bytes = 2 * config.fork_rounds * forks * config.fork_bytes;
+  return result;
+}
+
+void Print(const std::string &transport, const std::string &workload,
+           const Result &result) {
+  if (!result.ok) {
+    printf("%-6s %-14s failed\n", transport.c_str(), workload.c_str());
+    return;
+  }
+  printf("%-6s %-14s %9.3f %12.0f %10.1f %9.3f %9.3f %9.3f\n",
+         transport.c_str(), workload.c_str(), result.seconds,
+         result.rounds / result.seconds,
+         result.bytes / (1024.0 * 1024.0) / result.seconds, result.client_cpu,
+         result.server_cpu, result.process_cpu);
+}
+
+template <typename T>
+std::vector<T> SplitList(const std::string &value,
+                         const std::function<T(const std::string &)> &parse) {
+  std::vector<T> items;
+  size_t begin = 0;
+  while (begin <= value.size()) {
+    size_t end = value.find(',', begin);
+    if (end == std::string::npos)
+      end = value.size();
+    if (end > begin)
+      items.push_back(parse(value.substr(begin, end - begin)));
+    begin = end + 1;
+  }
+  return items;
+}
+
+bool ParseFlags(int argc, char **argv, Config *config) {
+  auto to_string = [](const std::string &s) { return s; };
+  auto to_size = [](const std::string &s) -> size_t {
+    return std::strtoul(s.c_str(), nullptr, 10);
+  };
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    if (arg.rfind("--", 0) != 0 || eq == std::string::npos) {
+      fprintf(stderr, "unknown argument %s\n", argv[i]);
+      return false;
+    }
+    std::string name = arg.substr(2, eq - 2);
+    std::string value = arg.substr(eq + 1);
+    if (name == "transport")
+      config->transports = SplitList<std::string>(value, to_string);
+    else if (name == "workload")
+      config->workloads = SplitList<std::string>(value, to_string);
+    else if (name == "forks")
+      config->forks = SplitList<size_t>(value, to_size);
+    else if (name == "layers")
+      config->layers = to_size(value);
+    else if (name == "layer_bytes")
+      config->layer_bytes = std::max<size_t>(1, to_size(value));
+    else if (name == "ot_mb")
+      config->ot_mb = to_size(value);
+    else if (name == "ot_chunk_kb")
+      config->ot_chunk_kb = to_size(value);
+    else if (name == "fork_rounds")
+      config->fork_rounds = to_size(value);
+    else if (name == "fork_bytes")
+      config->fork_bytes = std::max<size_t>(1, to_size(value));
+    else {
+      fprintf(stderr, "unknown flag --%s\n", name.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  Config config;
+  if (!ParseFlags(argc, argv, &config))
+    return 2;
+  // Every fork of a socket transport holds a descriptor on both sides.
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+
+  auto transports = Transports();
+  printf("%-6s %-14s %9s %12s %10s %9s %9s %9s\n", "trans", "workload",
+         "seconds", "rounds/s", "MB/s", "cpu cli", "cpu srv", "cpu proc");
+  int failures = 0;
+  int run = 0;
+  for (const auto &name : config.transports) {
+    auto factory = std::find_if(
+        transports.begin(), transports.end(),
+        [&](const auto &transport) { return transport.first == name; });
+    if (factory == transports.end()) {
+      fprintf(stderr, "unknown transport %s\n", name.c_str());
+      return 2;
+    }
+    for (const auto &workload : config.workloads) {
+      std::vector<size_t> fork_counts{0};
+      if (workload == "fanout")
+        fork_counts = config.forks;
+      for (size_t forks : fork_counts) {
+        std::string key = "mpc_workload_" + std::to_string(run++);
+        Endpoints endpoints = factory->second(key);
+        Channel client(endpoints.first, key);
+        Channel server(endpoints.second, key);
+        Result result;
+        std::string label = workload;
+        if (workload == "gates") {
+          result = GateLayers(&client, &server, config);
+        } else if (workload == "ot") {
+          result = OtExtension(&client, &server, config);
+        } else if (workload == "fanout") {
+          result = FanOut(&client, &server, forks, config);
+          label += " x" + std::to_string(forks);
+        } else {
+          fprintf(stderr, "unknown workload %s\n", workload.c_str());
+          return 2;
+        }
+        Print(name, label, result);
+        failures += result.ok ? 0 : 1;
+        client.close();
+        server.close();
+      }
+    }
+  }
+  return failures == 0 ? 0 : 1;
+}
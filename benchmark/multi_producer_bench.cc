@@ -0,0 +1,82 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+// Messages per second when 1 to 32 threads send small messages on one
+// Channel over MemoryChannel, straight and through MultiProducerChannel,
+// while one thread receives. Run with:
+//   ./bazel-bin/benchmark/multi_producer_bench [messages per thread]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "network/channel_interface.h"
+#include "network/mem_channel.h"
+#include "network/multi_producer_channel.h"
+
+using primihub::link::Channel;
+using primihub::link::ChannelBase;
+using primihub::link::MemoryChannel;
+using primihub::link::MultiProducerChannel;
+
+namespace {
+double Rate(int threads, size_t messages, bool multi_producer, bool ordered) {
+  static int run = 0;
+  std::string key = "multi_producer_bench_" + std::to_string(run++);
+  std::shared_ptr<ChannelBase> client_impl =
+      std::make_shared<MemoryChannel>(MemoryChannel::CLIENT);
+  if (multi_producer) {
+    MultiProducerChannel::Options options;
+    options.ordered = ordered;
+    client_impl = std::make_shared<MultiProducerChannel>(client_impl, options);
+  }
+  Channel client(client_impl, key);
+  Channel server(std::make_shared<MemoryChannel>(MemoryChannel::SERVER), key);
+
+  std::string message(64, 'm');
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> producers;
+  for (int t = 0; t < threads; t++) {
+    producers.emplace_back([&]() {
+      for (size_t i = 0; i < messages; i++)
+        client.send(message);
+    });
+  }
+  std::string buf;
+  size_t total = threads * messages;
+  for (size_t i = 0; i < total; i++)
+    server.recv(buf);
+  for (auto &producer : producers)
+    producer.join();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return total / elapsed.count();
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  size_t messages = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000;
+  printf("%8s  %12s  %14s  %14s\n", "threads", "plain msg/s", "multi msg/s",
+         "ordered msg/s");
+  for (int threads : {1, 2, 4, 8, 16, 32}) {
+    double plain = Rate(threads, messages, false, false);
+    double multi = Rate(threads, messages, true, false);
+    double ordered = Rate(threads, messages, true, true);
+    printf("%8d  %12.0f  %14.0f  %14.0f\n", threads, plain, multi, ordered);
+  }
+  return 0;
+}
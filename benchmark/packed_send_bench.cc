@@ -0,0 +1,109 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+// Throughput of Channel::send_packed/recv_packed against raw vector sends
+// over MemoryChannel. Run with: ./bazel-bin/benchmark/packed_send_bench
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "network/channel_interface.h"
+#include "network/mem_channel.h"
+
+using primihub::IntCodec;
+using primihub::link::Channel;
+using primihub::link::MemoryChannel;
+
+namespace {
+constexpr int kRounds = 20;
+
+double TimeIt(const std::function<void()> &fn) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kRounds; i++)
+    fn();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+template <typename T>
+void Run(const char *name, const std::vector<T> &data, uint32_t bits,
+         IntCodec codec) {
+  auto client = std::make_shared<Channel>(
+      std::make_shared<MemoryChannel>(MemoryChannel::CLIENT), name);
+  auto server = std::make_shared<Channel>(
+      std::make_shared<MemoryChannel>(MemoryChannel::SERVER), name);
+
+  std::vector<T> recv_buf(data.size());
+  double raw = TimeIt([&]() {
+    client->send(data);
+    server->recv(recv_buf);
+  });
+
+  size_t wire_bytes = 0;
+  double packed = TimeIt([&]() {
+    if (codec == IntCodec::kBitPack)
+      client->send_packed(data, bits);
+    else
+      client->send_packed(data, codec);
+    server->recv_packed(recv_buf);
+  });
+  std::string frame;
+  primihub::EncodeInts(data.data(), sizeof(T), std::is_signed<T>::value,
+                       data.size(), codec, bits, &frame);
+  wire_bytes = frame.size();
+
+  double mb = static_cast<double>(data.size() * sizeof(T)) * kRounds / 1e6;
+  printf("%-28s raw %9.1f MB/s   packed %9.1f MB/s   wire %6.2f%%\n", name,
+         mb / raw, mb / packed,
+         100.0 * wire_bytes / (data.size() * sizeof(T)));
+}
+}  // namespace
+
+int main(int argc, char **argv) {
+  constexpr size_t kCount = 1 << 22;
+  std::mt19937_64 rng(2023);
+
+  std::vector<uint8_t> bool_shares(kCount);
+  for (auto &v : bool_shares)
+    v = rng() & 1;
+  Run("uint8_t 1-bit", bool_shares, 1, IntCodec::kBitPack);
+
+  std::vector<uint64_t> ring_shares(kCount);
+  for (auto &v : ring_shares)
+    v = rng() & ((1ULL << 40) - 1);
+  Run("uint64_t 40-bit", ring_shares, 40, IntCodec::kBitPack);
+
+  std::vector<uint64_t> bits_shares(kCount);
+  for (auto &v : bits_shares)
+    v = rng() & 1;
+  Run("uint64_t 1-bit", bits_shares, 1, IntCodec::kBitPack);
+
+  std::vector<uint32_t> small(kCount);
+  for (auto &v : small)
+    v = rng() % 100;
+  Run("uint32_t varint (<100)", small, 0, IntCodec::kVarint);
+
+  std::vector<uint64_t> sorted(kCount);
+  uint64_t acc = 0;
+  for (auto &v : sorted) {
+    acc += rng() % 16;
+    v = acc;
+  }
+  Run("uint64_t delta varint", sorted, 0, IntCodec::kDeltaVarint);
+  return 0;
+}
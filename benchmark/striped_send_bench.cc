@@ -0,0 +1,66 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+// Throughput of Channel::sendStriped/recvStriped for K = 1..16 stripes over
+// MemoryChannel. Run with: ./bazel-bin/benchmark/striped_send_bench [MB]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "network/channel_interface.h"
+#include "network/mem_channel.h"
+
+using primihub::link::Channel;
+using primihub::link::MemoryChannel;
+
+int main(int argc, char **argv) {
+  size_t megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 256;
+  std::vector<char> payload(megabytes * 1024 * 1024);
+  for (size_t i = 0; i < payload.size(); i++)
+    payload[i] = static_cast<char>(i * 131);
+  std::vector<char> recv_buf(payload.size());
+
+  auto client = std::make_shared<Channel>(
+      std::make_shared<MemoryChannel>(MemoryChannel::CLIENT), "striped_bench");
+  auto server = std::make_shared<Channel>(
+      std::make_shared<MemoryChannel>(MemoryChannel::SERVER), "striped_bench");
+
+  double base = 0;
+  for (uint32_t k = 1; k <= 16; k++) {
+    // warm up the stripe channels and the destination pages once
+    auto warm = std::async(std::launch::async,
+                           [&]() { client->sendStriped(payload, k); });
+    server->recvStriped(recv_buf, k);
+    warm.get();
+
+    auto start = std::chrono::steady_clock::now();
+    auto send_fut = std::async(std::launch::async,
+                               [&]() { return client->sendStriped(payload, k); });
+    auto status = server->recvStriped(recv_buf, k);
+    bool ok = send_fut.get().IsOK() && status.IsOK();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    double mbps = megabytes / elapsed.count();
+    if (k == 1)
+      base = mbps;
+    printf("K=%2u  %9.1f MB/s  x%.2f%s\n", k, mbps, mbps / base,
+           ok && recv_buf == payload ? "" : "  (transfer failed)");
+  }
+  return 0;
+}
@@ -19,6 +19,8 @@ namespace primihub::link {
 enum class retcode {
   SUCCESS = 0,
   FAIL,
+  // The message arrived but failed its integrity check.
+  MISMATCH,
 };
 
 };
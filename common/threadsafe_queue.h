@@ -41,6 +41,17 @@ public:
     return m_queue.empty();
   }
 
+  // Calls fn with the oldest item without removing it, returns false if the
+  // queue is empty.
+  template <typename Fn> bool peek(Fn &&fn) const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_queue.empty()) {
+      return false;
+    }
+    fn(m_queue.front());
+    return true;
+  }
+
   bool try_pop(T &popped_value) {
     std::unique_lock<std::mutex> lock(m_mutex);
     if (m_queue.empty()) {
@@ -16,12 +16,16 @@
 #ifndef NETWORK_BASE_CHANNEL_H_
 #define NETWORK_BASE_CHANNEL_H_
 #include "common/common.h"
+#include "util/strided.h"
 #include <glog/logging.h>
 #include <string>
 #include <string_view>
 #include <memory>
+#include <utility>
 
 namespace primihub::link {
+class ReadyNotifier;
+
 class ChannelBase {
 public:
   ChannelBase() = default;
@@ -31,6 +35,79 @@ public:
   virtual retcode SendImpl(const char *buff, size_t size) = 0;
   virtual retcode RecvImpl(std::string *recv_buf) = 0;
   virtual retcode RecvImpl(char *recv_buf, size_t recv_size) = 0;
+
+  // Sends a buffer the caller no longer needs, transports that queue whole
+  // messages can take it over instead of copying it.
+  virtual retcode SendImpl(std::string &&send_buf) {
+    return SendImpl(static_cast<const std::string &>(send_buf));
+  }
+
+  // Sends a buffer owned by keepalive. Transports that send without copying
+  // may return before the data has left and hold keepalive until then, the
+  // default sends a copy right away.
+  virtual retcode SendImpl(const char *buff, size_t size,
+                           std::shared_ptr<const void> keepalive) {
+    return SendImpl(buff, size);
+  }
+
+  // Sends the elements of view as one message. The default gathers them
+  // straight into the outgoing message, transports that can send from
+  // scattered memory may override it.
+  virtual retcode SendImpl(const StridedView &view) {
+    std::string send_buf;
+    send_buf.resize(view.size());
+    StridedGather(view, &send_buf[0]);
+    return SendImpl(std::move(send_buf));
+  }
+
+  // Receives one message into the elements of view.
+  virtual retcode RecvImpl(const MutableStridedView &view) {
+    std::string recv_buf;
+    retcode ret = RecvImpl(&recv_buf);
+    if (ret != retcode::SUCCESS)
+      return ret;
+    if (recv_buf.size() != view.size()) {
+      LOG(ERROR) << "data length does not match: "
+                 << "expected: " << view.size() << " "
+                 << "actually: " << recv_buf.size();
+      return retcode::FAIL;
+    }
+    StridedScatter(recv_buf.data(), view);
+    return retcode::SUCCESS;
+  }
+
+  // Readiness hooks of ChannelSelector. A transport reports readiness
+  // either through a pollable fd from ReadinessFd or by notifying the
+  // notifier given to SetReadyNotifier whenever a message arrives.
+  // HasPendingData and ReadinessFd must not block, in particular they never
+  // connect.
+  virtual bool HasPendingData() { return false; }
+  virtual int ReadinessFd() { return -1; }
+  virtual void SetReadyNotifier(std::shared_ptr<ReadyNotifier> notifier) {}
+
+  // Establishes the connection ahead of the first send or recv, transports
+  // without one have nothing to do. ChannelPool calls it on the forks it
+  // keeps warm, CompletionReactor on channels with receives pending that
+  // are not connected yet. Returns FAIL if connecting failed, a server whose
+  // connection has not arrived yet has not failed.
+  virtual retcode Warmup() { return retcode::SUCCESS; }
+
+  // Receives one message if one is pending, received tells whether it did.
+  virtual retcode TryRecvImpl(std::string *recv_buf, bool *received) {
+    *received = HasPendingData();
+    if (!*received)
+      return retcode::SUCCESS;
+    return RecvImpl(recv_buf);
+  }
+
+  // Size of the next message without receiving it. With wait it blocks
+  // until a message arrives, otherwise available tells whether one is
+  // pending.
+  virtual retcode ProbeImpl(uint64_t *size, bool wait, bool *available) {
+    LOG(ERROR) << "Not implement error.";
+    return retcode::FAIL;
+  }
+
   virtual std::shared_ptr<ChannelBase> ForkImpl(const std::string &key) {
     LOG(ERROR) << "Not implement error.";
     return nullptr;
@@ -41,5 +118,30 @@ public:
   virtual void close() = 0;
   virtual void cancel() = 0;
 };
+
+// ForwardingChannel is the base of the channels that wrap another
+// transport. It hands readiness, connection setup, probing and shutdown to
+// inner_, a decorator overrides only the hooks it changes.
+class ForwardingChannel : public ChannelBase {
+public:
+  explicit ForwardingChannel(std::shared_ptr<ChannelBase> inner)
+      : inner_(std::move(inner)) {}
+
+  bool HasPendingData() override { return inner_->HasPendingData(); }
+  int ReadinessFd() override { return inner_->ReadinessFd(); }
+  void SetReadyNotifier(std::shared_ptr<ReadyNotifier> notifier) override {
+    inner_->SetReadyNotifier(std::move(notifier));
+  }
+  retcode Warmup() override { return inner_->Warmup(); }
+  retcode ProbeImpl(uint64_t *size, bool wait, bool *available) override {
+    return inner_->ProbeImpl(size, wait, available);
+  }
+  void SetKey(const std::string &key) override { inner_->SetKey(key); }
+  void close() override { inner_->close(); }
+  void cancel() override { inner_->cancel(); }
+
+protected:
+  std::shared_ptr<ChannelBase> inner_;
+};
 } // namespace primihub::link
 #endif // NETWORK_BASE_CHANNEL_H_
@@ -0,0 +1,236 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "network/batch_pipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+namespace primihub::link {
+namespace {
+using Clock = std::chrono::steady_clock;
+
+// Bounds of the interval the receiver polls a quiet channel at.
+constexpr std::chrono::microseconds kMinPoll{50};
+constexpr std::chrono::microseconds kMaxPoll{2000};
+
+uint64_t ElapsedUs(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() -
+                                                               start)
+      .count();
+}
+} // namespace
+
+BatchPipeline::BatchPipeline(std::shared_ptr<Channel> channel,
+                             const Options &options)
+    : channel_(std::move(channel)), options_(options) {
+  if (options_.depth == 0)
+    options_.depth = 1;
+}
+
+void BatchPipeline::Fail(const Status &status) {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (!failed_) {
+      failed_ = true;
+      status_ = status.Copy();
+    }
+  }
+  cv_.notify_all();
+}
+
+bool BatchPipeline::WaitForMessage() {
+  auto interval = kMinPoll;
+  while (true) {
+    uint64_t size = 0;
+    bool available = false;
+    // A transport that cannot probe, or a broken one, is left to recv.
+    if (!channel_->try_probe(&size, &available).IsOK() || available)
+      return true;
+    std::unique_lock<std::mutex> lock(mu_);
+    if (cv_.wait_for(lock, interval, [&]() { return failed_; }))
+      return false;
+    interval = std::min(interval * 2, kMaxPoll);
+  }
+}
+
+void BatchPipeline::ReceiveLoop(uint64_t batches) {
+  for (uint64_t i = 0; i < batches; i++) {
+    size_t index;
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      cv_.wait(lock, [&]() { return failed_ || !free_inputs_.empty(); });
+      if (failed_)
+        return;
+      index = free_inputs_.front();
+      free_inputs_.pop_front();
+    }
+    auto start = Clock::now();
+    if (!WaitForMessage()) {
+      recv_us_ += ElapsedUs(start);
+      return;
+    }
+    std::string &input = inputs_[index];
+    Status status =
+        options_.batch_bytes > 0
+            ? channel_->recv(&input[0], options_.batch_bytes, Priority::kNormal)
+            : channel_->recv(input, Priority::kNormal);
+    recv_us_ += ElapsedUs(start);
+    if (!status.IsOK()) {
+      LOG(ERROR) << "pipeline receive of batch " << i << " failed.";
+      Fail(status);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      ready_inputs_.push_back(index);
+    }
+    cv_.notify_all();
+  }
+}
+
+void BatchPipeline::SendLoop(uint64_t batches) {
+  for (uint64_t i = 0; i < batches; i++) {
+    size_t index;
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      cv_.wait(lock, [&]() { return failed_ || !queued_outputs_.empty(); });
+      // Results computed before a failure still go out.
+      if (queued_outputs_.empty())
+        return;
+      index = queued_outputs_.front();
+      queued_outputs_.pop_front();
+    }
+    auto start = Clock::now();
+    const std::string &output = outputs_[index];
+    Status status =
+        channel_->send(output.data(), output.size(), Priority::kNormal);
+    send_us_ += ElapsedUs(start);
+    if (!status.IsOK()) {
+      LOG(ERROR) << "pipeline send of batch " << i << " failed.";
+      Fail(status);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      free_outputs_.push_back(index);
+    }
+    cv_.notify_all();
+  }
+}
+
+Status BatchPipeline::run(uint64_t batches, const Compute &compute) {
+  size_t depth = options_.depth;
+  inputs_.assign(depth, std::string(options_.batch_bytes, '\0'));
+  outputs_.assign(depth, std::string());
+  free_inputs_.clear();
+  ready_inputs_.clear();
+  free_outputs_.clear();
+  queued_outputs_.clear();
+  for (size_t i = 0; i < depth; i++) {
+    free_inputs_.push_back(i);
+    free_outputs_.push_back(i);
+  }
+  failed_ = false;
+  status_ = Status::OK();
+  recv_us_ = 0;
+  send_us_ = 0;
+  stats_ = PipelineStats();
+
+  auto start = Clock::now();
+  std::thread receiver;
+  std::thread sender;
+  if (options_.receive)
+    receiver = std::thread(&BatchPipeline::ReceiveLoop, this, batches);
+  if (options_.send)
+    sender = std::thread(&BatchPipeline::SendLoop, this, batches);
+
+  const std::string no_input;
+  std::string scratch;
+  for (uint64_t i = 0; i < batches; i++) {
+    size_t in = 0;
+    size_t out = 0;
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      if (options_.receive) {
+        auto wait_start = Clock::now();
+        cv_.wait(lock, [&]() { return failed_ || !ready_inputs_.empty(); });
+        stats_.input_wait_us += ElapsedUs(wait_start);
+        if (failed_)
+          break;
+        in = ready_inputs_.front();
+        ready_inputs_.pop_front();
+      }
+      if (options_.send) {
+        auto wait_start = Clock::now();
+        cv_.wait(lock, [&]() { return failed_ || !free_outputs_.empty(); });
+        stats_.output_wait_us += ElapsedUs(wait_start);
+        if (failed_)
+          break;
+        out = free_outputs_.front();
+        free_outputs_.pop_front();
+      }
+    }
+
+    std::string *output = options_.send ? &outputs_[out] : &scratch;
+    output->clear();
+    auto compute_start = Clock::now();
+    Status status =
+        compute(i, options_.receive ? inputs_[in] : no_input, output);
+    stats_.compute_us += ElapsedUs(compute_start);
+    stats_.batches++;
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (options_.receive)
+        free_inputs_.push_back(in);
+      if (options_.send) {
+        if (status.IsOK())
+          queued_outputs_.push_back(out);
+        else
+          free_outputs_.push_back(out);
+      }
+    }
+    cv_.notify_all();
+    if (!status.IsOK()) {
+      LOG(ERROR) << "pipeline compute of batch " << i << " failed.";
+      Fail(status);
+      break;
+    }
+  }
+
+  if (receiver.joinable())
+    receiver.join();
+  if (sender.joinable())
+    sender.join();
+
+  stats_.wall_us = ElapsedUs(start);
+  stats_.recv_us = recv_us_;
+  stats_.send_us = send_us_;
+  uint64_t comm_us = stats_.recv_us + stats_.send_us;
+  if (comm_us > 0) {
+    // Run one after the other the batches would take compute plus
+    // communication, whatever the pipeline saved of that was overlapped.
+    double saved = static_cast<double>(stats_.compute_us + comm_us) -
+                   static_cast<double>(stats_.wall_us);
+    stats_.overlap = std::clamp(saved / comm_us, 0.0, 1.0);
+  }
+  if (stats_.wall_us > 0)
+    stats_.compute_utilization =
+        static_cast<double>(stats_.compute_us) / stats_.wall_us;
+  std::lock_guard<std::mutex> lock(mu_);
+  return status_.Copy();
+}
+} // namespace primihub::link
@@ -0,0 +1,120 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef NETWORK_BATCH_PIPELINE_H_
+#define NETWORK_BATCH_PIPELINE_H_
+
+#include "network/channel_interface.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace primihub::link {
+// Time split of a BatchPipeline run, in microseconds.
+struct PipelineStats {
+  uint64_t batches{0};
+  uint64_t wall_us{0};
+  // Time spent in the compute callback.
+  uint64_t compute_us{0};
+  // Time the compute thread waited for an input batch, and for a free
+  // output buffer while the sender was behind.
+  uint64_t input_wait_us{0};
+  uint64_t output_wait_us{0};
+  // Time the I/O threads spent in recv and send, waiting for the peer
+  // included.
+  uint64_t recv_us{0};
+  uint64_t send_us{0};
+  // Share of the communication time hidden behind compute, 1 if all of it
+  // overlapped and 0 if the run took as long as computing and
+  // communicating one after the other.
+  double overlap{1.0};
+  // compute_us / wall_us, how busy the compute thread was.
+  double compute_utilization{0.0};
+};
+
+// BatchPipeline overlaps the computation on batch i with receiving batch
+// i+1 and sending the result of batch i-1 over a Channel. A receiver thread
+// fills depth rotating input buffers ahead of the compute callback and a
+// sender thread drains depth rotating output buffers behind it, so compute
+// runs in the calling thread while both directions of the channel are busy.
+//
+// Batch i of the peer's messages is the input of compute call i and its
+// output is sent as message i. Either direction can be switched off, e.g.
+// for a party that only produces batches.
+class BatchPipeline {
+public:
+  struct Options {
+    // Rotating buffers per direction, 2 is double buffering.
+    size_t depth{2};
+    // Size of every input batch, received straight into the rotating
+    // buffer. 0 receives messages of any size.
+    size_t batch_bytes{0};
+    bool receive{true};
+    bool send{true};
+  };
+
+  // Fills output from input for batch index, output arrives empty but
+  // keeps the capacity of the buffer it was used as before.
+  using Compute = std::function<Status(uint64_t index, const std::string &input,
+                                       std::string *output)>;
+
+  BatchPipeline(std::shared_ptr<Channel> channel, const Options &options);
+
+  // Processes batches batches, returns the first failure of a receive,
+  // compute or send. Once one failed no more batches are computed, the
+  // outputs computed so far are still sent and the receiver stops waiting
+  // for the peer, which may have stopped sending too. The receiver probes
+  // the channel before every recv for that, on a transport without
+  // ProbeImpl it blocks in recv until the batch arrives.
+  Status run(uint64_t batches, const Compute &compute);
+
+  // Stats of the last run.
+  PipelineStats stats() const { return stats_; }
+
+private:
+  // Waits until a message is pending, false if the run failed meanwhile.
+  bool WaitForMessage();
+  void ReceiveLoop(uint64_t batches);
+  void SendLoop(uint64_t batches);
+  void Fail(const Status &status);
+
+  std::shared_ptr<Channel> channel_;
+  Options options_;
+  PipelineStats stats_;
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::vector<std::string> inputs_;
+  std::vector<std::string> outputs_;
+  // Buffer indices by state, guarded by mu_.
+  std::deque<size_t> free_inputs_;
+  std::deque<size_t> ready_inputs_;
+  std::deque<size_t> free_outputs_;
+  std::deque<size_t> queued_outputs_;
+  bool failed_{false};
+  Status status_{Status::OK()};
+  // Written by the I/O threads, read after they joined.
+  uint64_t recv_us_{0};
+  uint64_t send_us_{0};
+};
+} // namespace primihub::link
+
+#endif // NETWORK_BATCH_PIPELINE_H_
@@ -1,6 +1,367 @@
 
 #include "network/channel_interface.h"
 
+#include <algorithm>
+#include <chrono>
+
 namespace primihub::link {
+namespace {
+struct StripeHeader {
+  uint64_t total_size;
+  uint64_t num_stripes;
+};
+
+// Stripes are contiguous and cache line aligned, every stripe but the last
+// one holds stripe_size bytes.
+constexpr uint64_t kStripeChunkSize = 1024 * 1024;
+
+uint64_t StripeSize(uint64_t length, uint32_t k) {
+  uint64_t size = (length + k - 1) / k;
+  return (size + 63) / 64 * 64;
+}
+
+uint64_t StripeLength(uint64_t length, uint64_t stripe_size, uint32_t i) {
+  uint64_t begin = std::min(length, i * stripe_size);
+  uint64_t end = std::min(length, begin + stripe_size);
+  return end - begin;
+}
+
+Status RunStripes(uint32_t k, const std::function<retcode(uint32_t)> &fn) {
+  std::vector<std::future<retcode>> futs;
+  for (uint32_t i = 1; i < k; i++)
+    futs.push_back(std::async(std::launch::async, fn, i));
+
+  bool ok = fn(0) == retcode::SUCCESS;
+  for (auto &fut : futs)
+    ok = (fut.get() == retcode::SUCCESS) && ok;
+  return ok ? Status::OK() : Status::NetworkError();
+}
+} // namespace
+
+Status Channel::sendFrame(std::string &&frame) {
+  retcode ret = channel_impl_->SendImpl(std::move(frame));
+  if (ret != retcode::SUCCESS)
+    return Status::NetworkError();
+  return Status::OK();
+}
+
+Status Channel::recvFrame(std::string *frame) {
+  return RecvStatus(channel_impl_->RecvImpl(frame));
+}
+
+Status Channel::sendStrided(const StridedView &view) {
+  retcode ret = channel_impl_->SendImpl(view);
+  if (ret != retcode::SUCCESS)
+    return Status::NetworkError();
+  return Status::OK();
+}
+
+Status Channel::recvStrided(const MutableStridedView &view) {
+  return RecvStatus(channel_impl_->RecvImpl(view));
+}
+
+Status Channel::sendStream(const char *data, uint64_t length,
+                           uint64_t chunk_size) {
+  retcode ret = SendStream(channel_impl_.get(), data, length, chunk_size);
+  if (ret != retcode::SUCCESS)
+    return Status::NetworkError();
+  return Status::OK();
+}
+
+Status Channel::openStream(ChunkReader *reader) {
+  return reader->open(channel_impl_);
+}
+
+Status Channel::recvStream(
+    const std::function<void(uint64_t offset, std::string_view chunk)>
+        &on_chunk) {
+  ChunkReader reader;
+  auto status = openStream(&reader);
+  if (!status.IsOK())
+    return status;
+
+  std::string chunk;
+  while (!reader.done()) {
+    uint64_t offset = reader.offset();
+    status = reader.next(&chunk);
+    if (!status.IsOK())
+      return status;
+    on_chunk(offset, chunk);
+  }
+  return Status::OK();
+}
+
+std::vector<std::shared_ptr<ChannelBase>> Channel::stripeChannels(uint32_t k) {
+  std::lock_guard<std::mutex> lock(stripe_mu_);
+  while (stripe_channels_.size() < k) {
+    std::string stripe_key =
+        key_ + "_stripe_" + std::to_string(stripe_channels_.size());
+    auto base = channel_impl_->ForkImpl(stripe_key);
+    if (base == nullptr) {
+      LOG(ERROR) << "Fork stripe channel failed, key: " << stripe_key;
+      return {};
+    }
+    stripe_channels_.push_back(std::move(base));
+  }
+  return std::vector<std::shared_ptr<ChannelBase>>(stripe_channels_.begin(),
+                                                   stripe_channels_.begin() + k);
+}
+
+Status Channel::sendStriped(const char *data, uint64_t length, uint32_t k) {
+  if (k == 0)
+    return Status::InvalidError();
+  auto channels = stripeChannels(k);
+  if (channels.empty())
+    return Status::UnavailableError();
+
+  StripeHeader header{length, k};
+  retcode ret = channel_impl_->SendImpl(reinterpret_cast<const char *>(&header),
+                                        sizeof(header));
+  if (ret != retcode::SUCCESS)
+    return Status::NetworkError();
+
+  uint64_t stripe_size = StripeSize(length, k);
+  return RunStripes(k, [&](uint32_t i) -> retcode {
+    return SendStream(channels[i].get(), data + std::min(length, i * stripe_size),
+                      StripeLength(length, stripe_size, i), kStripeChunkSize);
+  });
+}
+
+Status Channel::recvStripeHeader(uint64_t *length, uint32_t k) {
+  StripeHeader header{0, 0};
+  retcode ret = channel_impl_->RecvImpl(reinterpret_cast<char *>(&header),
+                                        sizeof(header));
+  if (ret != retcode::SUCCESS)
+    return Status::NetworkError();
+
+  if (header.num_stripes != k) {
+    LOG(ERROR) << "stripe count does not match: "
+               << "expected: " << k << " "
+               << "actually: " << header.num_stripes;
+    return Status::MismatchError();
+  }
+  *length = header.total_size;
+  return Status::OK();
+}
+
+Status Channel::recvStripes(char *dest, uint64_t length, uint32_t k) {
+  auto channels = stripeChannels(k);
+  if (channels.empty())
+    return Status::UnavailableError();
+
+  uint64_t stripe_size = StripeSize(length, k);
+  return RunStripes(k, [&](uint32_t i) -> retcode {
+    ChunkReader reader;
+    if (!reader.open(channels[i]).IsOK())
+      return retcode::FAIL;
+    if (reader.totalSize() != StripeLength(length, stripe_size, i)) {
+      LOG(ERROR) << "stripe " << i << " length does not match: "
+                 << "expected: " << StripeLength(length, stripe_size, i) << " "
+                 << "actually: " << reader.totalSize();
+      return retcode::FAIL;
+    }
+
+    char *stripe_dest = dest + std::min(length, i * stripe_size);
+    while (!reader.done()) {
+      if (!reader.nextInto(stripe_dest + reader.offset()).IsOK())
+        return retcode::FAIL;
+    }
+    return retcode::SUCCESS;
+  });
+}
 
+Status Channel::recvStriped(char *dest, uint64_t length, uint32_t k) {
+  if (k == 0)
+    return Status::InvalidError();
+
+  uint64_t sent_length = 0;
+  auto status = recvStripeHeader(&sent_length, k);
+  if (!status.IsOK())
+    return status;
+
+  if (sent_length != length) {
+    LOG(ERROR) << "striped length does not match: "
+               << "expected: " << length << " "
+               << "actually: " << sent_length;
+    return Status::MismatchError();
+  }
+  return recvStripes(dest, length, k);
+}
+
+Status Channel::send_bits(const uint8_t *bits, uint64_t nbits) {
+  std::string frame(sizeof(nbits) + BitWords(nbits) * sizeof(uint64_t), 0);
+  memcpy(&frame[0], &nbits, sizeof(nbits));
+  PackBoolBytes(bits, nbits,
+                reinterpret_cast<uint64_t *>(&frame[sizeof(nbits)]));
+  return sendFrame(std::move(frame));
+}
+
+Status Channel::recvBitFrame(std::string *frame, uint64_t *nbits) {
+  auto status = recvFrame(frame);
+  if (!status.IsOK())
+    return status;
+
+  if (frame->size() < sizeof(uint64_t)) {
+    LOG(ERROR) << "Invalid bit frame, key: " << key_ << " "
+               << "size: " << frame->size();
+    return Status::InvalidError();
+  }
+  memcpy(nbits, frame->data(), sizeof(uint64_t));
+  size_t payload = frame->size() - sizeof(uint64_t);
+  if (*nbits > payload * 8 ||
+      payload != BitWords(*nbits) * sizeof(uint64_t)) {
+    LOG(ERROR) << "Invalid bit frame, key: " << key_ << " "
+               << "bits: " << *nbits << " "
+               << "size: " << frame->size();
+    return Status::InvalidError();
+  }
+  return Status::OK();
+}
+
+Status Channel::recv_bits(std::vector<uint8_t> &bits) {
+  std::string frame;
+  uint64_t nbits = 0;
+  auto status = recvBitFrame(&frame, &nbits);
+  if (!status.IsOK())
+    return status;
+
+  bits.resize(nbits);
+  UnpackBoolBytes(
+      reinterpret_cast<const uint64_t *>(frame.data() + sizeof(nbits)), nbits,
+      bits.data());
+  return Status::OK();
+}
+
+Status Channel::sendEncoded(const void *src, size_t elem_size, bool is_signed,
+                            size_t count, IntCodec codec, uint32_t bits) {
+  std::string frame;
+  if (!EncodeInts(src, elem_size, is_signed, count, codec, bits, &frame)) {
+    LOG(ERROR) << "Invalid packed encoding, "
+               << "codec: " << static_cast<int>(codec) << " "
+               << "bits: " << bits << " "
+               << "element size: " << elem_size;
+    return Status::InvalidError();
+  }
+
+  return sendFrame(std::move(frame));
+}
+
+Status Channel::recvEncodedFrame(std::string *frame, PackedHeader *header,
+                                 size_t elem_size) {
+  auto status = recvFrame(frame);
+  if (!status.IsOK())
+    return status;
+
+  if (!ParsePackedHeader(*frame, header)) {
+    LOG(ERROR) << "Invalid packed frame, key: " << key_ << " "
+               << "size: " << frame->size();
+    return Status::InvalidError();
+  }
+
+  if (header->elem_size != elem_size) {
+    LOG(ERROR) << "Packed element size does not match, "
+               << "expected: " << elem_size << " "
+               << "actually: " << static_cast<int>(header->elem_size);
+    return Status::MismatchError();
+  }
+  return Status::OK();
+}
+
+Status Channel::try_recv(std::string &recv_buf, bool *received) {
+  retcode ret = channel_impl_->TryRecvImpl(&recv_buf, received);
+  if (ret != retcode::SUCCESS) {
+    *received = false;
+    return RecvStatus(ret);
+  }
+  return Status::OK();
+}
+
+Status Channel::probe(uint64_t *size) {
+  bool available = false;
+  return RecvStatus(channel_impl_->ProbeImpl(size, true, &available));
+}
+
+Status Channel::try_probe(uint64_t *size, bool *available) {
+  retcode ret = channel_impl_->ProbeImpl(size, false, available);
+  if (ret != retcode::SUCCESS) {
+    *available = false;
+    return RecvStatus(ret);
+  }
+  return Status::OK();
+}
+
+std::shared_ptr<ChannelBase> Channel::laneChannel(Priority priority) {
+  if (priority == Priority::kNormal)
+    return channel_impl_;
+  std::lock_guard<std::mutex> lock(lane_mu_);
+  if (high_lane_ == nullptr) {
+    std::string lane_key = key_ + "_high";
+    high_lane_ = channel_impl_->ForkImpl(lane_key);
+    if (high_lane_ == nullptr)
+      LOG(ERROR) << "Fork priority lane failed, key: " << lane_key;
+  }
+  return high_lane_;
+}
+
+Status Channel::send(const char *data, uint64_t length, Priority priority) {
+  TraceSpan span("Channel::send", key_, length);
+  auto start = std::chrono::steady_clock::now();
+  auto lane = laneChannel(priority);
+  if (lane == nullptr)
+    return Status::UnavailableError();
+  retcode ret = lane->SendImpl(data, length);
+  if (ret != retcode::SUCCESS)
+    return Status::NetworkError();
+
+  uint64_t latency_us =
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count();
+  LaneCounters &counters = lane_counters_[static_cast<int>(priority)];
+  counters.messages.fetch_add(1);
+  counters.bytes.fetch_add(length);
+  counters.total_latency_us.fetch_add(latency_us);
+  uint64_t max_us = counters.max_latency_us.load();
+  while (latency_us > max_us &&
+         !counters.max_latency_us.compare_exchange_weak(max_us, latency_us)) {
+  }
+  return Status::OK();
+}
+
+Status Channel::recv(std::string &recv_buf, Priority priority) {
+  TraceSpan span("Channel::recv", key_);
+  auto lane = laneChannel(priority);
+  if (lane == nullptr)
+    return Status::UnavailableError();
+  retcode ret = lane->RecvImpl(&recv_buf);
+  span.setBytes(recv_buf.size());
+  return RecvStatus(ret);
+}
+
+Status Channel::recv(char *dest, uint64_t length, Priority priority) {
+  TraceSpan span("Channel::recv", key_, length);
+  auto lane = laneChannel(priority);
+  if (lane == nullptr)
+    return Status::UnavailableError();
+  return RecvStatus(lane->RecvImpl(dest, length));
+}
+
+LaneStats Channel::laneStats(Priority priority) const {
+  const LaneCounters &counters = lane_counters_[static_cast<int>(priority)];
+  LaneStats stats;
+  stats.messages = counters.messages.load();
+  stats.bytes = counters.bytes.load();
+  stats.total_latency_us = counters.total_latency_us.load();
+  stats.max_latency_us = counters.max_latency_us.load();
+  return stats;
+}
+
+void Channel::resetLaneStats() {
+  for (auto &counters : lane_counters_) {
+    counters.messages.store(0);
+    counters.bytes.store(0);
+    counters.total_latency_us.store(0);
+    counters.max_latency_us.store(0);
+  }
+}
 }
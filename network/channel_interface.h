@@ -18,17 +18,52 @@
 #include <glog/logging.h>
 
 #include "network/base_channel.h"
+#include "network/channel_pool.h"
+#include "network/chunk_stream.h"
+#include "network/completion_reactor.h"
 #include "network/status.h"
+#include "network/trace.h"
+#include "util/bit_vector.h"
+#include "util/int_codec.h"
+#include "util/serialize.h"
 #include "util/type_trait.h"
 #include <cassert>
 #include <cstring>
+#include <functional>
 #include <future>
 #include <iostream>
 #include <thread>
 #include <map>
 #include <mutex>
+#include <vector>
 
 namespace primihub::link {
+// Traffic class of a message. High priority messages travel on a lane of
+// their own, so a small control message such as an abort never waits behind
+// a bulk transfer queued on the same channel.
+enum class Priority {
+  kNormal,
+  kHigh
+};
+
+// Send statistics of one priority lane, latencies are measured from the
+// call to send until the transport accepted the message.
+struct LaneStats {
+  uint64_t messages{0};
+  uint64_t bytes{0};
+  uint64_t total_latency_us{0};
+  uint64_t max_latency_us{0};
+};
+
+// Status of a receive whose transport returned ret.
+inline Status RecvStatus(retcode ret) {
+  if (ret == retcode::SUCCESS)
+    return Status::OK();
+  if (ret == retcode::MISMATCH)
+    return Status::MismatchError();
+  return Status::NetworkError();
+}
+
 // Channel is the standard interface use to send data over the network.
 class Channel : public std::enable_shared_from_this<Channel> {
 public:
@@ -41,7 +76,7 @@ public:
     this->key_ = copy.key_;
     this->sended_data_ = 0;
     this->received_data_ = 0;
-    this->num_fork_ = copy.num_fork_;
+    this->num_fork_ = copy.num_fork_.load();
   }
 
   Channel(std::shared_ptr<ChannelBase> channel_impl, const std::string &key) {
@@ -57,11 +92,14 @@ public:
 
   virtual ~Channel() = default;
 
+  // Safe to call from several threads, every fork gets its own number.
   std::shared_ptr<Channel> fork(void) {
-    num_fork_++;
-    std::string new_key = key_ + "_fork_" + std::to_string(num_fork_);
+    uint32_t id = ++num_fork_;
+    std::string new_key = key_ + "_fork_" + std::to_string(id);
 
-    std::shared_ptr<ChannelBase> base = channel_impl_->ForkImpl(new_key);
+    std::shared_ptr<ChannelBase> base = fork_pool_ != nullptr
+                                            ? fork_pool_->Lease(id)
+                                            : channel_impl_->ForkImpl(new_key);
     std::shared_ptr<Channel> new_channel =
         std::make_shared<Channel>(base, new_key);
 
@@ -70,6 +108,17 @@ public:
 
   std::string getKey(void) { return key_; }
 
+  // Makes fork() lease its forks from a ChannelPool that keeps warm forks
+  // connected ahead of time, so short tasks do not wait for a handshake per
+  // fork. Call it before forking, forks of forks are not pooled.
+  void enableWarmForks(size_t warm = ChannelPool::Options().warm) {
+    ChannelPool::Options options;
+    options.warm = warm;
+    fork_pool_ = std::make_shared<ChannelPool>(
+        channel_impl_, key_ + "_fork_", num_fork_.load() + 1, options);
+  }
+  std::shared_ptr<ChannelPool> forkPool() const { return fork_pool_; }
+
   // Default assignment
   Channel &operator=(Channel &&move_ins) {
     *this = std::move(move_ins);
@@ -116,16 +165,14 @@ public:
   typename std::enable_if<std::is_pod<T>::value, Status>::type
   asyncSend(const T *data, uint64_t length);
 
-  // // Sends the data in buf over the network. The type Container  must meet
-  // the
-  // // requirements defined in IoBuffer.h. Returns before the data has been
-  // sent.
-  // // The life time of the data must be managed externally to ensure it lives
-  // // longer than the async operations.  callback is a function that is called
-  // // from another thread once the send operation has succeeded.
-  // template<typename Container>
-  // typename std::enable_if<is_container<Container>::value, void>::type
-  //     asyncSend(Container&& data, std::function<void()> callback);
+  // Sends the data in c over the network. The type Container must meet the
+  // requirements defined in IoBuffer.h. Returns right away, the container is
+  // moved into the operation. callback is called with the result of the send
+  // on a thread of CompletionReactor::Default(), sends on one channel complete
+  // in order.
+  template <class Container>
+  typename std::enable_if<is_container<Container>::value, void>::type
+  asyncSend(Container &&c, std::function<void(Status)> callback);
 
   // Sends the data in buf over the network. The type T must be POD.
   // Returns before the data has been sent. The life time of the data must be
@@ -185,6 +232,79 @@ public:
   typename std::enable_if<is_container<Container>::value, Status>::type
   asyncSendCopy(const Container &buf);
 
+  // Sends the integers in vec keeping only the low bits bits of each value,
+  // e.g. 1 for boolean shares or 40 for ring elements stored in uint64_t.
+  // The values are packed into one frame, the peer must call recv_packed.
+  template <typename T>
+  typename std::enable_if<
+      std::is_integral<T>::value && !std::is_same<T, bool>::value,
+      Status>::type
+  send_packed(const std::vector<T> &vec, uint32_t bits);
+
+  // Sends the integers in vec with a variable length codec, IntCodec::kVarint
+  // or IntCodec::kDeltaVarint. The peer must call recv_packed.
+  template <typename T>
+  typename std::enable_if<
+      std::is_integral<T>::value && !std::is_same<T, bool>::value,
+      Status>::type
+  send_packed(const std::vector<T> &vec, IntCodec codec);
+
+  // Sends the elements selected by view (a row, column, sub-block or
+  // transpose of a matrix) as one message packed row by row. The transport
+  // gathers them directly, no temporary copy is made by the caller.
+  Status sendStrided(const StridedView &view);
+
+  // Sends length bytes from data as a stream of chunk_size chunks. The peer
+  // receives it with recvStream or openStream and can process the first
+  // chunks while the rest are still in flight.
+  Status sendStream(const char *data, uint64_t length,
+                    uint64_t chunk_size = kDefaultStreamChunkSize);
+
+  // Sends the data in buf as a stream of chunk_size chunks.
+  template <class Container>
+  typename std::enable_if<is_container<Container>::value, Status>::type
+  sendStream(const Container &buf,
+             uint64_t chunk_size = kDefaultStreamChunkSize);
+
+  // Splits length bytes from data into k stripes and sends them in parallel,
+  // each stripe on its own sub-channel and thread. The sub-channels are
+  // forked once per channel and reused. The peer must call recvStriped.
+  Status sendStriped(const char *data, uint64_t length, uint32_t k);
+
+  // Sends the data in buf striped across k sub-channels.
+  template <class Container>
+  typename std::enable_if<is_container<Container>::value, Status>::type
+  sendStriped(const Container &buf, uint32_t k);
+
+  // Sends length bytes from data on the lane of priority. Messages keep their
+  // order within a lane only, the peer receives them with the recv overload
+  // taking the same priority.
+  Status send(const char *data, uint64_t length, Priority priority);
+
+  // Sends the data in buf on the lane of priority.
+  template <class Container>
+  typename std::enable_if<is_container<Container>::value, Status>::type
+  send(const Container &buf, Priority priority);
+
+  // Sends a bit container (std::vector<bool> or std::bitset) packed into
+  // 64-bit words behind its length in bits. Returns once all the data has
+  // been sent.
+  template <class BitContainer>
+  typename std::enable_if<is_bit_container<BitContainer>::value, Status>::type
+  send(const BitContainer &bits);
+
+  // Sends a struct that lists its fields with PH_SERIALIZE_FIELDS
+  // (util/serialize.h) as one frame. The frame is sized first and every
+  // field is copied into it once. Returns once all the data has been sent.
+  template <typename T>
+  typename std::enable_if<is_serializable<T>::value, Status>::type
+  send(const T &msg);
+
+  // Sends nbits boolean shares stored one per byte, only bit 0 of each byte
+  // is used. The wire format is the one of send(std::vector<bool>), so the
+  // peer may receive it with either recv_bits or recv(std::vector<bool>&).
+  Status send_bits(const uint8_t *bits, uint64_t nbits);
+
   //////////////////////////////////////////////////////////////////////////////
   //						   Receiving interface
   ////
@@ -198,7 +318,10 @@ public:
           has_resize<Container, void(typename Container::size_type)>::value,
       Status>::type
   recv(Container &c) {
-    return asyncRecv(c).get();
+    TraceSpan span("Channel::recv", key_);
+    Status status = asyncRecv(c).get();
+    span.setBytes(c.size() * sizeof(typename Container::value_type));
+    return status;
   }
 
   // Receive data over the network. The container c must be the correct size to
@@ -209,7 +332,10 @@ public:
           !has_resize<Container, void(typename Container::size_type)>::value,
       Status>::type
   recv(Container &c) {
-    return asyncRecv(c).get();
+    TraceSpan span("Channel::recv", key_);
+    Status status = asyncRecv(c).get();
+    span.setBytes(c.size() * sizeof(typename Container::value_type));
+    return status;
   }
 
   // Receive data over the network. The function returns once all the data
@@ -232,13 +358,14 @@ public:
   typename std::enable_if<std::is_pod<T>::value, std::future<Status>>::type
   asyncRecv(T *dest, uint64_t length);
 
-  // // Receive data over the network asynchronously.
-  // // The function returns right away, before the data has been received.
-  // // When all the data has benn received the
-  // // future is set and the callback fn is called.
-  // template<typename T>
-  // typename std::enable_if<std::is_pod<T>::value, std::future<void>>::type
-  // asyncRecv(T* dest, uint64_t length, std::function<void()> fn);
+  // Receive data over the network asynchronously.
+  // The function returns right away, before the data has been received.
+  // Once the message has been received into dest, or has failed, fn is
+  // called with the result on a thread of CompletionReactor::Default(). dest
+  // must stay valid until then.
+  template <typename T>
+  typename std::enable_if<std::is_pod<T>::value, void>::type
+  asyncRecv(T *dest, uint64_t length, std::function<void(Status)> fn);
 
   // Receive data over the network asynchronously.
   // The function returns right away, before the data has been received.
@@ -289,15 +416,106 @@ public:
 
   // Receive data over the network asynchronously.
   // The function returns right away, before the data has been received.
-  // When all the data has benn received the
-  // future is set and the callback fn is called.
-  // The container must be the correct size to fit the data received.
-  // template <class Container>
-  // typename std::enable_if<
-  //     is_container<Container>::value &&
-  //     has_resize<Container, void(typename Container::size_type)>::value,
-  //                std::future<Status>>::type
-  // asyncRecv(Container & c, std::function<void()> fn);
+  // When all the data has been received fn is called with the result on a
+  // thread of CompletionReactor::Default(). If possible the container is
+  // resized to fit the data, otherwise it must be the correct size. Receives
+  // on one channel complete in order and only run once their message has
+  // arrived, so pending receives do not occupy a thread.
+  template <class Container>
+  typename std::enable_if<is_container<Container>::value, void>::type
+  asyncRecv(Container &c, std::function<void(Status)> fn);
+
+  // Receive a message of exactly view.size() bytes and scatter it into the
+  // elements selected by view.
+  Status recvStrided(const MutableStridedView &view);
+
+  // Receive a stream sent by sendStream, on_chunk is called with the offset
+  // and the data of every chunk as soon as that chunk has arrived.
+  Status recvStream(
+      const std::function<void(uint64_t offset, std::string_view chunk)>
+          &on_chunk);
+
+  // Receive a stream sent by sendStream chunk by chunk straight into c. If
+  // possible the container is resized to fit the data, otherwise it must be
+  // the correct size.
+  template <class Container>
+  typename std::enable_if<is_container<Container>::value, Status>::type
+  recvStream(Container &c);
+
+  // Receive the header of a stream sent by sendStream, reader then yields
+  // the chunks one at a time.
+  Status openStream(ChunkReader *reader);
+
+  // Receive data sent by sendStriped with the same k. Every stripe is
+  // received on its own thread and written directly into dest, which must
+  // hold exactly length bytes.
+  Status recvStriped(char *dest, uint64_t length, uint32_t k);
+
+  // Receive data sent by sendStriped into c. If possible the container is
+  // resized to fit the data, otherwise it must be the correct size.
+  template <class Container>
+  typename std::enable_if<is_container<Container>::value, Status>::type
+  recvStriped(Container &c, uint32_t k);
+
+  // Receive a bit container sent by send(BitContainer) or send_bits. A
+  // std::vector<bool> is resized to the number of bits sent, a std::bitset
+  // must have exactly that size.
+  template <class BitContainer>
+  typename std::enable_if<is_bit_container<BitContainer>::value, Status>::type
+  recv(BitContainer &bits);
+
+  // Receive a struct sent by send(const T &). T may not have view fields
+  // (std::string_view, ConstView), use the overload below for those.
+  template <typename T>
+  typename std::enable_if<is_serializable<T>::value, Status>::type
+  recv(T &msg);
+
+  // Receive a struct sent by send(const T &) into frame and deserialize it
+  // from there. View fields of msg point into frame and stay valid as long
+  // as frame is neither modified nor destroyed.
+  template <typename T>
+  typename std::enable_if<is_serializable<T>::value, Status>::type
+  recv(T &msg, std::string &frame);
+
+  // Receive bits sent by send_bits or send(BitContainer) expanded to one
+  // byte (0 or 1) per bit, bits is resized to the number of bits sent.
+  Status recv_bits(std::vector<uint8_t> &bits);
+
+  // Receive integers sent by send_packed, whatever codec was used. vec is
+  // resized to the number of values sent.
+  template <typename T>
+  typename std::enable_if<
+      std::is_integral<T>::value && !std::is_same<T, bool>::value,
+      Status>::type
+  recv_packed(std::vector<T> &vec);
+
+  // Receive the next message of the lane of priority into recv_buf.
+  Status recv(std::string &recv_buf, Priority priority);
+
+  // Receive a message of exactly length bytes from the lane of priority.
+  Status recv(char *dest, uint64_t length, Priority priority);
+
+  // Receive the next message only if it has arrived already, received tells
+  // whether recv_buf was filled. Never waits for the sender, though socket
+  // transports may wait for the rest of a message that started to arrive.
+  Status try_recv(std::string &recv_buf, bool *received);
+
+  // Size in bytes of the next message without receiving it, so the caller
+  // can allocate once, or pick a pooled buffer, before recv. Blocks until a
+  // message arrives. The size is that of the message as sent, for packed,
+  // bit and stream sends it includes their frame header.
+  Status probe(uint64_t *size);
+
+  // Like probe, but never waits for the sender, available tells whether a
+  // message is pending and size was set.
+  Status try_probe(uint64_t *size, bool *available);
+
+  // Readiness hooks for ChannelSelector.
+  bool hasPendingData() { return channel_impl_->HasPendingData(); }
+  int readinessFd() { return channel_impl_->ReadinessFd(); }
+  void setReadyNotifier(std::shared_ptr<ReadyNotifier> notifier) {
+    channel_impl_->SetReadyNotifier(std::move(notifier));
+  }
 
   //////////////////////////////////////////////////////////////////////////////
   //						   Utility functions
@@ -312,6 +530,10 @@ public:
   // or when resetStats() was last called.
   uint64_t getTotalDataRecv() const { return received_data_.load(); }
 
+  // Statistics of the sends made with a Priority on this channel.
+  LaneStats laneStats(Priority priority) const;
+  void resetLaneStats();
+
   // Close this channel to denote that no more data will be sent or received.
   // blocks until all pending operations have completed.
   void close() { channel_impl_->close(); }
@@ -320,11 +542,39 @@ public:
   void cancel(bool close = true) { channel_impl_->cancel(); }
 
 private:
+  // Hands frame to the transport, which may take over its buffer.
+  Status sendFrame(std::string &&frame);
+  Status recvFrame(std::string *frame);
+  Status recvBitFrame(std::string *frame, uint64_t *nbits);
+  Status recvStripeHeader(uint64_t *length, uint32_t k);
+  Status recvStripes(char *dest, uint64_t length, uint32_t k);
+  std::vector<std::shared_ptr<ChannelBase>> stripeChannels(uint32_t k);
+  // The normal lane is the channel itself, the high lane a fork of it that
+  // is created on first use by both peers.
+  std::shared_ptr<ChannelBase> laneChannel(Priority priority);
+  Status sendEncoded(const void *src, size_t elem_size, bool is_signed,
+                     size_t count, IntCodec codec, uint32_t bits);
+  Status recvEncodedFrame(std::string *frame, PackedHeader *header,
+                          size_t elem_size);
+
   std::shared_ptr<ChannelBase> channel_impl_;
   std::atomic<uint64_t> sended_data_{0};
   std::atomic<uint64_t> received_data_{0};
   std::string key_{"default"};
-  uint32_t num_fork_{0};
+  std::atomic<uint32_t> num_fork_{0};
+  std::shared_ptr<ChannelPool> fork_pool_;
+  std::mutex stripe_mu_;
+  std::vector<std::shared_ptr<ChannelBase>> stripe_channels_;
+
+  struct LaneCounters {
+    std::atomic<uint64_t> messages{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> total_latency_us{0};
+    std::atomic<uint64_t> max_latency_us{0};
+  };
+  std::mutex lane_mu_;
+  std::shared_ptr<ChannelBase> high_lane_;
+  LaneCounters lane_counters_[2];
 };
 
 template <typename T> inline char *BuffData(const T &container) {
@@ -340,13 +590,19 @@ template <typename T> inline uint64_t BuffSize(const T &container) {
 template <class Container>
 typename std::enable_if<is_container<Container>::value, Status>::type
 Channel::asyncSend(std::unique_ptr<Container> c) {
-  return send(BuffData(*c), BuffSize(*c));
+  return asyncSend(std::shared_ptr<Container>(std::move(c)));
 }
 
 template <class Container>
 typename std::enable_if<is_container<Container>::value, Status>::type
 Channel::asyncSend(std::shared_ptr<Container> c) {
-  return send(BuffData(*c), BuffSize(*c));
+  // The transport may keep c alive until the data has really been sent.
+  char *buff = BuffData(*c);
+  uint64_t size = BuffSize(*c);
+  retcode ret = channel_impl_->SendImpl(buff, size, std::move(c));
+  if (ret != retcode::SUCCESS)
+    return Status::NetworkError();
+  return Status::OK();
 }
 
 template <class Container>
@@ -369,11 +625,8 @@ typename std::enable_if<
     std::future<Status>>::type
 Channel::asyncRecv(Container &c) {
   auto recv_func = [&](Container &c) -> Status {
-    retcode ret = this->channel_impl_->RecvImpl(BuffData(c), BuffSize(c));
-    if (ret == retcode::SUCCESS)
-      return Status::OK();
-    else
-      return Status::NetworkError();
+    TraceSpan span("Channel::asyncRecv", this->key_, BuffSize(c));
+    return RecvStatus(this->channel_impl_->RecvImpl(BuffData(c), BuffSize(c)));
   };
   return std::async(std::launch::async, recv_func, std::ref(c));
 }
@@ -408,8 +661,12 @@ typename std::enable_if<
     std::future<Status>>::type
 Channel::asyncRecv(Container &c) {
   auto recv_func = [&](Container &c) -> Status {
+    TraceSpan span("Channel::asyncRecv", this->key_);
     std::string recv_buf;
-    this->channel_impl_->RecvImpl(&recv_buf);
+    retcode ret = this->channel_impl_->RecvImpl(&recv_buf);
+    span.setBytes(recv_buf.size());
+    if (ret != retcode::SUCCESS)
+      return RecvStatus(ret);
     if (BuffSize(c) != recv_buf.size()) {
       LOG(WARNING) << "size does not match, "
                    << "need resize to " << recv_buf.size();
@@ -431,32 +688,52 @@ typename std::enable_if<
     std::future<Status>>::type
 Channel::asyncRecv(Container &c) {
   auto recv_func = [&](Container &c) -> Status {
-    this->channel_impl_->RecvImpl(&c);
-    return Status::OK();
+    TraceSpan span("Channel::asyncRecv", this->key_);
+    retcode ret = this->channel_impl_->RecvImpl(&c);
+    span.setBytes(c.size());
+    return RecvStatus(ret);
   };
   return std::async(std::launch::async, recv_func, std::ref(c));
 }
 
-// template <class Container>
-// typename std::enable_if<
-//     is_container<Container>::value&&
-//     has_resize<Container, void(typename Container::size_type)>::value,
-//                std::future<Status>>::type
-// Channel::asyncRecv(Container& c, std::function<void()> fn) {
-//   auto recv_func = [&](Container& c, std::function<void()> done) -> Status {
-//     std::string recv_buf;
-//     LOG(ERROR) << "Channel::asyncRecv";
-//     this->channel_impl_->RecvImpl(&recv_buf);
-//     if (BuffSize(c) != recv_buf.size()) {
-//       using value_type_t = typename Container::value_type;
-//       size_t item_size = recv_buf.size()/sizeof(value_type_t);
-//       c.resize(item_size);
-//     }
-//     memcpy(BuffData(c), recv_buf.data(), recv_buf.size());
-//     done();
-//   };
-//   return std::async(std::launch::async, recv_func, std::ref(c), fn);
-// }
+template <class Container>
+typename std::enable_if<is_container<Container>::value, void>::type
+Channel::asyncRecv(Container &c, std::function<void(Status)> fn) {
+  auto impl = channel_impl_;
+  Container *dest = &c;
+  // The key is copied for the trace only, the channel may be gone by the
+  // time the receive runs.
+  std::string key = TraceEnabled() ? key_ : std::string();
+  TraceInstant("enqueue", key);
+  auto recv_func = [impl, dest, key]() -> Status {
+    TraceSpan span("Channel::asyncRecv", key);
+    retcode ret;
+    if constexpr (std::is_same_v<Container, std::string>) {
+      ret = impl->RecvImpl(dest);
+    } else if constexpr (has_resize<
+                             Container,
+                             void(typename Container::size_type)>::value) {
+      using value_type_t = typename Container::value_type;
+      std::string recv_buf;
+      ret = impl->RecvImpl(&recv_buf);
+      if (ret == retcode::SUCCESS) {
+        if (recv_buf.size() % sizeof(value_type_t) != 0) {
+          LOG(ERROR) << "data length is not a multiple of element size: "
+                     << recv_buf.size() << " " << sizeof(value_type_t);
+          return Status::MismatchError();
+        }
+        dest->resize(recv_buf.size() / sizeof(value_type_t));
+        memcpy(BuffData(*dest), recv_buf.data(), recv_buf.size());
+      }
+    } else {
+      ret = impl->RecvImpl(BuffData(*dest), BuffSize(*dest));
+    }
+    span.setBytes(BuffSize(*dest));
+    return RecvStatus(ret);
+  };
+  CompletionReactor::Default().submitRecv(impl, std::move(recv_func),
+                                          std::move(fn));
+}
 
 template <class Container>
 typename std::enable_if<is_container<Container>::value, Status>::type
@@ -464,6 +741,12 @@ Channel::send(const Container &buf) {
   return send(BuffData(buf), BuffSize(buf));
 }
 
+template <class Container>
+typename std::enable_if<is_container<Container>::value, Status>::type
+Channel::send(const Container &buf, Priority priority) {
+  return send(BuffData(buf), BuffSize(buf), priority);
+}
+
 template <typename Container>
 typename std::enable_if<is_container<Container>::value, Status>::type
 Channel::asyncSendCopy(const Container &buf) {
@@ -475,6 +758,7 @@ typename std::enable_if<std::is_pod<T>::value, Status>::type
 Channel::send(const T *buffT, uint64_t sizeT) {
   char *buff = reinterpret_cast<char *>(const_cast<T *>(buffT));
   auto buff_length = sizeT * sizeof(T);
+  TraceSpan span("Channel::send", key_, buff_length);
   this->channel_impl_->SendImpl(buff, buff_length);
   return Status::OK();
 }
@@ -503,15 +787,28 @@ Channel::asyncRecv(T *buffT, uint64_t sizeT) {
   char *buff = reinterpret_cast<char *>(buffT);
   auto size = sizeT * sizeof(T);
   auto recv_func = [&](char *buf, uint64_t length) -> Status {
-    retcode ret = this->channel_impl_->RecvImpl(buf, length);
-    if (ret == retcode::SUCCESS)
-      return Status::OK();
-    else 
-      return Status::NetworkError();
+    TraceSpan span("Channel::asyncRecv", this->key_, length);
+    return RecvStatus(this->channel_impl_->RecvImpl(buf, length));
   };
   return std::async(std::launch::async, recv_func, buff, size);
 }
 
+template <typename T>
+typename std::enable_if<std::is_pod<T>::value, void>::type
+Channel::asyncRecv(T *buffT, uint64_t sizeT, std::function<void(Status)> fn) {
+  auto impl = channel_impl_;
+  char *buff = reinterpret_cast<char *>(buffT);
+  uint64_t size = sizeT * sizeof(T);
+  std::string key = TraceEnabled() ? key_ : std::string();
+  TraceInstant("enqueue", key, size);
+  auto recv_func = [impl, buff, size, key]() -> Status {
+    TraceSpan span("Channel::asyncRecv", key, size);
+    return RecvStatus(impl->RecvImpl(buff, size));
+  };
+  CompletionReactor::Default().submitRecv(impl, std::move(recv_func),
+                                          std::move(fn));
+}
+
 template <typename T>
 typename std::enable_if<std::is_pod<T>::value, Status>::type
 Channel::asyncSend(const T *buffT, uint64_t sizeT) {
@@ -527,20 +824,28 @@ Channel::asyncSend(const T &v) {
   return asyncSend(&v, 1);
 }
 
-// template<class Container>
-// typename std::enable_if<is_container<Container>::value, void>::type
-// Channel::asyncSend(Container&& c, std::function<void()> callback) {
-//   send(c);
-//   callback();
-// }
+template <class Container>
+typename std::enable_if<is_container<Container>::value, void>::type
+Channel::asyncSend(Container &&c, std::function<void(Status)> callback) {
+  auto impl = channel_impl_;
+  auto buffer = std::make_shared<Container>(std::move(c));
+  auto send_func = [impl, buffer]() -> Status {
+    retcode ret = impl->SendImpl(BuffData(*buffer), BuffSize(*buffer));
+    if (ret != retcode::SUCCESS)
+      return Status::NetworkError();
+    return Status::OK();
+  };
+  CompletionReactor::Default().submitSend(impl, std::move(send_func),
+                                          std::move(callback));
+}
 
 template <typename T>
 typename std::enable_if<std::is_pod<T>::value, Status>::type
 Channel::recv(T *buff, uint64_t size) {
   char *recv_buf = reinterpret_cast<char *>(buff);
   uint64_t length = sizeof(T) * size;
-  channel_impl_->RecvImpl(recv_buf, length);
-  return Status::OK();
+  TraceSpan span("Channel::recv", key_, length);
+  return RecvStatus(channel_impl_->RecvImpl(recv_buf, length));
 }
 
 template <typename T>
@@ -559,6 +864,178 @@ Channel::asyncSendCopy(const T &buf) {
   return asyncSendCopy(&buf, 1);
 }
 
+template <typename T>
+typename std::enable_if<
+    std::is_integral<T>::value && !std::is_same<T, bool>::value, Status>::type
+Channel::send_packed(const std::vector<T> &vec, uint32_t bits) {
+  return sendEncoded(vec.data(), sizeof(T), std::is_signed<T>::value,
+                     vec.size(), IntCodec::kBitPack, bits);
+}
+
+template <typename T>
+typename std::enable_if<
+    std::is_integral<T>::value && !std::is_same<T, bool>::value, Status>::type
+Channel::send_packed(const std::vector<T> &vec, IntCodec codec) {
+  return sendEncoded(vec.data(), sizeof(T), std::is_signed<T>::value,
+                     vec.size(), codec, 0);
+}
+
+template <typename T>
+typename std::enable_if<
+    std::is_integral<T>::value && !std::is_same<T, bool>::value, Status>::type
+Channel::recv_packed(std::vector<T> &vec) {
+  std::string frame;
+  PackedHeader header;
+  auto status = recvEncodedFrame(&frame, &header, sizeof(T));
+  if (!status.IsOK())
+    return status;
+
+  vec.resize(header.count);
+  if (!DecodeInts(frame, header, std::is_signed<T>::value, vec.data(),
+                  sizeof(T))) {
+    LOG(ERROR) << "Decode packed frame failed, key: " << key_;
+    return Status::InvalidError();
+  }
+  return Status::OK();
+}
+
+template <class Container>
+typename std::enable_if<is_container<Container>::value, Status>::type
+Channel::sendStream(const Container &buf, uint64_t chunk_size) {
+  return sendStream(BuffData(buf), BuffSize(buf), chunk_size);
+}
+
+template <class Container>
+typename std::enable_if<is_container<Container>::value, Status>::type
+Channel::recvStream(Container &c) {
+  ChunkReader reader;
+  auto status = openStream(&reader);
+  if (!status.IsOK())
+    return status;
+
+  using value_type_t = typename Container::value_type;
+  if constexpr (has_resize<Container,
+                           void(typename Container::size_type)>::value) {
+    c.resize(reader.totalSize() / sizeof(value_type_t));
+  }
+  if (BuffSize(c) != reader.totalSize()) {
+    LOG(ERROR) << "stream length does not match: "
+               << "expected: " << BuffSize(c) << " "
+               << "actually: " << reader.totalSize();
+    return Status::MismatchError();
+  }
+
+  char *dest = BuffData(c);
+  while (!reader.done()) {
+    status = reader.nextInto(dest + reader.offset());
+    if (!status.IsOK())
+      return status;
+  }
+  return Status::OK();
+}
+
+template <class Container>
+typename std::enable_if<is_container<Container>::value, Status>::type
+Channel::sendStriped(const Container &buf, uint32_t k) {
+  return sendStriped(BuffData(buf), BuffSize(buf), k);
+}
+
+template <class Container>
+typename std::enable_if<is_container<Container>::value, Status>::type
+Channel::recvStriped(Container &c, uint32_t k) {
+  uint64_t length = 0;
+  auto status = recvStripeHeader(&length, k);
+  if (!status.IsOK())
+    return status;
+
+  using value_type_t = typename Container::value_type;
+  if constexpr (has_resize<Container,
+                           void(typename Container::size_type)>::value) {
+    c.resize(length / sizeof(value_type_t));
+  }
+  if (BuffSize(c) != length) {
+    LOG(ERROR) << "striped length does not match: "
+               << "expected: " << BuffSize(c) << " "
+               << "actually: " << length;
+    return Status::MismatchError();
+  }
+  return recvStripes(BuffData(c), length, k);
+}
+
+template <class BitContainer>
+typename std::enable_if<is_bit_container<BitContainer>::value, Status>::type
+Channel::send(const BitContainer &bits) {
+  uint64_t nbits = BitSize(bits);
+  std::string frame(sizeof(nbits) + BitWords(nbits) * sizeof(uint64_t), 0);
+  memcpy(&frame[0], &nbits, sizeof(nbits));
+  PackBitWords(bits, reinterpret_cast<uint64_t *>(&frame[sizeof(nbits)]));
+  return sendFrame(std::move(frame));
+}
+
+template <class BitContainer>
+typename std::enable_if<is_bit_container<BitContainer>::value, Status>::type
+Channel::recv(BitContainer &bits) {
+  std::string frame;
+  uint64_t nbits = 0;
+  auto status = recvBitFrame(&frame, &nbits);
+  if (!status.IsOK())
+    return status;
+
+  if (!ResizeBits(&bits, nbits)) {
+    LOG(ERROR) << "bit length does not match: "
+               << "expected: " << BitSize(bits) << " "
+               << "actually: " << nbits;
+    return Status::MismatchError();
+  }
+  UnpackBitWords(
+      reinterpret_cast<const uint64_t *>(frame.data() + sizeof(nbits)), nbits,
+      &bits);
+  return Status::OK();
+}
+
+template <typename T>
+typename std::enable_if<is_serializable<T>::value, Status>::type
+Channel::send(const T &msg) {
+  std::string frame;
+  size_t size = SerializedSize(msg);
+#if defined(__cpp_lib_string_resize_and_overwrite)
+  frame.resize_and_overwrite(size, [&](char *data, size_t n) {
+    SerializeFields(msg, data);
+    return n;
+  });
+#else
+  frame.resize(size);
+  SerializeFields(msg, &frame[0]);
+#endif
+  TraceSpan span("Channel::send", key_, frame.size());
+  return sendFrame(std::move(frame));
+}
+
+template <typename T>
+typename std::enable_if<is_serializable<T>::value, Status>::type
+Channel::recv(T &msg) {
+  static_assert(!SerialField<T>::kHasViews,
+                "message has view fields, use recv(msg, frame)");
+  std::string frame;
+  return recv(msg, frame);
+}
+
+template <typename T>
+typename std::enable_if<is_serializable<T>::value, Status>::type
+Channel::recv(T &msg, std::string &frame) {
+  auto status = recvFrame(&frame);
+  if (!status.IsOK())
+    return status;
+
+  TraceSpan span("Channel::recv", key_, frame.size());
+  if (!DeserializeFields(frame.data(), frame.size(), &msg)) {
+    LOG(ERROR) << "Deserialize message failed, key: " << key_
+               << ", frame size: " << frame.size();
+    return Status::MismatchError();
+  }
+  return Status::OK();
+}
+
 } // namespace primihub::link
 
 #endif // NETWORK_CHANNEL_INTERFACE_H_
@@ -0,0 +1,96 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "network/channel_pool.h"
+
+#include <algorithm>
+
+namespace primihub::link {
+ChannelPool::ChannelPool(std::shared_ptr<ChannelBase> parent,
+                         const std::string &key_prefix, uint32_t first_id,
+                         const Options &options)
+    : parent_(std::move(parent)), key_prefix_(key_prefix), options_(options),
+      next_warm_(first_id), highest_leased_(first_id - 1) {
+  warm_thread_ = std::thread(&ChannelPool::WarmLoop, this);
+}
+
+ChannelPool::~ChannelPool() {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  warm_thread_.join();
+  for (auto &slot : slots_) {
+    if (slot.second.channel != nullptr)
+      slot.second.channel->close();
+  }
+}
+
+std::string ChannelPool::Key(uint32_t id) const {
+  return key_prefix_ + std::to_string(id);
+}
+
+std::shared_ptr<ChannelBase> ChannelPool::Lease(uint32_t id) {
+  std::unique_lock<std::mutex> lock(mu_);
+  if (id > highest_leased_) {
+    highest_leased_ = id;
+    cv_.notify_all();
+  }
+  if (slots_.count(id) != 0) {
+    cv_.wait(lock, [&]() { return slots_[id].ready; });
+    auto channel = std::move(slots_[id].channel);
+    slots_.erase(id);
+    hits_++;
+    return channel;
+  }
+  if (id >= next_warm_)
+    leased_ahead_.insert(id);
+  misses_++;
+  lock.unlock();
+  return parent_->ForkImpl(Key(id));
+}
+
+size_t ChannelPool::readyCount() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return std::count_if(slots_.begin(), slots_.end(),
+                       [](const auto &slot) { return slot.second.ready; });
+}
+
+void ChannelPool::WarmLoop() {
+  std::unique_lock<std::mutex> lock(mu_);
+  while (true) {
+    cv_.wait(lock, [&]() {
+      return stop_ ||
+             uint64_t(next_warm_) <= uint64_t(highest_leased_) + options_.warm;
+    });
+    if (stop_)
+      return;
+    uint32_t id = next_warm_++;
+    if (leased_ahead_.erase(id) != 0)
+      continue;
+    slots_[id] = Slot();
+    lock.unlock();
+    // The handshake runs without the lock, leases of other forks go on.
+    auto channel = parent_->ForkImpl(Key(id));
+    if (channel != nullptr)
+      channel->Warmup();
+    lock.lock();
+    slots_[id].channel = std::move(channel);
+    slots_[id].ready = true;
+    cv_.notify_all();
+  }
+}
+} // namespace primihub::link
@@ -0,0 +1,92 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef NETWORK_CHANNEL_POOL_H_
+#define NETWORK_CHANNEL_POOL_H_
+
+#include "network/base_channel.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+namespace primihub::link {
+// ChannelPool keeps the next forks of a channel ready before they are
+// asked for. Fork keys are numbered, so a background thread creates the
+// forks for the next numbers ahead of time and calls Warmup on them, which
+// makes a socket client connect and send its handshake. Leasing a fork then
+// takes the warm one, and the thread tops the pool up again.
+//
+// The peer needs no pool of its own, its forks pick up the connections
+// by key as usual. Forks warmed but never leased are closed with the pool.
+class ChannelPool {
+public:
+  struct Options {
+    // Forks kept ready beyond the highest one leased.
+    size_t warm{16};
+  };
+
+  // Fork number id gets the key key_prefix + id, first_id is the first
+  // number leased.
+  ChannelPool(std::shared_ptr<ChannelBase> parent,
+              const std::string &key_prefix, uint32_t first_id,
+              const Options &options);
+  ~ChannelPool();
+  ChannelPool(const ChannelPool &) = delete;
+  ChannelPool &operator=(const ChannelPool &) = delete;
+
+  // Returns fork number id, waits if it is being warmed right now and forks
+  // it in the calling thread if the pool has not come to it yet.
+  std::shared_ptr<ChannelBase> Lease(uint32_t id);
+  std::string Key(uint32_t id) const;
+
+  // Forks ready to be leased.
+  size_t readyCount() const;
+  // Leases served from the pool, and those forked on demand.
+  uint64_t hits() const { return hits_.load(); }
+  uint64_t misses() const { return misses_.load(); }
+
+private:
+  struct Slot {
+    bool ready{false};
+    std::shared_ptr<ChannelBase> channel;
+  };
+
+  void WarmLoop();
+
+  std::shared_ptr<ChannelBase> parent_;
+  std::string key_prefix_;
+  Options options_;
+
+  mutable std::mutex mu_;
+  std::condition_variable cv_;
+  std::map<uint32_t, Slot> slots_;
+  // Numbers leased before the warm thread came to them, it skips them.
+  std::set<uint32_t> leased_ahead_;
+  uint32_t next_warm_;
+  uint32_t highest_leased_;
+  bool stop_{false};
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+  std::thread warm_thread_;
+};
+} // namespace primihub::link
+
+#endif // NETWORK_CHANNEL_POOL_H_
@@ -0,0 +1,110 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "network/channel_selector.h"
+
+#include <poll.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+namespace primihub::link {
+namespace {
+// Without an eventfd readiness is checked at this interval.
+constexpr int kFallbackPollMs = 10;
+} // namespace
+
+ChannelSelector::ChannelSelector()
+    : notifier_(std::make_shared<ReadyNotifier>()) {}
+
+ChannelSelector::~ChannelSelector() {
+  std::lock_guard<std::mutex> lock(mu_);
+  for (auto &channel : channels_)
+    channel->setReadyNotifier(nullptr);
+}
+
+void ChannelSelector::add(std::shared_ptr<Channel> channel) {
+  channel->setReadyNotifier(notifier_);
+  std::lock_guard<std::mutex> lock(mu_);
+  channels_.push_back(std::move(channel));
+}
+
+void ChannelSelector::remove(const std::shared_ptr<Channel> &channel) {
+  std::lock_guard<std::mutex> lock(mu_);
+  auto iter = std::find(channels_.begin(), channels_.end(), channel);
+  if (iter == channels_.end())
+    return;
+  (*iter)->setReadyNotifier(nullptr);
+  channels_.erase(iter);
+}
+
+size_t ChannelSelector::size() {
+  std::lock_guard<std::mutex> lock(mu_);
+  return channels_.size();
+}
+
+std::vector<std::shared_ptr<Channel>> ChannelSelector::select(int timeout_ms) {
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(std::max(timeout_ms, 0));
+  std::vector<std::shared_ptr<Channel>> ready;
+  std::vector<pollfd> pfds;
+  while (true) {
+    // Drain first, a message arriving after the scan notifies again.
+    notifier_->Drain();
+    std::vector<std::shared_ptr<Channel>> channels;
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      channels = channels_;
+    }
+    for (auto &channel : channels)
+      if (channel->hasPendingData())
+        ready.push_back(channel);
+    if (!ready.empty())
+      return ready;
+
+    pfds.clear();
+    if (notifier_->fd() >= 0)
+      pfds.push_back(pollfd{notifier_->fd(), POLLIN, 0});
+    for (auto &channel : channels) {
+      int fd = channel->readinessFd();
+      if (fd >= 0)
+        pfds.push_back(pollfd{fd, POLLIN, 0});
+    }
+
+    int wait_ms = -1;
+    if (timeout_ms >= 0) {
+      auto remain = std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - std::chrono::steady_clock::now());
+      wait_ms = static_cast<int>(std::max<int64_t>(remain.count(), 0));
+    }
+    if (notifier_->fd() < 0 && (wait_ms < 0 || wait_ms > kFallbackPollMs))
+      wait_ms = kFallbackPollMs;
+
+    int ret = poll(pfds.data(), pfds.size(), wait_ms);
+    if (ret < 0 && errno != EINTR) {
+      LOG(ERROR) << "poll failed: " << strerror(errno);
+      return ready;
+    }
+    if (timeout_ms >= 0 && std::chrono::steady_clock::now() >= deadline) {
+      for (auto &channel : channels)
+        if (channel->hasPendingData())
+          ready.push_back(channel);
+      return ready;
+    }
+  }
+}
+} // namespace primihub::link
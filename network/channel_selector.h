@@ -0,0 +1,56 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef NETWORK_CHANNEL_SELECTOR_H_
+#define NETWORK_CHANNEL_SELECTOR_H_
+
+#include "network/channel_interface.h"
+#include "network/ready_notifier.h"
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace primihub::link {
+// ChannelSelector waits on many channels at once from a single thread and
+// returns those with a message pending, which can then be taken with
+// Channel::try_recv. In-memory channels signal one eventfd shared by all
+// channels of the selector, socket channels are polled on their own fds.
+//
+// A channel can be registered with one selector at a time. A socket client
+// that is not connected yet is not ready until Warmup or its first send
+// connects it.
+class ChannelSelector {
+public:
+  ChannelSelector();
+  ~ChannelSelector();
+
+  void add(std::shared_ptr<Channel> channel);
+  void remove(const std::shared_ptr<Channel> &channel);
+  size_t size();
+
+  // Blocks until at least one registered channel has a message pending and
+  // returns all that have. Returns an empty vector after timeout_ms, a
+  // negative timeout waits forever.
+  std::vector<std::shared_ptr<Channel>> select(int timeout_ms = -1);
+
+private:
+  std::shared_ptr<ReadyNotifier> notifier_;
+  std::mutex mu_;
+  std::vector<std::shared_ptr<Channel>> channels_;
+};
+} // namespace primihub::link
+
+#endif // NETWORK_CHANNEL_SELECTOR_H_
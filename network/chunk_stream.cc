@@ -0,0 +1,96 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "network/chunk_stream.h"
+
+#include <algorithm>
+
+namespace primihub::link {
+retcode SendStream(ChannelBase *channel, const char *data, uint64_t length,
+                   uint64_t chunk_size) {
+  if (chunk_size == 0) {
+    LOG(ERROR) << "Stream chunk size must not be 0.";
+    return retcode::FAIL;
+  }
+
+  StreamHeader header{length, chunk_size};
+  retcode ret = channel->SendImpl(reinterpret_cast<const char *>(&header),
+                                  sizeof(header));
+  if (ret != retcode::SUCCESS)
+    return ret;
+
+  for (uint64_t offset = 0; offset < length; offset += chunk_size) {
+    uint64_t size = std::min(chunk_size, length - offset);
+    ret = channel->SendImpl(data + offset, size);
+    if (ret != retcode::SUCCESS)
+      return ret;
+  }
+  return retcode::SUCCESS;
+}
+
+Status ChunkReader::open(std::shared_ptr<ChannelBase> channel) {
+  channel_ = std::move(channel);
+  offset_ = 0;
+  retcode ret = channel_->RecvImpl(reinterpret_cast<char *>(&header_),
+                                   sizeof(header_));
+  if (ret != retcode::SUCCESS) {
+    header_ = StreamHeader{0, 0};
+    return Status::NetworkError();
+  }
+
+  if (header_.chunk_size == 0) {
+    LOG(ERROR) << "Invalid stream header, chunk size is 0.";
+    header_ = StreamHeader{0, 0};
+    return Status::InvalidError();
+  }
+  return Status::OK();
+}
+
+uint64_t ChunkReader::nextChunkSize() const {
+  return std::min(header_.chunk_size, header_.total_size - offset_);
+}
+
+Status ChunkReader::next(std::string *chunk) {
+  if (done())
+    return Status::InvalidError();
+
+  uint64_t expected = nextChunkSize();
+  retcode ret = channel_->RecvImpl(chunk);
+  if (ret != retcode::SUCCESS)
+    return Status::NetworkError();
+
+  if (chunk->size() != expected) {
+    LOG(ERROR) << "stream chunk length does not match: "
+               << "expected: " << expected << " "
+               << "actually: " << chunk->size();
+    return Status::MismatchError();
+  }
+  offset_ += expected;
+  return Status::OK();
+}
+
+Status ChunkReader::nextInto(char *dest) {
+  if (done())
+    return Status::InvalidError();
+
+  uint64_t expected = nextChunkSize();
+  retcode ret = channel_->RecvImpl(dest, expected);
+  if (ret != retcode::SUCCESS)
+    return Status::NetworkError();
+
+  offset_ += expected;
+  return Status::OK();
+}
+} // namespace primihub::link
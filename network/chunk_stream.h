@@ -0,0 +1,70 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef NETWORK_CHUNK_STREAM_H_
+#define NETWORK_CHUNK_STREAM_H_
+#include "network/base_channel.h"
+#include "network/status.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace primihub::link {
+// A stream is one header message followed by ceil(total / chunk_size) chunk
+// messages, every chunk but the last one holds exactly chunk_size bytes.
+struct StreamHeader {
+  uint64_t total_size;
+  uint64_t chunk_size;
+};
+
+constexpr uint64_t kDefaultStreamChunkSize = 4 * 1024 * 1024;
+
+// Sends length bytes from data as a stream of chunk_size chunks.
+retcode SendStream(ChannelBase *channel, const char *data, uint64_t length,
+                   uint64_t chunk_size);
+
+// ChunkReader consumes a stream chunk by chunk, so the receiver can work on
+// the first chunks while the rest are still in flight.
+class ChunkReader {
+public:
+  ChunkReader() = default;
+
+  // Receives the stream header, must be called before anything else.
+  Status open(std::shared_ptr<ChannelBase> channel);
+
+  uint64_t totalSize() const { return header_.total_size; }
+  uint64_t chunkSize() const { return header_.chunk_size; }
+  // Offset in the stream of the next chunk.
+  uint64_t offset() const { return offset_; }
+  // Size of the next chunk, 0 once the stream is done.
+  uint64_t nextChunkSize() const;
+  bool done() const { return offset_ == header_.total_size; }
+
+  // Receives the next chunk, the string is replaced so no copy is made for
+  // transports that queue whole messages.
+  Status next(std::string *chunk);
+
+  // Receives the next chunk straight into dest, which must hold
+  // nextChunkSize() bytes.
+  Status nextInto(char *dest);
+
+private:
+  std::shared_ptr<ChannelBase> channel_{nullptr};
+  StreamHeader header_{0, 0};
+  uint64_t offset_{0};
+};
+} // namespace primihub::link
+#endif // NETWORK_CHUNK_STREAM_H_
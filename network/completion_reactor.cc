@@ -0,0 +1,269 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "network/completion_reactor.h"
+
+#include <glog/logging.h>
+#include <poll.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+namespace primihub::link {
+namespace {
+// Channels without a readiness fd or notifier are checked at this interval,
+// the others too in case a wakeup got lost.
+constexpr int kRecheckMs = 100;
+constexpr int kFallbackPollMs = 10;
+
+// std::hash of a pointer is the address itself, whose low bits are zero
+// for heap objects, so the address is mixed before it picks a worker.
+size_t MixPointer(const void *p) {
+  uint64_t x = reinterpret_cast<uintptr_t>(p);
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return static_cast<size_t>(x);
+}
+} // namespace
+
+CompletionReactor::CompletionReactor(size_t num_workers)
+    : notifier_(std::make_shared<ReadyNotifier>()) {
+  if (num_workers == 0)
+    num_workers = 1;
+  for (size_t i = 0; i < num_workers; i++)
+    queues_.push_back(std::make_unique<ThreadSafeQueue<Task>>());
+  auto run = [](ThreadSafeQueue<Task> *queue) {
+    while (true) {
+      Task task = queue->pop();
+      // An empty task is the shutdown sentinel, it is queued behind the
+      // remaining work.
+      if (!task)
+        break;
+      task();
+    }
+  };
+  for (size_t i = 0; i < num_workers; i++)
+    workers_.emplace_back(run, queues_[i].get());
+  connect_thread_ = std::thread(run, &connect_queue_);
+  reactor_thread_ = std::thread([this]() { reactorLoop(); });
+}
+
+CompletionReactor::~CompletionReactor() {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stop_ = true;
+  }
+  notifier_->Notify();
+  reactor_thread_.join();
+
+  std::vector<PendingRecv> cancelled;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    for (auto &lane : recv_lanes_) {
+      for (auto &pending : lane.second.pending)
+        cancelled.push_back(std::move(pending));
+      lane.second.pending.clear();
+    }
+  }
+  for (auto &pending : cancelled)
+    pending.done(Status::UnavailableError());
+
+  for (auto &queue : queues_)
+    queue->push(Task());
+  connect_queue_.push(Task());
+  for (auto &worker : workers_)
+    worker.join();
+  connect_thread_.join();
+  for (auto &lane : recv_lanes_)
+    lane.second.channel->SetReadyNotifier(nullptr);
+}
+
+CompletionReactor &CompletionReactor::Default() {
+  // Never destroyed, a callback may still be queued when static objects go.
+  static CompletionReactor *reactor = new CompletionReactor();
+  return *reactor;
+}
+
+void CompletionReactor::submitSend(const std::shared_ptr<ChannelBase> &channel,
+                                   Operation op, Callback done) {
+  // The task holds the channel so it outlives the operation.
+  post(channel.get(), false,
+       [channel, op = std::move(op), done = std::move(done)]() {
+         done(op());
+       });
+}
+
+void CompletionReactor::submitRecv(const std::shared_ptr<ChannelBase> &channel,
+                                   Operation op, Callback done) {
+  bool registered = true;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (stop_) {
+      registered = false;
+    } else {
+      RecvLane &lane = recv_lanes_[channel.get()];
+      if (lane.channel == nullptr) {
+        lane.channel = channel;
+        channel->SetReadyNotifier(notifier_);
+      }
+      lane.pending.push_back(PendingRecv{std::move(op), std::move(done)});
+    }
+  }
+  if (!registered) {
+    done(Status::UnavailableError());
+    return;
+  }
+  notifier_->Notify();
+}
+
+void CompletionReactor::post(const ChannelBase *channel, bool recv,
+                             Task task) {
+  // The recv lane of a channel goes to the worker after its send lane.
+  size_t lane = MixPointer(channel) + (recv ? 1 : 0);
+  queues_[lane % queues_.size()]->push(std::move(task));
+}
+
+void CompletionReactor::reactorLoop() {
+  std::vector<pollfd> pfds;
+  while (true) {
+    // Drain first, data arriving after the scan notifies again.
+    notifier_->Drain();
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (stop_)
+        return;
+    }
+    std::vector<int> fds = dispatchReady();
+
+    pfds.clear();
+    if (notifier_->fd() >= 0)
+      pfds.push_back(pollfd{notifier_->fd(), POLLIN, 0});
+    for (int fd : fds)
+      pfds.push_back(pollfd{fd, POLLIN, 0});
+    int wait_ms = notifier_->fd() >= 0 ? kRecheckMs : kFallbackPollMs;
+    int ret = poll(pfds.data(), pfds.size(), wait_ms);
+    if (ret < 0 && errno != EINTR) {
+      LOG(ERROR) << "poll failed: " << strerror(errno);
+      return;
+    }
+  }
+}
+
+std::vector<int> CompletionReactor::dispatchReady() {
+  // The lanes waiting for a message. Their channels are checked without
+  // mu_, so a slow hook does not hold up submitRecv and finishRecv.
+  std::vector<std::shared_ptr<ChannelBase>> waiting;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    for (auto iter = recv_lanes_.begin(); iter != recv_lanes_.end();) {
+      RecvLane &lane = iter->second;
+      if (lane.pending.empty() && !lane.in_flight && !lane.warming) {
+        // Idle channels are dropped so the reactor does not keep them alive.
+        // Under mu_, so a concurrent submitRecv registers again after this.
+        lane.channel->SetReadyNotifier(nullptr);
+        iter = recv_lanes_.erase(iter);
+        continue;
+      }
+      if (!lane.in_flight && !lane.pending.empty())
+        waiting.push_back(lane.channel);
+      ++iter;
+    }
+  }
+
+  std::vector<int> fds;
+  std::vector<ChannelBase *> ready;
+  std::vector<ChannelBase *> unconnected;
+  for (auto &channel : waiting) {
+    if (channel->HasPendingData()) {
+      ready.push_back(channel.get());
+      continue;
+    }
+    int fd = channel->ReadinessFd();
+    if (fd >= 0)
+      fds.push_back(fd);
+    else
+      unconnected.push_back(channel.get());
+  }
+
+  std::lock_guard<std::mutex> lock(mu_);
+  for (ChannelBase *key : ready) {
+    auto iter = recv_lanes_.find(key);
+    if (iter == recv_lanes_.end())
+      continue;
+    RecvLane &lane = iter->second;
+    if (lane.in_flight || lane.pending.empty())
+      continue;
+    // One receive per channel at a time keeps the messages in order.
+    lane.in_flight = true;
+    PendingRecv pending = std::move(lane.pending.front());
+    lane.pending.pop_front();
+    std::shared_ptr<ChannelBase> channel = lane.channel;
+    post(channel.get(), true,
+         [this, channel, pending = std::move(pending)]() {
+           pending.done(pending.op());
+           finishRecv(channel.get());
+         });
+  }
+  for (ChannelBase *key : unconnected) {
+    auto iter = recv_lanes_.find(key);
+    if (iter == recv_lanes_.end())
+      continue;
+    RecvLane &lane = iter->second;
+    if (lane.in_flight || lane.warming || lane.warmed)
+      continue;
+    // Channels without a connection run it too, it returns right away.
+    lane.warming = true;
+    std::shared_ptr<ChannelBase> channel = lane.channel;
+    connect_queue_.push([this, channel]() {
+      finishWarmup(channel.get(), channel->Warmup());
+    });
+  }
+  return fds;
+}
+
+void CompletionReactor::finishRecv(ChannelBase *channel) {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto iter = recv_lanes_.find(channel);
+    if (iter != recv_lanes_.end())
+      iter->second.in_flight = false;
+  }
+  notifier_->Notify();
+}
+
+void CompletionReactor::finishWarmup(ChannelBase *channel, retcode ret) {
+  std::deque<PendingRecv> failed;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto iter = recv_lanes_.find(channel);
+    if (iter != recv_lanes_.end()) {
+      iter->second.warming = false;
+      iter->second.warmed = true;
+      if (ret != retcode::SUCCESS)
+        failed.swap(iter->second.pending);
+    }
+  }
+  if (!failed.empty())
+    LOG(ERROR) << "CompletionReactor: channel failed to connect, "
+               << failed.size() << " receives fail.";
+  for (auto &pending : failed)
+    pending.done(Status::NetworkError());
+  notifier_->Notify();
+}
+} // namespace primihub::link
@@ -0,0 +1,106 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef NETWORK_COMPLETION_REACTOR_H_
+#define NETWORK_COMPLETION_REACTOR_H_
+
+#include "common/threadsafe_queue.h"
+#include "network/base_channel.h"
+#include "network/ready_notifier.h"
+#include "network/status.h"
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace primihub::link {
+// CompletionReactor runs the callback style operations of Channel on a
+// fixed pool of worker threads instead of a thread per operation. Every
+// channel has a send lane and a recv lane, each mapped to one worker, so the
+// operations of a lane run and complete in submission order.
+//
+// A receive is handed to its worker only once the channel has a message
+// pending, so a worker never blocks waiting for a peer and a few workers
+// serve any number of channels. The reactor thread waits for that with the
+// readiness hooks of ChannelBase, like ChannelSelector, so a channel must
+// not be registered with a selector while it has callback receives pending.
+// A channel that is neither ready nor pollable is warmed up once, which
+// connects a socket client. That may take up to the connect timeout, so it
+// runs on a connect thread of its own rather than on a worker. If it fails,
+// the pending receives of the channel complete with NetworkError.
+class CompletionReactor {
+public:
+  using Operation = std::function<Status()>;
+  using Callback = std::function<void(Status)>;
+
+  static constexpr size_t kDefaultWorkers = 4;
+
+  explicit CompletionReactor(size_t num_workers = kDefaultWorkers);
+  // Runs the queued sends, receives still waiting for data complete with
+  // UnavailableError.
+  ~CompletionReactor();
+
+  // The reactor shared by all channels of the process.
+  static CompletionReactor &Default();
+
+  // Runs op on the send lane of channel and passes its status to done.
+  void submitSend(const std::shared_ptr<ChannelBase> &channel, Operation op,
+                  Callback done);
+
+  // Runs op on the recv lane of channel once a message is pending there.
+  void submitRecv(const std::shared_ptr<ChannelBase> &channel, Operation op,
+                  Callback done);
+
+private:
+  using Task = std::function<void()>;
+  struct PendingRecv {
+    Operation op;
+    Callback done;
+  };
+  struct RecvLane {
+    std::shared_ptr<ChannelBase> channel;
+    std::deque<PendingRecv> pending;
+    bool in_flight{false};
+    // Warmup is running on the connect thread, or has run.
+    bool warming{false};
+    bool warmed{false};
+  };
+
+  void post(const ChannelBase *channel, bool recv, Task task);
+  void reactorLoop();
+  // Hands ready receives to their workers, returns the fds to poll. Calls
+  // the readiness hooks without holding mu_.
+  std::vector<int> dispatchReady();
+  void finishRecv(ChannelBase *channel);
+  void finishWarmup(ChannelBase *channel, retcode ret);
+
+  std::shared_ptr<ReadyNotifier> notifier_;
+  std::vector<std::unique_ptr<ThreadSafeQueue<Task>>> queues_;
+  std::vector<std::thread> workers_;
+  ThreadSafeQueue<Task> connect_queue_;
+  std::thread connect_thread_;
+  std::thread reactor_thread_;
+
+  std::mutex mu_;
+  std::map<ChannelBase *, RecvLane> recv_lanes_;
+  bool stop_{false};
+};
+} // namespace primihub::link
+
+#endif // NETWORK_COMPLETION_REACTOR_H_
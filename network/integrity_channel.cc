@@ -0,0 +1,134 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "network/integrity_channel.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "util/crc32c.h"
+
+namespace primihub::link {
+namespace {
+void StoreChecksum(char *dst, uint32_t crc) {
+  for (size_t i = 0; i < IntegrityChannel::kChecksumSize; i++)
+    dst[i] = static_cast<char>(crc >> (8 * i));
+}
+
+uint32_t LoadChecksum(const char *src) {
+  uint32_t crc = 0;
+  for (size_t i = 0; i < IntegrityChannel::kChecksumSize; i++)
+    crc |= uint32_t(static_cast<uint8_t>(src[i])) << (8 * i);
+  return crc;
+}
+} // namespace
+
+IntegrityChannel::IntegrityChannel(std::shared_ptr<ChannelBase> inner)
+    : ForwardingChannel(std::move(inner)) {}
+
+std::shared_ptr<ChannelBase>
+IntegrityChannel::ForkImpl(const std::string &key) {
+  auto inner = inner_->ForkImpl(key);
+  if (inner == nullptr)
+    return nullptr;
+  return std::make_shared<IntegrityChannel>(std::move(inner));
+}
+
+retcode IntegrityChannel::SendImpl(const char *buff, size_t size) {
+  std::string frame;
+  frame.resize(size + kChecksumSize);
+  uint32_t crc = primihub::Crc32cCopy(&frame[0], buff, size);
+  StoreChecksum(&frame[size], crc);
+  return inner_->SendImpl(std::move(frame));
+}
+
+retcode IntegrityChannel::SendImpl(std::string &&send_buf) {
+  // The buffer is ours, the checksum is appended without copying the
+  // payload.
+  uint32_t crc = primihub::Crc32c(send_buf.data(), send_buf.size());
+  size_t size = send_buf.size();
+  send_buf.resize(size + kChecksumSize);
+  StoreChecksum(&send_buf[size], crc);
+  return inner_->SendImpl(std::move(send_buf));
+}
+
+retcode IntegrityChannel::SendImpl(const std::string &send_buf) {
+  return SendImpl(send_buf.data(), send_buf.size());
+}
+
+retcode IntegrityChannel::SendImpl(std::string_view send_buff_sv) {
+  return SendImpl(send_buff_sv.data(), send_buff_sv.size());
+}
+
+retcode IntegrityChannel::Verify(const std::string &frame, uint32_t checksum) {
+  size_t size = frame.size() - kChecksumSize;
+  uint32_t expected = LoadChecksum(frame.data() + size);
+  checked_messages_++;
+  checked_bytes_ += size;
+  if (checksum != expected) {
+    mismatches_++;
+    LOG(ERROR) << "checksum does not match: "
+               << " "
+               << "expected: " << expected << " "
+               << "actually: " << checksum << ", message of " << size
+               << " bytes is corrupted.";
+    return retcode::MISMATCH;
+  }
+  return retcode::SUCCESS;
+}
+
+retcode IntegrityChannel::RecvImpl(std::string *recv_buf) {
+  retcode ret = inner_->RecvImpl(recv_buf);
+  if (ret != retcode::SUCCESS)
+    return ret;
+  if (recv_buf->size() < kChecksumSize) {
+    LOG(ERROR) << "message without checksum, does the peer check integrity?";
+    return retcode::FAIL;
+  }
+  size_t size = recv_buf->size() - kChecksumSize;
+  ret = Verify(*recv_buf, primihub::Crc32c(recv_buf->data(), size));
+  recv_buf->resize(size);
+  return ret;
+}
+
+retcode IntegrityChannel::RecvImpl(char *recv_buf, size_t recv_size) {
+  std::string frame;
+  retcode ret = inner_->RecvImpl(&frame);
+  if (ret != retcode::SUCCESS)
+    return ret;
+  if (frame.size() != recv_size + kChecksumSize) {
+    LOG(ERROR) << "data length does not match: "
+               << " "
+               << "expected: " << recv_size << " "
+               << "actually: "
+               << frame.size() - std::min(frame.size(), kChecksumSize);
+    return retcode::FAIL;
+  }
+  return Verify(frame, primihub::Crc32cCopy(recv_buf, frame.data(), recv_size));
+}
+
+retcode IntegrityChannel::ProbeImpl(uint64_t *size, bool wait, bool *available) {
+  retcode ret = inner_->ProbeImpl(size, wait, available);
+  if (ret != retcode::SUCCESS || !*available)
+    return ret;
+  if (*size < kChecksumSize) {
+    LOG(ERROR) << "message without checksum, does the peer check integrity?";
+    return retcode::FAIL;
+  }
+  *size -= kChecksumSize;
+  return retcode::SUCCESS;
+}
+
+} // namespace primihub::link
@@ -0,0 +1,68 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef NETWORK_INTEGRITY_CHANNEL_H_
+#define NETWORK_INTEGRITY_CHANNEL_H_
+
+#include "network/base_channel.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+namespace primihub::link {
+// IntegrityChannel appends the CRC32C of every message to its frame and
+// checks it on receipt, to catch shares corrupted between the two parties'
+// memory. A message whose checksum does not match fails with
+// retcode::MISMATCH, which Channel reports as Status::MismatchError(). Both
+// peers must wrap their transport.
+//
+// The checksum is computed with Crc32cCopy while the payload is copied into
+// or out of the frame, so the check rides along with a copy the transport
+// makes anyway. Forks check their messages too and count them on
+// their own.
+class IntegrityChannel : public ForwardingChannel {
+public:
+  static constexpr size_t kChecksumSize = sizeof(uint32_t);
+
+  explicit IntegrityChannel(std::shared_ptr<ChannelBase> inner);
+
+  retcode SendImpl(const std::string &send_buf) override;
+  retcode SendImpl(std::string_view send_buff_sv) override;
+  retcode SendImpl(const char *buff, size_t size) override;
+  retcode SendImpl(std::string &&send_buf) override;
+  retcode RecvImpl(std::string *recv_buf) override;
+  retcode RecvImpl(char *recv_buf, size_t recv_size) override;
+  retcode ProbeImpl(uint64_t *size, bool wait, bool *available) override;
+  std::shared_ptr<ChannelBase> ForkImpl(const std::string &key) override;
+
+  // Messages and payload bytes received and checked, and the messages among
+  // them whose checksum did not match.
+  uint64_t checkedMessages() const { return checked_messages_.load(); }
+  uint64_t checkedBytes() const { return checked_bytes_.load(); }
+  uint64_t mismatches() const { return mismatches_.load(); }
+
+private:
+  // Checks the trailer of frame, whose payload has the given checksum.
+  retcode Verify(const std::string &frame, uint32_t checksum);
+
+  std::atomic<uint64_t> checked_messages_{0};
+  std::atomic<uint64_t> checked_bytes_{0};
+  std::atomic<uint64_t> mismatches_{0};
+};
+} // namespace primihub::link
+
+#endif // NETWORK_INTEGRITY_CHANNEL_H_
@@ -0,0 +1,566 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "network/io_uring_reactor.h"
+
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+
+namespace primihub::link {
+namespace {
+constexpr unsigned kRingEntries = 512;
+// Size of the sparse fixed file table, one slot per connected socket.
+constexpr int kMaxFiles = 1024;
+// Frames up to kBufferSize bytes, header included, are copied into one of
+// the registered buffers and sent from there.
+constexpr size_t kBufferSize = 16 * 1024;
+constexpr int kBufferCount = 64;
+// Marks the user_data of fixed buffer sends, which carries the buffer index
+// instead of the operation.
+constexpr uint64_t kFixedSendTag = 1ULL << 63;
+
+int IoUringSetup(unsigned entries, io_uring_params *params) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int IoUringEnter(int ring_fd, unsigned to_submit, unsigned min_complete,
+                 unsigned flags) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit,
+                                  min_complete, flags, nullptr, 0));
+}
+
+int IoUringRegister(int ring_fd, unsigned opcode, const void *arg,
+                    unsigned nr_args) {
+  return static_cast<int>(
+      syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args));
+}
+
+template <typename T> T *RingField(void *ring, uint32_t offset) {
+  return reinterpret_cast<T *>(static_cast<char *>(ring) + offset);
+}
+} // namespace
+
+struct IoUringOp {
+  uint8_t opcode{IORING_OP_NOP};
+  // Fixed file index, or -1 to use fd.
+  int index{-1};
+  int fd{-1};
+  char *buf{nullptr};
+  size_t size{0};
+  size_t done{0};
+  int msg_flags{0};
+  // Registered buffer of a fixed buffer send, -1 otherwise.
+  int buf_index{-1};
+  uint64_t offset{0};
+  msghdr msg;
+  iovec iov[2];
+
+  int result{0};
+  bool finished{false};
+  std::mutex mu;
+  std::condition_variable cv;
+
+  // Blocks until the reactor has finished the operation.
+  int Wait() {
+    std::unique_lock<std::mutex> lock(mu);
+    cv.wait(lock, [this]() { return finished; });
+    return result;
+  }
+};
+
+std::shared_ptr<IoUringReactor> IoUringReactor::Create() {
+  std::shared_ptr<IoUringReactor> reactor(new IoUringReactor());
+  if (!reactor->Init())
+    return nullptr;
+  reactor->loop_thread_ = std::thread([ptr = reactor.get()]() { ptr->Loop(); });
+  return reactor;
+}
+
+bool IoUringReactor::Init() {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring_fd_ = IoUringSetup(kRingEntries, &params);
+  if (ring_fd_ < 0) {
+    LOG(WARNING) << "io_uring_setup failed: " << strerror(errno);
+    return false;
+  }
+  if (!(params.features & IORING_FEAT_NODROP)) {
+    LOG(WARNING) << "io_uring of this kernel may drop completions.";
+    return false;
+  }
+
+  sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap)
+    sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+  sq_ptr_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_ptr_ == MAP_FAILED) {
+    sq_ptr_ = nullptr;
+    LOG(WARNING) << "mmap io_uring sq ring failed: " << strerror(errno);
+    return false;
+  }
+  if (single_mmap) {
+    cq_ptr_ = sq_ptr_;
+  } else {
+    cq_ptr_ = mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    if (cq_ptr_ == MAP_FAILED) {
+      cq_ptr_ = nullptr;
+      LOG(WARNING) << "mmap io_uring cq ring failed: " << strerror(errno);
+      return false;
+    }
+  }
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  sqes_ptr_ = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (sqes_ptr_ == MAP_FAILED) {
+    sqes_ptr_ = nullptr;
+    LOG(WARNING) << "mmap io_uring sqes failed: " << strerror(errno);
+    return false;
+  }
+
+  sq_head_ = RingField<unsigned>(sq_ptr_, params.sq_off.head);
+  sq_tail_ = RingField<unsigned>(sq_ptr_, params.sq_off.tail);
+  sq_mask_ = *RingField<unsigned>(sq_ptr_, params.sq_off.ring_mask);
+  sq_entries_ = *RingField<unsigned>(sq_ptr_, params.sq_off.ring_entries);
+  sq_array_ = RingField<unsigned>(sq_ptr_, params.sq_off.array);
+  cq_head_ = RingField<unsigned>(cq_ptr_, params.cq_off.head);
+  cq_tail_ = RingField<unsigned>(cq_ptr_, params.cq_off.tail);
+  cq_mask_ = *RingField<unsigned>(cq_ptr_, params.cq_off.ring_mask);
+  cqes_ = RingField<void>(cq_ptr_, params.cq_off.cqes);
+  sqes_ = sqes_ptr_;
+
+  // Every operation used by the reactor must be supported.
+  std::vector<char> probe_mem(sizeof(io_uring_probe) +
+                              256 * sizeof(io_uring_probe_op));
+  auto probe = reinterpret_cast<io_uring_probe *>(probe_mem.data());
+  if (IoUringRegister(ring_fd_, IORING_REGISTER_PROBE, probe, 256) < 0) {
+    LOG(WARNING) << "io_uring probe failed: " << strerror(errno);
+    return false;
+  }
+  auto opcodeSupported = [probe](uint8_t opcode) {
+    return opcode <= probe->last_op &&
+           (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+  };
+  for (uint8_t opcode : {IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_READ,
+                         IORING_OP_FILES_UPDATE}) {
+    if (!opcodeSupported(opcode)) {
+      LOG(WARNING) << "io_uring op " << static_cast<int>(opcode)
+                   << " is not supported.";
+      return false;
+    }
+  }
+
+  std::vector<int> files(kMaxFiles, -1);
+  if (IoUringRegister(ring_fd_, IORING_REGISTER_FILES, files.data(),
+                      kMaxFiles) < 0) {
+    LOG(WARNING) << "Register io_uring files failed: " << strerror(errno);
+    return false;
+  }
+  for (int i = kMaxFiles - 1; i >= 0; i--)
+    free_files_.push_back(i);
+
+  wake_fd_ = eventfd(0, EFD_CLOEXEC);
+  if (wake_fd_ < 0) {
+    LOG(WARNING) << "Create eventfd failed: " << strerror(errno);
+    return false;
+  }
+
+#ifdef IORING_RECVSEND_FIXED_BUF
+  // Registered buffers are optional, they need locked memory. The kernel
+  // sends from them with IORING_OP_SEND_ZC only, SendFrame stops using them
+  // if the socket does not support that.
+  buffer_pool_.resize(kBufferSize * kBufferCount);
+  std::vector<iovec> buffers(kBufferCount);
+  for (int i = 0; i < kBufferCount; i++) {
+    buffers[i].iov_base = &buffer_pool_[i * kBufferSize];
+    buffers[i].iov_len = kBufferSize;
+  }
+  if (IoUringRegister(ring_fd_, IORING_REGISTER_BUFFERS, buffers.data(),
+                      kBufferCount) == 0 &&
+      opcodeSupported(IORING_OP_SEND_ZC)) {
+    for (int i = kBufferCount - 1; i >= 0; i--)
+      free_buffers_.push_back(i);
+    zc_ops_.assign(kBufferCount, nullptr);
+    zc_refs_.assign(kBufferCount, 0);
+  } else {
+    VLOG(1) << "io_uring registered buffers are not available.";
+    std::vector<char>().swap(buffer_pool_);
+  }
+#endif
+  return true;
+}
+
+IoUringReactor::~IoUringReactor() {
+  if (loop_thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      stop_ = true;
+    }
+    uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) < 0)
+      LOG(ERROR) << "Wake up io_uring reactor failed: " << strerror(errno);
+    loop_thread_.join();
+  }
+
+  if (sqes_ptr_ != nullptr)
+    munmap(sqes_ptr_, sqes_size_);
+  if (cq_ptr_ != nullptr && cq_ptr_ != sq_ptr_)
+    munmap(cq_ptr_, cq_size_);
+  if (sq_ptr_ != nullptr)
+    munmap(sq_ptr_, sq_size_);
+  if (ring_fd_ >= 0)
+    ::close(ring_fd_);
+  if (wake_fd_ >= 0)
+    ::close(wake_fd_);
+}
+
+int IoUringReactor::RegisterFile(int fd) {
+  int index = -1;
+  {
+    std::lock_guard<std::mutex> lock(table_mu_);
+    if (free_files_.empty()) {
+      LOG(ERROR) << "io_uring fixed file table is full.";
+      return -1;
+    }
+    index = free_files_.back();
+    free_files_.pop_back();
+  }
+
+  IoUringOp op;
+  op.opcode = IORING_OP_FILES_UPDATE;
+  op.buf = reinterpret_cast<char *>(&fd);
+  op.size = 1;
+  op.offset = index;
+  Submit(&op);
+  if (op.Wait() != 1) {
+    LOG(ERROR) << "Register fd to io_uring failed: " << strerror(-op.result);
+    std::lock_guard<std::mutex> lock(table_mu_);
+    free_files_.push_back(index);
+    return -1;
+  }
+  return index;
+}
+
+void IoUringReactor::UnregisterFile(int index) {
+  int fd = -1;
+  IoUringOp op;
+  op.opcode = IORING_OP_FILES_UPDATE;
+  op.buf = reinterpret_cast<char *>(&fd);
+  op.size = 1;
+  op.offset = index;
+  Submit(&op);
+  if (op.Wait() != 1) {
+    LOG(ERROR) << "Unregister fd from io_uring failed: "
+               << strerror(-op.result);
+    return;
+  }
+  std::lock_guard<std::mutex> lock(table_mu_);
+  free_files_.push_back(index);
+}
+
+bool IoUringReactor::SendFrame(int index, const char *buff, size_t size) {
+  uint64_t length = size;
+  IoUringOp op;
+  op.index = index;
+  op.msg_flags = MSG_NOSIGNAL;
+
+  int buf_index = -1;
+  if (sizeof(length) + size <= kBufferSize && fixed_send_.load())
+    buf_index = AcquireBuffer();
+  if (buf_index >= 0) {
+    char *slot = &buffer_pool_[buf_index * kBufferSize];
+    memcpy(slot, &length, sizeof(length));
+    if (size > 0)
+      memcpy(slot + sizeof(length), buff, size);
+    op.opcode = IORING_OP_SEND_ZC;
+    op.msg_flags |= MSG_WAITALL;
+    op.buf = slot;
+    op.size = sizeof(length) + size;
+    op.buf_index = buf_index;
+  } else {
+    op.opcode = IORING_OP_SENDMSG;
+    op.iov[0].iov_base = &length;
+    op.iov[0].iov_len = sizeof(length);
+    op.iov[1].iov_base = const_cast<char *>(buff);
+    op.iov[1].iov_len = size;
+    memset(&op.msg, 0, sizeof(op.msg));
+    op.msg.msg_iov = op.iov;
+    op.msg.msg_iovlen = size > 0 ? 2 : 1;
+    op.size = sizeof(length) + size;
+  }
+
+  Submit(&op);
+  int ret = op.Wait();
+  if (buf_index >= 0) {
+    // The reactor releases the buffer once the kernel is done with it.
+    if ((ret == -EOPNOTSUPP || ret == -EINVAL) && op.done == 0) {
+      // Nothing was sent, the socket can not send from registered buffers.
+      VLOG(1) << "io_uring fixed buffer send is not supported, "
+              << "use sendmsg instead.";
+      fixed_send_.store(false);
+      return SendFrame(index, buff, size);
+    }
+  }
+  if (ret < 0) {
+    LOG(ERROR) << "send failed: " << strerror(-ret);
+    return false;
+  }
+  return true;
+}
+
+bool IoUringReactor::RecvAll(int index, char *buff, size_t size) {
+  if (size == 0)
+    return true;
+  IoUringOp op;
+  op.opcode = IORING_OP_RECV;
+  op.index = index;
+  op.buf = buff;
+  op.size = size;
+  op.msg_flags = MSG_WAITALL;
+  Submit(&op);
+  int ret = op.Wait();
+  if (ret < 0) {
+    if (ret != -ECONNRESET)
+      LOG(ERROR) << "recv failed: " << strerror(-ret);
+    return false;
+  }
+  return true;
+}
+
+int IoUringReactor::AcquireBuffer() {
+  std::lock_guard<std::mutex> lock(table_mu_);
+  if (free_buffers_.empty())
+    return -1;
+  int index = free_buffers_.back();
+  free_buffers_.pop_back();
+  return index;
+}
+
+void IoUringReactor::ReleaseBuffer(int index) {
+  std::lock_guard<std::mutex> lock(table_mu_);
+  free_buffers_.push_back(index);
+}
+
+void IoUringReactor::Submit(IoUringOp *op) {
+  bool wake = false;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    pending_.push_back(op);
+    wake = sleeping_;
+    sleeping_ = false;
+  }
+  // Only a sleeping reactor needs the eventfd, a busy one picks the
+  // operation up before its next io_uring_enter.
+  if (wake) {
+    uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) < 0)
+      LOG(ERROR) << "Wake up io_uring reactor failed: " << strerror(errno);
+  }
+}
+
+bool IoUringReactor::Prepare(IoUringOp *op) {
+  unsigned tail = *sq_tail_;
+  if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_)
+    return false;
+
+  unsigned slot = tail & sq_mask_;
+  io_uring_sqe *sqe = static_cast<io_uring_sqe *>(sqes_) + slot;
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = op->opcode;
+  if (op->index >= 0) {
+    sqe->fd = op->index;
+    sqe->flags |= IOSQE_FIXED_FILE;
+  } else {
+    sqe->fd = op->fd;
+  }
+  switch (op->opcode) {
+  case IORING_OP_SENDMSG:
+    sqe->addr = reinterpret_cast<uint64_t>(&op->msg);
+    sqe->len = 1;
+    sqe->msg_flags = op->msg_flags;
+    break;
+  case IORING_OP_FILES_UPDATE:
+    sqe->fd = -1;
+    sqe->flags = 0;
+    sqe->addr = reinterpret_cast<uint64_t>(op->buf);
+    sqe->len = op->size;
+    sqe->off = op->offset;
+    break;
+  default:
+    sqe->addr = reinterpret_cast<uint64_t>(op->buf + op->done);
+    sqe->len = op->size - op->done;
+    sqe->msg_flags = op->msg_flags;
+#ifdef IORING_RECVSEND_FIXED_BUF
+    if (op->buf_index >= 0) {
+      sqe->ioprio = IORING_RECVSEND_FIXED_BUF;
+      sqe->buf_index = op->buf_index;
+    }
+#endif
+    break;
+  }
+  sqe->user_data = reinterpret_cast<uint64_t>(op);
+  if (op->buf_index >= 0) {
+    sqe->user_data = kFixedSendTag | op->buf_index;
+    zc_ops_[op->buf_index] = op;
+    zc_refs_[op->buf_index]++;
+  }
+
+  sq_array_[slot] = slot;
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+void IoUringReactor::Complete(IoUringOp *op, int res) {
+  std::lock_guard<std::mutex> lock(op->mu);
+  op->result = res;
+  op->finished = true;
+  // Notify under the lock, the waiter destroys op as soon as it sees it
+  // finished.
+  op->cv.notify_one();
+}
+
+bool IoUringReactor::Advance(IoUringOp *op, int res) {
+  if (op->opcode == IORING_OP_FILES_UPDATE || res < 0) {
+    op->result = res;
+    return false;
+  }
+  if (res == 0 && op->size > op->done) {
+    // The peer closed the connection.
+    op->result = -ECONNRESET;
+    return false;
+  }
+
+  op->done += res;
+  if (op->done >= op->size) {
+    op->result = static_cast<int>(std::min<size_t>(op->size, INT32_MAX));
+    return false;
+  }
+  if (op->opcode == IORING_OP_SENDMSG) {
+    size_t n = res;
+    while (n >= op->msg.msg_iov->iov_len) {
+      n -= op->msg.msg_iov->iov_len;
+      op->msg.msg_iov++;
+      op->msg.msg_iovlen--;
+    }
+    op->msg.msg_iov->iov_base =
+        static_cast<char *>(op->msg.msg_iov->iov_base) + n;
+    op->msg.msg_iov->iov_len -= n;
+  }
+  return true;
+}
+
+void IoUringReactor::Loop() {
+  IoUringOp wake_op;
+  wake_op.opcode = IORING_OP_READ;
+  wake_op.fd = wake_fd_;
+  wake_op.buf = reinterpret_cast<char *>(&wake_value_);
+  wake_op.size = sizeof(wake_value_);
+
+  std::deque<IoUringOp *> ready;
+  ready.push_back(&wake_op);
+  while (true) {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (stop_)
+        break;
+      ready.insert(ready.end(), pending_.begin(), pending_.end());
+      pending_.clear();
+    }
+    while (!ready.empty() && Prepare(ready.front()))
+      ready.pop_front();
+
+    // Sleep only if nothing is left to submit, a submitter seeing sleeping_
+    // wakes us through the eventfd read which is always in flight then.
+    unsigned min_complete = 0;
+    if (ready.empty()) {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (pending_.empty() && !stop_) {
+        sleeping_ = true;
+        min_complete = 1;
+      }
+    }
+    unsigned to_submit =
+        *sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    int ret = IoUringEnter(ring_fd_, to_submit, min_complete,
+                           IORING_ENTER_GETEVENTS);
+    if (min_complete > 0) {
+      std::lock_guard<std::mutex> lock(mu_);
+      sleeping_ = false;
+    }
+    if (ret < 0 && errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+      LOG(ERROR) << "io_uring_enter failed: " << strerror(errno);
+      continue;
+    }
+    if (ret > 0) {
+      enter_calls_++;
+      submitted_ops_ += ret;
+    }
+
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      auto cqe = static_cast<io_uring_cqe *>(cqes_) + (head & cq_mask_);
+      int res = cqe->res;
+      IoUringOp *op = nullptr;
+      int buf_index = -1;
+      if (cqe->user_data & kFixedSendTag) {
+        // A zero-copy send completes twice, the second completion notifies
+        // that the kernel is done with the registered buffer. The caller
+        // returns after the first one and the reactor frees the buffer.
+        buf_index = static_cast<int>(cqe->user_data & ~kFixedSendTag);
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+          zc_refs_[buf_index]--;
+        if (zc_refs_[buf_index] == 0 && zc_ops_[buf_index] == nullptr)
+          ReleaseBuffer(buf_index);
+        if (cqe->flags & IORING_CQE_F_NOTIF)
+          continue;
+        op = zc_ops_[buf_index];
+      } else {
+        op = reinterpret_cast<IoUringOp *>(cqe->user_data);
+      }
+
+      if (op == &wake_op || res == -EINTR || res == -EAGAIN) {
+        ready.push_back(op);
+        continue;
+      }
+      if (Advance(op, res)) {
+        ready.push_back(op);
+        continue;
+      }
+      if (buf_index >= 0) {
+        zc_ops_[buf_index] = nullptr;
+        if (zc_refs_[buf_index] == 0)
+          ReleaseBuffer(buf_index);
+      }
+      Complete(op, op->result);
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  }
+}
+} // namespace primihub::link
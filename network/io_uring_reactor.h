@@ -0,0 +1,113 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef NETWORK_IO_URING_REACTOR_H_
+#define NETWORK_IO_URING_REACTOR_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace primihub::link {
+struct IoUringOp;
+
+// IoUringReactor drives the socket I/O of a channel and all its forks with
+// one io_uring. Calling threads queue their operation and block until it
+// completes, the reactor thread submits everything queued since its last
+// wakeup with a single io_uring_enter, so the sends and recvs of many forks
+// share one syscall. Sockets are registered as fixed files and small frames
+// are sent from registered buffers with IORING_OP_SEND_ZC.
+class IoUringReactor {
+public:
+  // Returns nullptr if the kernel does not support io_uring or one of the
+  // operations used here, callers then fall back to plain syscalls.
+  static std::shared_ptr<IoUringReactor> Create();
+  ~IoUringReactor();
+
+  // Adds fd to the fixed file table, returns its index or -1.
+  int RegisterFile(int fd);
+  void UnregisterFile(int index);
+
+  // Sends an 8 byte length followed by size bytes from buff.
+  bool SendFrame(int index, const char *buff, size_t size);
+
+  // Receives exactly size bytes into buff.
+  bool RecvAll(int index, char *buff, size_t size);
+
+  // Number of io_uring_enter calls and of operations they submitted.
+  uint64_t enterCalls() const { return enter_calls_.load(); }
+  uint64_t submittedOps() const { return submitted_ops_.load(); }
+
+private:
+  IoUringReactor() = default;
+  bool Init();
+  void Loop();
+  void Submit(IoUringOp *op);
+  // Fills the next SQE for op, returns false if the ring is full.
+  bool Prepare(IoUringOp *op);
+  // Accounts res to op, returns true if op has to be submitted again.
+  bool Advance(IoUringOp *op, int res);
+  void Complete(IoUringOp *op, int res);
+  int AcquireBuffer();
+  void ReleaseBuffer(int index);
+
+  int ring_fd_{-1};
+  int wake_fd_{-1};
+  void *sq_ptr_{nullptr};
+  size_t sq_size_{0};
+  void *cq_ptr_{nullptr};
+  size_t cq_size_{0};
+  void *sqes_ptr_{nullptr};
+  size_t sqes_size_{0};
+
+  unsigned *sq_head_{nullptr};
+  unsigned *sq_tail_{nullptr};
+  unsigned sq_mask_{0};
+  unsigned sq_entries_{0};
+  unsigned *sq_array_{nullptr};
+  unsigned *cq_head_{nullptr};
+  unsigned *cq_tail_{nullptr};
+  unsigned cq_mask_{0};
+  void *cqes_{nullptr};
+  void *sqes_{nullptr};
+
+  std::thread loop_thread_;
+  std::mutex mu_;
+  std::deque<IoUringOp *> pending_;
+  bool sleeping_{false};
+  bool stop_{false};
+  uint64_t wake_value_{0};
+
+  std::mutex table_mu_;
+  std::vector<int> free_files_;
+  std::vector<int> free_buffers_;
+  std::vector<char> buffer_pool_;
+  std::atomic<bool> fixed_send_{true};
+  // Per registered buffer, the send using it and its outstanding zero-copy
+  // notifications. Only the reactor thread touches these.
+  std::vector<IoUringOp *> zc_ops_;
+  std::vector<int> zc_refs_;
+
+  std::atomic<uint64_t> enter_calls_{0};
+  std::atomic<uint64_t> submitted_ops_{0};
+};
+} // namespace primihub::link
+
+#endif // NETWORK_IO_URING_REACTOR_H_
@@ -15,18 +15,167 @@
  */
 #include "network/mem_channel.h"
 #include "common/threadsafe_queue.h"
+#include "network/ready_notifier.h"
+#include "network/trace.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
 #include <cstring>
+#include <deque>
 #include <iostream>
 #include <string_view>
 
 namespace primihub::link {
+// A receive buffer posted by RecvImpl(char*, size_t) while the queue of its
+// direction is empty. A sender claims it, copies into it without holding mu
+// and marks it filled. Every eager push notifies cv as well, so a posted
+// receiver takes a message queued before the next rendezvous from the queue.
+// The eager push also notifies the ReadyNotifier of a ChannelSelector
+// watching the receiving side.
+struct RendezvousSlot {
+  enum State { kIdle, kPosted, kClaimed, kFilled, kMismatch };
+
+  std::mutex mu;
+  std::condition_variable cv;
+  State state{kIdle};
+  char *buf{nullptr};
+  size_t size{0};
+  size_t actual_size{0};
+  std::shared_ptr<ReadyNotifier> notifier;
+};
+
+// Messages of one direction that went to the spill file, guarded by the mu
+// of the RendezvousSlot of the same direction so that a receiver waits for
+// queued and spilled messages alike on its cv. The file is unlinked and
+// starts over whenever the receiver caught up with it and no read is in
+// flight. Receivers copy a message out of the file without holding mu.
+struct SpillQueue {
+  // A message taken off the queue whose bytes are still in the file.
+  struct Record {
+    int fd;
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  ~SpillQueue() {
+    if (fd >= 0)
+      ::close(fd);
+  }
+
+  // Appends size bytes, returns false on I/O errors.
+  bool Append(const char *buff, size_t size);
+  // Takes the oldest message off the queue, the file keeps it until the
+  // matching EndRead.
+  Record TakeFront();
+  // Copies the message of record into dest, which holds record.size bytes.
+  // Does not need mu.
+  static bool Read(const Record &record, char *dest);
+  void EndRead();
+
+  std::atomic<size_t> threshold{0};
+  std::string dir;
+  // Bytes held by the in-memory queue of the direction.
+  size_t queued_bytes{0};
+  int fd{-1};
+  uint64_t write_offset{0};
+  uint64_t read_offset{0};
+  std::deque<uint64_t> sizes;
+  // sizes.size(), readable without mu.
+  std::atomic<uint64_t> pending{0};
+  // Records taken but not read yet.
+  size_t reading{0};
+};
+
+bool SpillQueue::Append(const char *buff, size_t size) {
+  if (fd < 0) {
+    fd = open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd < 0) {
+      std::string path = dir + "/mem_channel_spill_XXXXXX";
+      fd = mkostemp(&path[0], O_CLOEXEC);
+      if (fd >= 0)
+        unlink(path.c_str());
+    }
+    if (fd < 0) {
+      LOG(ERROR) << "create spill file in " << dir
+                 << " failed: " << strerror(errno);
+      return false;
+    }
+  }
+
+  size_t written = 0;
+  while (written < size) {
+    ssize_t ret =
+        pwrite(fd, buff + written, size - written, write_offset + written);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      LOG(ERROR) << "write spill file failed: " << strerror(errno);
+      return false;
+    }
+    written += ret;
+  }
+  write_offset += size;
+  sizes.push_back(size);
+  pending++;
+  return true;
+}
+
+SpillQueue::Record SpillQueue::TakeFront() {
+  Record record{fd, read_offset, sizes.front()};
+  read_offset += record.size;
+  sizes.pop_front();
+  pending--;
+  reading++;
+  return record;
+}
+
+bool SpillQueue::Read(const Record &record, char *dest) {
+  if (record.size == 0)
+    return true;
+
+  // Mapping the record copies it once, straight from the page cache.
+  static const uint64_t page_size = sysconf(_SC_PAGESIZE);
+  uint64_t begin = record.offset / page_size * page_size;
+  uint64_t map_size = record.offset + record.size - begin;
+  void *addr =
+      mmap(nullptr, map_size, PROT_READ, MAP_SHARED, record.fd, begin);
+  if (addr == MAP_FAILED) {
+    LOG(ERROR) << "map spill file failed: " << strerror(errno);
+    return false;
+  }
+  memcpy(dest, static_cast<char *>(addr) + (record.offset - begin),
+         record.size);
+  munmap(addr, map_size);
+  return true;
+}
+
+void SpillQueue::EndRead() {
+  reading--;
+  // Senders append behind the records being read, the file starts over
+  // only once nothing in it is needed any more.
+  if (sizes.empty() && reading == 0) {
+    if (ftruncate(fd, 0) != 0)
+      LOG(WARNING) << "truncate spill file failed: " << strerror(errno);
+    read_offset = 0;
+    write_offset = 0;
+  }
+}
+
 namespace {
 class QueuePair {
 public:
   QueuePair() {
     this->queue_c2s_ = std::make_shared<ThreadSafeQueue<std::string>>();
     this->queue_s2c_ = std::make_shared<ThreadSafeQueue<std::string>>();
+    this->rendezvous_c2s_ = std::make_shared<RendezvousSlot>();
+    this->rendezvous_s2c_ = std::make_shared<RendezvousSlot>();
+    this->spill_c2s_ = std::make_shared<SpillQueue>();
+    this->spill_s2c_ = std::make_shared<SpillQueue>();
   }
 
   ThreadSafeQueuePtr getQueue(bool c2s) {
@@ -36,9 +185,27 @@ public:
       return queue_s2c_;
   }
 
+  RendezvousSlotPtr getRendezvous(bool c2s) {
+    if (c2s)
+      return rendezvous_c2s_;
+    else
+      return rendezvous_s2c_;
+  }
+
+  SpillQueuePtr getSpill(bool c2s) {
+    if (c2s)
+      return spill_c2s_;
+    else
+      return spill_s2c_;
+  }
+
 private:
   ThreadSafeQueuePtr queue_c2s_;
   ThreadSafeQueuePtr queue_s2c_;
+  RendezvousSlotPtr rendezvous_c2s_;
+  RendezvousSlotPtr rendezvous_s2c_;
+  SpillQueuePtr spill_c2s_;
+  SpillQueuePtr spill_s2c_;
 };
 
 class QueueManager {
@@ -76,6 +243,10 @@ MemoryChannel::MemoryChannel(const std::string &key,
   std::shared_ptr<QueuePair> queue = manager.getOrCreate(this->key_);
   storage_c2s_ = queue->getQueue(true);
   storage_s2c_ = queue->getQueue(false);
+  rendezvous_c2s_ = queue->getRendezvous(true);
+  rendezvous_s2c_ = queue->getRendezvous(false);
+  spill_c2s_ = queue->getSpill(true);
+  spill_s2c_ = queue->getSpill(false);
 }
 
 void MemoryChannel::SetKey(const std::string &key) {
@@ -84,16 +255,211 @@ void MemoryChannel::SetKey(const std::string &key) {
   std::shared_ptr<QueuePair> queue = manager.getOrCreate(this->key_);
   storage_c2s_ = queue->getQueue(true);
   storage_s2c_ = queue->getQueue(false);
+  rendezvous_c2s_ = queue->getRendezvous(true);
+  rendezvous_s2c_ = queue->getRendezvous(false);
+  spill_c2s_ = queue->getSpill(true);
+  spill_s2c_ = queue->getSpill(false);
 }
 
-retcode MemoryChannel::SendImpl(std::string_view send_buff_sv) {
-  ThreadSafeQueuePtr storage = nullptr;
+ThreadSafeQueuePtr MemoryChannel::sendQueue() const {
   if (role_ == ChannelRole::SERVER)
-    storage = storage_s2c_;
+    return storage_s2c_;
   else
-    storage = storage_c2s_;
+    return storage_c2s_;
+}
+
+ThreadSafeQueuePtr MemoryChannel::recvQueue() const {
+  if (role_ == ChannelRole::SERVER)
+    return storage_c2s_;
+  else
+    return storage_s2c_;
+}
+
+void MemoryChannel::pushEager(std::string &&data) {
+  TraceInstant("enqueue", key_, data.size());
+  sendQueue()->push(std::move(data));
+  notifyReceiver();
+}
+
+void MemoryChannel::notifyReceiver() {
+  RendezvousSlotPtr slot =
+      role_ == ChannelRole::SERVER ? rendezvous_s2c_ : rendezvous_c2s_;
+  // Taking mu orders the push before a posted receiver's next check.
+  std::shared_ptr<ReadyNotifier> notifier;
+  {
+    std::lock_guard<std::mutex> lock(slot->mu);
+    notifier = slot->notifier;
+  }
+  slot->cv.notify_all();
+  if (notifier != nullptr)
+    notifier->Notify();
+}
+
+bool MemoryChannel::HasPendingData() {
+  SpillQueuePtr spill = role_ == ChannelRole::SERVER ? spill_c2s_ : spill_s2c_;
+  return !recvQueue()->empty() || (spill != nullptr && spill->pending > 0);
+}
+
+bool MemoryChannel::spillEnabled() const {
+  return spill_c2s_ != nullptr && spill_c2s_->threshold > 0;
+}
+
+void MemoryChannel::setSpillThreshold(size_t threshold,
+                                      const std::string &dir) {
+  std::pair<RendezvousSlotPtr, SpillQueuePtr> directions[] = {
+      {rendezvous_c2s_, spill_c2s_}, {rendezvous_s2c_, spill_s2c_}};
+  for (auto &direction : directions) {
+    std::lock_guard<std::mutex> lock(direction.first->mu);
+    direction.second->dir = dir;
+    direction.second->threshold = threshold;
+  }
+}
+
+bool MemoryChannel::trySpill(const char *buff, size_t size, bool *spilled) {
+  *spilled = false;
+  SpillQueuePtr spill = role_ == ChannelRole::SERVER ? spill_s2c_ : spill_c2s_;
+  size_t threshold = spill->threshold;
+  if (threshold == 0)
+    return true;
+
+  RendezvousSlotPtr slot =
+      role_ == ChannelRole::SERVER ? rendezvous_s2c_ : rendezvous_c2s_;
+  {
+    std::lock_guard<std::mutex> lock(slot->mu);
+    // Once spilling started every message goes to the file until the
+    // receiver drained it, so the messages stay in order.
+    if (spill->sizes.empty() && spill->queued_bytes < threshold) {
+      spill->queued_bytes += size;
+      return true;
+    }
+    if (!spill->Append(buff, size))
+      return false;
+  }
+  *spilled = true;
+  spilled_sends_++;
+  TraceInstant("spill", key_, size);
+  notifyReceiver();
+  return true;
+}
+
+retcode MemoryChannel::recvSpillable(std::string *recv_buf, char *dest,
+                                     size_t size, bool wait, bool *received) {
+  ThreadSafeQueuePtr storage = recvQueue();
+  RendezvousSlotPtr slot =
+      role_ == ChannelRole::SERVER ? rendezvous_c2s_ : rendezvous_s2c_;
+  SpillQueuePtr spill = role_ == ChannelRole::SERVER ? spill_c2s_ : spill_s2c_;
+  *received = false;
+
+  std::unique_lock<std::mutex> lock(slot->mu);
+  if (wait) {
+    TraceSpan span("wait", key_);
+    slot->cv.wait(
+        lock, [&]() { return !storage->empty() || !spill->sizes.empty(); });
+  }
+
+  // Everything queued in memory is older than the spill file.
+  std::string data_buf;
+  if (storage->try_pop(data_buf)) {
+    spill->queued_bytes -= std::min(spill->queued_bytes, data_buf.size());
+    lock.unlock();
+    *received = true;
+    TraceInstant("dequeue", key_, data_buf.size());
+    if (dest == nullptr) {
+      *recv_buf = std::move(data_buf);
+      return retcode::SUCCESS;
+    }
+    if (data_buf.size() != size) {
+      LOG(ERROR) << "data length does not match: "
+                 << " "
+                 << "expected: " << size << " "
+                 << "actually: " << data_buf.size();
+      return retcode::FAIL;
+    }
+    memcpy(dest, data_buf.data(), size);
+    return retcode::SUCCESS;
+  }
+  if (spill->sizes.empty())
+    return retcode::SUCCESS;
+
+  *received = true;
+  // Copy the message out of the file without blocking the sender.
+  SpillQueue::Record record = spill->TakeFront();
+  lock.unlock();
+  TraceInstant("dequeue", key_, record.size);
+  bool ok = true;
+  if (dest == nullptr) {
+    recv_buf->resize(record.size);
+    ok = SpillQueue::Read(record, &(*recv_buf)[0]);
+  } else if (record.size != size) {
+    LOG(ERROR) << "data length does not match: "
+               << " "
+               << "expected: " << size << " "
+               << "actually: " << record.size;
+    ok = false;
+  } else {
+    ok = SpillQueue::Read(record, dest);
+  }
+  lock.lock();
+  spill->EndRead();
+  return ok ? retcode::SUCCESS : retcode::FAIL;
+}
+
+void MemoryChannel::SetReadyNotifier(std::shared_ptr<ReadyNotifier> notifier) {
+  RendezvousSlotPtr slot =
+      role_ == ChannelRole::SERVER ? rendezvous_c2s_ : rendezvous_s2c_;
+  std::lock_guard<std::mutex> lock(slot->mu);
+  slot->notifier = std::move(notifier);
+}
 
-  storage->push(std::string(send_buff_sv.data(), send_buff_sv.size()));
+retcode MemoryChannel::TryRecvImpl(std::string *recv_buf, bool *received) {
+  if (spillEnabled())
+    return recvSpillable(recv_buf, nullptr, 0, false, received);
+  *received = recvQueue()->try_pop(*recv_buf);
+  return retcode::SUCCESS;
+}
+
+bool MemoryChannel::tryRendezvous(const char *buff, size_t size) {
+  RendezvousSlotPtr slot =
+      role_ == ChannelRole::SERVER ? rendezvous_s2c_ : rendezvous_c2s_;
+  std::unique_lock<std::mutex> lock(slot->mu);
+  // Queued messages come first, the posted receive belongs to the oldest.
+  SpillQueuePtr spill = role_ == ChannelRole::SERVER ? spill_s2c_ : spill_c2s_;
+  if (slot->state != RendezvousSlot::kPosted || !sendQueue()->empty() ||
+      !spill->sizes.empty())
+    return false;
+
+  if (slot->size != size) {
+    // Consumed like a queued message of the wrong size.
+    slot->state = RendezvousSlot::kMismatch;
+    slot->actual_size = size;
+    lock.unlock();
+    slot->cv.notify_all();
+    return true;
+  }
+
+  slot->state = RendezvousSlot::kClaimed;
+  char *dest = slot->buf;
+  lock.unlock();
+  memcpy(dest, buff, size);
+  lock.lock();
+  slot->state = RendezvousSlot::kFilled;
+  lock.unlock();
+  slot->cv.notify_all();
+  rendezvous_sends_++;
+  return true;
+}
+
+retcode MemoryChannel::SendImpl(std::string_view send_buff_sv) {
+  TraceSpan span("MemoryChannel::SendImpl", key_, send_buff_sv.size());
+  if (rendezvous_threshold_ == 0 ||
+      send_buff_sv.size() < rendezvous_threshold_ ||
+      !tryRendezvous(send_buff_sv.data(), send_buff_sv.size())) {
+    bool spilled = false;
+    if (!trySpill(send_buff_sv.data(), send_buff_sv.size(), &spilled))
+      return retcode::FAIL;
+    if (!spilled)
+      pushEager(std::string(send_buff_sv.data(), send_buff_sv.size()));
+  }
 
   if (VLOG_IS_ON(8)) {
     std::string send_data;
@@ -119,7 +485,32 @@ retcode MemoryChannel::SendImpl(const char *buff, size_t size) {
   return SendImpl(send_sv);
 }
 
+retcode MemoryChannel::SendImpl(std::string &&send_buf) {
+  TraceSpan span("MemoryChannel::SendImpl", key_, send_buf.size());
+  if (VLOG_IS_ON(8)) {
+    LOG(INFO) << "MemoryChannel::SendImpl "
+              << "send_key: " << key_ << " "
+              << "data size: " << send_buf.size();
+  }
+
+  // Moving into the queue costs no copy, the receiver copies once.
+  bool spilled = false;
+  if (!trySpill(send_buf.data(), send_buf.size(), &spilled))
+    return retcode::FAIL;
+  if (!spilled)
+    pushEager(std::move(send_buf));
+  return retcode::SUCCESS;
+}
+
 retcode MemoryChannel::RecvImpl(std::string *recv_buf) {
+  TraceSpan span("MemoryChannel::RecvImpl", key_);
+  if (spillEnabled()) {
+    bool received = false;
+    retcode ret = recvSpillable(recv_buf, nullptr, 0, true, &received);
+    span.setBytes(recv_buf->size());
+    return ret;
+  }
+
   ThreadSafeQueuePtr storage = nullptr;
   if (role_ == ChannelRole::SERVER)
     storage = storage_c2s_;
@@ -127,7 +518,12 @@ retcode MemoryChannel::RecvImpl(std::string *recv_buf) {
     storage = storage_s2c_;
 
   std::string data_buf;
-  storage->wait_and_pop(data_buf);
+  {
+    TraceSpan wait("wait", key_);
+    storage->wait_and_pop(data_buf);
+  }
+  TraceInstant("dequeue", key_, data_buf.size());
+  span.setBytes(data_buf.size());
   *recv_buf = std::move(data_buf);
 
   if (VLOG_IS_ON(8)) {
@@ -145,14 +541,63 @@ retcode MemoryChannel::RecvImpl(std::string *recv_buf) {
 }
 
 retcode MemoryChannel::RecvImpl(char *recv_buf, size_t recv_size) {
-  ThreadSafeQueuePtr storage = nullptr;
-  if (role_ == ChannelRole::SERVER)
-    storage = storage_c2s_;
-  else
-    storage = storage_s2c_;
+  TraceSpan span("MemoryChannel::RecvImpl", key_, recv_size);
+  ThreadSafeQueuePtr storage = recvQueue();
+  RendezvousSlotPtr slot =
+      role_ == ChannelRole::SERVER ? rendezvous_c2s_ : rendezvous_s2c_;
+  SpillQueuePtr spill = role_ == ChannelRole::SERVER ? spill_c2s_ : spill_s2c_;
+
+  // Post recv_buf if nothing is queued, a large message is then copied into
+  // it directly. A concurrent receive that finds the slot taken waits on the
+  // queue.
+  std::unique_lock<std::mutex> lock(slot->mu);
+  if (slot->state == RendezvousSlot::kIdle && storage->empty() &&
+      spill->sizes.empty()) {
+    slot->state = RendezvousSlot::kPosted;
+    slot->buf = recv_buf;
+    slot->size = recv_size;
+    {
+      TraceSpan wait("wait", key_);
+      slot->cv.wait(lock, [&]() {
+        return slot->state == RendezvousSlot::kFilled ||
+               slot->state == RendezvousSlot::kMismatch ||
+               (slot->state == RendezvousSlot::kPosted && !storage->empty());
+      });
+    }
+
+    RendezvousSlot::State state = slot->state;
+    slot->state = RendezvousSlot::kIdle;
+    slot->buf = nullptr;
+    if (state == RendezvousSlot::kMismatch) {
+      LOG(ERROR) << "data length does not match: "
+                 << " "
+                 << "expected: " << recv_size << " "
+                 << "actually: " << slot->actual_size;
+      return retcode::FAIL;
+    }
+    if (state == RendezvousSlot::kFilled) {
+      TraceInstant("dequeue", key_, recv_size);
+      if (VLOG_IS_ON(8)) {
+        LOG(INFO) << "MemoryChannel::RecvImpl "
+                  << "recv_key: " << key_ << " "
+                  << "data size: " << recv_size << " (rendezvous)";
+      }
+      return retcode::SUCCESS;
+    }
+  }
+  lock.unlock();
+
+  if (spillEnabled()) {
+    bool received = false;
+    return recvSpillable(nullptr, recv_buf, recv_size, true, &received);
+  }
 
   std::string tmp_recv_buf;
-  storage->wait_and_pop(tmp_recv_buf);
+  {
+    TraceSpan wait("wait", key_);
+    storage->wait_and_pop(tmp_recv_buf);
+  }
+  TraceInstant("dequeue", key_, tmp_recv_buf.size());
   if (tmp_recv_buf.size() != recv_size) {
     LOG(ERROR) << "data length does not match: "
                << " "
@@ -179,11 +624,40 @@ retcode MemoryChannel::RecvImpl(char *recv_buf, size_t recv_size) {
 }
 
 std::shared_ptr<ChannelBase> MemoryChannel::ForkImpl(const std::string &key) {
-  return std::make_shared<MemoryChannel>(key, this->role_);
+  auto channel = std::make_shared<MemoryChannel>(key, this->role_);
+  channel->setRendezvousThreshold(rendezvous_threshold_);
+  if (spillEnabled())
+    channel->setSpillThreshold(spill_c2s_->threshold, spill_c2s_->dir);
+  return channel;
 }
 
 void MemoryChannel::close() {}
 
 void MemoryChannel::cancel() {}
 
+
+retcode MemoryChannel::ProbeImpl(uint64_t *size, bool wait, bool *available) {
+  ThreadSafeQueuePtr storage = recvQueue();
+  RendezvousSlotPtr slot =
+      role_ == ChannelRole::SERVER ? rendezvous_c2s_ : rendezvous_s2c_;
+  SpillQueuePtr spill = role_ == ChannelRole::SERVER ? spill_c2s_ : spill_s2c_;
+
+  // Every eager push and spill notifies cv, a probe never posts a buffer so
+  // large messages are queued while it waits.
+  std::unique_lock<std::mutex> lock(slot->mu);
+  if (wait) {
+    TraceSpan span("wait", key_);
+    slot->cv.wait(
+        lock, [&]() { return !storage->empty() || !spill->sizes.empty(); });
+  }
+  // Everything queued in memory is older than the spill file.
+  *available = storage->peek(
+      [&](const std::string &message) { *size = message.size(); });
+  if (!*available && !spill->sizes.empty()) {
+    *size = spill->sizes.front();
+    *available = true;
+  }
+  return retcode::SUCCESS;
+}
+
 } // namespace primihub::link
@@ -19,12 +19,28 @@
 #include "common/threadsafe_queue.h"
 #include "network/base_channel.h"
 
+#include <atomic>
 #include <map>
 #include <mutex>
 #include <string_view>
 
 namespace primihub::link {
 using ThreadSafeQueuePtr = std::shared_ptr<ThreadSafeQueue<std::string>>;
+struct RendezvousSlot;
+using RendezvousSlotPtr = std::shared_ptr<RendezvousSlot>;
+struct SpillQueue;
+using SpillQueuePtr = std::shared_ptr<SpillQueue>;
+
+// MemoryChannel passes messages between threads of one process. Messages
+// are queued (eager), except that a message of at least the rendezvous
+// threshold is copied straight into the buffer of a RecvImpl(char*, size_t)
+// that is already waiting for it, so it is copied once instead of twice.
+//
+// With spilling enabled, messages sent while the queue of their direction
+// holds at least the spill threshold bytes are appended to an unlinked file
+// instead, and read back in order once the queue drained. A receiver that
+// falls far behind then costs disk space rather than memory, and the sender
+// never blocks.
 class MemoryChannel : public ChannelBase {
 public:
   enum ChannelRole {
@@ -32,21 +48,67 @@ public:
     CLIENT 
   };
 
+  static constexpr size_t kDefaultRendezvousThreshold = 64 * 1024;
+  static constexpr const char *kDefaultSpillDir = "/tmp";
+
   MemoryChannel(ChannelRole role);
   MemoryChannel(const std::string &key, ChannelRole role);
   retcode SendImpl(const std::string &send_buf) override;
   retcode SendImpl(std::string_view send_buff_sv) override;
   retcode SendImpl(const char *buff, size_t size) override;
+  retcode SendImpl(std::string &&send_buf) override;
   retcode RecvImpl(std::string *recv_buf) override;
   retcode RecvImpl(char *recv_buf, size_t recv_size) override;
+  retcode ProbeImpl(uint64_t *size, bool wait, bool *available) override;
   std::shared_ptr<ChannelBase> ForkImpl(const std::string &key) override;
   void SetKey(const std::string &key) override;
+  bool HasPendingData() override;
+  void SetReadyNotifier(std::shared_ptr<ReadyNotifier> notifier) override;
+  retcode TryRecvImpl(std::string *recv_buf, bool *received) override;
   void close() override;
   void cancel() override;
 
+  // 0 disables rendezvous sends, forks inherit the threshold.
+  void setRendezvousThreshold(size_t threshold) {
+    rendezvous_threshold_ = threshold;
+  }
+  // Number of messages this channel copied into a posted receive buffer.
+  uint64_t rendezvousSends() const { return rendezvous_sends_.load(); }
+
+  // Enables spilling for both directions of this channel's key, 0 disables
+  // it. Set it before any message is sent, forks inherit it.
+  void setSpillThreshold(size_t threshold,
+                         const std::string &dir = kDefaultSpillDir);
+  // Number of messages this channel wrote to its spill file.
+  uint64_t spilledSends() const { return spilled_sends_.load(); }
+
 private:
+  ThreadSafeQueuePtr sendQueue() const;
+  ThreadSafeQueuePtr recvQueue() const;
+  // Queues data and wakes up a receiver waiting in a posted receive.
+  void pushEager(std::string &&data);
+  // Copies size bytes into a posted receive buffer, returns false if no
+  // receive is posted and the message has to be queued.
+  bool tryRendezvous(const char *buff, size_t size);
+  // Appends the message to the spill file if the queue is over the spill
+  // threshold, otherwise accounts it to the queue. Fails on I/O errors.
+  bool trySpill(const char *buff, size_t size, bool *spilled);
+  // Receives the next message from the queue or else the spill file, into
+  // recv_buf or, if dest is set, into the size bytes at dest.
+  retcode recvSpillable(std::string *recv_buf, char *dest, size_t size,
+                        bool wait, bool *received);
+  bool spillEnabled() const;
+  void notifyReceiver();
+
   ThreadSafeQueuePtr storage_c2s_;
   ThreadSafeQueuePtr storage_s2c_;
+  RendezvousSlotPtr rendezvous_c2s_;
+  RendezvousSlotPtr rendezvous_s2c_;
+  SpillQueuePtr spill_c2s_;
+  SpillQueuePtr spill_s2c_;
+  size_t rendezvous_threshold_{kDefaultRendezvousThreshold};
+  std::atomic<uint64_t> rendezvous_sends_{0};
+  std::atomic<uint64_t> spilled_sends_{0};
   std::string key_{"default"};
   ChannelRole role_;
 };
@@ -0,0 +1,185 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "network/multi_producer_channel.h"
+
+#include <chrono>
+#include <utility>
+
+namespace primihub::link {
+namespace {
+// Threads get consecutive indices, so up to lanes threads never share one.
+size_t ThreadIndex() {
+  static std::atomic<size_t> next{0};
+  thread_local size_t index = next++;
+  return index;
+}
+} // namespace
+
+MultiProducerChannel::MultiProducerChannel(std::shared_ptr<ChannelBase> inner)
+    : MultiProducerChannel(std::move(inner), Options()) {}
+
+MultiProducerChannel::MultiProducerChannel(std::shared_ptr<ChannelBase> inner,
+                                           const Options &options)
+    : ForwardingChannel(std::move(inner)), options_(options) {
+  if (options_.lanes == 0)
+    options_.lanes = 1;
+  lanes_ = std::make_unique<Lane[]>(options_.lanes);
+}
+
+MultiProducerChannel::~MultiProducerChannel() { flush(); }
+
+std::shared_ptr<ChannelBase>
+MultiProducerChannel::ForkImpl(const std::string &key) {
+  auto inner = inner_->ForkImpl(key);
+  if (inner == nullptr)
+    return nullptr;
+  return std::make_shared<MultiProducerChannel>(std::move(inner), options_);
+}
+
+retcode MultiProducerChannel::SendImpl(const std::string &send_buf) {
+  return Enqueue(std::string(send_buf));
+}
+
+retcode MultiProducerChannel::SendImpl(std::string_view send_buff_sv) {
+  return Enqueue(std::string(send_buff_sv));
+}
+
+retcode MultiProducerChannel::SendImpl(const char *buff, size_t size) {
+  return Enqueue(std::string(buff, size));
+}
+
+retcode MultiProducerChannel::SendImpl(std::string &&send_buf) {
+  return Enqueue(std::move(send_buf));
+}
+
+retcode MultiProducerChannel::Enqueue(std::string &&data) {
+  if (failed_ || cancelled_)
+    return retcode::FAIL;
+  size_t size = data.size();
+  Lane &lane = lanes_[ThreadIndex() % options_.lanes];
+  {
+    std::lock_guard<std::mutex> lock(lane.mu);
+    // Taken under the lane lock, so a shared lane stays in sequence order.
+    uint64_t seq = options_.ordered ? next_seq_++ : 0;
+    lane.messages.push_back(Message{seq, std::move(data)});
+  }
+  queued_bytes_ += size;
+  enqueued_++;
+  Combine();
+
+  // Back pressure: the thread draining may be slower than the producers.
+  while (queued_bytes_.load() > options_.max_queued_bytes && !failed_ &&
+         !cancelled_) {
+    std::unique_lock<std::mutex> lock(done_mu_);
+    done_cv_.wait_for(lock, std::chrono::milliseconds(1));
+    lock.unlock();
+    Combine();
+  }
+  return failed_ ? retcode::FAIL : retcode::SUCCESS;
+}
+
+void MultiProducerChannel::Combine() {
+  while (drained_.load() != enqueued_.load()) {
+    // The thread holding the lock checks again after releasing it, so a
+    // message queued meanwhile is not left behind.
+    if (!combine_mu_.try_lock())
+      return;
+    Drain();
+    combine_mu_.unlock();
+    done_cv_.notify_all();
+  }
+}
+
+void MultiProducerChannel::Drain() {
+  drains_++;
+  for (size_t i = 0; i < options_.lanes; i++) {
+    Lane &lane = lanes_[i];
+    std::lock_guard<std::mutex> lock(lane.mu);
+    for (auto &message : lane.messages)
+      batch_.push_back(std::move(message));
+    lane.messages.clear();
+  }
+  drained_ += batch_.size();
+
+  if (!options_.ordered) {
+    for (auto &message : batch_)
+      Send(std::move(message.data));
+    batch_.clear();
+    return;
+  }
+  // A gap is a message whose sender took its number but has not queued it
+  // yet, it sends the rest once it did.
+  for (auto &message : batch_)
+    reorder_.emplace(message.seq, std::move(message.data));
+  batch_.clear();
+  while (!reorder_.empty() && reorder_.begin()->first == next_emit_) {
+    Send(std::move(reorder_.begin()->second));
+    reorder_.erase(reorder_.begin());
+    next_emit_++;
+  }
+}
+
+void MultiProducerChannel::Send(std::string &&data) {
+  size_t size = data.size();
+  if (!failed_ && !cancelled_ &&
+      inner_->SendImpl(std::move(data)) != retcode::SUCCESS) {
+    LOG(ERROR) << "multi-producer send failed, dropping the queued messages.";
+    failed_ = true;
+  }
+  queued_bytes_ -= size;
+  sent_++;
+}
+
+retcode MultiProducerChannel::flush() {
+  uint64_t target = enqueued_.load();
+  while (true) {
+    Combine();
+    if (sent_.load() >= target || failed_ || cancelled_)
+      break;
+    std::unique_lock<std::mutex> lock(done_mu_);
+    done_cv_.wait_for(lock, std::chrono::milliseconds(1));
+  }
+  return failed_ || cancelled_ ? retcode::FAIL : retcode::SUCCESS;
+}
+
+retcode MultiProducerChannel::RecvImpl(std::string *recv_buf) {
+  return inner_->RecvImpl(recv_buf);
+}
+
+retcode MultiProducerChannel::RecvImpl(char *recv_buf, size_t recv_size) {
+  return inner_->RecvImpl(recv_buf, recv_size);
+}
+
+retcode MultiProducerChannel::RecvImpl(const MutableStridedView &view) {
+  return inner_->RecvImpl(view);
+}
+
+retcode MultiProducerChannel::TryRecvImpl(std::string *recv_buf,
+                                          bool *received) {
+  return inner_->TryRecvImpl(recv_buf, received);
+}
+
+void MultiProducerChannel::close() {
+  flush();
+  inner_->close();
+}
+
+void MultiProducerChannel::cancel() {
+  cancelled_ = true;
+  done_cv_.notify_all();
+  inner_->cancel();
+}
+} // namespace primihub::link
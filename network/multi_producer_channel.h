@@ -0,0 +1,117 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef NETWORK_MULTI_PRODUCER_CHANNEL_H_
+#define NETWORK_MULTI_PRODUCER_CHANNEL_H_
+
+#include "network/base_channel.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+namespace primihub::link {
+// MultiProducerChannel lets many threads send on one transport without
+// serializing on its send lock. Each sending thread appends to its own
+// sub-lane, and whichever thread finds the transport idle drains all lanes
+// into it, so the transport sees one sender at a time and producers mostly
+// touch only their own lane.
+//
+// Messages of one thread keep their order. With ordered set, every message
+// takes a sequence number when it is sent and leaves in that order across
+// all threads. Sends return once the message is queued, a failure of the
+// transport fails all later sends and flush().
+class MultiProducerChannel : public ForwardingChannel {
+public:
+  struct Options {
+    // Sub-lanes, threads beyond this share them.
+    size_t lanes{32};
+    bool ordered{false};
+    // Senders wait while this many bytes are queued.
+    size_t max_queued_bytes{64 * 1024 * 1024};
+  };
+
+  explicit MultiProducerChannel(std::shared_ptr<ChannelBase> inner);
+  MultiProducerChannel(std::shared_ptr<ChannelBase> inner,
+                       const Options &options);
+  ~MultiProducerChannel() override;
+
+  retcode SendImpl(const std::string &send_buf) override;
+  retcode SendImpl(std::string_view send_buff_sv) override;
+  retcode SendImpl(const char *buff, size_t size) override;
+  retcode SendImpl(std::string &&send_buf) override;
+  retcode RecvImpl(std::string *recv_buf) override;
+  retcode RecvImpl(char *recv_buf, size_t recv_size) override;
+  retcode RecvImpl(const MutableStridedView &view) override;
+  retcode TryRecvImpl(std::string *recv_buf, bool *received) override;
+  std::shared_ptr<ChannelBase> ForkImpl(const std::string &key) override;
+  // Flushes before closing the transport.
+  void close() override;
+  void cancel() override;
+
+  // Waits until every message queued before the call reached the
+  // transport, fails if one of them or an earlier one failed.
+  retcode flush();
+
+  // Messages handed to the transport, and the drains that sent them.
+  uint64_t sentMessages() const { return sent_.load(); }
+  uint64_t drains() const { return drains_.load(); }
+
+private:
+  struct Message {
+    uint64_t seq;
+    std::string data;
+  };
+  struct alignas(64) Lane {
+    std::mutex mu;
+    std::deque<Message> messages;
+  };
+
+  retcode Enqueue(std::string &&data);
+  // Drains the lanes unless another thread is doing so, and again while
+  // messages were queued during the drain.
+  void Combine();
+  // Must hold combine_mu_.
+  void Drain();
+  void Send(std::string &&data);
+
+  Options options_;
+  std::unique_ptr<Lane[]> lanes_;
+  std::atomic<uint64_t> next_seq_{0};
+  std::atomic<uint64_t> enqueued_{0};
+  std::atomic<uint64_t> drained_{0};
+  std::atomic<uint64_t> sent_{0};
+  std::atomic<uint64_t> drains_{0};
+  std::atomic<size_t> queued_bytes_{0};
+  std::atomic<bool> failed_{false};
+  std::atomic<bool> cancelled_{false};
+
+  std::mutex combine_mu_;
+  // Guarded by combine_mu_.
+  std::vector<Message> batch_;
+  std::map<uint64_t, std::string> reorder_;
+  uint64_t next_emit_{0};
+
+  std::mutex done_mu_;
+  std::condition_variable done_cv_;
+};
+} // namespace primihub::link
+
+#endif // NETWORK_MULTI_PRODUCER_CHANNEL_H_
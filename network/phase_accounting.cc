@@ -0,0 +1,301 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "network/phase_accounting.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+namespace primihub::link {
+namespace {
+uint64_t ElapsedUs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+void AppendRow(std::string *out, const PhaseStats &stats) {
+  char row[256];
+  snprintf(row, sizeof(row),
+           "%-28s %8llu %10llu %14llu %10llu %14llu %12.3f\n",
+           stats.label.c_str(),
+           static_cast<unsigned long long>(stats.rounds),
+           static_cast<unsigned long long>(stats.messages_sent),
+           static_cast<unsigned long long>(stats.bytes_sent),
+           static_cast<unsigned long long>(stats.messages_received),
+           static_cast<unsigned long long>(stats.bytes_received),
+           stats.recv_blocked_us / 1000.0);
+  out->append(row);
+}
+} // namespace
+
+thread_local std::unordered_map<const PhaseAccounting *,
+                                std::vector<PhaseAccounting::ScopeState *>>
+    PhaseAccounting::thread_scopes_;
+
+PhaseAccounting::PhaseAccounting() {
+  counters_.emplace_back(std::make_unique<Counters>(kNoPhase));
+  scopes_.emplace_back(std::make_unique<ScopeState>());
+  scopes_.front()->counters.store(counters_.front().get());
+  current_.store(scopes_.front().get());
+}
+
+PhaseAccounting::Counters *PhaseAccounting::Find(const std::string &label) {
+  for (auto &counters : counters_) {
+    if (counters->label == label)
+      return counters.get();
+  }
+  counters_.emplace_back(std::make_unique<Counters>(label));
+  return counters_.back().get();
+}
+
+PhaseAccounting::ScopeState *
+PhaseAccounting::Enter(const std::string &label) {
+  std::lock_guard<std::mutex> lock(mu_);
+  ScopeState *scope = nullptr;
+  if (free_scopes_.empty()) {
+    scopes_.emplace_back(std::make_unique<ScopeState>());
+    scope = scopes_.back().get();
+  } else {
+    scope = free_scopes_.back();
+    free_scopes_.pop_back();
+  }
+  scope->counters.store(Find(label));
+  scope->id.store(next_id_++);
+  // The first receive of a phase starts its first round.
+  scope->sent_since_recv.store(true);
+  thread_scopes_[this].push_back(scope);
+  active_.push_back(scope);
+  current_.store(scope);
+  return scope;
+}
+
+void PhaseAccounting::Exit(ScopeState *scope) {
+  std::lock_guard<std::mutex> lock(mu_);
+  auto stacks = thread_scopes_.find(this);
+  if (stacks != thread_scopes_.end()) {
+    auto &stack = stacks->second;
+    auto it = std::find(stack.rbegin(), stack.rend(), scope);
+    if (it != stack.rend())
+      stack.erase(std::next(it).base());
+    if (stack.empty())
+      thread_scopes_.erase(stacks);
+    else
+      stack.back()->sent_since_recv.store(true);
+  }
+  // Scopes of different threads need not end in order.
+  auto it = std::find(active_.rbegin(), active_.rend(), scope);
+  if (it != active_.rend())
+    active_.erase(std::next(it).base());
+  // Channels that still point at the scope see that it ended.
+  scope->id.store(0);
+  free_scopes_.push_back(scope);
+  ScopeState *current = active_.empty() ? scopes_.front().get() : active_.back();
+  current->sent_since_recv.store(true);
+  current_.store(current);
+}
+
+PhaseAccounting::ScopeState *PhaseAccounting::Current(ScopeHint *hint) const {
+  if (!thread_scopes_.empty()) {
+    auto stacks = thread_scopes_.find(this);
+    if (stacks != thread_scopes_.end()) {
+      ScopeState *scope = stacks->second.back();
+      hint->scope.store(scope, std::memory_order_relaxed);
+      hint->id.store(scope->id.load(std::memory_order_relaxed),
+                     std::memory_order_relaxed);
+      return scope;
+    }
+  }
+  ScopeState *scope = hint->scope.load(std::memory_order_relaxed);
+  if (scope != nullptr) {
+    uint64_t id = hint->id.load(std::memory_order_relaxed);
+    if (id != 0 && scope->id.load(std::memory_order_relaxed) == id)
+      return scope;
+  }
+  return current_.load(std::memory_order_relaxed);
+}
+
+void PhaseAccounting::OnSend(size_t size, ScopeHint *hint) {
+  ScopeState *scope = Current(hint);
+  Counters *counters = scope->counters.load(std::memory_order_relaxed);
+  counters->messages_sent.fetch_add(1, std::memory_order_relaxed);
+  counters->bytes_sent.fetch_add(size, std::memory_order_relaxed);
+  scope->sent_since_recv.store(true, std::memory_order_relaxed);
+}
+
+void PhaseAccounting::OnRecv(size_t size, uint64_t blocked_us,
+                             ScopeHint *hint) {
+  ScopeState *scope = Current(hint);
+  Counters *counters = scope->counters.load(std::memory_order_relaxed);
+  if (scope->sent_since_recv.exchange(false, std::memory_order_relaxed))
+    counters->rounds.fetch_add(1, std::memory_order_relaxed);
+  counters->messages_received.fetch_add(1, std::memory_order_relaxed);
+  counters->bytes_received.fetch_add(size, std::memory_order_relaxed);
+  counters->recv_blocked_us.fetch_add(blocked_us, std::memory_order_relaxed);
+}
+
+PhaseStats PhaseAccounting::Snapshot(const Counters &counters) {
+  PhaseStats stats;
+  stats.label = counters.label;
+  stats.rounds = counters.rounds.load();
+  stats.messages_sent = counters.messages_sent.load();
+  stats.bytes_sent = counters.bytes_sent.load();
+  stats.messages_received = counters.messages_received.load();
+  stats.bytes_received = counters.bytes_received.load();
+  stats.recv_blocked_us = counters.recv_blocked_us.load();
+  return stats;
+}
+
+std::vector<PhaseStats> PhaseAccounting::phases() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  std::vector<PhaseStats> result;
+  for (const auto &counters : counters_) {
+    PhaseStats stats = Snapshot(*counters);
+    if (counters == counters_.front() && stats.messages_sent == 0 &&
+        stats.messages_received == 0)
+      continue;
+    result.push_back(std::move(stats));
+  }
+  return result;
+}
+
+PhaseStats PhaseAccounting::phase(const std::string &label) const {
+  std::lock_guard<std::mutex> lock(mu_);
+  for (const auto &counters : counters_) {
+    if (counters->label == label)
+      return Snapshot(*counters);
+  }
+  PhaseStats stats;
+  stats.label = label;
+  return stats;
+}
+
+std::string PhaseAccounting::report() const {
+  std::string out;
+  char header[256];
+  snprintf(header, sizeof(header),
+           "%-28s %8s %10s %14s %10s %14s %12s\n", "phase", "rounds",
+           "msgs sent", "bytes sent", "msgs recv", "bytes recv",
+           "blocked ms");
+  out.append(header);
+  PhaseStats total;
+  total.label = "total";
+  for (const auto &stats : phases()) {
+    AppendRow(&out, stats);
+    total.rounds += stats.rounds;
+    total.messages_sent += stats.messages_sent;
+    total.bytes_sent += stats.bytes_sent;
+    total.messages_received += stats.messages_received;
+    total.bytes_received += stats.bytes_received;
+    total.recv_blocked_us += stats.recv_blocked_us;
+  }
+  AppendRow(&out, total);
+  return out;
+}
+
+void PhaseAccounting::reset() {
+  std::lock_guard<std::mutex> lock(mu_);
+  for (auto &counters : counters_) {
+    counters->rounds = 0;
+    counters->messages_sent = 0;
+    counters->bytes_sent = 0;
+    counters->messages_received = 0;
+    counters->bytes_received = 0;
+    counters->recv_blocked_us = 0;
+  }
+  for (auto &scope : scopes_)
+    scope->sent_since_recv.store(true);
+}
+
+PhaseScope::PhaseScope(PhaseAccounting &accounting, const std::string &label)
+    : accounting_(accounting), scope_(accounting.Enter(label)) {}
+
+PhaseScope::~PhaseScope() { accounting_.Exit(scope_); }
+
+PhaseChannel::PhaseChannel(std::shared_ptr<ChannelBase> inner,
+                           std::shared_ptr<PhaseAccounting> accounting)
+    : ForwardingChannel(std::move(inner)), accounting_(std::move(accounting)) {}
+
+std::shared_ptr<ChannelBase> PhaseChannel::ForkImpl(const std::string &key) {
+  auto inner = inner_->ForkImpl(key);
+  if (inner == nullptr)
+    return nullptr;
+  return std::make_shared<PhaseChannel>(std::move(inner), accounting_);
+}
+
+retcode PhaseChannel::SendImpl(const std::string &send_buf) {
+  accounting_->OnSend(send_buf.size(), &scope_hint_);
+  return inner_->SendImpl(send_buf);
+}
+
+retcode PhaseChannel::SendImpl(std::string_view send_buff_sv) {
+  accounting_->OnSend(send_buff_sv.size(), &scope_hint_);
+  return inner_->SendImpl(send_buff_sv);
+}
+
+retcode PhaseChannel::SendImpl(const char *buff, size_t size) {
+  accounting_->OnSend(size, &scope_hint_);
+  return inner_->SendImpl(buff, size);
+}
+
+retcode PhaseChannel::SendImpl(std::string &&send_buf) {
+  accounting_->OnSend(send_buf.size(), &scope_hint_);
+  return inner_->SendImpl(std::move(send_buf));
+}
+
+retcode PhaseChannel::SendImpl(const char *buff, size_t size,
+                               std::shared_ptr<const void> keepalive) {
+  accounting_->OnSend(size, &scope_hint_);
+  return inner_->SendImpl(buff, size, std::move(keepalive));
+}
+
+retcode PhaseChannel::SendImpl(const StridedView &view) {
+  accounting_->OnSend(view.size(), &scope_hint_);
+  return inner_->SendImpl(view);
+}
+
+retcode PhaseChannel::RecvImpl(std::string *recv_buf) {
+  auto start = std::chrono::steady_clock::now();
+  retcode ret = inner_->RecvImpl(recv_buf);
+  if (ret == retcode::SUCCESS)
+    accounting_->OnRecv(recv_buf->size(), ElapsedUs(start), &scope_hint_);
+  return ret;
+}
+
+retcode PhaseChannel::RecvImpl(char *recv_buf, size_t recv_size) {
+  auto start = std::chrono::steady_clock::now();
+  retcode ret = inner_->RecvImpl(recv_buf, recv_size);
+  if (ret == retcode::SUCCESS)
+    accounting_->OnRecv(recv_size, ElapsedUs(start), &scope_hint_);
+  return ret;
+}
+
+retcode PhaseChannel::RecvImpl(const MutableStridedView &view) {
+  auto start = std::chrono::steady_clock::now();
+  retcode ret = inner_->RecvImpl(view);
+  if (ret == retcode::SUCCESS)
+    accounting_->OnRecv(view.size(), ElapsedUs(start), &scope_hint_);
+  return ret;
+}
+
+retcode PhaseChannel::TryRecvImpl(std::string *recv_buf, bool *received) {
+  // A polling receive never blocks.
+  retcode ret = inner_->TryRecvImpl(recv_buf, received);
+  if (ret == retcode::SUCCESS && *received)
+    accounting_->OnRecv(recv_buf->size(), 0, &scope_hint_);
+  return ret;
+}
+} // namespace primihub::link
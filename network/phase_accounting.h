@@ -0,0 +1,175 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef NETWORK_PHASE_ACCOUNTING_H_
+#define NETWORK_PHASE_ACCOUNTING_H_
+
+#include "network/base_channel.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace primihub::link {
+// Communication of one phase of a protocol.
+struct PhaseStats {
+  std::string label;
+  // Receive bursts: a receive that follows a send or starts the phase. A
+  // party that sends and then waits for the answer k times has k rounds.
+  uint64_t rounds{0};
+  uint64_t messages_sent{0};
+  uint64_t bytes_sent{0};
+  uint64_t messages_received{0};
+  uint64_t bytes_received{0};
+  // Wall time spent inside receives, waiting for the peer included.
+  uint64_t recv_blocked_us{0};
+};
+
+// PhaseAccounting attributes the traffic of a PhaseChannel and all its
+// forks to the innermost PhaseScope of the thread doing the send or
+// receive, so threads may run phases of their own side by side. A thread
+// without a scope of its own, such as the threads running async operations
+// and stripes, counts into the scope that last used the same channel or
+// fork, failing that into the scope entered last by any thread. Traffic
+// outside any scope goes to kNoPhase. Entering a label again adds to its
+// counters, an outer phase does not include the traffic of the phases
+// nested in it. Every scope counts its rounds on its own.
+class PhaseAccounting {
+public:
+  static constexpr const char *kNoPhase = "(no phase)";
+
+  PhaseAccounting();
+
+  // Counters of every phase in the order they were first entered, kNoPhase
+  // first if it saw traffic.
+  std::vector<PhaseStats> phases() const;
+  // The counters of label, zero if it never ran.
+  PhaseStats phase(const std::string &label) const;
+  // A table of all phases with their totals, for the end of a run.
+  std::string report() const;
+  void reset();
+
+private:
+  friend class PhaseChannel;
+  friend class PhaseScope;
+
+  struct Counters {
+    explicit Counters(const std::string &label) : label(label) {}
+    std::string label;
+    std::atomic<uint64_t> rounds{0};
+    std::atomic<uint64_t> messages_sent{0};
+    std::atomic<uint64_t> bytes_sent{0};
+    std::atomic<uint64_t> messages_received{0};
+    std::atomic<uint64_t> bytes_received{0};
+    std::atomic<uint64_t> recv_blocked_us{0};
+  };
+
+  // One entered scope. Scope states never go away, those of ended scopes
+  // are reused under a new id.
+  struct ScopeState {
+    std::atomic<Counters *> counters{nullptr};
+    std::atomic<uint64_t> id{0};
+    // Whether something was sent since the last receive, the next receive
+    // then starts a round.
+    std::atomic<bool> sent_since_recv{true};
+  };
+
+  // The scope that last used a channel, for the threads without one.
+  struct ScopeHint {
+    std::atomic<ScopeState *> scope{nullptr};
+    std::atomic<uint64_t> id{0};
+  };
+
+  ScopeState *Enter(const std::string &label);
+  void Exit(ScopeState *scope);
+  ScopeState *Current(ScopeHint *hint) const;
+  void OnSend(size_t size, ScopeHint *hint);
+  void OnRecv(size_t size, uint64_t blocked_us, ScopeHint *hint);
+  // Must hold mu_.
+  Counters *Find(const std::string &label);
+  static PhaseStats Snapshot(const Counters &counters);
+
+  // Scope stacks of the calling thread, by accounting.
+  static thread_local std::unordered_map<const PhaseAccounting *,
+                                         std::vector<ScopeState *>>
+      thread_scopes_;
+
+  mutable std::mutex mu_;
+  // Counters and scope states never move, the traffic path reads them
+  // without the lock. The first scope state stands for kNoPhase.
+  std::vector<std::unique_ptr<Counters>> counters_;
+  std::vector<std::unique_ptr<ScopeState>> scopes_;
+  std::vector<ScopeState *> free_scopes_;
+  uint64_t next_id_{1};
+  // Scopes of all threads, the last one is current_.
+  std::vector<ScopeState *> active_;
+  std::atomic<ScopeState *> current_;
+};
+
+// Makes label the current phase of accounting until it goes out of scope.
+// Scopes may nest, e.g. a "mul-gate layer 3" inside "online".
+class PhaseScope {
+public:
+  PhaseScope(PhaseAccounting &accounting, const std::string &label);
+  PhaseScope(const std::shared_ptr<PhaseAccounting> &accounting,
+             const std::string &label)
+      : PhaseScope(*accounting, label) {}
+  ~PhaseScope();
+  PhaseScope(const PhaseScope &) = delete;
+  PhaseScope &operator=(const PhaseScope &) = delete;
+
+private:
+  PhaseAccounting &accounting_;
+  PhaseAccounting::ScopeState *scope_;
+};
+
+// PhaseChannel counts the messages of another transport into a
+// PhaseAccounting, its forks count into the same one. Wrap the transport
+// before creating the Channel, the stripes and priority lanes of the Channel
+// and its forks are then counted as well.
+class PhaseChannel : public ForwardingChannel {
+public:
+  PhaseChannel(std::shared_ptr<ChannelBase> inner,
+               std::shared_ptr<PhaseAccounting> accounting);
+
+  retcode SendImpl(const std::string &send_buf) override;
+  retcode SendImpl(std::string_view send_buff_sv) override;
+  retcode SendImpl(const char *buff, size_t size) override;
+  retcode SendImpl(std::string &&send_buf) override;
+  retcode SendImpl(const char *buff, size_t size,
+                   std::shared_ptr<const void> keepalive) override;
+  retcode SendImpl(const StridedView &view) override;
+  retcode RecvImpl(std::string *recv_buf) override;
+  retcode RecvImpl(char *recv_buf, size_t recv_size) override;
+  retcode RecvImpl(const MutableStridedView &view) override;
+  retcode TryRecvImpl(std::string *recv_buf, bool *received) override;
+  std::shared_ptr<ChannelBase> ForkImpl(const std::string &key) override;
+
+  const std::shared_ptr<PhaseAccounting> &accounting() const {
+    return accounting_;
+  }
+
+private:
+  std::shared_ptr<PhaseAccounting> accounting_;
+  PhaseAccounting::ScopeHint scope_hint_;
+};
+} // namespace primihub::link
+
+#endif // NETWORK_PHASE_ACCOUNTING_H_
@@ -0,0 +1,54 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "network/ready_notifier.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <glog/logging.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+namespace primihub::link {
+ReadyNotifier::ReadyNotifier() {
+  fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd_ < 0)
+    LOG(ERROR) << "Create eventfd failed: " << strerror(errno);
+}
+
+ReadyNotifier::~ReadyNotifier() {
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+void ReadyNotifier::Notify() {
+  if (fd_ < 0 || signalled_.exchange(true))
+    return;
+  uint64_t one = 1;
+  if (write(fd_, &one, sizeof(one)) < 0)
+    LOG(ERROR) << "Write eventfd failed: " << strerror(errno);
+}
+
+void ReadyNotifier::Drain() {
+  if (fd_ < 0)
+    return;
+  signalled_.store(false);
+  uint64_t value = 0;
+  if (read(fd_, &value, sizeof(value)) < 0 && errno != EAGAIN)
+    LOG(ERROR) << "Read eventfd failed: " << strerror(errno);
+}
+} // namespace primihub::link
@@ -0,0 +1,48 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef NETWORK_READY_NOTIFIER_H_
+#define NETWORK_READY_NOTIFIER_H_
+
+#include <atomic>
+
+namespace primihub::link {
+// ReadyNotifier is an eventfd shared by many channels. Transports without a
+// pollable fd of their own notify it whenever a message arrives, the waiter
+// polls fd() next to the sockets of the other channels.
+class ReadyNotifier {
+public:
+  ReadyNotifier();
+  ~ReadyNotifier();
+  ReadyNotifier(const ReadyNotifier &) = delete;
+  ReadyNotifier &operator=(const ReadyNotifier &) = delete;
+
+  // Makes fd() readable, only the first notify after a Drain costs a
+  // syscall.
+  void Notify();
+
+  // Resets fd() to not readable. Call it before checking the channels, a
+  // message arriving after the check notifies again.
+  void Drain();
+
+  int fd() const { return fd_; }
+
+private:
+  int fd_{-1};
+  std::atomic<bool> signalled_{false};
+};
+} // namespace primihub::link
+
+#endif // NETWORK_READY_NOTIFIER_H_
@@ -0,0 +1,124 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "network/recording_channel.h"
+
+namespace primihub::link {
+RecordingChannel::RecordingChannel(std::shared_ptr<ChannelBase> inner,
+                                   const std::string &dir)
+    : ForwardingChannel(std::move(inner)), dir_(dir) {}
+
+RecordingChannel::~RecordingChannel() {
+  std::lock_guard<std::mutex> lock(log_mu_);
+  log_.Close();
+}
+
+void RecordingChannel::OpenLog(const std::string &key) {
+  std::lock_guard<std::mutex> lock(log_mu_);
+  // Channel sets the key of a fork once more, that keeps the log.
+  if (log_.isOpen() && key == key_)
+    return;
+  key_ = key;
+  log_.Open(TrafficLogPath(dir_, key_));
+}
+
+void RecordingChannel::Record(TrafficKind kind, const char *data,
+                              size_t size) {
+  std::lock_guard<std::mutex> lock(log_mu_);
+  // Reopening after close would truncate the finished log.
+  if (closed_)
+    return;
+  if (!log_.isOpen() && !log_.Open(TrafficLogPath(dir_, key_)))
+    return;
+  if (!log_.Append(kind, data, size))
+    LOG(ERROR) << "record message of key " << key_ << " failed";
+}
+
+uint64_t RecordingChannel::recordedMessages() {
+  std::lock_guard<std::mutex> lock(log_mu_);
+  return log_.records();
+}
+
+// Sends are recorded before they are handed over, a moved buffer is gone
+// afterwards.
+retcode RecordingChannel::SendImpl(const std::string &send_buf) {
+  Record(TrafficKind::kSent, send_buf.data(), send_buf.size());
+  return inner_->SendImpl(send_buf);
+}
+
+retcode RecordingChannel::SendImpl(std::string_view send_buff_sv) {
+  Record(TrafficKind::kSent, send_buff_sv.data(), send_buff_sv.size());
+  return inner_->SendImpl(send_buff_sv);
+}
+
+retcode RecordingChannel::SendImpl(const char *buff, size_t size) {
+  Record(TrafficKind::kSent, buff, size);
+  return inner_->SendImpl(buff, size);
+}
+
+retcode RecordingChannel::SendImpl(std::string &&send_buf) {
+  Record(TrafficKind::kSent, send_buf.data(), send_buf.size());
+  return inner_->SendImpl(std::move(send_buf));
+}
+
+retcode RecordingChannel::SendImpl(const char *buff, size_t size,
+                                   std::shared_ptr<const void> keepalive) {
+  Record(TrafficKind::kSent, buff, size);
+  return inner_->SendImpl(buff, size, std::move(keepalive));
+}
+
+retcode RecordingChannel::RecvImpl(std::string *recv_buf) {
+  retcode ret = inner_->RecvImpl(recv_buf);
+  if (ret == retcode::SUCCESS)
+    Record(TrafficKind::kReceived, recv_buf->data(), recv_buf->size());
+  return ret;
+}
+
+retcode RecordingChannel::RecvImpl(char *recv_buf, size_t recv_size) {
+  retcode ret = inner_->RecvImpl(recv_buf, recv_size);
+  if (ret == retcode::SUCCESS)
+    Record(TrafficKind::kReceived, recv_buf, recv_size);
+  return ret;
+}
+
+retcode RecordingChannel::TryRecvImpl(std::string *recv_buf, bool *received) {
+  retcode ret = inner_->TryRecvImpl(recv_buf, received);
+  if (ret == retcode::SUCCESS && *received)
+    Record(TrafficKind::kReceived, recv_buf->data(), recv_buf->size());
+  return ret;
+}
+
+std::shared_ptr<ChannelBase>
+RecordingChannel::ForkImpl(const std::string &key) {
+  auto inner = inner_->ForkImpl(key);
+  if (inner == nullptr)
+    return nullptr;
+  auto channel = std::make_shared<RecordingChannel>(std::move(inner), dir_);
+  channel->OpenLog(key);
+  return channel;
+}
+
+void RecordingChannel::SetKey(const std::string &key) {
+  inner_->SetKey(key);
+  OpenLog(key);
+}
+
+void RecordingChannel::close() {
+  inner_->close();
+  std::lock_guard<std::mutex> lock(log_mu_);
+  log_.Close();
+  closed_ = true;
+}
+} // namespace primihub::link
@@ -0,0 +1,62 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef NETWORK_RECORDING_CHANNEL_H_
+#define NETWORK_RECORDING_CHANNEL_H_
+
+#include "network/base_channel.h"
+#include "network/traffic_log.h"
+
+#include <mutex>
+#include <string_view>
+
+namespace primihub::link {
+// RecordingChannel wraps the transport of a real run and writes every
+// message sent and received to a traffic log in dir, one file per channel
+// key and fork. ReplayChannel plays such a log back as the peer.
+class RecordingChannel : public ForwardingChannel {
+public:
+  RecordingChannel(std::shared_ptr<ChannelBase> inner, const std::string &dir);
+  ~RecordingChannel() override;
+
+  retcode SendImpl(const std::string &send_buf) override;
+  retcode SendImpl(std::string_view send_buff_sv) override;
+  retcode SendImpl(const char *buff, size_t size) override;
+  retcode SendImpl(std::string &&send_buf) override;
+  retcode SendImpl(const char *buff, size_t size,
+                   std::shared_ptr<const void> keepalive) override;
+  retcode RecvImpl(std::string *recv_buf) override;
+  retcode RecvImpl(char *recv_buf, size_t recv_size) override;
+  retcode TryRecvImpl(std::string *recv_buf, bool *received) override;
+  std::shared_ptr<ChannelBase> ForkImpl(const std::string &key) override;
+  void SetKey(const std::string &key) override;
+  void close() override;
+
+  // Number of messages written to the log of the current key.
+  uint64_t recordedMessages();
+
+private:
+  void OpenLog(const std::string &key);
+  void Record(TrafficKind kind, const char *data, size_t size);
+
+  std::string dir_;
+  std::string key_{"default"};
+  std::mutex log_mu_;
+  TrafficLogWriter log_;
+  bool closed_{false};
+};
+} // namespace primihub::link
+
+#endif // NETWORK_RECORDING_CHANNEL_H_
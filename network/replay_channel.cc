@@ -0,0 +1,172 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "network/replay_channel.h"
+
+#include <cstring>
+#include <thread>
+
+namespace primihub::link {
+ReplayChannel::ReplayChannel(const std::string &dir)
+    : ReplayChannel(dir, Options()) {}
+
+ReplayChannel::ReplayChannel(const std::string &dir, const Options &options)
+    : dir_(dir), options_(options) {}
+
+bool ReplayChannel::OpenLog(const std::string &key) {
+  auto log = std::make_unique<TrafficLogReader>();
+  bool ok = log->Open(TrafficLogPath(dir_, key));
+  std::lock_guard<std::mutex> lock(mu_);
+  key_ = key;
+  log_ = ok ? std::move(log) : nullptr;
+  send_cursor_ = TrafficCursor();
+  recv_cursor_ = TrafficCursor();
+  start_ = std::chrono::steady_clock::now();
+  return ok;
+}
+
+void ReplayChannel::SetKey(const std::string &key) {
+  {
+    // Channel sets the key of a fork once more, that keeps the position.
+    std::lock_guard<std::mutex> lock(mu_);
+    if (log_ != nullptr && key == key_)
+      return;
+  }
+  OpenLog(key);
+}
+
+std::shared_ptr<ChannelBase> ReplayChannel::ForkImpl(const std::string &key) {
+  auto channel = std::make_shared<ReplayChannel>(dir_, options_);
+  channel->OpenLog(key);
+  return channel;
+}
+
+bool ReplayChannel::NextRecord(TrafficCursor *cursor, TrafficKind kind,
+                               TrafficRecord *record) {
+  if (log_ == nullptr) {
+    LOG(ERROR) << "no traffic log for key " << key_ << " in " << dir_;
+    return false;
+  }
+  while (log_->Next(cursor, record)) {
+    if (record->kind == kind)
+      return true;
+  }
+  return false;
+}
+
+bool ReplayChannel::NextReceived(TrafficRecord *record) {
+  std::chrono::steady_clock::time_point due;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (!NextRecord(&recv_cursor_, TrafficKind::kReceived, record)) {
+      LOG(ERROR) << "recording of key " << key_ << " has no more messages";
+      return false;
+    }
+    due = start_ + std::chrono::nanoseconds(record->time_ns);
+  }
+  if (options_.original_timing)
+    std::this_thread::sleep_until(due);
+  replayed_++;
+  return true;
+}
+
+bool ReplayChannel::HasPendingData() {
+  std::lock_guard<std::mutex> lock(mu_);
+  if (log_ == nullptr)
+    return false;
+  TrafficCursor cursor = recv_cursor_;
+  TrafficRecord record;
+  if (!NextRecord(&cursor, TrafficKind::kReceived, &record))
+    return false;
+  return !options_.original_timing ||
+         std::chrono::steady_clock::now() >=
+             start_ + std::chrono::nanoseconds(record.time_ns);
+}
+
+retcode ReplayChannel::RecvImpl(std::string *recv_buf) {
+  TrafficRecord record;
+  if (!NextReceived(&record))
+    return retcode::FAIL;
+  recv_buf->assign(record.payload.data(), record.payload.size());
+  return retcode::SUCCESS;
+}
+
+retcode ReplayChannel::RecvImpl(char *recv_buf, size_t recv_size) {
+  TrafficRecord record;
+  if (!NextReceived(&record))
+    return retcode::FAIL;
+  if (record.payload.size() != recv_size) {
+    LOG(ERROR) << "data length does not match: "
+               << " "
+               << "expected: " << recv_size << " "
+               << "actually: " << record.payload.size();
+    return retcode::FAIL;
+  }
+  memcpy(recv_buf, record.payload.data(), recv_size);
+  return retcode::SUCCESS;
+}
+
+retcode ReplayChannel::SendImpl(const char *buff, size_t size) {
+  std::lock_guard<std::mutex> lock(mu_);
+  TrafficRecord record;
+  if (!NextRecord(&send_cursor_, TrafficKind::kSent, &record)) {
+    LOG(ERROR) << "recording of key " << key_ << " has no more sends";
+    send_mismatches_++;
+    return retcode::FAIL;
+  }
+  // A diverging send is counted, the replayed peer keeps going.
+  if (options_.verify_sends &&
+      (record.payload.size() != size ||
+       memcmp(record.payload.data(), buff, size) != 0)) {
+    LOG(WARNING) << "send of key " << key_ << " differs from the recording, "
+                 << "expected: " << record.payload.size() << " bytes "
+                 << "actually: " << size << " bytes";
+    send_mismatches_++;
+  }
+  return retcode::SUCCESS;
+}
+
+retcode ReplayChannel::SendImpl(const std::string &send_buf) {
+  return SendImpl(send_buf.data(), send_buf.size());
+}
+
+retcode ReplayChannel::SendImpl(std::string_view send_buff_sv) {
+  return SendImpl(send_buff_sv.data(), send_buff_sv.size());
+}
+
+retcode ReplayChannel::ProbeImpl(uint64_t *size, bool wait, bool *available) {
+  std::chrono::steady_clock::time_point due;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    TrafficCursor cursor = recv_cursor_;
+    TrafficRecord record;
+    if (!NextRecord(&cursor, TrafficKind::kReceived, &record)) {
+      LOG(ERROR) << "recording of key " << key_ << " has no more messages";
+      return retcode::FAIL;
+    }
+    *size = record.payload.size();
+    due = start_ + std::chrono::nanoseconds(record.time_ns);
+  }
+  *available = true;
+  if (options_.original_timing) {
+    if (wait)
+      std::this_thread::sleep_until(due);
+    else
+      *available = std::chrono::steady_clock::now() >= due;
+  }
+  return retcode::SUCCESS;
+}
+
+} // namespace primihub::link
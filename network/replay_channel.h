@@ -0,0 +1,85 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef NETWORK_REPLAY_CHANNEL_H_
+#define NETWORK_REPLAY_CHANNEL_H_
+
+#include "network/base_channel.h"
+#include "network/traffic_log.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string_view>
+
+namespace primihub::link {
+// ReplayChannel stands in for the peers of a party recorded with
+// RecordingChannel. Its receives return the messages the party received in
+// the recorded run and its sends are checked against the messages the
+// party sent, so one party can be benchmarked on its own and every run sees
+// the same traffic. Forks replay the logs of their keys.
+class ReplayChannel : public ChannelBase {
+public:
+  struct Options {
+    // Deliver every message no earlier than it arrived in the recorded run,
+    // counted from when the key was opened. Otherwise messages are available
+    // right away.
+    bool original_timing{false};
+    // Compare sent messages with the recorded ones and count mismatches.
+    bool verify_sends{true};
+  };
+
+  explicit ReplayChannel(const std::string &dir);
+  ReplayChannel(const std::string &dir, const Options &options);
+
+  retcode SendImpl(const std::string &send_buf) override;
+  retcode SendImpl(std::string_view send_buff_sv) override;
+  retcode SendImpl(const char *buff, size_t size) override;
+  retcode RecvImpl(std::string *recv_buf) override;
+  retcode RecvImpl(char *recv_buf, size_t recv_size) override;
+  bool HasPendingData() override;
+  retcode ProbeImpl(uint64_t *size, bool wait, bool *available) override;
+  std::shared_ptr<ChannelBase> ForkImpl(const std::string &key) override;
+  void SetKey(const std::string &key) override;
+  void close() override {}
+  void cancel() override {}
+
+  // Number of sends that differ from the recording or go beyond it.
+  uint64_t sendMismatches() const { return send_mismatches_.load(); }
+  uint64_t replayedMessages() const { return replayed_.load(); }
+
+private:
+  bool OpenLog(const std::string &key);
+  // Moves cursor past the next record of kind, returns false at the end.
+  bool NextRecord(TrafficCursor *cursor, TrafficKind kind,
+                  TrafficRecord *record);
+  // Takes the next received record and waits until it is due.
+  bool NextReceived(TrafficRecord *record);
+
+  std::string dir_;
+  Options options_;
+  std::string key_{"default"};
+  std::mutex mu_;
+  std::unique_ptr<TrafficLogReader> log_;
+  TrafficCursor send_cursor_;
+  TrafficCursor recv_cursor_;
+  std::chrono::steady_clock::time_point start_;
+  std::atomic<uint64_t> send_mismatches_{0};
+  std::atomic<uint64_t> replayed_{0};
+};
+} // namespace primihub::link
+
+#endif // NETWORK_REPLAY_CHANNEL_H_
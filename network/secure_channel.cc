@@ -0,0 +1,287 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "network/secure_channel.h"
+
+#include <sys/random.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "util/hkdf.h"
+
+namespace primihub::link {
+namespace {
+constexpr char kKeySalt[] = "primihub-secure-channel";
+
+void StoreSeq(uint8_t *p, uint64_t seq) {
+  for (size_t i = 0; i < sizeof(seq); i++)
+    p[i] = static_cast<uint8_t>(seq >> (8 * i));
+}
+
+uint64_t LoadSeq(const uint8_t *p) {
+  uint64_t seq = 0;
+  for (size_t i = 0; i < sizeof(seq); i++)
+    seq |= uint64_t(p[i]) << (8 * i);
+  return seq;
+}
+
+bool RandomBytes(uint8_t *out, size_t size) {
+  while (size > 0) {
+    ssize_t n = getrandom(out, size, 0);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    out += n;
+    size -= n;
+  }
+  return true;
+}
+
+// The nonce is the sequence number, every direction has a key of its own.
+void MakeNonce(uint64_t seq, uint8_t nonce[Aead::kNonceSize]) {
+  memset(nonce, 0, Aead::kNonceSize - sizeof(seq));
+  StoreSeq(nonce + Aead::kNonceSize - sizeof(seq), seq);
+}
+} // namespace
+
+SecureChannel::SecureChannel(std::shared_ptr<ChannelBase> inner,
+                             ChannelRole role, const std::string &psk)
+    : SecureChannel(std::move(inner), role, psk, Options()) {}
+
+SecureChannel::SecureChannel(std::shared_ptr<ChannelBase> inner,
+                             ChannelRole role, const std::string &psk,
+                             const Options &options)
+    : ForwardingChannel(std::move(inner)), role_(role), psk_(psk), options_(options) {
+  switch (options_.cipher) {
+  case Cipher::kAes256Gcm:
+    suite_ = AeadSuite::kAes256Gcm;
+    if (!AesGcmSupported()) {
+      LOG(WARNING) << "AES-GCM needs AES-NI and PCLMULQDQ, "
+                   << "sending with ChaCha20-Poly1305 instead.";
+      suite_ = AeadSuite::kChaCha20Poly1305;
+    }
+    break;
+  case Cipher::kChaCha20Poly1305:
+    suite_ = AeadSuite::kChaCha20Poly1305;
+    break;
+  default:
+    suite_ = AesGcmSupported() ? AeadSuite::kAes256Gcm
+                               : AeadSuite::kChaCha20Poly1305;
+    break;
+  }
+  DeriveKeys("default");
+}
+
+void SecureChannel::DeriveKeys(const std::string &key) {
+  std::string send_info = (role_ == CLIENT ? "c2s:" : "s2c:") + key + ":";
+  uint8_t session[kSessionIdSize];
+  if (!RandomBytes(session, sizeof(session)))
+    LOG(FATAL) << "getrandom failed: " << strerror(errno);
+  send_info.append(reinterpret_cast<const char *>(session), sizeof(session));
+  uint8_t send_key[Aead::kKeySize];
+  HkdfSha256(psk_, kKeySalt, send_info, send_key, sizeof(send_key));
+  {
+    std::lock_guard<std::mutex> lock(send_mu_);
+    send_aead_.Init(suite_, send_key);
+    memcpy(send_session_, session, sizeof(session));
+    send_seq_ = 0;
+  }
+  {
+    std::lock_guard<std::mutex> lock(recv_mu_);
+    recv_info_ = (role_ == CLIENT ? "s2c:" : "c2s:") + key + ":";
+    for (auto &aead : recv_aead_)
+      aead.reset();
+    recv_seq_ = 0;
+  }
+  memset(send_key, 0, sizeof(send_key));
+}
+
+void SecureChannel::SetKey(const std::string &key) {
+  inner_->SetKey(key);
+  DeriveKeys(key);
+}
+
+std::shared_ptr<ChannelBase> SecureChannel::ForkImpl(const std::string &key) {
+  auto inner = inner_->ForkImpl(key);
+  if (inner == nullptr)
+    return nullptr;
+  auto fork = std::make_shared<SecureChannel>(std::move(inner), role_, psk_,
+                                              options_);
+  fork->DeriveKeys(key);
+  return fork;
+}
+
+retcode SecureChannel::SendImpl(const char *buff, size_t size) {
+  std::string frame;
+  // Held until the frame is handed to the transport, so frames leave in
+  // sequence order.
+  std::lock_guard<std::mutex> lock(send_mu_);
+  size_t header_size = FrameOverhead(send_seq_) - Aead::kTagSize;
+  frame.resize(size + header_size + Aead::kTagSize);
+  auto *header = reinterpret_cast<uint8_t *>(&frame[0]);
+  header[0] = static_cast<uint8_t>(suite_);
+  StoreSeq(header + 1, send_seq_);
+  if (send_seq_ == 0)
+    memcpy(header + kHeaderSize, send_session_, kSessionIdSize);
+  uint8_t nonce[Aead::kNonceSize];
+  MakeNonce(send_seq_, nonce);
+  // Encrypts straight into the outgoing frame.
+  send_aead_.Seal(nonce, header, header_size,
+                  reinterpret_cast<const uint8_t *>(buff), size,
+                  header + header_size, header + header_size + size);
+  send_seq_++;
+  return inner_->SendImpl(std::move(frame));
+}
+
+retcode SecureChannel::SendImpl(const std::string &send_buf) {
+  return SendImpl(send_buf.data(), send_buf.size());
+}
+
+retcode SecureChannel::SendImpl(std::string_view send_buff_sv) {
+  return SendImpl(send_buff_sv.data(), send_buff_sv.size());
+}
+
+retcode SecureChannel::Open(const char *frame, size_t frame_size, char *out) {
+  const auto *header = reinterpret_cast<const uint8_t *>(frame);
+  uint8_t suite = header[0];
+  if (suite != static_cast<uint8_t>(AeadSuite::kAes256Gcm) &&
+      suite != static_cast<uint8_t>(AeadSuite::kChaCha20Poly1305)) {
+    LOG(ERROR) << "unknown cipher suite " << static_cast<int>(suite)
+               << ", is the peer secure?";
+    auth_failures_++;
+    return retcode::FAIL;
+  }
+  uint64_t seq = LoadSeq(header + 1);
+  if (seq != recv_seq_) {
+    LOG(ERROR) << "frame out of sequence: "
+               << " "
+               << "expected: " << recv_seq_ << " "
+               << "actually: " << seq;
+    auth_failures_++;
+    return retcode::FAIL;
+  }
+  if (seq == 0) {
+    // A new session, the keys of the previous one are useless now.
+    for (auto &aead : recv_aead_)
+      aead.reset();
+  }
+  auto &aead = recv_aead_[suite];
+  if (aead == nullptr) {
+    if (seq != 0) {
+      LOG(ERROR) << "first frame of suite " << static_cast<int>(suite)
+                 << " in the middle of a session";
+      auth_failures_++;
+      return retcode::FAIL;
+    }
+    uint8_t recv_key[Aead::kKeySize];
+    std::string info = recv_info_;
+    info.append(frame + kHeaderSize, kSessionIdSize);
+    HkdfSha256(psk_, kKeySalt, info, recv_key, sizeof(recv_key));
+    aead = std::make_unique<Aead>();
+    bool supported = aead->Init(static_cast<AeadSuite>(suite), recv_key);
+    memset(recv_key, 0, sizeof(recv_key));
+    if (!supported) {
+      LOG(ERROR) << "peer sends AES-GCM but this CPU lacks AES-NI, "
+                 << "pin ChaCha20-Poly1305 on both sides.";
+      aead.reset();
+      return retcode::FAIL;
+    }
+  }
+  uint8_t nonce[Aead::kNonceSize];
+  MakeNonce(seq, nonce);
+  size_t header_size = FrameOverhead(seq) - Aead::kTagSize;
+  size_t size = frame_size - header_size - Aead::kTagSize;
+  if (!aead->Open(nonce, header, header_size, header + header_size, size,
+                  reinterpret_cast<uint8_t *>(out),
+                  header + header_size + size)) {
+    LOG(ERROR) << "message authentication failed at sequence " << seq;
+    auth_failures_++;
+    return retcode::FAIL;
+  }
+  recv_seq_++;
+  return retcode::SUCCESS;
+}
+
+retcode SecureChannel::RecvImpl(std::string *recv_buf) {
+  std::lock_guard<std::mutex> lock(recv_mu_);
+  std::string frame;
+  retcode ret = inner_->RecvImpl(&frame);
+  if (ret != retcode::SUCCESS)
+    return ret;
+  size_t overhead = FrameOverhead(recv_seq_);
+  if (frame.size() < overhead) {
+    LOG(ERROR) << "frame of " << frame.size() << " bytes is too short";
+    auth_failures_++;
+    return retcode::FAIL;
+  }
+  std::string payload;
+  payload.resize(frame.size() - overhead);
+  ret = Open(frame.data(), frame.size(), &payload[0]);
+  if (ret != retcode::SUCCESS)
+    return ret;
+  *recv_buf = std::move(payload);
+  return retcode::SUCCESS;
+}
+
+retcode SecureChannel::RecvImpl(char *recv_buf, size_t recv_size) {
+  std::lock_guard<std::mutex> lock(recv_mu_);
+  std::string frame;
+  retcode ret = inner_->RecvImpl(&frame);
+  if (ret != retcode::SUCCESS)
+    return ret;
+  size_t overhead = FrameOverhead(recv_seq_);
+  if (frame.size() < overhead) {
+    LOG(ERROR) << "frame of " << frame.size() << " bytes is too short";
+    auth_failures_++;
+    return retcode::FAIL;
+  }
+  if (frame.size() != recv_size + overhead) {
+    LOG(ERROR) << "data length does not match: "
+               << " "
+               << "expected: " << recv_size << " "
+               << "actually: " << frame.size() - overhead;
+    // The frame has been taken from the transport, open it anyway so the
+    // sequence stays in step and the next message can be received.
+    std::string payload;
+    payload.resize(frame.size() - overhead);
+    Open(frame.data(), frame.size(), &payload[0]);
+    return retcode::FAIL;
+  }
+  // Decrypts directly into the caller's buffer, which holds no plaintext if
+  // the frame turns out to be forged.
+  return Open(frame.data(), frame.size(), recv_buf);
+}
+
+retcode SecureChannel::ProbeImpl(uint64_t *size, bool wait, bool *available) {
+  retcode ret = inner_->ProbeImpl(size, wait, available);
+  if (ret != retcode::SUCCESS || !*available)
+    return ret;
+  size_t overhead = 0;
+  {
+    std::lock_guard<std::mutex> lock(recv_mu_);
+    overhead = FrameOverhead(recv_seq_);
+  }
+  if (*size < overhead) {
+    LOG(ERROR) << "frame of " << *size << " bytes is too short";
+    return retcode::FAIL;
+  }
+  *size -= overhead;
+  return retcode::SUCCESS;
+}
+
+} // namespace primihub::link
@@ -0,0 +1,124 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef NETWORK_SECURE_CHANNEL_H_
+#define NETWORK_SECURE_CHANNEL_H_
+
+#include "network/base_channel.h"
+#include "util/aead.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string_view>
+
+namespace primihub::link {
+// SecureChannel encrypts and authenticates every message of another
+// transport. Both peers hold the same pre-shared key, per direction keys
+// are derived from it with HKDF-SHA256 over the channel key and a random
+// session id the sender draws when the channel is constructed, on SetKey
+// and on ForkImpl. Every run and every reconnect thus sends under a fresh
+// key, even though the sequence numbers restart at 0.
+//
+// A message is sent as one frame
+//   [suite: 1 byte][sequence: 8 bytes LE][ciphertext][tag: 16 bytes]
+// whose header is authenticated as associated data. The first frame of a
+// session, sequence 0, carries the 16 byte session id right behind the
+// sequence number, the receiver derives its key from it. The sequence
+// number is the nonce, the receiver requires it to count up from 0, so
+// dropped, replayed or reordered frames fail like tampered ones. Only the
+// sender contributes to the session id, a replay of a whole recorded
+// session is not detected.
+//
+// kAuto picks AES-256-GCM on CPUs with AES-NI and PCLMULQDQ and
+// ChaCha20-Poly1305 elsewhere. The receiver follows the suite of each
+// frame, a peer without AES-NI cannot open AES-GCM frames though, so pin
+// kChaCha20Poly1305 when the hardware of the parties differs.
+class SecureChannel : public ForwardingChannel {
+public:
+  enum ChannelRole {
+    SERVER,
+    CLIENT
+  };
+
+  enum class Cipher {
+    kAuto,
+    kAes256Gcm,
+    kChaCha20Poly1305
+  };
+
+  struct Options {
+    Cipher cipher{Cipher::kAuto};
+  };
+
+  static constexpr size_t kHeaderSize = 1 + sizeof(uint64_t);
+  static constexpr size_t kOverhead = kHeaderSize + Aead::kTagSize;
+  // Sent once per session, in the first frame.
+  static constexpr size_t kSessionIdSize = 16;
+
+  SecureChannel(std::shared_ptr<ChannelBase> inner, ChannelRole role,
+                const std::string &psk);
+  SecureChannel(std::shared_ptr<ChannelBase> inner, ChannelRole role,
+                const std::string &psk, const Options &options);
+
+  retcode SendImpl(const std::string &send_buf) override;
+  retcode SendImpl(std::string_view send_buff_sv) override;
+  retcode SendImpl(const char *buff, size_t size) override;
+  retcode RecvImpl(std::string *recv_buf) override;
+  retcode RecvImpl(char *recv_buf, size_t recv_size) override;
+  retcode ProbeImpl(uint64_t *size, bool wait, bool *available) override;
+  std::shared_ptr<ChannelBase> ForkImpl(const std::string &key) override;
+  // Starts a new session for key and restarts the sequence numbers, so
+  // both peers have to call it before their first message.
+  void SetKey(const std::string &key) override;
+
+  // Suite used for sending.
+  AeadSuite suite() const { return suite_; }
+  // Frames that failed authentication or came out of sequence.
+  uint64_t authFailures() const { return auth_failures_.load(); }
+
+private:
+  void DeriveKeys(const std::string &key);
+  // Overhead of the frame with sequence number seq.
+  static size_t FrameOverhead(uint64_t seq) {
+    return seq == 0 ? kOverhead + kSessionIdSize : kOverhead;
+  }
+  // Authenticates frame and decrypts its payload into out, which holds
+  // frame_size - FrameOverhead(recv_seq_) bytes.
+  retcode Open(const char *frame, size_t frame_size, char *out);
+
+  ChannelRole role_;
+  std::string psk_;
+  Options options_;
+  AeadSuite suite_;
+
+  std::mutex send_mu_;
+  Aead send_aead_;
+  uint8_t send_session_[kSessionIdSize];
+  uint64_t send_seq_{0};
+
+  std::mutex recv_mu_;
+  // HKDF info of the receive direction, the peer's session id is appended.
+  std::string recv_info_;
+  // Indexed by suite, set up when the first frame of the suite arrives.
+  std::unique_ptr<Aead> recv_aead_[3];
+  uint64_t recv_seq_{0};
+
+  std::atomic<uint64_t> auth_failures_{0};
+};
+} // namespace primihub::link
+
+#endif // NETWORK_SECURE_CHANNEL_H_
@@ -0,0 +1,262 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "network/shaped_channel.h"
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+namespace primihub::link {
+namespace {
+// Every message is prefixed with its arrival time in steady_clock
+// nanoseconds.
+constexpr size_t kStampSize = sizeof(int64_t);
+
+std::chrono::steady_clock::time_point StampTime(const char *stamp) {
+  int64_t ns;
+  memcpy(&ns, stamp, sizeof(ns));
+  return std::chrono::steady_clock::time_point(std::chrono::nanoseconds(ns));
+}
+} // namespace
+
+ShapedChannel::ShapedChannel(std::shared_ptr<ChannelBase> inner,
+                             const Options &options)
+    : ShapedChannel(std::move(inner), options,
+                    std::make_shared<ForkOptions>()) {}
+
+ShapedChannel::ShapedChannel(std::shared_ptr<ChannelBase> inner,
+                             const Options &options,
+                             std::shared_ptr<ForkOptions> fork_options)
+    : ForwardingChannel(std::move(inner)), options_(options),
+      fork_options_(std::move(fork_options)),
+      tokens_(static_cast<double>(options.burst_bytes)),
+      refilled_(std::chrono::steady_clock::now()), rng_(options.seed) {}
+
+ShapedChannel::~ShapedChannel() {
+  if (timer_fd_ >= 0)
+    ::close(timer_fd_);
+}
+
+void ShapedChannel::setForkOptions(const std::string &key,
+                                   const Options &options) {
+  std::lock_guard<std::mutex> lock(fork_options_->mu);
+  fork_options_->options[key] = options;
+}
+
+std::shared_ptr<ChannelBase> ShapedChannel::ForkImpl(const std::string &key) {
+  auto inner = inner_->ForkImpl(key);
+  if (inner == nullptr)
+    return nullptr;
+  Options options = options_;
+  {
+    std::lock_guard<std::mutex> lock(fork_options_->mu);
+    auto iter = fork_options_->options.find(key);
+    if (iter != fork_options_->options.end())
+      options = iter->second;
+  }
+  // Make the jitter of every fork differ but stay reproducible.
+  options.seed += std::hash<std::string>()(key);
+  return std::shared_ptr<ChannelBase>(
+      new ShapedChannel(std::move(inner), options, fork_options_));
+}
+
+std::chrono::steady_clock::time_point ShapedChannel::Transmit(size_t size) {
+  using namespace std::chrono;
+  std::lock_guard<std::mutex> lock(link_mu_);
+  auto now = steady_clock::now();
+  if (options_.bandwidth_bytes_per_sec > 0) {
+    // The link sends one message at a time, a sender waits with link_mu_
+    // held until the bucket paid for its message.
+    double rate = static_cast<double>(options_.bandwidth_bytes_per_sec);
+    double refill = duration<double>(now - refilled_).count() * rate;
+    tokens_ = std::min(static_cast<double>(options_.burst_bytes),
+                       tokens_ + refill);
+    refilled_ = now;
+    tokens_ -= static_cast<double>(size + options_.per_message_overhead);
+    if (tokens_ < 0) {
+      auto wait = duration_cast<nanoseconds>(duration<double>(-tokens_ / rate));
+      std::this_thread::sleep_for(wait);
+      throttled_us_ += duration_cast<microseconds>(wait).count();
+      now = steady_clock::now();
+      tokens_ = 0;
+      refilled_ = now;
+    }
+  }
+
+  auto arrival = now + options_.latency;
+  if (options_.jitter.count() > 0) {
+    std::uniform_int_distribution<int64_t> dist(0, options_.jitter.count());
+    arrival += microseconds(dist(rng_));
+  }
+  // A later message never overtakes an earlier one.
+  arrival = std::max(arrival, last_arrival_);
+  last_arrival_ = arrival;
+  return arrival;
+}
+
+retcode ShapedChannel::SendImpl(const char *buff, size_t size) {
+  auto arrival = Transmit(size);
+  int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   arrival.time_since_epoch())
+                   .count();
+  std::string frame;
+  frame.resize(kStampSize + size);
+  memcpy(&frame[0], &ns, kStampSize);
+  if (size > 0)
+    memcpy(&frame[kStampSize], buff, size);
+  return inner_->SendImpl(std::move(frame));
+}
+
+retcode ShapedChannel::SendImpl(const std::string &send_buf) {
+  return SendImpl(send_buf.data(), send_buf.size());
+}
+
+retcode ShapedChannel::SendImpl(std::string_view send_buff_sv) {
+  return SendImpl(send_buff_sv.data(), send_buff_sv.size());
+}
+
+bool ShapedChannel::Hold() {
+  if (!holding_ && inner_->HasPendingData()) {
+    if (inner_->RecvImpl(&held_) != retcode::SUCCESS)
+      return false;
+    holding_ = true;
+  }
+  return holding_;
+}
+
+bool ShapedChannel::HeldDue() const {
+  // A frame without a stamp is due, so the receive reports it.
+  return holding_ &&
+         (held_.size() < kStampSize ||
+          std::chrono::steady_clock::now() >= StampTime(held_.data()));
+}
+
+retcode ShapedChannel::NextFrame(std::string *frame) {
+  std::lock_guard<std::mutex> lock(recv_mu_);
+  if (!holding_)
+    return inner_->RecvImpl(frame);
+  frame->swap(held_);
+  held_.clear();
+  holding_ = false;
+  return retcode::SUCCESS;
+}
+
+bool ShapedChannel::HasPendingData() {
+  // A receive in progress owns the next frame.
+  std::unique_lock<std::mutex> lock(recv_mu_, std::try_to_lock);
+  return lock.owns_lock() && Hold() && HeldDue();
+}
+
+retcode ShapedChannel::TryRecvImpl(std::string *recv_buf, bool *received) {
+  std::string frame;
+  {
+    std::unique_lock<std::mutex> lock(recv_mu_, std::try_to_lock);
+    *received = lock.owns_lock() && Hold() && HeldDue();
+    if (!*received)
+      return retcode::SUCCESS;
+    frame.swap(held_);
+    held_.clear();
+    holding_ = false;
+  }
+  if (frame.size() < kStampSize) {
+    LOG(ERROR) << "message without arrival time, is the peer shaped?";
+    return retcode::FAIL;
+  }
+  recv_buf->assign(frame.data() + kStampSize, frame.size() - kStampSize);
+  return retcode::SUCCESS;
+}
+
+int ShapedChannel::ReadinessFd() {
+  std::unique_lock<std::mutex> lock(recv_mu_, std::try_to_lock);
+  if (!lock.owns_lock() || !holding_ || held_.size() < kStampSize)
+    return inner_->ReadinessFd();
+  // The held frame took the readiness of the inner transport with it.
+  if (timer_fd_ < 0) {
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd_ < 0) {
+      LOG(ERROR) << "timerfd_create failed: " << strerror(errno);
+      return inner_->ReadinessFd();
+    }
+  }
+  int64_t ns;
+  memcpy(&ns, held_.data(), sizeof(ns));
+  // 0 would disarm the timer.
+  ns = std::max<int64_t>(ns, 1);
+  itimerspec spec{};
+  spec.it_value.tv_sec = ns / 1000000000;
+  spec.it_value.tv_nsec = ns % 1000000000;
+  timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr);
+  return timer_fd_;
+}
+
+retcode ShapedChannel::RecvImpl(std::string *recv_buf) {
+  std::string frame;
+  retcode ret = NextFrame(&frame);
+  if (ret != retcode::SUCCESS)
+    return ret;
+  if (frame.size() < kStampSize) {
+    LOG(ERROR) << "message without arrival time, is the peer shaped?";
+    return retcode::FAIL;
+  }
+  std::this_thread::sleep_until(StampTime(frame.data()));
+  recv_buf->assign(frame.data() + kStampSize, frame.size() - kStampSize);
+  return retcode::SUCCESS;
+}
+
+retcode ShapedChannel::RecvImpl(char *recv_buf, size_t recv_size) {
+  std::string frame;
+  retcode ret = NextFrame(&frame);
+  if (ret != retcode::SUCCESS)
+    return ret;
+  if (frame.size() != kStampSize + recv_size) {
+    LOG(ERROR) << "data length does not match: "
+               << " "
+               << "expected: " << recv_size << " "
+               << "actually: "
+               << frame.size() - std::min(frame.size(), kStampSize);
+    return retcode::FAIL;
+  }
+  std::this_thread::sleep_until(StampTime(frame.data()));
+  if (recv_size > 0)
+    memcpy(recv_buf, frame.data() + kStampSize, recv_size);
+  return retcode::SUCCESS;
+}
+
+// The size is known once the message reached the inner transport, before
+// it is due on the emulated link.
+retcode ShapedChannel::ProbeImpl(uint64_t *size, bool wait, bool *available) {
+  std::lock_guard<std::mutex> lock(recv_mu_);
+  if (holding_) {
+    *size = held_.size();
+    *available = true;
+  } else {
+    retcode ret = inner_->ProbeImpl(size, wait, available);
+    if (ret != retcode::SUCCESS || !*available)
+      return ret;
+  }
+  if (*size < kStampSize) {
+    LOG(ERROR) << "message without arrival time, is the peer shaped?";
+    return retcode::FAIL;
+  }
+  *size -= kStampSize;
+  return retcode::SUCCESS;
+}
+
+} // namespace primihub::link
@@ -0,0 +1,121 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef NETWORK_SHAPED_CHANNEL_H_
+#define NETWORK_SHAPED_CHANNEL_H_
+
+#include "network/base_channel.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string_view>
+
+namespace primihub::link {
+// ShapedChannel emulates a WAN link on top of another transport, usually a
+// MemoryChannel. The sender is held back by a token bucket for the link
+// bandwidth, then every message is stamped with the time it would arrive
+// after the one-way latency plus jitter, and the receiving ShapedChannel
+// hands it out no earlier than that. Messages are never reordered. Both
+// peers must wrap their transport, and since the stamp is a local clock
+// they must run on the same host.
+//
+// Every key and fork is a link of its own, forks inherit the options of
+// their parent unless setForkOptions configured their key.
+//
+// A message is pending only once its arrival time has passed. To tell,
+// HasPendingData and TryRecvImpl take a message that reached the inner
+// transport early and hold it, until then ReadinessFd is a timer that
+// fires at its arrival.
+class ShapedChannel : public ForwardingChannel {
+public:
+  struct Options {
+    std::chrono::microseconds latency{0};
+    // Extra delay drawn uniformly from [0, jitter] for every message.
+    std::chrono::microseconds jitter{0};
+    // 0 leaves the bandwidth unlimited.
+    uint64_t bandwidth_bytes_per_sec{0};
+    // Bytes the link may send back to back at full speed.
+    uint64_t burst_bytes{64 * 1024};
+    // Bytes charged per message on top of its payload, e.g. for headers.
+    uint64_t per_message_overhead{0};
+    uint64_t seed{0x5eed};
+  };
+
+  ShapedChannel(std::shared_ptr<ChannelBase> inner, const Options &options);
+  ~ShapedChannel() override;
+
+  retcode SendImpl(const std::string &send_buf) override;
+  retcode SendImpl(std::string_view send_buff_sv) override;
+  retcode SendImpl(const char *buff, size_t size) override;
+  retcode RecvImpl(std::string *recv_buf) override;
+  retcode RecvImpl(char *recv_buf, size_t recv_size) override;
+  retcode TryRecvImpl(std::string *recv_buf, bool *received) override;
+  bool HasPendingData() override;
+  int ReadinessFd() override;
+  retcode ProbeImpl(uint64_t *size, bool wait, bool *available) override;
+  std::shared_ptr<ChannelBase> ForkImpl(const std::string &key) override;
+
+  // Options for the fork with key, created by this channel or its forks.
+  void setForkOptions(const std::string &key, const Options &options);
+  const Options &options() const { return options_; }
+
+  // Time senders spent waiting for bandwidth.
+  std::chrono::microseconds throttledTime() const {
+    return std::chrono::microseconds(throttled_us_.load());
+  }
+
+private:
+  struct ForkOptions {
+    std::mutex mu;
+    std::map<std::string, Options> options;
+  };
+
+  ShapedChannel(std::shared_ptr<ChannelBase> inner, const Options &options,
+                std::shared_ptr<ForkOptions> fork_options);
+  // Waits for the tokens of a size byte message, returns its arrival time.
+  std::chrono::steady_clock::time_point Transmit(size_t size);
+  // Must hold recv_mu_. Takes the next frame from inner_ into held_ if one
+  // is pending there, returns whether a frame is held.
+  bool Hold();
+  // Must hold recv_mu_. Whether the held frame has arrived.
+  bool HeldDue() const;
+  // The next frame, the held one or one received from inner_.
+  retcode NextFrame(std::string *frame);
+
+  Options options_;
+  std::shared_ptr<ForkOptions> fork_options_;
+
+  std::mutex link_mu_;
+  double tokens_;
+  std::chrono::steady_clock::time_point refilled_;
+  std::chrono::steady_clock::time_point last_arrival_;
+  std::mt19937_64 rng_;
+  std::atomic<uint64_t> throttled_us_{0};
+
+  // Held while receiving from inner_, so frames are handed out in order.
+  std::mutex recv_mu_;
+  std::string held_;
+  bool holding_{false};
+  // Armed for the arrival of the held frame, created on first use.
+  int timer_fd_{-1};
+};
+} // namespace primihub::link
+
+#endif // NETWORK_SHAPED_CHANNEL_H_
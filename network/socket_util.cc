@@ -0,0 +1,654 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "network/socket_util.h"
+#include "network/ready_notifier.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+namespace primihub::link {
+namespace {
+constexpr uint32_t kMaxKeySize = 4096;
+
+bool ResolveIpv4(const std::string &host, uint16_t port, sockaddr_in *addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sin_family = AF_INET;
+  addr->sin_port = htons(port);
+  if (host.empty()) {
+    addr->sin_addr.s_addr = htonl(INADDR_ANY);
+    return true;
+  }
+  if (inet_pton(AF_INET, host.c_str(), &addr->sin_addr) == 1)
+    return true;
+
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *result = nullptr;
+  if (getaddrinfo(host.c_str(), nullptr, &hints, &result) != 0 ||
+      result == nullptr) {
+    LOG(ERROR) << "Resolve host " << host << " failed.";
+    return false;
+  }
+  addr->sin_addr = reinterpret_cast<sockaddr_in *>(result->ai_addr)->sin_addr;
+  freeaddrinfo(result);
+  return true;
+}
+
+bool UnixAddress(const std::string &path, sockaddr_un *addr,
+                 socklen_t *addr_len) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(addr->sun_path)) {
+    LOG(ERROR) << "Invalid unix socket path: " << path;
+    return false;
+  }
+  memcpy(addr->sun_path, path.data(), path.size());
+  if (path[0] == '@')
+    addr->sun_path[0] = '\0';
+  *addr_len = offsetof(sockaddr_un, sun_path) + path.size();
+  return true;
+}
+
+constexpr ssize_t kWouldBlock = -2;
+
+// Copies up to size buffered bytes of fd without consuming them. Returns
+// kWouldBlock if nothing is buffered, 0 on EOF and -1 on errors.
+ssize_t PeekInput(int fd, char *buf, size_t size) {
+  ssize_t n = 0;
+  do {
+    n = recv(fd, buf, size, MSG_PEEK | MSG_DONTWAIT);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    return kWouldBlock;
+  if (n < 0)
+    LOG(ERROR) << "recv failed: " << strerror(errno);
+  return n;
+}
+} // namespace
+
+bool SendAll(int fd, const char *buf, size_t size, int flags) {
+  while (size > 0) {
+    ssize_t n = send(fd, buf, size, flags | MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      LOG(ERROR) << "send failed: " << strerror(errno);
+      return false;
+    }
+    buf += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool RecvAll(int fd, char *buf, size_t size) {
+  while (size > 0) {
+    ssize_t n = recv(fd, buf, size, 0);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      LOG(ERROR) << "recv failed: " << strerror(errno);
+      return false;
+    }
+    if (n == 0)
+      return false;
+    buf += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool HasInput(int fd) {
+  pollfd pfd{fd, POLLIN, 0};
+  int ret = 0;
+  do {
+    ret = poll(&pfd, 1, 0);
+  } while (ret < 0 && errno == EINTR);
+  return ret > 0 && (pfd.revents & POLLIN);
+}
+
+bool WriteKeyHandshake(int fd, const std::string &key) {
+  std::string handshake(sizeof(uint32_t) + key.size(), 0);
+  uint32_t key_size = static_cast<uint32_t>(key.size());
+  memcpy(&handshake[0], &key_size, sizeof(key_size));
+  memcpy(&handshake[sizeof(key_size)], key.data(), key.size());
+  return SendAll(fd, handshake.data(), handshake.size());
+}
+
+HandshakeResult ReadKeyHandshake(int fd, std::string *key) {
+  // Peeks until the whole handshake is buffered, then consumes it at once.
+  uint32_t key_size = 0;
+  ssize_t n = PeekInput(fd, reinterpret_cast<char *>(&key_size),
+                        sizeof(key_size));
+  if (n < 0)
+    return n == kWouldBlock ? HandshakeResult::kPending
+                            : HandshakeResult::kFailed;
+  if (n == 0)
+    return HandshakeResult::kFailed;
+  if (static_cast<size_t>(n) < sizeof(key_size))
+    return HandshakeResult::kPending;
+  if (key_size > kMaxKeySize) {
+    LOG(ERROR) << "Invalid handshake, key size: " << key_size;
+    return HandshakeResult::kFailed;
+  }
+
+  std::string handshake(sizeof(key_size) + key_size, 0);
+  n = PeekInput(fd, &handshake[0], handshake.size());
+  if (n < 0 && n != kWouldBlock)
+    return HandshakeResult::kFailed;
+  if (n < static_cast<ssize_t>(handshake.size()))
+    return HandshakeResult::kPending;
+  if (!RecvAll(fd, &handshake[0], handshake.size()))
+    return HandshakeResult::kFailed;
+  key->assign(handshake, sizeof(key_size), key_size);
+  return HandshakeResult::kDone;
+}
+
+int ListenTcp(const std::string &host, uint16_t port, uint16_t *bound_port) {
+  sockaddr_in addr;
+  if (!ResolveIpv4(host, port, &addr))
+    return -1;
+
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    LOG(ERROR) << "Create socket failed: " << strerror(errno);
+    return -1;
+  }
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    LOG(ERROR) << "Listen on " << host << ":" << port
+               << " failed: " << strerror(errno);
+    ::close(fd);
+    return -1;
+  }
+
+  socklen_t len = sizeof(addr);
+  getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len);
+  *bound_port = ntohs(addr.sin_port);
+  return fd;
+}
+
+int ConnectTcp(const std::string &host, uint16_t port, int timeout_ms) {
+  sockaddr_in addr;
+  if (!ResolveIpv4(host, port, &addr))
+    return -1;
+
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  while (true) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      LOG(ERROR) << "Create socket failed: " << strerror(errno);
+      return -1;
+    }
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0) {
+      int on = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+      return fd;
+    }
+
+    int err = errno;
+    ::close(fd);
+    if ((err != ECONNREFUSED && err != EINTR) ||
+        std::chrono::steady_clock::now() > deadline) {
+      LOG(ERROR) << "Connect to " << host << ":" << port
+                 << " failed: " << strerror(err);
+      return -1;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+}
+
+int ListenUnix(const std::string &path, int type) {
+  sockaddr_un addr;
+  socklen_t addr_len = 0;
+  if (!UnixAddress(path, &addr, &addr_len))
+    return -1;
+
+  int fd = socket(AF_UNIX, type | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    LOG(ERROR) << "Create socket failed: " << strerror(errno);
+    return -1;
+  }
+  // A socket file left behind by a previous run would fail the bind.
+  if (path[0] != '@')
+    unlink(path.c_str());
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), addr_len) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    LOG(ERROR) << "Listen on " << path << " failed: " << strerror(errno);
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int ConnectUnix(const std::string &path, int type, int timeout_ms) {
+  sockaddr_un addr;
+  socklen_t addr_len = 0;
+  if (!UnixAddress(path, &addr, &addr_len))
+    return -1;
+
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  while (true) {
+    int fd = socket(AF_UNIX, type | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      LOG(ERROR) << "Create socket failed: " << strerror(errno);
+      return -1;
+    }
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), addr_len) == 0)
+      return fd;
+
+    int err = errno;
+    ::close(fd);
+    if ((err != ECONNREFUSED && err != ENOENT && err != EINTR) ||
+        std::chrono::steady_clock::now() > deadline) {
+      LOG(ERROR) << "Connect to " << path << " failed: " << strerror(err);
+      return -1;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+}
+
+bool WritePacketHandshake(int fd, const std::string &key) {
+  if (key.size() > kMaxKeySize) {
+    LOG(ERROR) << "Key is too long for the handshake, key size: "
+               << key.size();
+    return false;
+  }
+  while (send(fd, key.data(), key.size(), MSG_NOSIGNAL) < 0) {
+    if (errno != EINTR) {
+      LOG(ERROR) << "send failed: " << strerror(errno);
+      return false;
+    }
+  }
+  return true;
+}
+
+HandshakeResult ReadPacketHandshake(int fd, std::string *key) {
+  // A packet arrives whole, so the handshake is complete once it is there.
+  key->resize(kMaxKeySize + 1);
+  ssize_t n = 0;
+  do {
+    n = recv(fd, &(*key)[0], key->size(), MSG_DONTWAIT);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    return HandshakeResult::kPending;
+  if (n < 0 || static_cast<size_t>(n) > kMaxKeySize) {
+    LOG(ERROR) << "Invalid handshake packet.";
+    return HandshakeResult::kFailed;
+  }
+  key->resize(n);
+  return HandshakeResult::kDone;
+}
+
+KeyedAcceptor::KeyedAcceptor(int listen_fd, HandshakeReader read_handshake)
+    : listen_fd_(listen_fd), read_handshake_(std::move(read_handshake)) {
+  // The accept thread polls for connections, accept() must not block when
+  // one was reset in between.
+  fcntl(listen_fd_, F_SETFL, fcntl(listen_fd_, F_GETFL) | O_NONBLOCK);
+  accept_thread_ = std::thread([this]() { AcceptLoop(); });
+}
+
+KeyedAcceptor::~KeyedAcceptor() {
+  Stop();
+  if (accept_thread_.joinable())
+    accept_thread_.join();
+
+  for (auto &item : ready_)
+    for (int fd : item.second)
+      ::close(fd);
+  ::close(listen_fd_);
+}
+
+void KeyedAcceptor::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (stop_)
+      return;
+    stop_ = true;
+  }
+  // Wakes up the poll() of the accept thread.
+  shutdown(listen_fd_, SHUT_RDWR);
+  cv_.notify_all();
+}
+
+int KeyedAcceptor::Take(const std::string &key) {
+  std::unique_lock<std::mutex> lock(mu_);
+  cv_.wait(lock, [&]() {
+    auto iter = ready_.find(key);
+    return stop_ || (iter != ready_.end() && !iter->second.empty());
+  });
+  if (stop_)
+    return -1;
+
+  auto iter = ready_.find(key);
+  int fd = iter->second.front();
+  iter->second.pop_front();
+  if (iter->second.empty())
+    ready_.erase(iter);
+  return fd;
+}
+
+int KeyedAcceptor::TryTake(const std::string &key) {
+  std::lock_guard<std::mutex> lock(mu_);
+  auto iter = ready_.find(key);
+  if (stop_ || iter == ready_.end() || iter->second.empty())
+    return -1;
+
+  int fd = iter->second.front();
+  iter->second.pop_front();
+  if (iter->second.empty())
+    ready_.erase(iter);
+  return fd;
+}
+
+void KeyedAcceptor::Watch(const std::string &key,
+                          std::function<void()> on_arrival) {
+  bool arrived = false;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (!on_arrival) {
+      watchers_.erase(key);
+      return;
+    }
+    watchers_[key] = on_arrival;
+    arrived = ready_.find(key) != ready_.end();
+  }
+  if (arrived)
+    on_arrival();
+}
+
+void KeyedAcceptor::AcceptLoop() {
+  using Clock = std::chrono::steady_clock;
+  struct Handshaking {
+    int fd;
+    Clock::time_point deadline;
+  };
+  // Connections waiting for their handshake, only the accept thread
+  // touches them.
+  std::vector<Handshaking> handshaking;
+  // Queued connections whose peer hung up after sending data, they stay
+  // queued for their channel to read and are not watched any more.
+  std::set<int> lingering;
+  std::vector<pollfd> pfds;
+  std::vector<int> hung_up;
+
+  while (true) {
+    pfds.assign(1, pollfd{listen_fd_, POLLIN, 0});
+    int timeout_ms = -1;
+    auto now = Clock::now();
+    for (const auto &conn : handshaking) {
+      pfds.push_back(pollfd{conn.fd, POLLIN | POLLRDHUP, 0});
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      conn.deadline - now)
+                      .count() +
+                  1;
+      if (timeout_ms < 0 || left < timeout_ms)
+        timeout_ms = static_cast<int>(std::max<int64_t>(left, 0));
+    }
+    size_t queued_begin = pfds.size();
+    {
+      // POLLRDHUP alone, data waiting to be read must not wake the loop.
+      std::lock_guard<std::mutex> lock(mu_);
+      std::set<int> still_queued;
+      for (const auto &item : ready_) {
+        for (int fd : item.second) {
+          if (lingering.count(fd) != 0)
+            still_queued.insert(fd);
+          else
+            pfds.push_back(pollfd{fd, POLLRDHUP, 0});
+        }
+      }
+      lingering.swap(still_queued);
+    }
+
+    int ret = poll(pfds.data(), pfds.size(), timeout_ms);
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (stop_)
+        break;
+    }
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      LOG(ERROR) << "poll failed: " << strerror(errno);
+      break;
+    }
+
+    // Read the handshakes that made progress and drop the stalled ones,
+    // before new connections are added behind them.
+    now = Clock::now();
+    size_t kept = 0;
+    for (size_t i = 0; i < handshaking.size(); ++i) {
+      Handshaking conn = handshaking[i];
+      short revents = pfds[i + 1].revents;
+      HandshakeResult result = HandshakeResult::kPending;
+      std::string key;
+      if (revents != 0)
+        result = read_handshake_(conn.fd, &key);
+      // A peer that hung up will never complete its handshake.
+      if (result == HandshakeResult::kPending &&
+          (revents & (POLLRDHUP | POLLHUP | POLLERR)))
+        result = HandshakeResult::kFailed;
+      if (result == HandshakeResult::kPending && now >= conn.deadline) {
+        LOG(ERROR) << "Handshake of new connection timed out.";
+        ::close(conn.fd);
+        continue;
+      }
+      if (result == HandshakeResult::kFailed) {
+        LOG(ERROR) << "Read handshake of new connection failed.";
+        ::close(conn.fd);
+        continue;
+      }
+      if (result == HandshakeResult::kDone)
+        Publish(key, conn.fd);
+      else
+        handshaking[kept++] = conn;
+    }
+    handshaking.resize(kept);
+
+    hung_up.clear();
+    for (size_t i = queued_begin; i < pfds.size(); ++i)
+      if (pfds[i].revents != 0)
+        hung_up.push_back(pfds[i].fd);
+    if (!hung_up.empty())
+      Reap(hung_up, &lingering);
+
+    if (!(pfds[0].revents & POLLIN))
+      continue;
+    while (true) {
+      int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd >= 0) {
+        handshaking.push_back(Handshaking{
+            fd, now + std::chrono::milliseconds(kHandshakeTimeoutMs)});
+        continue;
+      }
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        LOG(ERROR) << "accept failed: " << strerror(errno);
+      break;
+    }
+  }
+
+  for (const auto &conn : handshaking)
+    ::close(conn.fd);
+}
+
+void KeyedAcceptor::Publish(const std::string &key, int fd) {
+  std::function<void()> on_arrival;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    ready_[key].push_back(fd);
+    auto iter = watchers_.find(key);
+    if (iter != watchers_.end())
+      on_arrival = iter->second;
+  }
+  cv_.notify_all();
+  if (on_arrival)
+    on_arrival();
+}
+
+void KeyedAcceptor::Reap(const std::vector<int> &fds,
+                         std::set<int> *lingering) {
+  std::lock_guard<std::mutex> lock(mu_);
+  for (auto iter = ready_.begin(); iter != ready_.end();) {
+    auto &queue = iter->second;
+    for (auto fd_iter = queue.begin(); fd_iter != queue.end();) {
+      int fd = *fd_iter;
+      if (std::find(fds.begin(), fds.end(), fd) == fds.end()) {
+        ++fd_iter;
+        continue;
+      }
+      // The fd may have been taken and its number reused since the poll,
+      // so check again while it cannot be taken.
+      char byte = 0;
+      ssize_t n = PeekInput(fd, &byte, 1);
+      if (n > 0) {
+        lingering->insert(fd);
+        ++fd_iter;
+      } else if (n == 0 || n == -1) {
+        ::close(fd);
+        fd_iter = queue.erase(fd_iter);
+      } else {
+        ++fd_iter;
+      }
+    }
+    if (queue.empty())
+      iter = ready_.erase(iter);
+    else
+      ++iter;
+  }
+}
+
+std::shared_ptr<KeyedAcceptor>
+SharedAcceptor(const std::string &address,
+               const std::function<int(std::string *address)> &listen,
+               KeyedAcceptor::HandshakeReader read_handshake) {
+  static std::mutex mu;
+  static auto *acceptors =
+      new std::map<std::string, std::shared_ptr<KeyedAcceptor>>();
+  std::lock_guard<std::mutex> lock(mu);
+  if (!address.empty()) {
+    auto iter = acceptors->find(address);
+    if (iter != acceptors->end())
+      return iter->second;
+  }
+
+  std::string bound_address = address;
+  int listen_fd = listen(&bound_address);
+  if (listen_fd < 0)
+    return nullptr;
+  auto acceptor =
+      std::make_shared<KeyedAcceptor>(listen_fd, std::move(read_handshake));
+  acceptors->emplace(bound_address, acceptor);
+  return acceptor;
+}
+
+KeyedConnector::KeyedConnector(const char *name, bool server, Dial dial,
+                               Setup setup)
+    : name_(name), server_(server), dial_(std::move(dial)),
+      setup_(std::move(setup)) {}
+
+int KeyedConnector::Connect(const std::string &key, bool wait) {
+  int fd = fd_.load();
+  if (fd >= 0)
+    return fd;
+
+  // A caller that does not wait must not block behind one that does.
+  std::unique_lock<std::mutex> lock(connect_mu_, std::defer_lock);
+  if (wait)
+    lock.lock();
+  else if (!lock.try_lock())
+    return -1;
+  fd = fd_.load();
+  if (fd >= 0)
+    return fd;
+  if (closed_.load())
+    return -1;
+
+  if (server_) {
+    if (acceptor_ == nullptr)
+      fd = -1;
+    else if (wait)
+      fd = acceptor_->Take(key);
+    else if ((fd = acceptor_->TryTake(key)) < 0)
+      return -1;
+  } else if (wait) {
+    fd = dial_(key);
+  } else {
+    // Dialing blocks up to the connect timeout.
+    return -1;
+  }
+  if (fd < 0) {
+    LOG(ERROR) << name_ << " connect failed, key: " << key;
+    return -1;
+  }
+
+  setup_(fd);
+  fd_.store(fd);
+  return fd;
+}
+
+void KeyedConnector::SetReadyNotifier(const std::string &key,
+                                      std::shared_ptr<ReadyNotifier> notifier) {
+  // Once connected the socket itself signals readiness, until then the
+  // acceptor tells when the connection arrives.
+  if (!server_ || acceptor_ == nullptr)
+    return;
+  if (notifier == nullptr) {
+    acceptor_->Watch(key, nullptr);
+    return;
+  }
+  std::weak_ptr<ReadyNotifier> weak_notifier = notifier;
+  acceptor_->Watch(key, [weak_notifier]() {
+    if (auto notifier = weak_notifier.lock())
+      notifier->Notify();
+  });
+}
+
+int KeyedConnector::Release() {
+  closed_.store(true);
+  return fd_.exchange(-1);
+}
+
+void KeyedConnector::Cancel() {
+  closed_.store(true);
+  int fd = fd_.load();
+  if (fd >= 0)
+    shutdown(fd, SHUT_RDWR);
+}
+} // namespace primihub::link
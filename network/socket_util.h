@@ -0,0 +1,186 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef NETWORK_SOCKET_UTIL_H_
+#define NETWORK_SOCKET_UTIL_H_
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace primihub::link {
+class ReadyNotifier;
+
+// Writes exactly size bytes, retrying on EINTR and partial writes.
+bool SendAll(int fd, const char *buf, size_t size, int flags = 0);
+
+// Reads exactly size bytes, fails on EOF.
+bool RecvAll(int fd, char *buf, size_t size);
+
+// Whether fd has input (or EOF) to read, without blocking.
+bool HasInput(int fd);
+
+// Outcome of reading a handshake without blocking, kPending until all of it
+// has arrived.
+enum class HandshakeResult { kDone, kPending, kFailed };
+
+// Every socket channel connection starts with the key of the channel it
+// belongs to, so one listening port can serve a channel and all its forks.
+// The reader consumes the handshake only once it is complete and never
+// blocks.
+bool WriteKeyHandshake(int fd, const std::string &key);
+HandshakeResult ReadKeyHandshake(int fd, std::string *key);
+
+// Creates a listening TCP socket, port 0 picks a free port which is returned
+// in bound_port. Returns -1 on failure.
+int ListenTcp(const std::string &host, uint16_t port, uint16_t *bound_port);
+
+// Connects to host:port, retrying until timeout_ms while the peer is not
+// listening yet. Returns -1 on failure.
+int ConnectTcp(const std::string &host, uint16_t port, int timeout_ms);
+
+// Creates a listening AF_UNIX socket of type (SOCK_STREAM or SOCK_SEQPACKET)
+// at path, a leading '@' selects the abstract namespace. Returns -1 on
+// failure.
+int ListenUnix(const std::string &path, int type);
+
+// Connects to path, retrying until timeout_ms while the peer is not
+// listening yet. Returns -1 on failure.
+int ConnectUnix(const std::string &path, int type, int timeout_ms);
+
+// Handshake of message oriented sockets, the key is sent as one packet.
+bool WritePacketHandshake(int fd, const std::string &key);
+HandshakeResult ReadPacketHandshake(int fd, std::string *key);
+
+// KeyedAcceptor accepts connections on a listening socket in the background
+// and hands them out by the key sent in their handshake. The accept thread
+// polls the listening socket together with the connections whose handshake
+// is incomplete, so a slow or silent client does not hold up the others,
+// and drops a connection that has not finished its handshake within
+// kHandshakeTimeoutMs. It also watches the connections waiting to be taken
+// and closes those whose peer hung up without sending anything, such as
+// the warm forks of a ChannelPool that were never leased.
+class KeyedAcceptor {
+public:
+  using HandshakeReader =
+      std::function<HandshakeResult(int fd, std::string *key)>;
+
+  static constexpr int kHandshakeTimeoutMs = 10000;
+
+  explicit KeyedAcceptor(int listen_fd,
+                         HandshakeReader read_handshake = ReadKeyHandshake);
+  ~KeyedAcceptor();
+
+  // Blocks until a connection for key has arrived, returns its fd or -1 once
+  // the acceptor is stopped.
+  int Take(const std::string &key);
+
+  // Returns the fd of a connection for key that has arrived already, or -1.
+  int TryTake(const std::string &key);
+
+  // Calls on_arrival (from the accept thread) when a connection for key
+  // arrives, right away if one is waiting. An empty function unregisters.
+  void Watch(const std::string &key, std::function<void()> on_arrival);
+
+  void Stop();
+
+private:
+  void AcceptLoop();
+  // Queues fd for key and tells its watcher.
+  void Publish(const std::string &key, int fd);
+  // Closes the queued connections among fds whose peer is gone and left no
+  // data, adds those with data left to lingering.
+  void Reap(const std::vector<int> &fds, std::set<int> *lingering);
+
+  int listen_fd_;
+  HandshakeReader read_handshake_;
+  std::thread accept_thread_;
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::map<std::string, std::deque<int>> ready_;
+  std::map<std::string, std::function<void()>> watchers_;
+  bool stop_{false};
+};
+
+// Returns the acceptor shared by the server channels of the process that
+// listen on address, e.g. "tcp:9000" or "unix:/tmp/party0". If there is
+// none yet, listen is called for the listening fd and may set address, a
+// TCP port 0 for instance is only known once bound. An empty address
+// always creates a new acceptor. Returns nullptr if listen fails.
+std::shared_ptr<KeyedAcceptor>
+SharedAcceptor(const std::string &address,
+               const std::function<int(std::string *address)> &listen,
+               KeyedAcceptor::HandshakeReader read_handshake);
+
+// KeyedConnector establishes the one connection of a socket channel. A
+// client dials and sends its key, a server takes the connection for its key
+// from a KeyedAcceptor. The first send, recv or readiness check connects,
+// the others wait for it or, without wait, return right away.
+class KeyedConnector {
+public:
+  // Connects a client and sends the handshake for key, returns the fd or -1.
+  using Dial = std::function<int(const std::string &key)>;
+  // Configures a new connection before it is published.
+  using Setup = std::function<void(int fd)>;
+
+  KeyedConnector(const char *name, bool server, Dial dial, Setup setup);
+
+  // Servers only, nullptr if listening failed.
+  void SetAcceptor(std::shared_ptr<KeyedAcceptor> acceptor) {
+    acceptor_ = std::move(acceptor);
+  }
+
+  // Returns the fd of the connection for key, connecting first if needed.
+  // Without wait it returns -1 unless connected already, a server takes its
+  // connection if it has arrived but a client never dials.
+  int Connect(const std::string &key, bool wait);
+
+  // The connected fd or -1.
+  int fd() const { return fd_.load(); }
+
+  // Tells notifier when the connection for key arrives at a server, until
+  // then the channel has no socket to poll. nullptr unregisters.
+  void SetReadyNotifier(const std::string &key,
+                        std::shared_ptr<ReadyNotifier> notifier);
+
+  // Makes every later Connect fail and returns the fd for the caller to
+  // close, or -1.
+  int Release();
+
+  // Makes every later Connect fail and shuts the connection down, pending
+  // operations return.
+  void Cancel();
+
+private:
+  const char *name_;
+  bool server_;
+  Dial dial_;
+  Setup setup_;
+  std::shared_ptr<KeyedAcceptor> acceptor_{nullptr};
+  std::mutex connect_mu_;
+  std::atomic<int> fd_{-1};
+  std::atomic<bool> closed_{false};
+};
+} // namespace primihub::link
+#endif // NETWORK_SOCKET_UTIL_H_
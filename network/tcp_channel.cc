@@ -0,0 +1,485 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "network/tcp_channel.h"
+#include "network/ready_notifier.h"
+#include "network/trace.h"
+
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+namespace primihub::link {
+namespace {
+// At most this many zero-copy payloads stay pinned before a pinned send
+// waits for the oldest one.
+constexpr size_t kMaxPinnedSends = 64;
+constexpr int kReapTimeoutMs = 30000;
+
+bool SendFrameCopy(int fd, uint64_t length, const char *buff, size_t size) {
+  iovec iov[2];
+  iov[0].iov_base = &length;
+  iov[0].iov_len = sizeof(length);
+  iov[1].iov_base = const_cast<char *>(buff);
+  iov[1].iov_len = size;
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = size > 0 ? 2 : 1;
+
+  size_t remain = sizeof(length) + size;
+  while (true) {
+    ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      LOG(ERROR) << "send failed: " << strerror(errno);
+      return false;
+    }
+    remain -= n;
+    if (remain == 0)
+      return true;
+
+    while (static_cast<size_t>(n) >= msg.msg_iov->iov_len) {
+      n -= msg.msg_iov->iov_len;
+      msg.msg_iov++;
+      msg.msg_iovlen--;
+    }
+    msg.msg_iov->iov_base = static_cast<char *>(msg.msg_iov->iov_base) + n;
+    msg.msg_iov->iov_len -= n;
+  }
+}
+} // namespace
+
+TcpChannel::TcpChannel(TcpChannel::ChannelRole role, const std::string &host,
+                       uint16_t port)
+    : TcpChannel(role, host, port, Options()) {}
+
+TcpChannel::TcpChannel(TcpChannel::ChannelRole role, const std::string &host,
+                       uint16_t port, const Options &options)
+    : TcpChannel(role, host, port, options,
+                 options.io_backend == IoBackend::kIoUring
+                     ? IoUringReactor::Create()
+                     : nullptr) {
+  if (options_.io_backend == IoBackend::kIoUring && reactor_ == nullptr)
+    LOG(WARNING) << "io_uring is not available, TcpChannel falls back to "
+                 << "plain socket calls.";
+}
+
+TcpChannel::TcpChannel(TcpChannel::ChannelRole role, const std::string &host,
+                       uint16_t port, const Options &options,
+                       std::shared_ptr<IoUringReactor> reactor)
+    : connector_("TcpChannel", role == ChannelRole::SERVER,
+                 [this](const std::string &key) { return Dial(key); },
+                 [this](int fd) { Setup(fd); }) {
+  this->role_ = role;
+  this->host_ = host;
+  this->port_ = port;
+  this->options_ = options;
+  this->reactor_ = std::move(reactor);
+
+  if (role_ == ChannelRole::SERVER) {
+    // Port 0 always listens anew, on a port known once bound.
+    std::string address = port_ == 0 ? "" : "tcp:" + std::to_string(port_);
+    auto acceptor = SharedAcceptor(
+        address,
+        [this](std::string *address) {
+          uint16_t bound_port = 0;
+          int fd = ListenTcp(host_, port_, &bound_port);
+          if (fd >= 0) {
+            port_ = bound_port;
+            *address = "tcp:" + std::to_string(bound_port);
+          }
+          return fd;
+        },
+        ReadKeyHandshake);
+    if (acceptor == nullptr)
+      LOG(ERROR) << "TcpChannel listen on " << host << ":" << port
+                 << " failed.";
+    connector_.SetAcceptor(std::move(acceptor));
+  }
+}
+
+TcpChannel::~TcpChannel() { close(); }
+
+void TcpChannel::SetKey(const std::string &key) {
+  // Channel sets the key of a fork once more, a pooled fork is connected
+  // by then.
+  if (key == key_)
+    return;
+  if (connector_.fd() >= 0) {
+    LOG(ERROR) << "TcpChannel " << key_
+               << " is connected already, can not change key to " << key;
+    return;
+  }
+  this->key_ = key;
+}
+
+int TcpChannel::Connect(bool wait) { return connector_.Connect(key_, wait); }
+
+int TcpChannel::Dial(const std::string &key) {
+  int fd = ConnectTcp(host_, port_, options_.connect_timeout_ms);
+  if (fd >= 0 && !WriteKeyHandshake(fd, key)) {
+    ::close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+void TcpChannel::Setup(int fd) {
+  int on = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  if (options_.zerocopy_threshold > 0) {
+    if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0) {
+      zerocopy_enabled_ = true;
+    } else {
+      LOG(WARNING) << "SO_ZEROCOPY is not supported, fall back to copy, "
+                   << "error: " << strerror(errno);
+    }
+  }
+
+  if (reactor_ != nullptr) {
+    fixed_index_ = reactor_->RegisterFile(fd);
+    if (fixed_index_ < 0)
+      LOG(WARNING) << "TcpChannel " << key_
+                   << " falls back to plain socket calls.";
+  }
+}
+
+bool TcpChannel::ReadExact(int fd, char *buf, size_t size) {
+  if (fixed_index_ >= 0)
+    return reactor_->RecvAll(fixed_index_, buf, size);
+  return RecvAll(fd, buf, size);
+}
+
+bool TcpChannel::ReadHeader(int fd, uint64_t *length) {
+  // Until the header arrives the receiver waits for its peer.
+  TraceSpan span("wait", key_);
+  return ReadExact(fd, reinterpret_cast<char *>(length), sizeof(*length));
+}
+
+retcode TcpChannel::SendImpl(const std::string &send_buf) {
+  return WriteFrame(send_buf.data(), send_buf.size(), nullptr);
+}
+
+retcode TcpChannel::SendImpl(std::string_view send_buff_sv) {
+  return WriteFrame(send_buff_sv.data(), send_buff_sv.size(), nullptr);
+}
+
+retcode TcpChannel::SendImpl(const char *buff, size_t size) {
+  return WriteFrame(buff, size, nullptr);
+}
+
+retcode TcpChannel::SendImpl(const char *buff, size_t size,
+                             std::shared_ptr<const void> keepalive) {
+  return WriteFrame(buff, size, std::move(keepalive));
+}
+
+retcode TcpChannel::WriteFrame(const char *buff, size_t size,
+                               std::shared_ptr<const void> keepalive) {
+  TraceSpan span("TcpChannel::SendImpl", key_, size);
+  int fd = Connect();
+  if (fd < 0)
+    return retcode::FAIL;
+
+  std::lock_guard<std::mutex> lock(send_mu_);
+  uint64_t length = size;
+  bool zerocopy = zerocopy_enabled_ && size >= options_.zerocopy_threshold;
+  if (!zerocopy && fixed_index_ >= 0)
+    return reactor_->SendFrame(fixed_index_, buff, size) ? retcode::SUCCESS
+                                                         : retcode::FAIL;
+  if (!zerocopy)
+    return SendFrameCopy(fd, length, buff, size) ? retcode::SUCCESS
+                                                  : retcode::FAIL;
+
+  if (!SendAll(fd, reinterpret_cast<const char *>(&length), sizeof(length),
+               MSG_MORE))
+    return retcode::FAIL;
+  uint32_t first_id = zc_issued_;
+  if (!ZeroCopyWrite(buff, size))
+    return retcode::FAIL;
+
+  bool ok = true;
+  if (keepalive == nullptr) {
+    // The caller owns the buffer again once we return, wait for the kernel.
+    ok = ReapCompletions(zc_issued_, true);
+  } else {
+    if (zc_issued_ != first_id)
+      zc_pinned_.emplace_back(zc_issued_, std::move(keepalive));
+    if (zc_pinned_.size() > kMaxPinnedSends)
+      ok = ReapCompletions(zc_pinned_.front().first, true);
+    else
+      ok = ReapCompletions(zc_completed_, false);
+  }
+  return ok ? retcode::SUCCESS : retcode::FAIL;
+}
+
+bool TcpChannel::ZeroCopyWrite(const char *buff, size_t size) {
+  int fd = connector_.fd();
+  while (size > 0) {
+    ssize_t n = send(fd, buff, size, MSG_ZEROCOPY | MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == ENOBUFS) {
+        // Too many notifications outstanding, wait for one or copy the rest.
+        if (zc_issued_ != zc_completed_) {
+          if (!ReapCompletions(zc_completed_ + 1, true))
+            return false;
+          continue;
+        }
+        return SendAll(fd, buff, size);
+      }
+      LOG(ERROR) << "zero-copy send failed: " << strerror(errno);
+      return false;
+    }
+    zc_issued_++;
+    zc_sends_++;
+    buff += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool TcpChannel::ReapCompletions(uint32_t target, bool wait) {
+  int fd = connector_.fd();
+  if (fd < 0)
+    return false;
+
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(kReapTimeoutMs);
+  while (true) {
+    while (true) {
+      char control[256];
+      msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        break;
+
+      for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr;
+           cm = CMSG_NXTHDR(&msg, cm)) {
+        if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+            !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+          continue;
+        auto serr = reinterpret_cast<sock_extended_err *>(CMSG_DATA(cm));
+        if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0)
+          continue;
+
+        uint32_t lo = serr->ee_info;
+        uint32_t hi = serr->ee_data;
+        if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+          zc_copied_ += hi - lo + 1;
+        if (lo != zc_completed_) {
+          zc_out_of_order_[lo] = hi;
+          continue;
+        }
+        zc_completed_ = hi + 1;
+        for (auto iter = zc_out_of_order_.find(zc_completed_);
+             iter != zc_out_of_order_.end();
+             iter = zc_out_of_order_.find(zc_completed_)) {
+          zc_completed_ = iter->second + 1;
+          zc_out_of_order_.erase(iter);
+        }
+      }
+    }
+
+    while (!zc_pinned_.empty() &&
+           static_cast<int32_t>(zc_completed_ - zc_pinned_.front().first) >= 0)
+      zc_pinned_.pop_front();
+
+    if (static_cast<int32_t>(zc_completed_ - target) >= 0 || !wait)
+      return true;
+    if (std::chrono::steady_clock::now() > deadline) {
+      LOG(ERROR) << "Wait for zero-copy completion timeout, key: " << key_;
+      return false;
+    }
+
+    // The error queue turns the socket readable for POLLERR only.
+    pollfd pfd{fd, 0, 0};
+    int ret = poll(&pfd, 1, 100);
+    if (ret < 0 && errno != EINTR) {
+      LOG(ERROR) << "poll failed: " << strerror(errno);
+      return false;
+    }
+    if (pfd.revents & POLLNVAL)
+      return false;
+    if ((pfd.revents & POLLHUP) && !(pfd.revents & POLLERR))
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+retcode TcpChannel::RecvImpl(std::string *recv_buf) {
+  TraceSpan span("TcpChannel::RecvImpl", key_);
+  int fd = Connect();
+  if (fd < 0)
+    return retcode::FAIL;
+
+  std::lock_guard<std::mutex> lock(recv_mu_);
+  uint64_t length = 0;
+  if (!ReadHeader(fd, &length))
+    return retcode::FAIL;
+  span.setBytes(length);
+
+  if (length > options_.max_message_size) {
+    LOG(ERROR) << "TcpChannel " << key_ << " received length " << length
+               << " above max message size " << options_.max_message_size;
+    return retcode::FAIL;
+  }
+  recv_buf->resize(length);
+  if (!ReadExact(fd, &(*recv_buf)[0], length))
+    return retcode::FAIL;
+  return retcode::SUCCESS;
+}
+
+retcode TcpChannel::RecvImpl(char *recv_buf, size_t recv_size) {
+  TraceSpan span("TcpChannel::RecvImpl", key_, recv_size);
+  int fd = Connect();
+  if (fd < 0)
+    return retcode::FAIL;
+
+  std::lock_guard<std::mutex> lock(recv_mu_);
+  uint64_t length = 0;
+  if (!ReadHeader(fd, &length))
+    return retcode::FAIL;
+
+  if (length != recv_size) {
+    LOG(ERROR) << "data length does not match: "
+               << " "
+               << "expected: " << recv_size << " "
+               << "actually: " << length;
+    // Drop the payload so that the next message is read from its header.
+    char discard[4096];
+    while (length > 0) {
+      size_t n = length < sizeof(discard) ? length : sizeof(discard);
+      if (!ReadExact(fd, discard, n))
+        break;
+      length -= n;
+    }
+    return retcode::FAIL;
+  }
+
+  if (!ReadExact(fd, recv_buf, recv_size))
+    return retcode::FAIL;
+  return retcode::SUCCESS;
+}
+
+std::shared_ptr<ChannelBase> TcpChannel::ForkImpl(const std::string &key) {
+  // Forks share the reactor, so their I/O is submitted together.
+  std::shared_ptr<TcpChannel> channel(
+      new TcpChannel(role_, host_, port_, options_, reactor_));
+  channel->SetKey(key);
+  return channel;
+}
+
+bool TcpChannel::HasPendingData() {
+  int fd = connector_.fd();
+  return fd >= 0 && HasInput(fd);
+}
+
+int TcpChannel::ReadinessFd() {
+  // A server picks up its connection once it has arrived. A client has
+  // nothing to poll until Warmup or its first send or recv connects it,
+  // dialing here would block the selector.
+  return Connect(false);
+}
+
+retcode TcpChannel::Warmup() {
+  // The client pays for connect and handshake here instead of on its first
+  // message, the server takes its connection if it has arrived already.
+  if (Connect(role_ == ChannelRole::CLIENT) < 0 &&
+      role_ == ChannelRole::CLIENT)
+    return retcode::FAIL;
+  return retcode::SUCCESS;
+}
+
+void TcpChannel::SetReadyNotifier(std::shared_ptr<ReadyNotifier> notifier) {
+  connector_.SetReadyNotifier(key_, std::move(notifier));
+}
+
+void TcpChannel::close() {
+  {
+    std::lock_guard<std::mutex> lock(send_mu_);
+    if (connector_.fd() >= 0 && zc_issued_ != zc_completed_)
+      ReapCompletions(zc_issued_, true);
+    zc_pinned_.clear();
+  }
+
+  int fd = connector_.Release();
+  if (fd >= 0) {
+    shutdown(fd, SHUT_RDWR);
+    if (fixed_index_ >= 0) {
+      // The fixed file table holds a reference to the socket as well.
+      reactor_->UnregisterFile(fixed_index_);
+      fixed_index_ = -1;
+    }
+    ::close(fd);
+  }
+}
+
+void TcpChannel::cancel() { connector_.Cancel(); }
+
+retcode TcpChannel::ProbeImpl(uint64_t *size, bool wait, bool *available) {
+  *available = false;
+  int fd = Connect(wait || role_ == ChannelRole::CLIENT);
+  if (fd < 0)
+    return wait ? retcode::FAIL : retcode::SUCCESS;
+
+  // The length leads every frame, peeking it leaves the frame in the socket.
+  std::lock_guard<std::mutex> lock(recv_mu_);
+  uint64_t length = 0;
+  ssize_t n = 0;
+  {
+    TraceSpan span("wait", key_);
+    do {
+      n = recv(fd, &length, sizeof(length),
+               MSG_PEEK | (wait ? MSG_WAITALL : MSG_DONTWAIT));
+    } while ((n < 0 && errno == EINTR) ||
+             (wait && n > 0 && static_cast<size_t>(n) < sizeof(length)));
+  }
+  if (n < 0) {
+    if (!wait && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return retcode::SUCCESS;
+    LOG(ERROR) << "recv failed: " << strerror(errno);
+    return retcode::FAIL;
+  }
+  if (n == 0) {
+    LOG(ERROR) << "TcpChannel " << key_ << " is closed by the peer.";
+    return retcode::FAIL;
+  }
+  if (static_cast<size_t>(n) < sizeof(length))
+    return retcode::SUCCESS;
+  *size = length;
+  *available = true;
+  return retcode::SUCCESS;
+}
+
+} // namespace primihub::link
@@ -0,0 +1,143 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef NETWORK_TCP_CHANNEL_H_
+#define NETWORK_TCP_CHANNEL_H_
+
+#include "network/base_channel.h"
+#include "network/io_uring_reactor.h"
+#include "network/socket_util.h"
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string_view>
+
+namespace primihub::link {
+// TcpChannel sends every message as an 8 byte length followed by the payload
+// over one TCP connection per key. The server side listens on port and
+// routes incoming connections by the key in their handshake, so a channel
+// and all its forks share one port. The connection is established by the
+// first send or recv.
+//
+// With IoBackend::kIoUring a channel and all its forks share one
+// IoUringReactor, which batches the socket I/O of all of them into few
+// io_uring_enter calls. This pays off with many forks talking at the same
+// time, it falls back to plain socket calls if io_uring is not available.
+class TcpChannel : public ChannelBase {
+public:
+  enum ChannelRole {
+    SERVER,
+    CLIENT
+  };
+
+  enum class IoBackend {
+    kSyscall,
+    kIoUring
+  };
+
+  struct Options {
+    // Payloads of at least this many bytes are sent with MSG_ZEROCOPY, the
+    // kernel then reads them straight from user memory instead of copying
+    // them. 0 disables zero-copy sends.
+    size_t zerocopy_threshold{0};
+    int connect_timeout_ms{10000};
+    // A received length above this fails the receive before anything is
+    // allocated for it.
+    uint64_t max_message_size{4ULL << 30};
+    IoBackend io_backend{IoBackend::kSyscall};
+  };
+
+  // For the server, port 0 listens on a free port, see port().
+  TcpChannel(ChannelRole role, const std::string &host, uint16_t port);
+  TcpChannel(ChannelRole role, const std::string &host, uint16_t port,
+             const Options &options);
+  ~TcpChannel() override;
+
+  retcode SendImpl(const std::string &send_buf) override;
+  retcode SendImpl(std::string_view send_buff_sv) override;
+  retcode SendImpl(const char *buff, size_t size) override;
+  retcode SendImpl(const char *buff, size_t size,
+                   std::shared_ptr<const void> keepalive) override;
+  retcode RecvImpl(std::string *recv_buf) override;
+  retcode RecvImpl(char *recv_buf, size_t recv_size) override;
+  retcode ProbeImpl(uint64_t *size, bool wait, bool *available) override;
+  std::shared_ptr<ChannelBase> ForkImpl(const std::string &key) override;
+  void SetKey(const std::string &key) override;
+  bool HasPendingData() override;
+  int ReadinessFd() override;
+  retcode Warmup() override;
+  void SetReadyNotifier(std::shared_ptr<ReadyNotifier> notifier) override;
+  void close() override;
+  void cancel() override;
+
+  uint16_t port() const { return port_; }
+
+  // Whether send and recv go through io_uring, false after a fallback.
+  bool usingIoUring() const { return reactor_ != nullptr; }
+  std::shared_ptr<IoUringReactor> reactor() const { return reactor_; }
+
+  // Number of send calls issued with MSG_ZEROCOPY, and how many of them the
+  // kernel copied after all (always the case on loopback).
+  uint64_t zerocopySends() const { return zc_sends_.load(); }
+  uint64_t zerocopyCopied() const { return zc_copied_.load(); }
+
+private:
+  TcpChannel(ChannelRole role, const std::string &host, uint16_t port,
+             const Options &options,
+             std::shared_ptr<IoUringReactor> reactor);
+  // Without wait a server returns -1 unless its connection has arrived.
+  int Connect(bool wait = true);
+  int Dial(const std::string &key);
+  void Setup(int fd);
+  bool ReadExact(int fd, char *buf, size_t size);
+  // Reads the length that precedes every message.
+  bool ReadHeader(int fd, uint64_t *length);
+  retcode WriteFrame(const char *buff, size_t size,
+                     std::shared_ptr<const void> keepalive);
+  bool ZeroCopyWrite(const char *buff, size_t size);
+  // Reads zero-copy completions until at least target sends have completed
+  // (or none if target is already reached) and releases pinned buffers.
+  bool ReapCompletions(uint32_t target, bool wait);
+
+  ChannelRole role_;
+  std::string host_;
+  uint16_t port_;
+  Options options_;
+  std::string key_{"default"};
+  std::shared_ptr<IoUringReactor> reactor_{nullptr};
+  // Index of the socket in the fixed file table of reactor_, written before
+  // the fd is published.
+  int fixed_index_{-1};
+
+  KeyedConnector connector_;
+  std::mutex send_mu_;
+  std::mutex recv_mu_;
+
+  // Zero-copy state, guarded by send_mu_. Every successful MSG_ZEROCOPY
+  // send gets the next 32 bit id, the kernel reports completed id ranges on
+  // the error queue.
+  bool zerocopy_enabled_{false};
+  uint32_t zc_issued_{0};
+  uint32_t zc_completed_{0};
+  std::map<uint32_t, uint32_t> zc_out_of_order_;
+  std::deque<std::pair<uint32_t, std::shared_ptr<const void>>> zc_pinned_;
+  std::atomic<uint64_t> zc_sends_{0};
+  std::atomic<uint64_t> zc_copied_{0};
+};
+} // namespace primihub::link
+
+#endif // NETWORK_TCP_CHANNEL_H_
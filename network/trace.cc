@@ -0,0 +1,340 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "network/trace.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace primihub::link {
+#ifndef PH_NO_TRACE
+std::atomic<bool> g_trace_enabled{false};
+#endif
+
+namespace {
+struct TraceEvent {
+  const char *name;
+  uint64_t begin_ns;
+  uint64_t end_ns;
+  uint64_t bytes;
+  uint32_t key;
+  int tid;
+  bool instant;
+};
+
+// A slot holds event number seq - 1, seq is 0 while the owner rewrites it.
+struct TraceSlot {
+  std::atomic<uint64_t> seq{0};
+  TraceEvent event;
+};
+
+// Only the owning thread writes slots and head. Exporters read the slots
+// below head and keep those whose seq was the same before and after the
+// copy, so an event the owner overwrote meanwhile is skipped.
+//
+// When its thread exits a ring goes to the free list of the registry and
+// the next thread that starts recording takes it over, with the events
+// still in it. Threads started per operation, as by Channel::asyncRecv,
+// thus reuse a few rings instead of leaving one behind each.
+struct ThreadRing {
+  explicit ThreadRing(size_t capacity)
+      : slots(new TraceSlot[capacity]), mask(capacity - 1) {}
+
+  std::unique_ptr<TraceSlot[]> slots;
+  uint64_t mask;
+  // Thread id of the current owner, events carry the id of their thread.
+  int tid{0};
+  std::atomic<uint64_t> head{0};
+  // Events below this index were dropped by Clear.
+  std::atomic<uint64_t> cleared{0};
+  // Key ids this thread has seen, so that recording needs no lock.
+  std::unordered_map<std::string, uint32_t> key_ids;
+};
+
+struct Registry {
+  std::mutex mu;
+  std::vector<std::shared_ptr<ThreadRing>> rings;
+  // Rings of exited threads, a subset of rings.
+  std::vector<std::shared_ptr<ThreadRing>> free_rings;
+  std::vector<std::string> keys;
+  std::unordered_map<std::string, uint32_t> key_ids;
+  std::atomic<size_t> capacity{Tracer::kDefaultEventsPerThread};
+};
+
+// First event still held by ring, given its head.
+uint64_t FirstHeld(const ThreadRing &ring, uint64_t head) {
+  uint64_t capacity = ring.mask + 1;
+  uint64_t first = head > capacity ? head - capacity : 0;
+  return std::max(first, ring.cleared.load(std::memory_order_acquire));
+}
+
+Registry &GetRegistry() {
+  // Leaked so that threads exiting after main can still record.
+  static Registry *registry = new Registry();
+  return *registry;
+}
+
+// Holds the ring of a thread and hands it back when the thread exits.
+struct RingOwner {
+  std::shared_ptr<ThreadRing> ring;
+
+  ~RingOwner() {
+    if (ring == nullptr)
+      return;
+    Registry &registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mu);
+    registry.free_rings.push_back(std::move(ring));
+  }
+};
+
+// Takes a free ring of capacity events, rings of another capacity that
+// hold no events any more are released on the way. Called under mu.
+[[maybe_unused]] std::shared_ptr<ThreadRing>
+TakeFreeRing(Registry *registry, size_t capacity) {
+  std::shared_ptr<ThreadRing> taken;
+  auto &free_rings = registry->free_rings;
+  for (auto iter = free_rings.begin(); iter != free_rings.end();) {
+    ThreadRing *ring = iter->get();
+    if (taken == nullptr && ring->mask + 1 == capacity) {
+      taken = std::move(*iter);
+      iter = free_rings.erase(iter);
+    } else if (ring->mask + 1 != capacity &&
+               FirstHeld(*ring, ring->head.load()) == ring->head.load()) {
+      auto &rings = registry->rings;
+      rings.erase(std::find(rings.begin(), rings.end(), *iter));
+      iter = free_rings.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+  return taken;
+}
+
+[[maybe_unused]] ThreadRing *LocalRing() {
+  thread_local RingOwner owner;
+  if (owner.ring == nullptr) {
+    Registry &registry = GetRegistry();
+    size_t capacity = registry.capacity.load();
+    {
+      std::lock_guard<std::mutex> lock(registry.mu);
+      owner.ring = TakeFreeRing(&registry, capacity);
+      if (owner.ring == nullptr) {
+        owner.ring = std::make_shared<ThreadRing>(capacity);
+        registry.rings.push_back(owner.ring);
+      }
+    }
+    owner.ring->tid = static_cast<int>(syscall(SYS_gettid));
+  }
+  return owner.ring.get();
+}
+
+[[maybe_unused]] uint32_t InternKey(ThreadRing *ring, const std::string &key) {
+  auto iter = ring->key_ids.find(key);
+  if (iter != ring->key_ids.end())
+    return iter->second;
+  Registry &registry = GetRegistry();
+  uint32_t id;
+  {
+    std::lock_guard<std::mutex> lock(registry.mu);
+    auto global = registry.key_ids.find(key);
+    if (global != registry.key_ids.end()) {
+      id = global->second;
+    } else {
+      id = static_cast<uint32_t>(registry.keys.size());
+      registry.keys.push_back(key);
+      registry.key_ids.emplace(key, id);
+    }
+  }
+  ring->key_ids.emplace(key, id);
+  return id;
+}
+
+void AppendEscaped(std::string *out, const std::string &value) {
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      out->push_back('\\');
+      out->push_back(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out->append(escaped);
+    } else {
+      out->push_back(c);
+    }
+  }
+}
+
+void AppendMicros(std::string *out, uint64_t ns) {
+  char number[32];
+  snprintf(number, sizeof(number), "%.3f", static_cast<double>(ns) / 1000);
+  out->append(number);
+}
+} // namespace
+
+#ifndef PH_NO_TRACE
+void TraceRecord(const char *name, const std::string &key, uint64_t begin_ns,
+                 uint64_t end_ns, uint64_t bytes, bool instant) {
+  ThreadRing *ring = LocalRing();
+  uint32_t key_id = InternKey(ring, key);
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+  TraceSlot &slot = ring->slots[head & ring->mask];
+  slot.seq.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.event = {name, begin_ns, end_ns, bytes, key_id, ring->tid, instant};
+  slot.seq.store(head + 1, std::memory_order_release);
+  ring->head.store(head + 1, std::memory_order_release);
+}
+#endif
+
+void Tracer::Enable(size_t events_per_thread) {
+  size_t capacity = 1;
+  while (capacity < events_per_thread)
+    capacity <<= 1;
+  GetRegistry().capacity = capacity;
+#ifndef PH_NO_TRACE
+  g_trace_enabled = true;
+#endif
+}
+
+void Tracer::Disable() {
+#ifndef PH_NO_TRACE
+  g_trace_enabled = false;
+#endif
+}
+
+void Tracer::Clear() {
+  Registry &registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mu);
+  for (auto &ring : registry.rings)
+    ring->cleared.store(ring->head.load(std::memory_order_acquire));
+}
+
+uint64_t Tracer::recordedEvents() {
+  Registry &registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mu);
+  uint64_t events = 0;
+  for (auto &ring : registry.rings) {
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    events += head - FirstHeld(*ring, head);
+  }
+  return events;
+}
+
+uint64_t Tracer::droppedEvents() {
+  Registry &registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mu);
+  uint64_t dropped = 0;
+  for (auto &ring : registry.rings) {
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    uint64_t cleared = ring->cleared.load(std::memory_order_acquire);
+    dropped += FirstHeld(*ring, head) - std::min(cleared, head);
+  }
+  return dropped;
+}
+
+size_t Tracer::rings() {
+  Registry &registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mu);
+  return registry.rings.size();
+}
+
+std::string Tracer::ChromeTraceJson() {
+  // A ring holds the events of every thread that owned it, they are
+  // grouped by thread again.
+  std::map<int, std::vector<TraceEvent>> threads;
+  std::vector<std::string> keys;
+  {
+    Registry &registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mu);
+    keys = registry.keys;
+    for (auto &ring : registry.rings) {
+      uint64_t head = ring->head.load(std::memory_order_acquire);
+      uint64_t first = FirstHeld(*ring, head);
+      for (uint64_t i = first; i < head; i++) {
+        TraceSlot &slot = ring->slots[i & ring->mask];
+        if (slot.seq.load(std::memory_order_acquire) != i + 1)
+          continue;
+        TraceEvent event = slot.event;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) == i + 1)
+          threads[event.tid].push_back(event);
+      }
+    }
+  }
+
+  uint64_t origin = UINT64_MAX;
+  for (auto &thread : threads) {
+    for (auto &event : thread.second)
+      origin = std::min(origin, event.begin_ns);
+  }
+
+  std::string pid = std::to_string(getpid());
+  std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  bool first = true;
+  for (auto &thread : threads) {
+    std::string tid = std::to_string(thread.first);
+    if (!first)
+      out.append(",");
+    first = false;
+    out.append("\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":")
+        .append(pid)
+        .append(",\"tid\":")
+        .append(tid)
+        .append(",\"args\":{\"name\":\"thread ")
+        .append(tid)
+        .append("\"}}");
+    for (auto &event : thread.second) {
+      out.append(",\n{\"name\":\"");
+      AppendEscaped(&out, event.name);
+      out.append("\",\"cat\":\"channel\",\"ph\":\"")
+          .append(event.instant ? "i\",\"s\":\"t" : "X")
+          .append("\",\"ts\":");
+      AppendMicros(&out, event.begin_ns - origin);
+      if (!event.instant) {
+        out.append(",\"dur\":");
+        AppendMicros(&out, event.end_ns - event.begin_ns);
+      }
+      out.append(",\"pid\":")
+          .append(pid)
+          .append(",\"tid\":")
+          .append(tid)
+          .append(",\"args\":{\"key\":\"");
+      if (event.key < keys.size())
+        AppendEscaped(&out, keys[event.key]);
+      out.append("\",\"bytes\":").append(std::to_string(event.bytes));
+      out.append("}}");
+    }
+  }
+  out.append("\n]}\n");
+  return out;
+}
+
+bool Tracer::ExportChromeTrace(const std::string &path) {
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file)
+    return false;
+  file << ChromeTraceJson();
+  return static_cast<bool>(file.flush());
+}
+} // namespace primihub::link
@@ -0,0 +1,125 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef NETWORK_TRACE_H_
+#define NETWORK_TRACE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace primihub::link {
+// Timeline tracing of channel operations, exported as Chrome trace JSON for
+// chrome://tracing or ui.perfetto.dev.
+//
+// Tracing is off by default, then every trace point costs one relaxed
+// atomic load. Building with -DPH_NO_TRACE (bazel build --config=notrace)
+// removes the trace points altogether. Once enabled, every thread records
+// into a ring buffer of its own without locks, the oldest events of a
+// thread are overwritten when its ring is full. The ring of an exited
+// thread is taken over by the next thread that records, so rings are only
+// allocated for threads that run at the same time.
+class Tracer {
+public:
+  static constexpr size_t kDefaultEventsPerThread = 64 * 1024;
+
+  // Starts recording. Rings created from now on hold events_per_thread
+  // events, rounded up to a power of two, free rings of another size are
+  // not reused.
+  static void Enable(size_t events_per_thread = kDefaultEventsPerThread);
+  static void Disable();
+  // Drops the events recorded so far.
+  static void Clear();
+
+  // All recorded events as Chrome trace JSON. Events recorded while
+  // exporting may be missing.
+  static std::string ChromeTraceJson();
+  static bool ExportChromeTrace(const std::string &path);
+
+  // Events currently held in the rings, and events lost because a ring was
+  // full.
+  static uint64_t recordedEvents();
+  static uint64_t droppedEvents();
+  // Ring buffers currently allocated.
+  static size_t rings();
+};
+
+#ifdef PH_NO_TRACE
+inline bool TraceEnabled() { return false; }
+
+class TraceSpan {
+public:
+  TraceSpan(const char *name, const std::string &key, uint64_t bytes = 0) {}
+  void setBytes(uint64_t bytes) {}
+};
+
+inline void TraceInstant(const char *name, const std::string &key,
+                         uint64_t bytes = 0) {}
+#else
+extern std::atomic<bool> g_trace_enabled;
+
+inline bool TraceEnabled() {
+  return g_trace_enabled.load(std::memory_order_relaxed);
+}
+
+inline uint64_t TraceNow() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Records one event into the ring of the calling thread. name must be a
+// string literal, key is copied only the first time a thread sees it.
+void TraceRecord(const char *name, const std::string &key, uint64_t begin_ns,
+                 uint64_t end_ns, uint64_t bytes, bool instant);
+
+// Records the time from construction to destruction as one span, e.g. a
+// send or the wait for a peer.
+class TraceSpan {
+public:
+  TraceSpan(const char *name, const std::string &key, uint64_t bytes = 0)
+      : name_(name), key_(key), bytes_(bytes),
+        begin_ns_(TraceEnabled() ? TraceNow() : 0) {}
+  ~TraceSpan() {
+    if (begin_ns_ != 0)
+      TraceRecord(name_, key_, begin_ns_, TraceNow(), bytes_, false);
+  }
+  TraceSpan(const TraceSpan &) = delete;
+  TraceSpan &operator=(const TraceSpan &) = delete;
+
+  // For receives, whose size is known at the end.
+  void setBytes(uint64_t bytes) { bytes_ = bytes; }
+
+private:
+  const char *name_;
+  const std::string &key_;
+  uint64_t bytes_;
+  uint64_t begin_ns_;
+};
+
+// Records a point in time, e.g. a message entering or leaving a queue.
+inline void TraceInstant(const char *name, const std::string &key,
+                         uint64_t bytes = 0) {
+  if (TraceEnabled()) {
+    uint64_t now = TraceNow();
+    TraceRecord(name, key, now, now, bytes, true);
+  }
+}
+#endif // PH_NO_TRACE
+} // namespace primihub::link
+
+#endif // NETWORK_TRACE_H_
@@ -0,0 +1,202 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "network/traffic_log.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+
+namespace primihub::link {
+namespace {
+constexpr char kMagic[8] = {'P', 'H', 'T', 'R', 'A', 'F', '0', '1'};
+constexpr size_t kInitialCapacity = 1024 * 1024;
+// Kind byte plus two varints of at most 10 bytes.
+constexpr size_t kMaxRecordHeader = 21;
+
+size_t PutVarint(uint64_t value, char *dst) {
+  size_t n = 0;
+  while (value >= 0x80) {
+    dst[n++] = static_cast<char>(value | 0x80);
+    value >>= 7;
+  }
+  dst[n++] = static_cast<char>(value);
+  return n;
+}
+
+bool GetVarint(const char *src, size_t size, size_t *offset, uint64_t *value) {
+  uint64_t result = 0;
+  for (int shift = 0; shift < 64 && *offset < size; shift += 7) {
+    uint8_t byte = static_cast<uint8_t>(src[(*offset)++]);
+    result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+} // namespace
+
+std::string TrafficLogPath(const std::string &dir, const std::string &key) {
+  std::string name = key;
+  for (auto &ch : name) {
+    if (!isalnum(static_cast<unsigned char>(ch)) && ch != '_' && ch != '-' &&
+        ch != '.')
+      ch = '_';
+  }
+  return dir + "/" + name + ".traffic";
+}
+
+TrafficLogWriter::~TrafficLogWriter() { Close(); }
+
+bool TrafficLogWriter::Open(const std::string &path) {
+  Close();
+  fd_ = open(path.c_str(), O_CREAT | O_RDWR | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    LOG(ERROR) << "open traffic log " << path << " failed: " << strerror(errno);
+    return false;
+  }
+  if (!Reserve(sizeof(kMagic))) {
+    Close();
+    return false;
+  }
+  memcpy(base_, kMagic, sizeof(kMagic));
+  size_ = sizeof(kMagic);
+  records_ = 0;
+  last_ = std::chrono::steady_clock::now();
+  return true;
+}
+
+bool TrafficLogWriter::Reserve(size_t size) {
+  if (size_ + size <= capacity_)
+    return true;
+  size_t capacity = std::max(kInitialCapacity, capacity_);
+  while (capacity < size_ + size)
+    capacity *= 2;
+  if (ftruncate(fd_, capacity) != 0) {
+    LOG(ERROR) << "grow traffic log failed: " << strerror(errno);
+    return false;
+  }
+  void *addr = base_ == nullptr
+                   ? mmap(nullptr, capacity, PROT_READ | PROT_WRITE,
+                          MAP_SHARED, fd_, 0)
+                   : mremap(base_, capacity_, capacity, MREMAP_MAYMOVE);
+  if (addr == MAP_FAILED) {
+    LOG(ERROR) << "map traffic log failed: " << strerror(errno);
+    return false;
+  }
+  base_ = static_cast<char *>(addr);
+  capacity_ = capacity;
+  return true;
+}
+
+bool TrafficLogWriter::Append(TrafficKind kind, const char *data,
+                              size_t size) {
+  if (fd_ < 0 || !Reserve(kMaxRecordHeader + size))
+    return false;
+  auto now = std::chrono::steady_clock::now();
+  uint64_t delta_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_)
+          .count();
+  last_ = now;
+
+  char *dst = base_ + size_;
+  *dst++ = static_cast<char>(kind);
+  dst += PutVarint(delta_ns, dst);
+  dst += PutVarint(size, dst);
+  if (size > 0)
+    memcpy(dst, data, size);
+  size_ = dst + size - base_;
+  records_++;
+  return true;
+}
+
+void TrafficLogWriter::Close() {
+  if (base_ != nullptr)
+    munmap(base_, capacity_);
+  if (fd_ >= 0) {
+    if (ftruncate(fd_, size_) != 0)
+      LOG(WARNING) << "trim traffic log failed: " << strerror(errno);
+    close(fd_);
+  }
+  fd_ = -1;
+  base_ = nullptr;
+  size_ = 0;
+  capacity_ = 0;
+}
+
+TrafficLogReader::~TrafficLogReader() {
+  if (base_ != nullptr)
+    munmap(const_cast<char *>(base_), size_);
+}
+
+bool TrafficLogReader::Open(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    LOG(ERROR) << "open traffic log " << path << " failed: " << strerror(errno);
+    return false;
+  }
+  struct stat st;
+  bool ok = fstat(fd, &st) == 0 &&
+            static_cast<size_t>(st.st_size) >= sizeof(kMagic);
+  void *addr = MAP_FAILED;
+  if (ok)
+    addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    LOG(ERROR) << "map traffic log " << path << " failed";
+    return false;
+  }
+  if (memcmp(addr, kMagic, sizeof(kMagic)) != 0) {
+    LOG(ERROR) << "not a traffic log: " << path;
+    munmap(addr, st.st_size);
+    return false;
+  }
+  base_ = static_cast<const char *>(addr);
+  size_ = st.st_size;
+  open_ = true;
+  return true;
+}
+
+bool TrafficLogReader::Next(TrafficCursor *cursor,
+                            TrafficRecord *record) const {
+  size_t offset = std::max(cursor->offset, sizeof(kMagic));
+  if (!open_ || offset >= size_)
+    return false;
+  uint8_t kind = static_cast<uint8_t>(base_[offset++]);
+  uint64_t delta_ns = 0;
+  uint64_t size = 0;
+  if (kind > static_cast<uint8_t>(TrafficKind::kReceived) ||
+      !GetVarint(base_, size_, &offset, &delta_ns) ||
+      !GetVarint(base_, size_, &offset, &size) || size > size_ - offset) {
+    LOG(ERROR) << "traffic log is corrupted at offset: " << cursor->offset;
+    return false;
+  }
+  record->kind = static_cast<TrafficKind>(kind);
+  record->time_ns = cursor->time_ns + delta_ns;
+  record->payload = std::string_view(base_ + offset, size);
+  cursor->offset = offset + size;
+  cursor->time_ns = record->time_ns;
+  return true;
+}
+} // namespace primihub::link
@@ -0,0 +1,104 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef NETWORK_TRAFFIC_LOG_H_
+#define NETWORK_TRAFFIC_LOG_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace primihub::link {
+// A traffic log holds the messages one party sent and received on one
+// channel key, in the order it saw them. After an 8 byte magic every record
+// is a kind byte, the nanoseconds since the previous record and the payload
+// size as LEB128 varints, then the payload.
+enum class TrafficKind : uint8_t {
+  kSent = 0,
+  kReceived = 1
+};
+
+struct TrafficRecord {
+  TrafficKind kind;
+  // Nanoseconds since the log was opened.
+  uint64_t time_ns;
+  std::string_view payload;
+};
+
+// Maps a channel key to the name of its log file in a log directory.
+std::string TrafficLogPath(const std::string &dir, const std::string &key);
+
+// Appends records to a log file through a growing shared mapping, so a
+// record costs a memcpy and no syscall. Not thread safe.
+class TrafficLogWriter {
+public:
+  TrafficLogWriter() = default;
+  ~TrafficLogWriter();
+  TrafficLogWriter(const TrafficLogWriter &) = delete;
+  TrafficLogWriter &operator=(const TrafficLogWriter &) = delete;
+
+  // Creates or truncates path, timestamps count from here.
+  bool Open(const std::string &path);
+  bool Append(TrafficKind kind, const char *data, size_t size);
+  // Trims the file to its content and unmaps it.
+  void Close();
+
+  bool isOpen() const { return fd_ >= 0; }
+  uint64_t records() const { return records_; }
+
+private:
+  bool Reserve(size_t size);
+
+  int fd_{-1};
+  char *base_{nullptr};
+  size_t size_{0};
+  size_t capacity_{0};
+  uint64_t records_{0};
+  std::chrono::steady_clock::time_point last_;
+};
+
+// Position in a log, the timestamps are deltas so it carries the time of
+// the record before it.
+struct TrafficCursor {
+  size_t offset{0};
+  uint64_t time_ns{0};
+};
+
+// Reads the records of a log file from a read-only mapping, the payloads
+// point into it and stay valid while the reader lives.
+class TrafficLogReader {
+public:
+  TrafficLogReader() = default;
+  ~TrafficLogReader();
+  TrafficLogReader(const TrafficLogReader &) = delete;
+  TrafficLogReader &operator=(const TrafficLogReader &) = delete;
+
+  bool Open(const std::string &path);
+  // Reads the record at cursor and advances it, returns false at the end of
+  // the log or on a truncated record.
+  bool Next(TrafficCursor *cursor, TrafficRecord *record) const;
+
+  bool isOpen() const { return open_; }
+
+private:
+  bool open_{false};
+  const char *base_{nullptr};
+  size_t size_{0};
+};
+} // namespace primihub::link
+
+#endif // NETWORK_TRAFFIC_LOG_H_
@@ -0,0 +1,474 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "network/uds_channel.h"
+#include "network/ready_notifier.h"
+#include "network/trace.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <map>
+
+namespace primihub::link {
+namespace {
+// Every packet starts with a tag byte, a memfd packet carries the payload
+// size after it and the memfd as SCM_RIGHTS.
+constexpr uint8_t kInlineTag = 0;
+constexpr uint8_t kMemfdTag = 1;
+constexpr size_t kMemfdPacketSize = 1 + sizeof(uint64_t);
+// The receiver maps only memfds it can trust not to change or shrink.
+constexpr int kRequiredSeals = F_SEAL_SHRINK | F_SEAL_WRITE;
+
+ssize_t RecvMsgRetry(int fd, msghdr *msg, int flags) {
+  ssize_t n = 0;
+  do {
+    n = recvmsg(fd, msg, flags | MSG_CMSG_CLOEXEC);
+  } while (n < 0 && errno == EINTR);
+  return n;
+}
+
+// Returns the first fd passed with msg and closes all others.
+int TakePassedFd(msghdr *msg) {
+  int passed = -1;
+  for (cmsghdr *cm = CMSG_FIRSTHDR(msg); cm != nullptr;
+       cm = CMSG_NXTHDR(msg, cm)) {
+    if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+      continue;
+    size_t count = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (size_t i = 0; i < count; i++) {
+      int fd = -1;
+      memcpy(&fd, CMSG_DATA(cm) + i * sizeof(int), sizeof(int));
+      if (passed < 0)
+        passed = fd;
+      else
+        ::close(fd);
+    }
+  }
+  return passed;
+}
+} // namespace
+
+UdsChannel::UdsChannel(UdsChannel::ChannelRole role, const std::string &path)
+    : UdsChannel(role, path, Options()) {}
+
+UdsChannel::UdsChannel(UdsChannel::ChannelRole role, const std::string &path,
+                       const Options &options)
+    : connector_("UdsChannel", role == ChannelRole::SERVER,
+                 [this](const std::string &key) { return Dial(key); },
+                 [](int fd) {
+                   // An inline packet has to fit into the send buffer as a
+                   // whole.
+                   int sndbuf = static_cast<int>(2 * kMaxInlineSize);
+                   setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf,
+                              sizeof(sndbuf));
+                 }) {
+  this->role_ = role;
+  this->path_ = path;
+  this->options_ = options;
+  if (options_.memfd_threshold > kMaxInlineSize)
+    options_.memfd_threshold = kMaxInlineSize;
+
+  if (role_ == ChannelRole::SERVER) {
+    auto acceptor = SharedAcceptor(
+        "unix:" + path_,
+        [this](std::string *) { return ListenUnix(path_, SOCK_SEQPACKET); },
+        ReadPacketHandshake);
+    if (acceptor == nullptr)
+      LOG(ERROR) << "UdsChannel listen on " << path_ << " failed.";
+    connector_.SetAcceptor(std::move(acceptor));
+  }
+}
+
+UdsChannel::~UdsChannel() { close(); }
+
+void UdsChannel::SetKey(const std::string &key) {
+  // Channel sets the key of a fork once more, a pooled fork is connected
+  // by then.
+  if (key == key_)
+    return;
+  if (connector_.fd() >= 0) {
+    LOG(ERROR) << "UdsChannel " << key_
+               << " is connected already, can not change key to " << key;
+    return;
+  }
+  this->key_ = key;
+}
+
+int UdsChannel::Connect(bool wait) { return connector_.Connect(key_, wait); }
+
+int UdsChannel::Dial(const std::string &key) {
+  int fd = ConnectUnix(path_, SOCK_SEQPACKET, options_.connect_timeout_ms);
+  if (fd >= 0 && !WritePacketHandshake(fd, key)) {
+    ::close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+retcode UdsChannel::SendImpl(const std::string &send_buf) {
+  return WritePacket(send_buf.data(), send_buf.size());
+}
+
+retcode UdsChannel::SendImpl(std::string_view send_buff_sv) {
+  return WritePacket(send_buff_sv.data(), send_buff_sv.size());
+}
+
+retcode UdsChannel::SendImpl(const char *buff, size_t size) {
+  return WritePacket(buff, size);
+}
+
+retcode UdsChannel::WritePacket(const char *buff, size_t size) {
+  TraceSpan span("UdsChannel::SendImpl", key_, size);
+  int fd = Connect();
+  if (fd < 0)
+    return retcode::FAIL;
+
+  std::lock_guard<std::mutex> lock(send_mu_);
+  if (size > options_.memfd_threshold)
+    return WriteMemfd(fd, buff, size) ? retcode::SUCCESS : retcode::FAIL;
+
+  uint8_t tag = kInlineTag;
+  iovec iov[2];
+  iov[0].iov_base = &tag;
+  iov[0].iov_len = sizeof(tag);
+  iov[1].iov_base = const_cast<char *>(buff);
+  iov[1].iov_len = size;
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = size > 0 ? 2 : 1;
+  // A SOCK_SEQPACKET packet is sent as a whole or not at all.
+  while (sendmsg(fd, &msg, MSG_NOSIGNAL) < 0) {
+    if (errno != EINTR) {
+      LOG(ERROR) << "send failed: " << strerror(errno);
+      return retcode::FAIL;
+    }
+  }
+  return retcode::SUCCESS;
+}
+
+bool UdsChannel::WriteMemfd(int fd, const char *buff, size_t size) {
+  int mem_fd = memfd_create("primihub_uds_payload",
+                            MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (mem_fd < 0) {
+    LOG(ERROR) << "memfd_create failed: " << strerror(errno);
+    return false;
+  }
+
+  bool ok = ftruncate(mem_fd, static_cast<off_t>(size)) == 0;
+  for (size_t offset = 0; ok && offset < size;) {
+    ssize_t n = pwrite(mem_fd, buff + offset, size - offset,
+                       static_cast<off_t>(offset));
+    if (n < 0 && errno == EINTR)
+      continue;
+    ok = n > 0;
+    offset += ok ? n : 0;
+  }
+  ok = ok && fcntl(mem_fd, F_ADD_SEALS,
+                   F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE |
+                       F_SEAL_SEAL) == 0;
+  if (!ok) {
+    LOG(ERROR) << "Write payload to memfd failed: " << strerror(errno);
+    ::close(mem_fd);
+    return false;
+  }
+
+  char packet[kMemfdPacketSize];
+  uint64_t length = size;
+  packet[0] = static_cast<char>(kMemfdTag);
+  memcpy(packet + 1, &length, sizeof(length));
+  iovec iov{packet, sizeof(packet)};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+  memset(control, 0, sizeof(control));
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+  cm->cmsg_level = SOL_SOCKET;
+  cm->cmsg_type = SCM_RIGHTS;
+  cm->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cm), &mem_fd, sizeof(int));
+
+  // The receiver holds its own reference to the memfd once it is sent.
+  ok = true;
+  while (sendmsg(fd, &msg, MSG_NOSIGNAL) < 0) {
+    if (errno != EINTR) {
+      LOG(ERROR) << "send memfd failed: " << strerror(errno);
+      ok = false;
+      break;
+    }
+  }
+  ::close(mem_fd);
+  if (ok)
+    memfd_sends_++;
+  return ok;
+}
+
+int64_t UdsChannel::PeekSize(int fd, bool *is_memfd) {
+  char packet[kMemfdPacketSize];
+  ssize_t n = 0;
+  {
+    // Until a packet arrives the receiver waits for its peer.
+    TraceSpan span("wait", key_);
+    do {
+      n = recv(fd, packet, sizeof(packet), MSG_PEEK | MSG_TRUNC);
+    } while (n < 0 && errno == EINTR);
+  }
+  if (n < 0) {
+    LOG(ERROR) << "recv failed: " << strerror(errno);
+    return -1;
+  }
+  // Every packet carries at least its tag, 0 is the end of the connection.
+  if (n == 0)
+    return -1;
+
+  *is_memfd = static_cast<uint8_t>(packet[0]) == kMemfdTag;
+  if (!*is_memfd)
+    return n - 1;
+  if (static_cast<size_t>(n) != kMemfdPacketSize) {
+    LOG(ERROR) << "Invalid memfd packet, size: " << n;
+    DropPacket(fd);
+    return -1;
+  }
+  uint64_t length = 0;
+  memcpy(&length, packet + 1, sizeof(length));
+  return static_cast<int64_t>(length);
+}
+
+void UdsChannel::DropPacket(int fd) {
+  alignas(cmsghdr) char control[CMSG_SPACE(4 * sizeof(int))];
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  if (RecvMsgRetry(fd, &msg, 0) >= 0) {
+    int passed = TakePassedFd(&msg);
+    if (passed >= 0)
+      ::close(passed);
+  }
+}
+
+retcode UdsChannel::ReadPacket(int fd, char *recv_buf, size_t size,
+                               bool is_memfd) {
+  alignas(cmsghdr) char control[CMSG_SPACE(4 * sizeof(int))];
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  if (!is_memfd) {
+    uint8_t tag = 0;
+    iovec iov[2];
+    iov[0].iov_base = &tag;
+    iov[0].iov_len = sizeof(tag);
+    iov[1].iov_base = recv_buf;
+    iov[1].iov_len = size;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = size > 0 ? 2 : 1;
+    ssize_t n = RecvMsgRetry(fd, &msg, 0);
+    int passed = TakePassedFd(&msg);
+    if (passed >= 0)
+      ::close(passed);
+    if (n < 0) {
+      LOG(ERROR) << "recv failed: " << strerror(errno);
+      return retcode::FAIL;
+    }
+    return static_cast<size_t>(n) == size + 1 ? retcode::SUCCESS
+                                                : retcode::FAIL;
+  }
+
+  int mem_fd = TakeMemfd(fd, size);
+  if (mem_fd < 0)
+    return retcode::FAIL;
+  return CopyMemfd(mem_fd, recv_buf, size);
+}
+
+int UdsChannel::TakeMemfd(int fd, size_t size) {
+  alignas(cmsghdr) char control[CMSG_SPACE(4 * sizeof(int))];
+  char packet[kMemfdPacketSize];
+  iovec iov{packet, sizeof(packet)};
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  if (RecvMsgRetry(fd, &msg, 0) < 0) {
+    LOG(ERROR) << "recv failed: " << strerror(errno);
+    return -1;
+  }
+  int mem_fd = TakePassedFd(&msg);
+  if (mem_fd < 0) {
+    LOG(ERROR) << "memfd packet without fd"
+               << (msg.msg_flags & MSG_CTRUNC ? ", fd limit reached?" : ".");
+    return -1;
+  }
+
+  struct stat st;
+  int seals = fcntl(mem_fd, F_GET_SEALS);
+  if (seals < 0 || (seals & kRequiredSeals) != kRequiredSeals) {
+    LOG(ERROR) << "Received memfd is not sealed, seals: " << seals;
+  } else if (fstat(mem_fd, &st) != 0 ||
+             static_cast<uint64_t>(st.st_size) < size) {
+    LOG(ERROR) << "Received memfd is smaller than its payload.";
+  } else {
+    return mem_fd;
+  }
+  ::close(mem_fd);
+  return -1;
+}
+
+retcode UdsChannel::CopyMemfd(int mem_fd, char *recv_buf, size_t size) {
+  retcode ret = retcode::SUCCESS;
+  if (size > 0) {
+    void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE,
+                      mem_fd, 0);
+    if (addr == MAP_FAILED) {
+      LOG(ERROR) << "mmap memfd failed: " << strerror(errno);
+      ret = retcode::FAIL;
+    } else {
+      memcpy(recv_buf, addr, size);
+      munmap(addr, size);
+    }
+  }
+  ::close(mem_fd);
+  return ret;
+}
+
+retcode UdsChannel::RecvImpl(std::string *recv_buf) {
+  TraceSpan span("UdsChannel::RecvImpl", key_);
+  int fd = Connect();
+  if (fd < 0)
+    return retcode::FAIL;
+
+  std::lock_guard<std::mutex> lock(recv_mu_);
+  bool is_memfd = false;
+  int64_t length = PeekSize(fd, &is_memfd);
+  if (length < 0)
+    return retcode::FAIL;
+  span.setBytes(length);
+  if (!is_memfd) {
+    // An inline packet fits into the socket buffer.
+    recv_buf->resize(length);
+    return ReadPacket(fd, &(*recv_buf)[0], length, is_memfd);
+  }
+
+  // The length of a memfd packet is only the claim of the peer, it is
+  // checked against the memfd before anything is allocated for it.
+  int mem_fd = TakeMemfd(fd, length);
+  if (mem_fd < 0)
+    return retcode::FAIL;
+  if (static_cast<uint64_t>(length) > options_.max_message_size) {
+    LOG(ERROR) << "UdsChannel " << key_ << " received length " << length
+               << " above max message size " << options_.max_message_size;
+    ::close(mem_fd);
+    return retcode::FAIL;
+  }
+  recv_buf->resize(length);
+  return CopyMemfd(mem_fd, &(*recv_buf)[0], length);
+}
+
+retcode UdsChannel::RecvImpl(char *recv_buf, size_t recv_size) {
+  TraceSpan span("UdsChannel::RecvImpl", key_, recv_size);
+  int fd = Connect();
+  if (fd < 0)
+    return retcode::FAIL;
+
+  std::lock_guard<std::mutex> lock(recv_mu_);
+  bool is_memfd = false;
+  int64_t length = PeekSize(fd, &is_memfd);
+  if (length < 0)
+    return retcode::FAIL;
+  if (static_cast<uint64_t>(length) != recv_size) {
+    LOG(ERROR) << "data length does not match: "
+               << " "
+               << "expected: " << recv_size << " "
+               << "actually: " << length;
+    DropPacket(fd);
+    return retcode::FAIL;
+  }
+  return ReadPacket(fd, recv_buf, recv_size, is_memfd);
+}
+
+std::shared_ptr<ChannelBase> UdsChannel::ForkImpl(const std::string &key) {
+  auto channel = std::make_shared<UdsChannel>(role_, path_, options_);
+  channel->SetKey(key);
+  return channel;
+}
+
+bool UdsChannel::HasPendingData() {
+  int fd = connector_.fd();
+  return fd >= 0 && HasInput(fd);
+}
+
+int UdsChannel::ReadinessFd() {
+  // A server picks up its connection once it has arrived. A client has
+  // nothing to poll until Warmup or its first send or recv connects it,
+  // dialing here would block the selector.
+  return Connect(false);
+}
+
+retcode UdsChannel::Warmup() {
+  // The client pays for connect and handshake here instead of on its first
+  // message, the server takes its connection if it has arrived already.
+  if (Connect(role_ == ChannelRole::CLIENT) < 0 &&
+      role_ == ChannelRole::CLIENT)
+    return retcode::FAIL;
+  return retcode::SUCCESS;
+}
+
+void UdsChannel::SetReadyNotifier(std::shared_ptr<ReadyNotifier> notifier) {
+  connector_.SetReadyNotifier(key_, std::move(notifier));
+}
+
+void UdsChannel::close() {
+  int fd = connector_.Release();
+  if (fd >= 0) {
+    shutdown(fd, SHUT_RDWR);
+    ::close(fd);
+  }
+}
+
+void UdsChannel::cancel() { connector_.Cancel(); }
+
+retcode UdsChannel::ProbeImpl(uint64_t *size, bool wait, bool *available) {
+  *available = false;
+  int fd = Connect(wait || role_ == ChannelRole::CLIENT);
+  if (fd < 0)
+    return wait ? retcode::FAIL : retcode::SUCCESS;
+
+  std::lock_guard<std::mutex> lock(recv_mu_);
+  if (!wait && !HasInput(fd))
+    return retcode::SUCCESS;
+  bool is_memfd = false;
+  int64_t length = PeekSize(fd, &is_memfd);
+  if (length < 0)
+    return retcode::FAIL;
+  *size = static_cast<uint64_t>(length);
+  *available = true;
+  return retcode::SUCCESS;
+}
+
+} // namespace primihub::link
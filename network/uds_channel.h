@@ -0,0 +1,108 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef NETWORK_UDS_CHANNEL_H_
+#define NETWORK_UDS_CHANNEL_H_
+
+#include "network/base_channel.h"
+#include "network/socket_util.h"
+
+#include <atomic>
+#include <mutex>
+#include <string_view>
+
+namespace primihub::link {
+// UdsChannel connects parties on the same host over an AF_UNIX
+// SOCK_SEQPACKET socket, the kernel keeps message boundaries so every
+// message is one packet. Payloads of at least memfd_threshold bytes are
+// written to a sealed memfd whose fd is passed with SCM_RIGHTS, the receiver
+// maps it instead of pulling megabytes through the socket buffer.
+//
+// Like TcpChannel the server side routes connections by key, so a channel
+// and all its forks share one path. A path starting with '@' lives in the
+// abstract namespace.
+class UdsChannel : public ChannelBase {
+public:
+  enum ChannelRole {
+    SERVER,
+    CLIENT
+  };
+
+  struct Options {
+    // Payloads up to this size are sent inline, larger ones through a
+    // memfd. Inline packets must fit into the socket buffer, so values above
+    // kMaxInlineSize are clamped.
+    size_t memfd_threshold{64 * 1024};
+    int connect_timeout_ms{10000};
+    // A memfd message above this fails the receive before anything is
+    // allocated for it.
+    uint64_t max_message_size{4ULL << 30};
+  };
+
+  static constexpr size_t kMaxInlineSize = 128 * 1024;
+
+  UdsChannel(ChannelRole role, const std::string &path);
+  UdsChannel(ChannelRole role, const std::string &path,
+             const Options &options);
+  ~UdsChannel() override;
+
+  retcode SendImpl(const std::string &send_buf) override;
+  retcode SendImpl(std::string_view send_buff_sv) override;
+  retcode SendImpl(const char *buff, size_t size) override;
+  retcode RecvImpl(std::string *recv_buf) override;
+  retcode RecvImpl(char *recv_buf, size_t recv_size) override;
+  retcode ProbeImpl(uint64_t *size, bool wait, bool *available) override;
+  std::shared_ptr<ChannelBase> ForkImpl(const std::string &key) override;
+  void SetKey(const std::string &key) override;
+  bool HasPendingData() override;
+  int ReadinessFd() override;
+  retcode Warmup() override;
+  void SetReadyNotifier(std::shared_ptr<ReadyNotifier> notifier) override;
+  void close() override;
+  void cancel() override;
+
+  // Number of messages sent through a memfd.
+  uint64_t memfdSends() const { return memfd_sends_.load(); }
+
+private:
+  // Without wait a server returns -1 unless its connection has arrived.
+  int Connect(bool wait = true);
+  int Dial(const std::string &key);
+  retcode WritePacket(const char *buff, size_t size);
+  bool WriteMemfd(int fd, const char *buff, size_t size);
+  // Peeks the size of the next message, -1 on failure.
+  int64_t PeekSize(int fd, bool *is_memfd);
+  // Receives the next message into recv_buf, which holds exactly size bytes.
+  retcode ReadPacket(int fd, char *recv_buf, size_t size, bool is_memfd);
+  // Receives the next memfd packet and returns its memfd once it is sealed
+  // and holds size bytes, -1 otherwise.
+  int TakeMemfd(int fd, size_t size);
+  // Copies size bytes out of mem_fd and closes it.
+  retcode CopyMemfd(int mem_fd, char *recv_buf, size_t size);
+  void DropPacket(int fd);
+
+  ChannelRole role_;
+  std::string path_;
+  Options options_;
+  std::string key_{"default"};
+
+  KeyedConnector connector_;
+  std::mutex send_mu_;
+  std::mutex recv_mu_;
+  std::atomic<uint64_t> memfd_sends_{0};
+};
+} // namespace primihub::link
+
+#endif // NETWORK_UDS_CHANNEL_H_
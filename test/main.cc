@@ -1,17 +1,73 @@
 #include <glog/logging.h>
 #include <gtest/gtest.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <array>
+#include <bitset>
+#include <condition_variable>
+#include <fstream>
+#include <future>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <set>
+#include <thread>
 #include <vector>
 
+#include "network/batch_pipeline.h"
 #include "network/channel_interface.h"
+#include "network/channel_selector.h"
+#include "network/integrity_channel.h"
 #include "network/mem_channel.h"
+#include "network/multi_producer_channel.h"
+#include "network/phase_accounting.h"
+#include "network/recording_channel.h"
+#include "network/replay_channel.h"
+#include "network/secure_channel.h"
+#include "network/shaped_channel.h"
+#include "network/socket_util.h"
+#include "network/tcp_channel.h"
+#include "network/trace.h"
+#include "network/uds_channel.h"
+#include "util/aead.h"
+#include "util/bit_vector.h"
+#include "util/crc32c.h"
+#include "util/serialize.h"
 
+using primihub::link::BatchPipeline;
 using primihub::link::Channel;
+using primihub::link::ChannelBase;
+using primihub::link::ChannelSelector;
+using primihub::link::CompletionReactor;
+using primihub::link::IntegrityChannel;
+using primihub::link::LaneStats;
 using primihub::link::MemoryChannel;
+using primihub::link::MultiProducerChannel;
+using primihub::link::PhaseAccounting;
+using primihub::link::PhaseChannel;
+using primihub::link::PhaseScope;
+using primihub::link::Priority;
+using primihub::link::RecordingChannel;
+using primihub::link::ReplayChannel;
 using primihub::link::retcode;
+using primihub::link::SecureChannel;
+using primihub::link::ShapedChannel;
 using primihub::link::Status;
+using primihub::link::TcpChannel;
+using primihub::link::Tracer;
+using primihub::link::TrafficLogPath;
+using primihub::link::UdsChannel;
+using primihub::Aead;
+using primihub::AeadSuite;
+using primihub::ConstView;
+using primihub::Crc32c;
+using primihub::Crc32cPortable;
 
 using ChannelRole = MemoryChannel::ChannelRole;
 
@@ -29,6 +85,17 @@ static std::string gen_random(uint32_t len, uint32_t seed) {
   return tmp_s;
 }
 
+static size_t open_fds() {
+  size_t count = 0;
+  DIR *dir = opendir("/proc/self/fd");
+  if (dir == nullptr)
+    return 0;
+  while (readdir(dir) != nullptr)
+    count++;
+  closedir(dir);
+  return count;
+}
+
 TEST(channel, type_test) {
   auto channel_impl1 = std::make_shared<MemoryChannel>(ChannelRole::CLIENT);
   auto channel1 = std::make_shared<Channel>(channel_impl1, "type_test");
@@ -195,3 +262,2088 @@ TEST(channel, fork_test) {
   send_fut.get();
   recv_fut.get();
 }
+
+TEST(channel, packed_test) {
+  auto channel_impl1 = std::make_shared<MemoryChannel>(ChannelRole::CLIENT);
+  auto channel1 = std::make_shared<Channel>(channel_impl1, "packed_test");
+
+  auto channel_impl2 = std::make_shared<MemoryChannel>(ChannelRole::SERVER);
+  auto channel2 = std::make_shared<Channel>(channel_impl2, "packed_test");
+
+  srand(26);
+  std::vector<uint8_t> bool_shares(1001);
+  for (auto &v : bool_shares)
+    v = rand() & 1;
+  EXPECT_EQ(channel1->send_packed(bool_shares, 1).IsOK(), true);
+
+  std::vector<uint64_t> ring_shares(333);
+  for (auto &v : ring_shares)
+    v = ((static_cast<uint64_t>(rand()) << 31) ^ rand()) & ((1ULL << 40) - 1);
+  EXPECT_EQ(channel1->send_packed(ring_shares, 40).IsOK(), true);
+
+  std::vector<int32_t> signed_shares{0, -1, 5, -300, 1 << 20, -(1 << 30)};
+  EXPECT_EQ(channel1->send_packed(signed_shares, 31).IsOK(), true);
+  EXPECT_EQ(
+      channel1->send_packed(signed_shares, primihub::IntCodec::kVarint).IsOK(),
+      true);
+
+  std::vector<uint32_t> indices(100);
+  for (size_t i = 0; i < indices.size(); i++)
+    indices[i] = 1000 + 3 * i;
+  EXPECT_EQ(
+      channel1->send_packed(indices, primihub::IntCodec::kDeltaVarint).IsOK(),
+      true);
+  EXPECT_EQ(channel1->send_packed(indices, 33).IsOK(), false);
+  EXPECT_EQ(channel1->send_packed(indices, 32).IsOK(), true);
+
+  std::vector<uint8_t> recv_bool;
+  EXPECT_EQ(channel2->recv_packed(recv_bool).IsOK(), true);
+  EXPECT_EQ(recv_bool, bool_shares);
+
+  std::vector<uint64_t> recv_ring;
+  EXPECT_EQ(channel2->recv_packed(recv_ring).IsOK(), true);
+  EXPECT_EQ(recv_ring, ring_shares);
+
+  std::vector<int32_t> recv_signed;
+  EXPECT_EQ(channel2->recv_packed(recv_signed).IsOK(), true);
+  EXPECT_EQ(recv_signed, signed_shares);
+  recv_signed.clear();
+  EXPECT_EQ(channel2->recv_packed(recv_signed).IsOK(), true);
+  EXPECT_EQ(recv_signed, signed_shares);
+
+  std::vector<uint32_t> recv_indices;
+  EXPECT_EQ(channel2->recv_packed(recv_indices).IsOK(), true);
+  EXPECT_EQ(recv_indices, indices);
+
+  std::vector<uint64_t> wrong_type;
+  EXPECT_EQ(channel2->recv_packed(wrong_type).IsOK(), false);
+}
+
+TEST(channel, bit_container_test) {
+  auto channel_impl1 = std::make_shared<MemoryChannel>(ChannelRole::CLIENT);
+  auto channel1 = std::make_shared<Channel>(channel_impl1, "bit_container_test");
+
+  auto channel_impl2 = std::make_shared<MemoryChannel>(ChannelRole::SERVER);
+  auto channel2 = std::make_shared<Channel>(channel_impl2, "bit_container_test");
+
+  srand(27);
+  std::vector<bool> bits(1000);
+  for (size_t i = 0; i < bits.size(); i++)
+    bits[i] = rand() & 1;
+  EXPECT_EQ(channel1->send(bits).IsOK(), true);
+
+  std::bitset<130> bitset;
+  bitset.set(0).set(64).set(129);
+  EXPECT_EQ(channel1->send(bitset).IsOK(), true);
+  EXPECT_EQ(channel1->send(bitset).IsOK(), true);
+
+  std::vector<uint8_t> bool_shares(77);
+  for (auto &v : bool_shares)
+    v = rand() & 1;
+  EXPECT_EQ(channel1->send_bits(bool_shares.data(), bool_shares.size()).IsOK(),
+            true);
+  EXPECT_EQ(channel1->send(bits).IsOK(), true);
+
+  std::vector<bool> recv_bits;
+  EXPECT_EQ(channel2->recv(recv_bits).IsOK(), true);
+  EXPECT_EQ(recv_bits, bits);
+
+  std::bitset<130> recv_bitset;
+  EXPECT_EQ(channel2->recv(recv_bitset).IsOK(), true);
+  EXPECT_EQ(recv_bitset, bitset);
+
+  std::bitset<64> wrong_size;
+  EXPECT_EQ(channel2->recv(wrong_size).IsOK(), false);
+
+  std::vector<bool> recv_from_bytes;
+  EXPECT_EQ(channel2->recv(recv_from_bytes).IsOK(), true);
+  ASSERT_EQ(recv_from_bytes.size(), bool_shares.size());
+  for (size_t i = 0; i < bool_shares.size(); i++)
+    EXPECT_EQ(recv_from_bytes[i], bool_shares[i] == 1);
+
+  std::vector<uint8_t> recv_bytes;
+  EXPECT_EQ(channel2->recv_bits(recv_bytes).IsOK(), true);
+  ASSERT_EQ(recv_bytes.size(), bits.size());
+  for (size_t i = 0; i < bits.size(); i++)
+    EXPECT_EQ(recv_bytes[i], bits[i] ? 1 : 0);
+
+  // Every packing path produces the same words.
+  auto reference = [](auto &&get, size_t nbits) {
+    std::vector<uint64_t> words(primihub::BitWords(nbits), 0);
+    for (size_t i = 0; i < nbits; i++)
+      words[i / 64] |= static_cast<uint64_t>(get(i)) << (i % 64);
+    return words;
+  };
+  std::vector<uint64_t> words(primihub::BitWords(bits.size()));
+  primihub::PackBitWords(bits, words.data());
+  EXPECT_EQ(words, reference([&](size_t i) { return bits[i]; }, bits.size()));
+  std::fill(words.begin(), words.end(), 0);
+  primihub::PackBitsByByte(bits, bits.size(), words.data());
+  EXPECT_EQ(words, reference([&](size_t i) { return bits[i]; }, bits.size()));
+  std::vector<bool> unpacked(bits.size());
+  primihub::UnpackBitsByByte(words.data(), bits.size(), &unpacked);
+  EXPECT_EQ(unpacked, bits);
+
+  std::bitset<3000> large;
+  for (size_t i = 0; i < large.size(); i += 7)
+    large.set(i);
+  words.assign(primihub::BitWords(large.size()), 0);
+  primihub::PackBitWords(large, words.data());
+  EXPECT_EQ(words,
+            reference([&](size_t i) { return large[i]; }, large.size()));
+  std::bitset<3000> large_back;
+  primihub::UnpackBitWords(words.data(), large.size(), &large_back);
+  EXPECT_EQ(large_back, large);
+
+  words.assign(primihub::BitWords(bitset.size()), 0);
+  primihub::PackBitWords(bitset, words.data());
+  EXPECT_EQ(words,
+            reference([&](size_t i) { return bitset[i]; }, bitset.size()));
+}
+
+struct SerialShare {
+  uint32_t party;
+  std::vector<uint64_t> values;
+  PH_SERIALIZE_FIELDS(party, values)
+};
+
+struct SerialBatch {
+  uint64_t round;
+  double scale;
+  std::string label;
+  std::vector<uint16_t> offsets;
+  SerialShare own;
+  std::vector<SerialShare> peers;
+  PH_SERIALIZE_FIELDS(round, scale, label, offsets, own, peers)
+};
+
+// Same wire format as SerialBatch, the receiver reads the arrays in place.
+struct SerialBatchView {
+  uint64_t round;
+  double scale;
+  std::string_view label;
+  ConstView<uint16_t> offsets;
+  uint32_t party;
+  ConstView<uint64_t> values;
+  std::vector<SerialShare> peers;
+  PH_SERIALIZE_FIELDS(round, scale, label, offsets, party, values, peers)
+};
+
+TEST(channel, serialize_test) {
+  auto channel1 = std::make_shared<Channel>(
+      std::make_shared<MemoryChannel>(ChannelRole::CLIENT), "serialize_test");
+  auto channel2 = std::make_shared<Channel>(
+      std::make_shared<MemoryChannel>(ChannelRole::SERVER), "serialize_test");
+
+  SerialBatch batch;
+  batch.round = 7;
+  batch.scale = 0.5;
+  batch.label = gen_random(33, 5);
+  batch.offsets = {1, 2, 3};
+  batch.own.party = 1;
+  batch.own.values.resize(1000);
+  std::iota(batch.own.values.begin(), batch.own.values.end(), 100);
+  batch.peers.push_back({2, {5, 6}});
+  batch.peers.push_back({3, {}});
+  EXPECT_EQ(channel1->send(batch).IsOK(), true);
+  EXPECT_EQ(channel1->send(batch).IsOK(), true);
+  EXPECT_EQ(channel1->send(batch).IsOK(), true);
+
+  SerialBatch recv_batch;
+  EXPECT_EQ(channel2->recv(recv_batch).IsOK(), true);
+  EXPECT_EQ(recv_batch.round, batch.round);
+  EXPECT_EQ(recv_batch.scale, batch.scale);
+  EXPECT_EQ(recv_batch.label, batch.label);
+  EXPECT_EQ(recv_batch.offsets, batch.offsets);
+  EXPECT_EQ(recv_batch.own.party, batch.own.party);
+  EXPECT_EQ(recv_batch.own.values, batch.own.values);
+  ASSERT_EQ(recv_batch.peers.size(), 2);
+  EXPECT_EQ(recv_batch.peers[0].party, 2);
+  EXPECT_EQ(recv_batch.peers[0].values, std::vector<uint64_t>({5, 6}));
+  EXPECT_EQ(recv_batch.peers[1].values.empty(), true);
+
+  std::string frame;
+  SerialBatchView view;
+  EXPECT_EQ(channel2->recv(view, frame).IsOK(), true);
+  EXPECT_EQ(view.round, batch.round);
+  EXPECT_EQ(view.label, batch.label);
+  EXPECT_EQ(view.label.data() >= frame.data() &&
+                view.label.data() < frame.data() + frame.size(),
+            true);
+  EXPECT_EQ(std::vector<uint16_t>(view.offsets.begin(), view.offsets.end()),
+            batch.offsets);
+  EXPECT_EQ(view.party, batch.own.party);
+  ASSERT_EQ(view.values.size, batch.own.values.size());
+  EXPECT_EQ(memcmp(view.values.data, batch.own.values.data(),
+                   view.values.size * sizeof(uint64_t)),
+            0);
+  EXPECT_EQ(view.peers.size(), 2);
+
+  // The frame is sized exactly, a truncated or padded one is rejected.
+  std::string truncated(primihub::SerializedSize(batch), 0);
+  primihub::SerializeFields(batch, &truncated[0]);
+  EXPECT_EQ(primihub::DeserializeFields(truncated.data(), truncated.size(),
+                                        &recv_batch),
+            true);
+  EXPECT_EQ(primihub::DeserializeFields(truncated.data(),
+                                        truncated.size() - 1, &recv_batch),
+            false);
+  std::string padded = truncated + "x";
+  EXPECT_EQ(primihub::DeserializeFields(padded.data(), padded.size(),
+                                        &recv_batch),
+            false);
+
+  // A message of another type does not fit, the receiver gets a mismatch.
+  EXPECT_EQ(channel2->recv(recv_batch).IsOK(), true);
+  EXPECT_EQ(channel1->send(std::string("not a batch")).IsOK(), true);
+  EXPECT_EQ(channel2->recv(recv_batch).IsOK(), false);
+}
+
+TEST(channel, strided_test) {
+  auto channel_impl1 = std::make_shared<MemoryChannel>(ChannelRole::CLIENT);
+  auto channel1 = std::make_shared<Channel>(channel_impl1, "strided_test");
+
+  auto channel_impl2 = std::make_shared<MemoryChannel>(ChannelRole::SERVER);
+  auto channel2 = std::make_shared<Channel>(channel_impl2, "strided_test");
+
+  constexpr size_t rows = 37;
+  constexpr size_t cols = 23;
+  std::vector<uint64_t> matrix(rows * cols);
+  for (size_t i = 0; i < matrix.size(); i++)
+    matrix[i] = i * 2654435761u;
+
+  // column 5, a 4x6 block at (3, 2) and the whole transpose
+  auto column = primihub::MakeStridedView(&matrix[5], rows, 1, cols);
+  auto block = primihub::MakeStridedView(&matrix[3 * cols + 2], 4, 6, cols);
+  auto transpose = primihub::MakeStridedView(matrix.data(), cols, rows, 1, cols);
+  EXPECT_EQ(channel1->sendStrided(column).IsOK(), true);
+  EXPECT_EQ(channel1->sendStrided(block).IsOK(), true);
+  EXPECT_EQ(channel1->sendStrided(transpose).IsOK(), true);
+
+  std::vector<uint64_t> recv_column(rows);
+  EXPECT_EQ(channel2->recv(recv_column).IsOK(), true);
+  for (size_t r = 0; r < rows; r++)
+    EXPECT_EQ(recv_column[r], matrix[r * cols + 5]);
+
+  // receive the block straight into another matrix at (10, 10)
+  std::vector<uint64_t> target(20 * 20, 0);
+  auto target_block = primihub::MakeStridedView(&target[10 * 20 + 10], 4, 6, 20);
+  EXPECT_EQ(channel2->recvStrided(target_block).IsOK(), true);
+  for (size_t r = 0; r < 4; r++)
+    for (size_t c = 0; c < 6; c++)
+      EXPECT_EQ(target[(10 + r) * 20 + 10 + c], matrix[(3 + r) * cols + 2 + c]);
+
+  std::vector<uint64_t> recv_transpose(rows * cols);
+  EXPECT_EQ(channel2->recv(recv_transpose).IsOK(), true);
+  for (size_t r = 0; r < rows; r++)
+    for (size_t c = 0; c < cols; c++)
+      EXPECT_EQ(recv_transpose[c * rows + r], matrix[r * cols + c]);
+
+  std::vector<int32_t> small(8 * 8);
+  for (size_t i = 0; i < small.size(); i++)
+    small[i] = static_cast<int32_t>(i);
+  EXPECT_EQ(channel1->sendStrided(
+                primihub::MakeStridedView(&small[1], 8, 1, 8)).IsOK(), true);
+  auto wrong_size = primihub::MakeStridedView(small.data(), 2, 2, 8);
+  EXPECT_EQ(channel2->recvStrided(wrong_size).IsOK(), false);
+}
+
+TEST(channel, stream_test) {
+  auto channel_impl1 = std::make_shared<MemoryChannel>(ChannelRole::CLIENT);
+  auto channel1 = std::make_shared<Channel>(channel_impl1, "stream_test");
+
+  auto channel_impl2 = std::make_shared<MemoryChannel>(ChannelRole::SERVER);
+  auto channel2 = std::make_shared<Channel>(channel_impl2, "stream_test");
+
+  std::string payload = gen_random(100000, 29);
+  std::vector<uint32_t> numbers(25000);
+  for (size_t i = 0; i < numbers.size(); i++)
+    numbers[i] = static_cast<uint32_t>(i * 7);
+
+  auto send_fut = std::async(std::launch::async, [&]() {
+    EXPECT_EQ(channel1->sendStream(payload.data(), payload.size(), 4096).IsOK(),
+              true);
+    EXPECT_EQ(channel1->sendStream(numbers, 1000).IsOK(), true);
+    EXPECT_EQ(channel1->sendStream(payload.data(), 0, 4096).IsOK(), true);
+    EXPECT_EQ(channel1->sendStream(payload, 3000).IsOK(), true);
+  });
+
+  std::string recv_payload;
+  size_t num_chunks = 0;
+  auto status = channel2->recvStream(
+      [&](uint64_t offset, std::string_view chunk) {
+        EXPECT_EQ(offset, recv_payload.size());
+        recv_payload.append(chunk.data(), chunk.size());
+        num_chunks++;
+      });
+  EXPECT_EQ(status.IsOK(), true);
+  EXPECT_EQ(recv_payload, payload);
+  EXPECT_EQ(num_chunks, (payload.size() + 4095) / 4096);
+
+  std::vector<uint32_t> recv_numbers;
+  EXPECT_EQ(channel2->recvStream(recv_numbers).IsOK(), true);
+  EXPECT_EQ(recv_numbers, numbers);
+
+  std::vector<char> empty;
+  EXPECT_EQ(channel2->recvStream(empty).IsOK(), true);
+  EXPECT_EQ(empty.size(), 0);
+
+  primihub::link::ChunkReader reader;
+  EXPECT_EQ(channel2->openStream(&reader).IsOK(), true);
+  EXPECT_EQ(reader.totalSize(), payload.size());
+  std::string chunk;
+  recv_payload.clear();
+  while (!reader.done()) {
+    EXPECT_EQ(reader.next(&chunk).IsOK(), true);
+    recv_payload += chunk;
+  }
+  EXPECT_EQ(recv_payload, payload);
+  send_fut.get();
+}
+
+TEST(channel, striped_test) {
+  auto channel_impl1 = std::make_shared<MemoryChannel>(ChannelRole::CLIENT);
+  auto channel1 = std::make_shared<Channel>(channel_impl1, "striped_test");
+
+  auto channel_impl2 = std::make_shared<MemoryChannel>(ChannelRole::SERVER);
+  auto channel2 = std::make_shared<Channel>(channel_impl2, "striped_test");
+
+  std::string payload = gen_random(3 * 1024 * 1024 + 17, 30);
+  for (uint32_t k : {1, 4, 7}) {
+    auto send_fut = std::async(std::launch::async, [&]() {
+      EXPECT_EQ(channel1->sendStriped(payload, k).IsOK(), true);
+    });
+    std::string recv_payload(payload.size(), 0);
+    EXPECT_EQ(channel2->recvStriped(&recv_payload[0], recv_payload.size(), k)
+                  .IsOK(),
+              true);
+    send_fut.get();
+    EXPECT_EQ(recv_payload == payload, true);
+  }
+
+  std::vector<uint64_t> numbers(1000);
+  for (size_t i = 0; i < numbers.size(); i++)
+    numbers[i] = i * i;
+  EXPECT_EQ(channel1->sendStriped(numbers, 16).IsOK(), true);
+  std::vector<uint64_t> recv_numbers;
+  EXPECT_EQ(channel2->recvStriped(recv_numbers, 16).IsOK(), true);
+  EXPECT_EQ(recv_numbers, numbers);
+}
+
+TEST(channel, tcp_zerocopy_test) {
+  TcpChannel::Options options;
+  options.zerocopy_threshold = 64 * 1024;
+  auto channel_impl2 = std::make_shared<TcpChannel>(TcpChannel::SERVER,
+                                                    "127.0.0.1", 0, options);
+  auto channel_impl1 = std::make_shared<TcpChannel>(
+      TcpChannel::CLIENT, "127.0.0.1", channel_impl2->port(), options);
+  auto channel1 = std::make_shared<Channel>(channel_impl1, "tcp_zerocopy_test");
+  auto channel2 = std::make_shared<Channel>(channel_impl2, "tcp_zerocopy_test");
+
+  std::string small = gen_random(100, 31);
+  std::string large = gen_random(4 * 1024 * 1024, 32);
+  auto pinned = std::make_shared<std::vector<char>>(large.begin(), large.end());
+  auto send_fut = std::async(std::launch::async, [&]() {
+    EXPECT_EQ(channel1->asyncSend(small).IsOK(), true);
+    EXPECT_EQ(channel1->asyncSend(large).IsOK(), true);
+    EXPECT_EQ(channel1->asyncSend(std::move(pinned)).IsOK(), true);
+  });
+
+  std::string recv_small;
+  std::string recv_large;
+  std::vector<char> recv_pinned(large.size());
+  channel2->asyncRecv(recv_small).get();
+  channel2->asyncRecv(recv_large).get();
+  EXPECT_EQ(channel2->asyncRecv(recv_pinned).get().IsOK(), true);
+  send_fut.get();
+
+  EXPECT_EQ(recv_small, small);
+  EXPECT_EQ(recv_large == large, true);
+  EXPECT_EQ(std::string(recv_pinned.begin(), recv_pinned.end()) == large, true);
+  EXPECT_GT(channel_impl1->zerocopySends(), 0);
+
+  auto fork1 = channel1->fork();
+  auto fork2 = channel2->fork();
+  EXPECT_EQ(fork1->asyncSend(small).IsOK(), true);
+  std::string recv_fork;
+  fork2->asyncRecv(recv_fork).get();
+  EXPECT_EQ(recv_fork, small);
+  channel1->close();
+  channel2->close();
+}
+
+TEST(channel, tcp_io_uring_test) {
+  TcpChannel::Options options;
+  options.io_backend = TcpChannel::IoBackend::kIoUring;
+  auto channel_impl2 = std::make_shared<TcpChannel>(TcpChannel::SERVER,
+                                                    "127.0.0.1", 0, options);
+  auto channel_impl1 = std::make_shared<TcpChannel>(
+      TcpChannel::CLIENT, "127.0.0.1", channel_impl2->port(), options);
+  auto channel1 = std::make_shared<Channel>(channel_impl1, "tcp_io_uring_test");
+  auto channel2 = std::make_shared<Channel>(channel_impl2, "tcp_io_uring_test");
+
+  // Small frames go through registered buffers, large ones through sendmsg,
+  // both work the same when io_uring is missing and the channel falls back.
+  std::string small = gen_random(100, 41);
+  std::string large = gen_random(1024 * 1024, 42);
+  auto send_fut = std::async(std::launch::async, [&]() {
+    EXPECT_EQ(channel1->asyncSend(small).IsOK(), true);
+    EXPECT_EQ(channel1->asyncSend(large).IsOK(), true);
+  });
+  std::string recv_small;
+  std::string recv_large;
+  EXPECT_EQ(channel2->asyncRecv(recv_small).get().IsOK(), true);
+  EXPECT_EQ(channel2->asyncRecv(recv_large).get().IsOK(), true);
+  send_fut.get();
+  EXPECT_EQ(recv_small, small);
+  EXPECT_EQ(recv_large == large, true);
+
+  // Forks share the reactor of their parent.
+  constexpr int kForks = 8;
+  std::vector<std::shared_ptr<Channel>> forks1;
+  std::vector<std::shared_ptr<Channel>> forks2;
+  for (int i = 0; i < kForks; i++) {
+    forks1.push_back(channel1->fork());
+    forks2.push_back(channel2->fork());
+  }
+  std::vector<std::future<void>> futs;
+  for (int i = 0; i < kForks; i++) {
+    futs.push_back(std::async(std::launch::async, [&, i]() {
+      for (int round = 0; round < 20; round++) {
+        uint64_t value = i * 1000 + round;
+        uint64_t echo = 0;
+        EXPECT_EQ(forks1[i]->asyncSend(value).IsOK(), true);
+        EXPECT_EQ(forks1[i]->asyncRecv(echo).get().IsOK(), true);
+        EXPECT_EQ(echo, value + 1);
+      }
+    }));
+    futs.push_back(std::async(std::launch::async, [&, i]() {
+      for (int round = 0; round < 20; round++) {
+        uint64_t value = 0;
+        EXPECT_EQ(forks2[i]->asyncRecv(value).get().IsOK(), true);
+        EXPECT_EQ(forks2[i]->asyncSend(value + 1).IsOK(), true);
+      }
+    }));
+  }
+  for (auto &fut : futs)
+    fut.get();
+
+  if (channel_impl1->usingIoUring()) {
+    auto reactor = channel_impl1->reactor();
+    EXPECT_GT(reactor->enterCalls(), 0);
+    EXPECT_GE(reactor->submittedOps(), reactor->enterCalls());
+  }
+  for (auto &fork : forks1)
+    fork->close();
+  for (auto &fork : forks2)
+    fork->close();
+  channel1->close();
+  channel2->close();
+}
+
+TEST(channel, uds_memfd_test) {
+  std::string path = "@primihub_uds_test_" + std::to_string(getpid());
+  UdsChannel::Options options;
+  options.memfd_threshold = 64 * 1024;
+  auto channel_impl2 =
+      std::make_shared<UdsChannel>(UdsChannel::SERVER, path, options);
+  auto channel_impl1 =
+      std::make_shared<UdsChannel>(UdsChannel::CLIENT, path, options);
+  auto channel1 = std::make_shared<Channel>(channel_impl1, "uds_memfd_test");
+  auto channel2 = std::make_shared<Channel>(channel_impl2, "uds_memfd_test");
+
+  std::string empty;
+  std::string small = gen_random(100, 51);
+  std::string large = gen_random(4 * 1024 * 1024, 52);
+  std::vector<uint32_t> values(100000);
+  for (size_t i = 0; i < values.size(); i++)
+    values[i] = static_cast<uint32_t>(i * 2654435761u);
+  auto send_fut = std::async(std::launch::async, [&]() {
+    EXPECT_EQ(channel1->asyncSend(empty).IsOK(), true);
+    EXPECT_EQ(channel1->asyncSend(small).IsOK(), true);
+    EXPECT_EQ(channel1->asyncSend(large).IsOK(), true);
+    EXPECT_EQ(channel1->asyncSend(values).IsOK(), true);
+  });
+
+  std::string recv_empty = "not empty";
+  std::string recv_small;
+  std::string recv_large;
+  std::vector<uint32_t> recv_values(values.size());
+  EXPECT_EQ(channel2->asyncRecv(recv_empty).get().IsOK(), true);
+  EXPECT_EQ(channel2->asyncRecv(recv_small).get().IsOK(), true);
+  EXPECT_EQ(channel2->asyncRecv(recv_large).get().IsOK(), true);
+  EXPECT_EQ(channel2->asyncRecv(recv_values).get().IsOK(), true);
+  send_fut.get();
+
+  EXPECT_EQ(recv_empty.empty(), true);
+  EXPECT_EQ(recv_small, small);
+  EXPECT_EQ(recv_large == large, true);
+  EXPECT_EQ(recv_values == values, true);
+  EXPECT_EQ(channel_impl1->memfdSends(), 2);
+
+  // A size mismatch drops the message, the next one is intact.
+  auto fork1 = channel1->fork();
+  auto fork2 = channel2->fork();
+  EXPECT_EQ(fork1->asyncSend(large).IsOK(), true);
+  EXPECT_EQ(fork1->asyncSend(small).IsOK(), true);
+  char wrong_size[10];
+  EXPECT_EQ(fork2->asyncRecv(wrong_size, sizeof(wrong_size)).get().IsOK(),
+            false);
+  std::string recv_fork;
+  EXPECT_EQ(fork2->asyncRecv(recv_fork).get().IsOK(), true);
+  EXPECT_EQ(recv_fork, small);
+  fork1->close();
+  fork2->close();
+
+  // The size a memfd packet claims is checked against the memfd before it
+  // is allocated, an unsealed one is dropped and the next packet is intact.
+  auto raw_server = channel2->fork();
+  int raw_fd = primihub::link::ConnectUnix(path, SOCK_SEQPACKET, 1000);
+  ASSERT_GE(raw_fd, 0);
+  EXPECT_EQ(primihub::link::WritePacketHandshake(raw_fd, raw_server->getKey()),
+            true);
+  int mem_fd = memfd_create("uds_memfd_test", MFD_CLOEXEC);
+  ASSERT_GE(mem_fd, 0);
+  char packet[9] = {1};
+  uint64_t claimed = uint64_t(1) << 50;
+  memcpy(packet + 1, &claimed, sizeof(claimed));
+  iovec iov{packet, sizeof(packet)};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+  msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+  cm->cmsg_level = SOL_SOCKET;
+  cm->cmsg_type = SCM_RIGHTS;
+  cm->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cm), &mem_fd, sizeof(int));
+  EXPECT_EQ(sendmsg(raw_fd, &msg, 0), sizeof(packet));
+  ::close(mem_fd);
+  char inline_packet[] = {0, 'o', 'k'};
+  EXPECT_EQ(send(raw_fd, inline_packet, sizeof(inline_packet), 0),
+            sizeof(inline_packet));
+  std::string raw_received;
+  EXPECT_EQ(raw_server->recv(raw_received).IsOK(), false);
+  EXPECT_EQ(raw_server->recv(raw_received).IsOK(), true);
+  EXPECT_EQ(raw_received, "ok");
+  ::close(raw_fd);
+  raw_server->close();
+
+  // A memfd message above max_message_size fails, the next one is intact.
+  std::string limited_path = path + "_limited";
+  UdsChannel::Options limited_options = options;
+  limited_options.max_message_size = 1024 * 1024;
+  Channel limited(std::make_shared<UdsChannel>(UdsChannel::SERVER,
+                                               limited_path, limited_options),
+                  "uds_memfd_test");
+  Channel sender(std::make_shared<UdsChannel>(UdsChannel::CLIENT,
+                                              limited_path, options),
+                 "uds_memfd_test");
+  EXPECT_EQ(sender.send(large).IsOK(), true);
+  EXPECT_EQ(sender.send(small).IsOK(), true);
+  EXPECT_EQ(limited.recv(raw_received).IsOK(), false);
+  EXPECT_EQ(limited.recv(raw_received).IsOK(), true);
+  EXPECT_EQ(raw_received, small);
+  sender.close();
+  limited.close();
+  channel1->close();
+  channel2->close();
+}
+
+TEST(channel, mem_rendezvous_test) {
+  auto channel_impl1 = std::make_shared<MemoryChannel>(ChannelRole::CLIENT);
+  auto channel_impl2 = std::make_shared<MemoryChannel>(ChannelRole::SERVER);
+  auto channel1 = std::make_shared<Channel>(channel_impl1, "rendezvous_test");
+  auto channel2 = std::make_shared<Channel>(channel_impl2, "rendezvous_test");
+
+  // The receive is posted before the send, the payload is copied once.
+  std::string large = gen_random(1024 * 1024, 61);
+  std::vector<char> recv_large(large.size());
+  auto recv_fut = channel2->asyncRecv(recv_large.data(), recv_large.size());
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(channel1->asyncSend(large.data(), large.size()).IsOK(), true);
+  EXPECT_EQ(recv_fut.get().IsOK(), true);
+  EXPECT_EQ(std::string(recv_large.begin(), recv_large.end()) == large, true);
+  EXPECT_EQ(channel_impl1->rendezvousSends(), 1);
+
+  // A small message queued while the receive is posted keeps its order.
+  std::string small = gen_random(100, 62);
+  std::vector<char> recv_small(small.size());
+  recv_fut = channel2->asyncRecv(recv_small.data(), recv_small.size());
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(channel1->asyncSend(small.data(), small.size()).IsOK(), true);
+  EXPECT_EQ(recv_fut.get().IsOK(), true);
+  EXPECT_EQ(std::string(recv_small.begin(), recv_small.end()), small);
+  EXPECT_EQ(channel_impl1->rendezvousSends(), 1);
+
+  // Without a posted receive large messages are queued.
+  EXPECT_EQ(channel1->asyncSend(large.data(), large.size()).IsOK(), true);
+  EXPECT_EQ(channel1->asyncSend(small.data(), small.size()).IsOK(), true);
+  EXPECT_EQ(channel2->asyncRecv(recv_large.data(), recv_large.size())
+                .get()
+                .IsOK(),
+            true);
+  EXPECT_EQ(channel2->asyncRecv(recv_small.data(), recv_small.size())
+                .get()
+                .IsOK(),
+            true);
+  EXPECT_EQ(std::string(recv_small.begin(), recv_small.end()), small);
+  EXPECT_EQ(channel_impl1->rendezvousSends(), 1);
+
+  // A posted receive of the wrong size fails and consumes the message.
+  auto fork1 = channel1->fork();
+  auto fork2 = channel2->fork();
+  std::vector<char> wrong_size(10);
+  recv_fut = fork2->asyncRecv(wrong_size.data(), wrong_size.size());
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(fork1->asyncSend(large.data(), large.size()).IsOK(), true);
+  EXPECT_EQ(recv_fut.get().IsOK(), false);
+  EXPECT_EQ(fork1->asyncSend(small.data(), small.size()).IsOK(), true);
+  std::string recv_fork;
+  fork2->asyncRecv(recv_fork).get();
+  EXPECT_EQ(recv_fork, small);
+}
+
+TEST(channel, selector_test) {
+  auto mem_client = std::make_shared<Channel>(
+      std::make_shared<MemoryChannel>(ChannelRole::CLIENT), "selector_test");
+  auto mem_server = std::make_shared<Channel>(
+      std::make_shared<MemoryChannel>(ChannelRole::SERVER), "selector_test");
+  auto tcp_server_impl =
+      std::make_shared<TcpChannel>(TcpChannel::SERVER, "127.0.0.1", 0);
+  auto tcp_client = std::make_shared<Channel>(
+      std::make_shared<TcpChannel>(TcpChannel::CLIENT, "127.0.0.1",
+                                   tcp_server_impl->port()),
+      "selector_test");
+  auto tcp_server = std::make_shared<Channel>(tcp_server_impl, "selector_test");
+
+  constexpr int kMemForks = 64;
+  constexpr int kTcpForks = 4;
+  std::vector<std::shared_ptr<Channel>> senders;
+  ChannelSelector selector;
+  std::map<Channel *, int> index;
+  for (int i = 0; i < kMemForks + kTcpForks; i++) {
+    bool mem = i < kMemForks;
+    senders.push_back(mem ? mem_client->fork() : tcp_client->fork());
+    auto receiver = mem ? mem_server->fork() : tcp_server->fork();
+    index[receiver.get()] = i;
+    selector.add(receiver);
+  }
+  EXPECT_EQ(selector.size(), kMemForks + kTcpForks);
+  EXPECT_EQ(selector.select(10).empty(), true);
+
+  // Every sender sends its index twice, in a shuffled order.
+  std::vector<int> order;
+  for (int round = 0; round < 2; round++)
+    for (int i = 0; i < kMemForks + kTcpForks; i++)
+      order.push_back(i);
+  std::mt19937 rng(7);
+  std::shuffle(order.begin(), order.end(), rng);
+  auto send_fut = std::async(std::launch::async, [&]() {
+    for (int i : order)
+      EXPECT_EQ(senders[i]->asyncSend(std::to_string(i)).IsOK(), true);
+  });
+
+  std::vector<int> counts(kMemForks + kTcpForks, 0);
+  size_t received_total = 0;
+  while (received_total < order.size()) {
+    auto ready = selector.select(10000);
+    ASSERT_EQ(ready.empty(), false);
+    for (auto &channel : ready) {
+      std::string message;
+      bool received = false;
+      while (channel->try_recv(message, &received).IsOK() && received) {
+        EXPECT_EQ(message, std::to_string(index[channel.get()]));
+        counts[index[channel.get()]]++;
+        received_total++;
+      }
+    }
+  }
+  send_fut.get();
+  for (int count : counts)
+    EXPECT_EQ(count, 2);
+
+  std::string message;
+  bool received = true;
+  EXPECT_EQ(senders[0]->try_recv(message, &received).IsOK(), true);
+  EXPECT_EQ(received, false);
+  for (auto &sender : senders)
+    sender->close();
+  tcp_server->close();
+
+  // A client that is not connected has nothing to poll, select must not
+  // dial a peer that is not listening.
+  uint16_t dead_port = 0;
+  ::close(primihub::link::ListenTcp("127.0.0.1", 0, &dead_port));
+  TcpChannel::Options options;
+  options.connect_timeout_ms = 3000;
+  auto dead = std::make_shared<Channel>(
+      std::make_shared<TcpChannel>(TcpChannel::CLIENT, "127.0.0.1", dead_port,
+                                   options),
+      "selector_test");
+  ChannelSelector dead_selector;
+  dead_selector.add(dead);
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_EQ(dead_selector.select(100).empty(), true);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+  dead_selector.remove(dead);
+}
+
+TEST(channel, callback_test) {
+  auto mem_client = std::make_shared<Channel>(
+      std::make_shared<MemoryChannel>(ChannelRole::CLIENT), "callback_test");
+  auto mem_server = std::make_shared<Channel>(
+      std::make_shared<MemoryChannel>(ChannelRole::SERVER), "callback_test");
+  auto tcp_server_impl =
+      std::make_shared<TcpChannel>(TcpChannel::SERVER, "127.0.0.1", 0);
+  auto tcp_client = std::make_shared<Channel>(
+      std::make_shared<TcpChannel>(TcpChannel::CLIENT, "127.0.0.1",
+                                   tcp_server_impl->port()),
+      "callback_test");
+  auto tcp_server = std::make_shared<Channel>(tcp_server_impl, "callback_test");
+
+  constexpr int kForks = 32;
+  constexpr int kMessages = 3;
+  std::vector<std::shared_ptr<Channel>> senders;
+  std::vector<std::shared_ptr<Channel>> receivers;
+  for (int i = 0; i < kForks; i++) {
+    bool mem = i % 2 == 0;
+    senders.push_back(mem ? mem_client->fork() : tcp_client->fork());
+    receivers.push_back(mem ? mem_server->fork() : tcp_server->fork());
+  }
+
+  std::mutex mu;
+  std::condition_variable cv;
+  int completed = 0;
+  int failed = 0;
+  auto done = [&](Status status) {
+    std::lock_guard<std::mutex> lock(mu);
+    if (!status.IsOK())
+      failed++;
+    completed++;
+    cv.notify_all();
+  };
+
+  // Receives are posted before anything is sent, they must neither block a
+  // thread each nor complete out of order.
+  std::vector<std::string> strings(kForks);
+  std::vector<std::vector<uint32_t>> vectors(kForks);
+  std::vector<uint64_t> values(kForks, 0);
+  for (int i = 0; i < kForks; i++) {
+    receivers[i]->asyncRecv(strings[i], done);
+    receivers[i]->asyncRecv(vectors[i], done);
+    receivers[i]->asyncRecv(&values[i], 1, done);
+  }
+  for (int i = 0; i < kForks; i++) {
+    senders[i]->asyncSend(std::string("fork " + std::to_string(i)), done);
+    senders[i]->asyncSend(std::vector<uint32_t>(i + 1, i), done);
+    senders[i]->asyncSend(std::vector<uint64_t>{uint64_t(i) << 40}, done);
+  }
+  {
+    std::unique_lock<std::mutex> lock(mu);
+    ASSERT_EQ(cv.wait_for(lock, std::chrono::seconds(30), [&]() {
+      return completed == 2 * kForks * kMessages;
+    }), true);
+  }
+  EXPECT_EQ(failed, 0);
+  for (int i = 0; i < kForks; i++) {
+    EXPECT_EQ(strings[i], "fork " + std::to_string(i));
+    EXPECT_EQ(vectors[i], std::vector<uint32_t>(i + 1, i));
+    EXPECT_EQ(values[i], uint64_t(i) << 40);
+  }
+
+  // A size mismatch is reported through the callback.
+  char small[4];
+  std::promise<bool> result;
+  receivers[0]->asyncRecv(small, sizeof(small), [&](Status status) {
+    result.set_value(status.IsOK());
+  });
+  EXPECT_EQ(senders[0]->send(std::string("too long")).IsOK(), true);
+  EXPECT_EQ(result.get_future().get(), false);
+
+  for (auto &sender : senders)
+    sender->close();
+  tcp_server->close();
+}
+
+TEST(channel, reactor_lanes_test) {
+  CompletionReactor reactor;
+  constexpr int kChannels = 64;
+  std::vector<std::shared_ptr<ChannelBase>> channels;
+  for (int i = 0; i < kChannels; i++)
+    channels.push_back(std::make_shared<MemoryChannel>(ChannelRole::CLIENT));
+
+  // The lanes of many channels are spread over all workers.
+  std::mutex mu;
+  std::condition_variable cv;
+  std::map<ChannelBase *, std::thread::id> workers;
+  for (auto &channel : channels) {
+    ChannelBase *key = channel.get();
+    reactor.submitSend(
+        channel,
+        [&, key]() {
+          std::lock_guard<std::mutex> lock(mu);
+          workers[key] = std::this_thread::get_id();
+          return Status::OK();
+        },
+        [&](Status) { cv.notify_all(); });
+  }
+  {
+    std::unique_lock<std::mutex> lock(mu);
+    ASSERT_EQ(cv.wait_for(lock, std::chrono::seconds(10),
+                          [&]() { return workers.size() == kChannels; }),
+              true);
+  }
+  std::set<std::thread::id> distinct;
+  for (auto &worker : workers)
+    distinct.insert(worker.second);
+  EXPECT_EQ(distinct.size(), CompletionReactor::kDefaultWorkers);
+
+  // A send blocked on one channel does not hold up the send of a channel
+  // on another worker.
+  auto first = channels[0];
+  std::shared_ptr<ChannelBase> other;
+  for (auto &channel : channels) {
+    if (workers[channel.get()] != workers[first.get()]) {
+      other = channel;
+      break;
+    }
+  }
+  ASSERT_NE(other, nullptr);
+  std::promise<void> other_ran;
+  auto other_future = other_ran.get_future();
+  std::promise<bool> first_saw_other;
+  reactor.submitSend(
+      first,
+      [&]() {
+        first_saw_other.set_value(other_future.wait_for(std::chrono::seconds(
+                                      10)) == std::future_status::ready);
+        return Status::OK();
+      },
+      [](Status) {});
+  reactor.submitSend(
+      other,
+      [&]() {
+        other_ran.set_value();
+        return Status::OK();
+      },
+      [](Status) {});
+  EXPECT_EQ(first_saw_other.get_future().get(), true);
+
+  // A client whose peer is not listening neither holds up the receives of
+  // other channels nor leaves its own pending, they fail once connecting
+  // has failed.
+  uint16_t dead_port = 0;
+  ::close(primihub::link::ListenTcp("127.0.0.1", 0, &dead_port));
+  TcpChannel::Options options;
+  options.connect_timeout_ms = 2000;
+  std::shared_ptr<ChannelBase> dead = std::make_shared<TcpChannel>(
+      TcpChannel::CLIENT, "127.0.0.1", dead_port, options);
+  dead->SetKey("reactor_lanes_test");
+  std::promise<bool> dead_result;
+  reactor.submitRecv(
+      dead,
+      [dead]() {
+        std::string message;
+        return dead->RecvImpl(&message) == retcode::SUCCESS
+                   ? Status::OK()
+                   : Status::NetworkError();
+      },
+      [&](Status status) { dead_result.set_value(status.IsOK()); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  auto mem_sender =
+      std::make_shared<MemoryChannel>("reactor_lanes_test", ChannelRole::CLIENT);
+  std::shared_ptr<ChannelBase> mem_receiver =
+      std::make_shared<MemoryChannel>("reactor_lanes_test", ChannelRole::SERVER);
+  auto start = std::chrono::steady_clock::now();
+  std::promise<std::string> mem_result;
+  reactor.submitRecv(
+      mem_receiver,
+      [&, mem_receiver]() {
+        std::string message;
+        mem_receiver->RecvImpl(&message);
+        mem_result.set_value(message);
+        return Status::OK();
+      },
+      [](Status) {});
+  EXPECT_EQ(mem_sender->SendImpl(std::string("not held up")),
+            retcode::SUCCESS);
+  EXPECT_EQ(mem_result.get_future().get(), "not held up");
+  EXPECT_LT(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(1000));
+  auto dead_future = dead_result.get_future();
+  ASSERT_EQ(dead_future.wait_for(std::chrono::seconds(10)),
+            std::future_status::ready);
+  EXPECT_EQ(dead_future.get(), false);
+}
+
+TEST(channel, priority_test) {
+  auto tcp_server_impl =
+      std::make_shared<TcpChannel>(TcpChannel::SERVER, "127.0.0.1", 0);
+  auto client = std::make_shared<Channel>(
+      std::make_shared<TcpChannel>(TcpChannel::CLIENT, "127.0.0.1",
+                                   tcp_server_impl->port()),
+      "priority_test");
+  auto server = std::make_shared<Channel>(tcp_server_impl, "priority_test");
+
+  // The bulk message is larger than the socket buffers, its send can only
+  // finish once the receiver reads the normal lane.
+  std::string bulk(32 * 1024 * 1024, 'b');
+  auto bulk_fut = std::async(std::launch::async, [&]() {
+    return client->send(bulk, Priority::kNormal).IsOK();
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(client->send(std::string("abort"), Priority::kHigh).IsOK(), true);
+  std::string control;
+  EXPECT_EQ(server->recv(control, Priority::kHigh).IsOK(), true);
+  EXPECT_EQ(control, "abort");
+  EXPECT_EQ(bulk_fut.wait_for(std::chrono::seconds(0)),
+            std::future_status::timeout);
+
+  std::string received;
+  EXPECT_EQ(server->recv(received, Priority::kNormal).IsOK(), true);
+  EXPECT_EQ(bulk_fut.get(), true);
+  EXPECT_EQ(received == bulk, true);
+
+  LaneStats high = client->laneStats(Priority::kHigh);
+  LaneStats normal = client->laneStats(Priority::kNormal);
+  EXPECT_EQ(high.messages, 1);
+  EXPECT_EQ(high.bytes, 5);
+  EXPECT_EQ(normal.messages, 1);
+  EXPECT_EQ(normal.bytes, bulk.size());
+  EXPECT_GE(normal.max_latency_us, high.max_latency_us);
+  client->resetLaneStats();
+  EXPECT_EQ(client->laneStats(Priority::kNormal).messages, 0);
+
+  // Lanes of a memory channel are separate queues.
+  auto mem_client = std::make_shared<Channel>(
+      std::make_shared<MemoryChannel>(ChannelRole::CLIENT), "priority_test");
+  auto mem_server = std::make_shared<Channel>(
+      std::make_shared<MemoryChannel>(ChannelRole::SERVER), "priority_test");
+  EXPECT_EQ(mem_client->send(std::string("bulk"), Priority::kNormal).IsOK(),
+            true);
+  EXPECT_EQ(mem_client->send(std::string("sync"), Priority::kHigh).IsOK(),
+            true);
+  char sync[4];
+  EXPECT_EQ(mem_server->recv(sync, sizeof(sync), Priority::kHigh).IsOK(), true);
+  EXPECT_EQ(std::string(sync, sizeof(sync)), "sync");
+  EXPECT_EQ(mem_server->recv(received, Priority::kNormal).IsOK(), true);
+  EXPECT_EQ(received, "bulk");
+
+  client->close();
+  server->close();
+}
+
+TEST(channel, mem_spill_test) {
+  auto client_impl =
+      std::make_shared<MemoryChannel>("mem_spill_test", ChannelRole::CLIENT);
+  auto server_impl =
+      std::make_shared<MemoryChannel>("mem_spill_test", ChannelRole::SERVER);
+  client_impl->setSpillThreshold(64 * 1024);
+  auto client = std::make_shared<Channel>(client_impl, "mem_spill_test");
+  auto server = std::make_shared<Channel>(server_impl, "mem_spill_test");
+
+  // The receiver is idle until everything has been sent, all but the first
+  // 64 KB end up in the spill file.
+  constexpr int kMessages = 64;
+  auto message = [](int i) {
+    return std::string(i % 4 == 0 ? 16 : 16 * 1024, static_cast<char>('a' + i));
+  };
+  for (int i = 0; i < kMessages; i++)
+    EXPECT_EQ(client->send(message(i)).IsOK(), true);
+  EXPECT_GE(client_impl->spilledSends(), kMessages / 2);
+  EXPECT_EQ(server_impl->HasPendingData(), true);
+
+  for (int i = 0; i < kMessages; i++) {
+    std::string expected = message(i);
+    if (i % 3 == 0) {
+      std::string received;
+      EXPECT_EQ(server->recv(received).IsOK(), true);
+      EXPECT_EQ(received == expected, true);
+    } else if (i % 3 == 1) {
+      std::vector<char> received(expected.size());
+      EXPECT_EQ(server->recv(received.data(), received.size()).IsOK(), true);
+      EXPECT_EQ(std::string(received.begin(), received.end()) == expected,
+                true);
+    } else {
+      std::string received;
+      bool got = false;
+      EXPECT_EQ(server->try_recv(received, &got).IsOK(), true);
+      EXPECT_EQ(got, true);
+      EXPECT_EQ(received == expected, true);
+    }
+  }
+  EXPECT_EQ(server_impl->HasPendingData(), false);
+
+  // Once the receiver caught up messages are queued in memory again, forks
+  // spill as well.
+  uint64_t spilled = client_impl->spilledSends();
+  EXPECT_EQ(client->send(std::string("small")).IsOK(), true);
+  EXPECT_EQ(client_impl->spilledSends(), spilled);
+  std::string received;
+  EXPECT_EQ(server->recv(received).IsOK(), true);
+  EXPECT_EQ(received, "small");
+
+  auto client_fork = std::dynamic_pointer_cast<MemoryChannel>(
+      client_impl->ForkImpl("mem_spill_test_fork"));
+  auto server_fork = server_impl->ForkImpl("mem_spill_test_fork");
+  std::string bulk(48 * 1024, 'x');
+  for (int i = 0; i < 4; i++)
+    EXPECT_EQ(client_fork->SendImpl(bulk), retcode::SUCCESS);
+  EXPECT_EQ(client_fork->spilledSends(), 2);
+  char mismatch[16];
+  EXPECT_EQ(server_fork->RecvImpl(mismatch, sizeof(mismatch)), retcode::FAIL);
+  for (int i = 1; i < 4; i++) {
+    EXPECT_EQ(server_fork->RecvImpl(&received), retcode::SUCCESS);
+    EXPECT_EQ(received == bulk, true);
+  }
+
+  // Receives copy out of the file while the sender keeps spilling behind
+  // them, the file only starts over once no read is in flight.
+  auto stream_fork = std::dynamic_pointer_cast<MemoryChannel>(
+      client_impl->ForkImpl("mem_spill_test_stream"));
+  auto stream_server = server_impl->ForkImpl("mem_spill_test_stream");
+  constexpr int kStreamed = 200;
+  constexpr int kAhead = 16;
+  for (int i = 0; i < kAhead; i++)
+    EXPECT_EQ(stream_fork->SendImpl(message(i)), retcode::SUCCESS);
+  EXPECT_GT(stream_fork->spilledSends(), 0);
+  auto sender = std::async(std::launch::async, [&]() {
+    for (int i = kAhead; i < kStreamed; i++)
+      EXPECT_EQ(stream_fork->SendImpl(message(i)), retcode::SUCCESS);
+  });
+  for (int i = 0; i < kStreamed; i++) {
+    EXPECT_EQ(stream_server->RecvImpl(&received), retcode::SUCCESS);
+    EXPECT_EQ(received == message(i), true);
+  }
+  sender.get();
+}
+
+TEST(channel, record_replay_test) {
+  char dir_template[] = "/tmp/primihub_replay_XXXXXX";
+  ASSERT_NE(mkdtemp(dir_template), nullptr);
+  std::string dir = dir_template;
+
+  // The party under test asks its peer on the channel and on a fork.
+  auto party = [](Channel &channel) {
+    std::string reply;
+    EXPECT_EQ(channel.send(std::string("ping")).IsOK(), true);
+    EXPECT_EQ(channel.recv(reply).IsOK(), true);
+    auto fork = channel.fork();
+    uint64_t sum = 0;
+    EXPECT_EQ(fork->send(std::vector<uint64_t>{1, 2, 3}).IsOK(), true);
+    EXPECT_EQ(fork->recv(sum).IsOK(), true);
+    return reply + " " + std::to_string(sum);
+  };
+
+  auto recorder = std::make_shared<RecordingChannel>(
+      std::make_shared<MemoryChannel>(ChannelRole::CLIENT), dir);
+  Channel recorded(recorder, "record_replay_test");
+  Channel peer(std::make_shared<MemoryChannel>(ChannelRole::SERVER),
+               "record_replay_test");
+  auto peer_fut = std::async(std::launch::async, [&]() {
+    std::string request;
+    EXPECT_EQ(peer.recv(request).IsOK(), true);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(peer.send(request == "ping" ? std::string("pong")
+                                          : std::string("?")).IsOK(),
+              true);
+    auto fork = peer.fork();
+    std::vector<uint64_t> values;
+    EXPECT_EQ(fork->recv(values).IsOK(), true);
+    uint64_t sum = std::accumulate(values.begin(), values.end(), uint64_t(0));
+    EXPECT_EQ(fork->send(sum).IsOK(), true);
+  });
+  EXPECT_EQ(party(recorded), "pong 6");
+  peer_fut.get();
+  EXPECT_EQ(recorder->recordedMessages(), 2);
+  recorded.close();
+
+  // Replaying needs no peer, with the original timing the reply comes as
+  // late as it did.
+  for (bool original_timing : {false, true}) {
+    ReplayChannel::Options options;
+    options.original_timing = original_timing;
+    auto replay_impl = std::make_shared<ReplayChannel>(dir, options);
+    Channel replay(replay_impl, "record_replay_test");
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(party(replay), "pong 6");
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    if (original_timing) {
+      EXPECT_GE(elapsed, std::chrono::milliseconds(45));
+    }
+    EXPECT_EQ(replay_impl->sendMismatches(), 0);
+    EXPECT_EQ(replay_impl->replayedMessages(), 1);
+  }
+
+  auto replay_impl = std::make_shared<ReplayChannel>(dir);
+  Channel replay(replay_impl, "record_replay_test");
+  EXPECT_EQ(replay.send(std::string("pang")).IsOK(), true);
+  EXPECT_EQ(replay_impl->sendMismatches(), 1);
+  std::string reply;
+  EXPECT_EQ(replay.recv(reply).IsOK(), true);
+  EXPECT_EQ(reply, "pong");
+  EXPECT_EQ(replay_impl->HasPendingData(), false);
+
+  for (auto key : {"record_replay_test", "record_replay_test_fork_1"})
+    unlink(TrafficLogPath(dir, key).c_str());
+  rmdir(dir.c_str());
+}
+
+TEST(channel, shaped_test) {
+  ShapedChannel::Options wan;
+  wan.latency = std::chrono::milliseconds(20);
+  wan.jitter = std::chrono::milliseconds(2);
+  auto client_impl = std::make_shared<ShapedChannel>(
+      std::make_shared<MemoryChannel>(ChannelRole::CLIENT), wan);
+  auto server_impl = std::make_shared<ShapedChannel>(
+      std::make_shared<MemoryChannel>(ChannelRole::SERVER), wan);
+  Channel client(client_impl, "shaped_test");
+  Channel server(server_impl, "shaped_test");
+
+  // A round trip pays the latency twice, pipelined messages pay it once.
+  using std::chrono::milliseconds;
+  auto start = std::chrono::steady_clock::now();
+  auto echo = std::async(std::launch::async, [&]() {
+    std::string message;
+    for (int i = 0; i < 10; i++)
+      EXPECT_EQ(server.recv(message).IsOK(), true);
+    EXPECT_EQ(server.send(message).IsOK(), true);
+  });
+  for (int i = 0; i < 10; i++)
+    EXPECT_EQ(client.send(std::to_string(i)).IsOK(), true);
+  std::string reply;
+  EXPECT_EQ(client.recv(reply).IsOK(), true);
+  echo.get();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  EXPECT_EQ(reply, "9");
+  EXPECT_GE(elapsed, milliseconds(40));
+  EXPECT_LT(elapsed, milliseconds(200));
+
+  // A fork configured as a 10 MB/s link is bandwidth bound.
+  ShapedChannel::Options slow;
+  slow.bandwidth_bytes_per_sec = 10 * 1024 * 1024;
+  slow.per_message_overhead = 64;
+  client_impl->setForkOptions("shaped_test_fork_1", slow);
+  server_impl->setForkOptions("shaped_test_fork_1", slow);
+  auto client_fork = client.fork();
+  auto server_fork = server.fork();
+  std::string bulk(1024 * 1024, 'x');
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < 2; i++)
+    EXPECT_EQ(client_fork->send(bulk).IsOK(), true);
+  for (int i = 0; i < 2; i++) {
+    EXPECT_EQ(server_fork->recv(reply).IsOK(), true);
+    EXPECT_EQ(reply == bulk, true);
+  }
+  elapsed = std::chrono::steady_clock::now() - start;
+  EXPECT_GE(elapsed, milliseconds(180));
+  EXPECT_EQ(client_impl->throttledTime().count(), 0);
+
+  char mismatch[4];
+  EXPECT_EQ(client.send(std::string("too long")).IsOK(), true);
+  EXPECT_EQ(server_impl->RecvImpl(mismatch, sizeof(mismatch)), retcode::FAIL);
+
+  // A message in flight is not pending yet, try_recv returns right away and
+  // a selector wakes up once it arrives.
+  ShapedChannel::Options far;
+  far.latency = milliseconds(100);
+  auto far_client = std::make_shared<Channel>(
+      std::make_shared<ShapedChannel>(
+          std::make_shared<MemoryChannel>(ChannelRole::CLIENT), far),
+      "shaped_test_far");
+  auto far_server = std::make_shared<Channel>(
+      std::make_shared<ShapedChannel>(
+          std::make_shared<MemoryChannel>(ChannelRole::SERVER), far),
+      "shaped_test_far");
+  ChannelSelector selector;
+  selector.add(far_server);
+  start = std::chrono::steady_clock::now();
+  EXPECT_EQ(far_client->send(std::string("late")).IsOK(), true);
+  bool received = true;
+  EXPECT_EQ(far_server->try_recv(reply, &received).IsOK(), true);
+  EXPECT_EQ(received, false);
+  EXPECT_EQ(far_server->hasPendingData(), false);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, milliseconds(50));
+  auto ready = selector.select(2000);
+  elapsed = std::chrono::steady_clock::now() - start;
+  ASSERT_EQ(ready.size(), 1);
+  EXPECT_GE(elapsed, milliseconds(100));
+  EXPECT_LT(elapsed, milliseconds(1000));
+  EXPECT_EQ(far_server->try_recv(reply, &received).IsOK(), true);
+  EXPECT_EQ(received, true);
+  EXPECT_EQ(reply, "late");
+  selector.remove(far_server);
+}
+
+static std::string FromHex(const std::string &hex) {
+  std::string bytes;
+  for (size_t i = 0; i + 1 < hex.size(); i += 2)
+    bytes.push_back(static_cast<char>(std::stoi(hex.substr(i, 2), nullptr, 16)));
+  return bytes;
+}
+
+TEST(channel, secure_channel_test) {
+  // Known answers: GCM spec test case 16 and RFC 8439 section 2.8.2.
+  struct Vector {
+    AeadSuite suite;
+    std::string key, nonce, aad, plaintext, ciphertext, tag;
+  };
+  std::string chacha_key;
+  for (int i = 0x80; i < 0xa0; i++)
+    chacha_key.push_back(static_cast<char>(i));
+  std::vector<Vector> vectors = {
+      {AeadSuite::kAes256Gcm,
+       FromHex("feffe9928665731c6d6a8f9467308308"
+               "feffe9928665731c6d6a8f9467308308"),
+       FromHex("cafebabefacedbaddecaf888"),
+       FromHex("feedfacedeadbeeffeedfacedeadbeefabaddad2"),
+       FromHex("d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a31"
+               "8a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39"),
+       FromHex("522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555"
+               "d1aa8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662"),
+       FromHex("76fc6ece0f4e1768cddf8853bb2d551b")},
+      {AeadSuite::kChaCha20Poly1305, chacha_key,
+       FromHex("070000004041424344454647"),
+       FromHex("50515253c0c1c2c3c4c5c6c7"),
+       "Ladies and Gentlemen of the class of '99: If I could offer you only "
+       "one tip for the future, sunscreen would be it.",
+       FromHex("d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee"
+               "62d63dbea45e8ca9671282fafb69da92728b1a71de0a9e060b2905d6a5b6"
+               "7ecd3b3692ddbd7f2d778b8c9803aee328091b58fab324e4fad675945585"
+               "808b4831d7bc3ff4def08e4b7a9de576d26586cec64b6116"),
+       FromHex("1ae10b594f09e26a7e902ecbd0600691")},
+  };
+  for (auto &v : vectors) {
+    Aead aead;
+    if (!aead.Init(v.suite, reinterpret_cast<const uint8_t *>(v.key.data())))
+      continue;
+    std::string out(v.plaintext.size(), '\0');
+    std::string tag(Aead::kTagSize, '\0');
+    aead.Seal(reinterpret_cast<const uint8_t *>(v.nonce.data()),
+              reinterpret_cast<const uint8_t *>(v.aad.data()), v.aad.size(),
+              reinterpret_cast<const uint8_t *>(v.plaintext.data()),
+              v.plaintext.size(), reinterpret_cast<uint8_t *>(&out[0]),
+              reinterpret_cast<uint8_t *>(&tag[0]));
+    EXPECT_EQ(out == v.ciphertext, true);
+    EXPECT_EQ(tag == v.tag, true);
+    // In place.
+    EXPECT_EQ(aead.Open(reinterpret_cast<const uint8_t *>(v.nonce.data()),
+                        reinterpret_cast<const uint8_t *>(v.aad.data()),
+                        v.aad.size(), reinterpret_cast<uint8_t *>(&out[0]),
+                        out.size(), reinterpret_cast<uint8_t *>(&out[0]),
+                        reinterpret_cast<const uint8_t *>(tag.data())),
+              true);
+    EXPECT_EQ(out == v.plaintext, true);
+  }
+
+  for (auto cipher : {SecureChannel::Cipher::kAuto,
+                      SecureChannel::Cipher::kChaCha20Poly1305}) {
+    SecureChannel::Options options;
+    options.cipher = cipher;
+    auto client_mem = std::make_shared<MemoryChannel>(ChannelRole::CLIENT);
+    auto server_mem = std::make_shared<MemoryChannel>(ChannelRole::SERVER);
+    auto client_impl = std::make_shared<SecureChannel>(
+        client_mem, SecureChannel::CLIENT, "psk", options);
+    auto server_impl = std::make_shared<SecureChannel>(
+        server_mem, SecureChannel::SERVER, "psk", options);
+    Channel client(client_impl, "secure_test");
+    Channel server(server_impl, "secure_test");
+
+    std::string reply;
+    for (size_t size : {0, 1, 15, 16, 17, 129, 4096, 100003}) {
+      std::string message(size, 'm');
+      for (size_t i = 0; i < size; i++)
+        message[i] = static_cast<char>(i * 7);
+      EXPECT_EQ(client.send(message).IsOK(), true);
+      EXPECT_EQ(server.recv(reply).IsOK(), true);
+      EXPECT_EQ(reply == message, true);
+      EXPECT_EQ(server.send(message).IsOK(), true);
+      EXPECT_EQ(client.recv(reply).IsOK(), true);
+      EXPECT_EQ(reply == message, true);
+    }
+    std::vector<uint64_t> numbers(100);
+    std::iota(numbers.begin(), numbers.end(), 0);
+    std::vector<uint64_t> received(100);
+    EXPECT_EQ(client.send(numbers).IsOK(), true);
+    EXPECT_EQ(server_impl->RecvImpl(reinterpret_cast<char *>(received.data()),
+                                    received.size() * sizeof(uint64_t)),
+              retcode::SUCCESS);
+    EXPECT_EQ(received == numbers, true);
+
+    // A receive of the wrong size fails, the channel stays usable.
+    EXPECT_EQ(client.send(std::string("12345678")).IsOK(), true);
+    char short_buf[4];
+    EXPECT_EQ(server_impl->RecvImpl(short_buf, sizeof(short_buf)),
+              retcode::FAIL);
+    EXPECT_EQ(client.send(std::string("after")).IsOK(), true);
+    EXPECT_EQ(server.recv(reply).IsOK(), true);
+    EXPECT_EQ(reply, "after");
+
+    // The payload does not cross the transport in clear.
+    std::string secret = "attack at dawn";
+    EXPECT_EQ(client_impl->SendImpl(secret), retcode::SUCCESS);
+    std::string frame;
+    EXPECT_EQ(server_mem->RecvImpl(&frame), retcode::SUCCESS);
+    EXPECT_EQ(frame.size(), secret.size() + SecureChannel::kOverhead);
+    EXPECT_EQ(frame.find(secret), std::string::npos);
+
+    // A flipped bit, a replayed and a foreign frame are all rejected.
+    std::string tampered = frame;
+    tampered[SecureChannel::kHeaderSize] ^= 1;
+    EXPECT_EQ(client_mem->SendImpl(tampered), retcode::SUCCESS);
+    char plain[14];
+    EXPECT_EQ(server_impl->RecvImpl(plain, sizeof(plain)), retcode::FAIL);
+    EXPECT_EQ(server_mem->SendImpl(frame), retcode::SUCCESS);
+    EXPECT_EQ(client_impl->RecvImpl(&reply), retcode::FAIL);
+    EXPECT_EQ(server_impl->authFailures(), 1);
+    EXPECT_EQ(client_impl->authFailures(), 1);
+
+    // Forks have keys of their own.
+    auto client_fork = client.fork();
+    auto server_fork = server.fork();
+    EXPECT_EQ(client_fork->send(std::string("fork")).IsOK(), true);
+    EXPECT_EQ(server_fork->recv(reply).IsOK(), true);
+    EXPECT_EQ(reply, "fork");
+
+    // So do peers with another pre-shared key.
+    auto stranger = std::make_shared<SecureChannel>(
+        std::make_shared<MemoryChannel>(ChannelRole::CLIENT),
+        SecureChannel::CLIENT, "other psk", options);
+    auto victim = std::make_shared<SecureChannel>(
+        std::make_shared<MemoryChannel>(ChannelRole::SERVER),
+        SecureChannel::SERVER, "psk", options);
+    Channel stranger_channel(stranger, "secure_test_stranger");
+    Channel victim_channel(victim, "secure_test_stranger");
+    EXPECT_EQ(stranger_channel.send(std::string("hello")).IsOK(), true);
+    EXPECT_EQ(victim->RecvImpl(&reply), retcode::FAIL);
+    EXPECT_EQ(victim->authFailures(), 1);
+  }
+
+  // Two sessions with the same pre-shared key and channel key do not reuse
+  // keys and nonces, the same message gives different frames.
+  std::string frames[2];
+  for (auto &frame : frames) {
+    auto client_mem = std::make_shared<MemoryChannel>(ChannelRole::CLIENT);
+    auto server_mem = std::make_shared<MemoryChannel>(ChannelRole::SERVER);
+    Channel client(std::make_shared<SecureChannel>(
+                       client_mem, SecureChannel::CLIENT, "psk"),
+                   "secure_test_session");
+    Channel server(std::make_shared<SecureChannel>(
+                       server_mem, SecureChannel::SERVER, "psk"),
+                   "secure_test_session");
+    EXPECT_EQ(client.send(std::string("same message")).IsOK(), true);
+    EXPECT_EQ(server_mem->RecvImpl(&frame), retcode::SUCCESS);
+  }
+  EXPECT_EQ(frames[0].size(), frames[1].size());
+  EXPECT_NE(frames[0], frames[1]);
+  EXPECT_NE(frames[0].substr(SecureChannel::kHeaderSize),
+            frames[1].substr(SecureChannel::kHeaderSize));
+}
+
+TEST(channel, integrity_test) {
+  // Check values from RFC 3720.
+  std::string zeros(32, '\0');
+  EXPECT_EQ(Crc32c("123456789", 9), 0xe3069283u);
+  EXPECT_EQ(Crc32c(zeros.data(), zeros.size()), 0x8a9136aau);
+  std::mt19937 rng(42);
+  std::string data(300000, '\0');
+  for (auto &c : data)
+    c = static_cast<char>(rng());
+  for (size_t size : {0, 7, 8, 4095, 12288, 12289, 40000, 300000}) {
+    for (size_t offset : {0, 3}) {
+      size_t n = std::min(size, data.size() - offset);
+      const char *p = data.data() + offset;
+      uint32_t crc = Crc32c(p, n);
+      EXPECT_EQ(crc, Crc32cPortable(p, n));
+      EXPECT_EQ(crc, Crc32c(p + n / 3, n - n / 3, Crc32c(p, n / 3)));
+    }
+  }
+
+  auto client_mem = std::make_shared<MemoryChannel>(ChannelRole::CLIENT);
+  auto server_mem = std::make_shared<MemoryChannel>(ChannelRole::SERVER);
+  auto client_impl = std::make_shared<IntegrityChannel>(client_mem);
+  auto server_impl = std::make_shared<IntegrityChannel>(server_mem);
+  Channel client(client_impl, "integrity_test");
+  Channel server(server_impl, "integrity_test");
+
+  std::string reply;
+  EXPECT_EQ(client.send(data).IsOK(), true);
+  EXPECT_EQ(server.recv(reply).IsOK(), true);
+  EXPECT_EQ(reply == data, true);
+  std::vector<uint32_t> numbers(1000);
+  std::iota(numbers.begin(), numbers.end(), 0);
+  std::vector<uint32_t> received(1000);
+  EXPECT_EQ(client.send(numbers).IsOK(), true);
+  EXPECT_EQ(server.recv(received.data(), received.size()).IsOK(), true);
+  EXPECT_EQ(received == numbers, true);
+  EXPECT_EQ(server_impl->checkedMessages(), 2);
+  EXPECT_EQ(server_impl->checkedBytes(), data.size() + 4000);
+
+  // A flipped bit in transit is reported as a mismatch, by the transport and
+  // by every Channel receive.
+  std::string frame = "share" + std::string(IntegrityChannel::kChecksumSize, 0);
+  uint32_t crc = Crc32c("share", 5);
+  memcpy(&frame[5], &crc, sizeof(crc));
+  frame[1] ^= 0x10;
+  EXPECT_EQ(client_mem->SendImpl(frame), retcode::SUCCESS);
+  EXPECT_EQ(server_impl->RecvImpl(&reply), retcode::MISMATCH);
+  EXPECT_EQ(client_mem->SendImpl(frame), retcode::SUCCESS);
+  char share[5];
+  EXPECT_EQ(server.recv(share, sizeof(share)).IsOK(), false);
+  EXPECT_EQ(client_mem->SendImpl(frame), retcode::SUCCESS);
+  EXPECT_EQ(server.recv(reply, Priority::kNormal).IsOK(), false);
+  EXPECT_EQ(server_impl->mismatches(), 3);
+
+  // Other failures of the decorator are no success either, on the blocking
+  // and the future based receives.
+  EXPECT_EQ(client.send(std::string("too long")).IsOK(), true);
+  EXPECT_EQ(server.recv(share, sizeof(share)).IsOK(), false);
+  std::string truncated_frame = "ab";
+  EXPECT_EQ(client_mem->SendImpl(truncated_frame), retcode::SUCCESS);
+  EXPECT_EQ(server.asyncRecv(reply).get().IsOK(), false);
+  EXPECT_EQ(client_mem->SendImpl(truncated_frame), retcode::SUCCESS);
+  std::vector<uint32_t> resized;
+  EXPECT_EQ(server.asyncRecv(resized).get().IsOK(), false);
+
+  auto client_fork = client.fork();
+  auto server_fork = server.fork();
+  EXPECT_EQ(client_fork->send(std::string("fork")).IsOK(), true);
+  EXPECT_EQ(server_fork->recv(reply).IsOK(), true);
+  EXPECT_EQ(reply, "fork");
+  EXPECT_EQ(server_impl->checkedMessages(), 5);
+}
+
+TEST(channel, pipeline_test) {
+  constexpr uint64_t kBatches = 20;
+  constexpr size_t kBatchWords = 256;
+  auto client = std::make_shared<Channel>(
+      std::make_shared<MemoryChannel>(ChannelRole::CLIENT), "pipeline_test");
+  auto server = std::make_shared<Channel>(
+      std::make_shared<MemoryChannel>(ChannelRole::SERVER), "pipeline_test");
+  auto busy = []() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  };
+
+  // The client produces batches and consumes the results, the server turns
+  // every batch into a result while the next one is on its way.
+  BatchPipeline::Options produce_options;
+  produce_options.receive = false;
+  BatchPipeline producer(client, produce_options);
+  auto produced = std::async(std::launch::async, [&]() {
+    return producer
+        .run(kBatches,
+             [&](uint64_t index, const std::string &, std::string *output) {
+               std::vector<uint32_t> words(kBatchWords);
+               std::iota(words.begin(), words.end(), index * kBatchWords);
+               output->assign(reinterpret_cast<char *>(words.data()),
+                              words.size() * sizeof(uint32_t));
+               busy();
+               return Status::OK();
+             })
+        .IsOK();
+  });
+
+  BatchPipeline::Options transform_options;
+  transform_options.batch_bytes = kBatchWords * sizeof(uint32_t);
+  BatchPipeline transformer(server, transform_options);
+  auto transformed = std::async(std::launch::async, [&]() {
+    return transformer
+        .run(kBatches,
+             [&](uint64_t index, const std::string &input,
+                 std::string *output) {
+               *output = input;
+               auto *words = reinterpret_cast<uint32_t *>(&(*output)[0]);
+               for (size_t k = 0; k < kBatchWords; k++)
+                 words[k] = 2 * words[k] + 1;
+               busy();
+               return Status::OK();
+             })
+        .IsOK();
+  });
+
+  BatchPipeline::Options consume_options;
+  consume_options.send = false;
+  consume_options.depth = 3;
+  BatchPipeline consumer(client, consume_options);
+  uint64_t mismatches = 0;
+  Status status = consumer.run(
+      kBatches, [&](uint64_t index, const std::string &input, std::string *) {
+        if (input.size() != kBatchWords * sizeof(uint32_t))
+          return Status::MismatchError();
+        auto *words = reinterpret_cast<const uint32_t *>(input.data());
+        for (size_t k = 0; k < kBatchWords; k++) {
+          if (words[k] != 2 * (index * kBatchWords + k) + 1)
+            mismatches++;
+        }
+        return Status::OK();
+      });
+  EXPECT_EQ(status.IsOK(), true);
+  EXPECT_EQ(produced.get(), true);
+  EXPECT_EQ(transformed.get(), true);
+  EXPECT_EQ(mismatches, 0);
+
+  auto stats = transformer.stats();
+  EXPECT_EQ(stats.batches, kBatches);
+  EXPECT_GE(stats.compute_us, kBatches * 1000);
+  EXPECT_GE(stats.wall_us, stats.compute_us);
+  EXPECT_GE(stats.overlap, 0.0);
+  EXPECT_LE(stats.overlap, 1.0);
+  EXPECT_GT(stats.compute_utilization, 0.0);
+
+  // A failing batch stops the run, its output is not sent.
+  BatchPipeline failing(client, produce_options);
+  status = failing.run(kBatches, [](uint64_t index, const std::string &,
+                                    std::string *output) {
+    output->assign("batch");
+    return index == 3 ? Status::InvalidError() : Status::OK();
+  });
+  EXPECT_EQ(status.IsOK(), false);
+  EXPECT_EQ(failing.stats().batches, 4);
+  std::string reply;
+  for (int i = 0; i < 3; i++) {
+    EXPECT_EQ(server->recv(reply).IsOK(), true);
+    EXPECT_EQ(reply, "batch");
+  }
+  bool received = true;
+  EXPECT_EQ(server->try_recv(reply, &received).IsOK(), true);
+  EXPECT_EQ(received, false);
+
+  // A failure while the peer has stopped sending too does not leave the
+  // receiver waiting for a batch that never comes.
+  EXPECT_EQ(client->send(std::string("only batch")).IsOK(), true);
+  BatchPipeline stalled(server, BatchPipeline::Options());
+  auto stalled_run = std::async(std::launch::async, [&]() {
+    return stalled
+        .run(kBatches,
+             [](uint64_t, const std::string &, std::string *) {
+               return Status::InvalidError();
+             })
+        .IsOK();
+  });
+  ASSERT_EQ(stalled_run.wait_for(std::chrono::seconds(10)),
+            std::future_status::ready);
+  EXPECT_EQ(stalled_run.get(), false);
+  EXPECT_EQ(stalled.stats().batches, 1);
+}
+
+TEST(channel, probe_test) {
+  auto client_mem = std::make_shared<MemoryChannel>(ChannelRole::CLIENT);
+  Channel client(client_mem, "probe_test");
+  Channel server(std::make_shared<MemoryChannel>(ChannelRole::SERVER),
+                 "probe_test");
+  uint64_t size = 0;
+  bool available = true;
+  EXPECT_EQ(server.try_probe(&size, &available).IsOK(), true);
+  EXPECT_EQ(available, false);
+
+  // The size is known before the message is taken, the receive then needs
+  // exactly one buffer of that size.
+  std::string large = gen_random(200000, 7);
+  EXPECT_EQ(client.send(std::string("tiny")).IsOK(), true);
+  EXPECT_EQ(client.send(large).IsOK(), true);
+  EXPECT_EQ(server.try_probe(&size, &available).IsOK(), true);
+  EXPECT_EQ(available, true);
+  EXPECT_EQ(size, 4);
+  EXPECT_EQ(server.probe(&size).IsOK(), true);
+  EXPECT_EQ(size, 4);
+  std::string reply(size, 0);
+  EXPECT_EQ(server.recv(&reply[0], size).IsOK(), true);
+  EXPECT_EQ(reply, "tiny");
+  EXPECT_EQ(server.probe(&size).IsOK(), true);
+  EXPECT_EQ(size, large.size());
+  reply.resize(size);
+  EXPECT_EQ(server.recv(&reply[0], size).IsOK(), true);
+  EXPECT_EQ(reply == large, true);
+
+  // A blocking probe waits for the sender.
+  auto sender = std::async(std::launch::async, [&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    return client.send(std::string(300, 'w')).IsOK();
+  });
+  EXPECT_EQ(server.probe(&size).IsOK(), true);
+  EXPECT_EQ(size, 300);
+  EXPECT_EQ(sender.get(), true);
+  EXPECT_EQ(server.recv(reply).IsOK(), true);
+
+  // Spilled messages and decorators report the payload size.
+  client_mem->setSpillThreshold(1);
+  EXPECT_EQ(client.send(std::string(10, 'a')).IsOK(), true);
+  EXPECT_EQ(client.send(std::string(20, 'b')).IsOK(), true);
+  for (uint64_t expected : {10, 20}) {
+    EXPECT_EQ(server.probe(&size).IsOK(), true);
+    EXPECT_EQ(size, expected);
+    EXPECT_EQ(server.recv(reply).IsOK(), true);
+  }
+  auto checked_client = std::make_shared<IntegrityChannel>(
+      std::make_shared<MemoryChannel>(ChannelRole::CLIENT));
+  auto checked_server = std::make_shared<IntegrityChannel>(
+      std::make_shared<MemoryChannel>(ChannelRole::SERVER));
+  Channel checked(checked_client, "probe_integrity");
+  Channel checked_peer(checked_server, "probe_integrity");
+  EXPECT_EQ(checked.send(std::string(33, 'c')).IsOK(), true);
+  EXPECT_EQ(checked_peer.probe(&size).IsOK(), true);
+  EXPECT_EQ(size, 33);
+
+  // Socket transports peek the length of the next frame.
+  auto tcp_server_impl =
+      std::make_shared<TcpChannel>(TcpChannel::SERVER, "127.0.0.1", 0);
+  auto tcp_client_impl = std::make_shared<TcpChannel>(
+      TcpChannel::CLIENT, "127.0.0.1", tcp_server_impl->port());
+  std::string path = "@primihub_probe_test_" + std::to_string(getpid());
+  auto uds_server_impl = std::make_shared<UdsChannel>(UdsChannel::SERVER, path);
+  auto uds_client_impl = std::make_shared<UdsChannel>(UdsChannel::CLIENT, path);
+  std::pair<std::shared_ptr<primihub::link::ChannelBase>,
+            std::shared_ptr<primihub::link::ChannelBase>>
+      pairs[] = {{tcp_client_impl, tcp_server_impl},
+                 {uds_client_impl, uds_server_impl}};
+  for (auto &pair : pairs) {
+    Channel socket_client(pair.first, "probe_socket");
+    Channel socket_server(pair.second, "probe_socket");
+    EXPECT_EQ(socket_client.send(large).IsOK(), true);
+    EXPECT_EQ(socket_client.send(std::string("after")).IsOK(), true);
+    EXPECT_EQ(socket_server.probe(&size).IsOK(), true);
+    EXPECT_EQ(size, large.size());
+    EXPECT_EQ(socket_server.probe(&size).IsOK(), true);
+    EXPECT_EQ(size, large.size());
+    reply.assign(size, 0);
+    EXPECT_EQ(socket_server.recv(&reply[0], size).IsOK(), true);
+    EXPECT_EQ(reply == large, true);
+    EXPECT_EQ(socket_server.try_probe(&size, &available).IsOK(), true);
+    EXPECT_EQ(available, true);
+    EXPECT_EQ(size, 5);
+    EXPECT_EQ(socket_server.recv(reply).IsOK(), true);
+    EXPECT_EQ(reply, "after");
+    EXPECT_EQ(socket_server.try_probe(&size, &available).IsOK(), true);
+    EXPECT_EQ(available, false);
+    socket_client.close();
+    socket_server.close();
+  }
+}
+
+TEST(channel, channel_pool_test) {
+  auto server_impl =
+      std::make_shared<TcpChannel>(TcpChannel::SERVER, "127.0.0.1", 0);
+  auto client_impl = std::make_shared<TcpChannel>(
+      TcpChannel::CLIENT, "127.0.0.1", server_impl->port());
+  Channel server(server_impl, "channel_pool_test");
+  Channel client(client_impl, "channel_pool_test");
+  // Leasing a connected fork must not log an error.
+  testing::internal::CaptureStderr();
+  client.enableWarmForks(4);
+  auto pool = client.forkPool();
+  for (int i = 0; i < 500 && pool->readyCount() < 4; i++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_EQ(pool->readyCount(), 4);
+
+  // Warm forks pair up with the plain forks of the peer by key.
+  std::vector<std::shared_ptr<Channel>> forks;
+  for (int i = 0; i < 10; i++) {
+    auto client_fork = client.fork();
+    auto server_fork = server.fork();
+    EXPECT_EQ(client_fork->getKey(), server_fork->getKey());
+    std::string message = "fork " + std::to_string(i);
+    std::string reply;
+    EXPECT_EQ(client_fork->send(message).IsOK(), true);
+    EXPECT_EQ(server_fork->recv(reply).IsOK(), true);
+    EXPECT_EQ(reply, message);
+    EXPECT_EQ(server_fork->send(reply + " back").IsOK(), true);
+    EXPECT_EQ(client_fork->recv(reply).IsOK(), true);
+    EXPECT_EQ(reply, message + " back");
+    forks.push_back(client_fork);
+    forks.push_back(server_fork);
+  }
+  EXPECT_EQ(testing::internal::GetCapturedStderr(), "");
+  EXPECT_GE(pool->hits(), 4);
+  EXPECT_EQ(pool->hits() + pool->misses(), 10);
+  for (auto &fork : forks)
+    fork->close();
+
+  // Warm forks that are never leased close with the pool, and the server
+  // drops their connections although no fork of its own took them.
+  auto idle_server =
+      std::make_shared<TcpChannel>(TcpChannel::SERVER, "127.0.0.1", 0);
+  size_t baseline = open_fds();
+  {
+    Channel idle_client(std::make_shared<TcpChannel>(
+                            TcpChannel::CLIENT, "127.0.0.1",
+                            idle_server->port()),
+                        "channel_pool_test");
+    idle_client.enableWarmForks(4);
+    auto idle_pool = idle_client.forkPool();
+    for (int i = 0; i < 500 && idle_pool->readyCount() < 4; i++)
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_EQ(idle_pool->readyCount(), 4);
+    EXPECT_GE(open_fds(), baseline + 4);
+  }
+  for (int i = 0; i < 500 && open_fds() > baseline; i++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_EQ(open_fds(), baseline);
+}
+
+TEST(channel, acceptor_test) {
+  auto server_impl =
+      std::make_shared<TcpChannel>(TcpChannel::SERVER, "127.0.0.1", 0);
+  uint16_t port = server_impl->port();
+  // A client that never sends its handshake and one that stops halfway must
+  // not hold up the connections behind them.
+  int silent_fd = primihub::link::ConnectTcp("127.0.0.1", port, 1000);
+  int partial_fd = primihub::link::ConnectTcp("127.0.0.1", port, 1000);
+  ASSERT_GE(silent_fd, 0);
+  ASSERT_GE(partial_fd, 0);
+  uint32_t key_size = 64;
+  EXPECT_EQ(primihub::link::SendAll(partial_fd,
+                                    reinterpret_cast<char *>(&key_size), 2),
+            true);
+
+  auto client_impl =
+      std::make_shared<TcpChannel>(TcpChannel::CLIENT, "127.0.0.1", port);
+  Channel server(server_impl, "acceptor_test");
+  Channel client(client_impl, "acceptor_test");
+  auto start = std::chrono::steady_clock::now();
+  std::string message = "behind a silent client";
+  std::string received;
+  EXPECT_EQ(client.send(message).IsOK(), true);
+  EXPECT_EQ(server.recv(received).IsOK(), true);
+  EXPECT_EQ(received, message);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+
+  ::close(silent_fd);
+  ::close(partial_fd);
+  client.close();
+  server.close();
+
+  // A length above max_message_size fails the receive instead of being
+  // allocated.
+  TcpChannel::Options options;
+  options.max_message_size = 1024;
+  auto limited_impl = std::make_shared<TcpChannel>(TcpChannel::SERVER,
+                                                   "127.0.0.1", 0, options);
+  Channel limited(limited_impl, "acceptor_test");
+  Channel sender(std::make_shared<TcpChannel>(TcpChannel::CLIENT, "127.0.0.1",
+                                              limited_impl->port()),
+                 "acceptor_test");
+  EXPECT_EQ(sender.send(std::string(2048, 'x')).IsOK(), true);
+  EXPECT_EQ(limited.recv(received).IsOK(), false);
+  sender.close();
+  limited.close();
+}
+
+TEST(channel, multi_producer_test) {
+  constexpr uint32_t kThreads = 32;
+  constexpr uint32_t kMessages = 200;
+  auto client_impl = std::make_shared<MultiProducerChannel>(
+      std::make_shared<MemoryChannel>(ChannelRole::CLIENT));
+  Channel client(client_impl, "multi_producer_test");
+  Channel server(std::make_shared<MemoryChannel>(ChannelRole::SERVER),
+                 "multi_producer_test");
+
+  // Every thread's messages arrive complete and in its order.
+  std::vector<std::thread> producers;
+  for (uint32_t t = 0; t < kThreads; t++) {
+    producers.emplace_back([&client, t]() {
+      for (uint32_t i = 0; i < kMessages; i++) {
+        uint32_t message[2] = {t, i};
+        EXPECT_EQ(client.send(message, 2).IsOK(), true);
+      }
+    });
+  }
+  std::vector<uint32_t> next(kThreads, 0);
+  for (uint32_t n = 0; n < kThreads * kMessages; n++) {
+    uint32_t message[2];
+    ASSERT_EQ(server.recv(message, 2).IsOK(), true);
+    ASSERT_LT(message[0], kThreads);
+    EXPECT_EQ(message[1], next[message[0]]++);
+  }
+  for (auto &producer : producers)
+    producer.join();
+  EXPECT_EQ(client_impl->flush(), retcode::SUCCESS);
+  EXPECT_EQ(client_impl->sentMessages(), kThreads * kMessages);
+
+  // Ordered: a send that returned before another one started arrives
+  // first, even from threads on different lanes.
+  MultiProducerChannel::Options options;
+  options.ordered = true;
+  options.lanes = 4;
+  auto ordered_impl = std::make_shared<MultiProducerChannel>(
+      std::make_shared<MemoryChannel>(ChannelRole::CLIENT), options);
+  Channel ordered(ordered_impl, "multi_producer_ordered");
+  Channel ordered_server(std::make_shared<MemoryChannel>(ChannelRole::SERVER),
+                         "multi_producer_ordered");
+  std::atomic<uint32_t> turn{0};
+  producers.clear();
+  for (uint32_t t = 0; t < 8; t++) {
+    producers.emplace_back([&ordered, &turn, t]() {
+      for (uint32_t i = t; i < 8 * 50; i += 8) {
+        while (turn.load() != i)
+          std::this_thread::yield();
+        EXPECT_EQ(ordered.send(&i, 1).IsOK(), true);
+        turn++;
+      }
+    });
+  }
+  for (uint32_t i = 0; i < 8 * 50; i++) {
+    uint32_t value;
+    ASSERT_EQ(ordered_server.recv(&value, 1).IsOK(), true);
+    EXPECT_EQ(value, i);
+  }
+  for (auto &producer : producers)
+    producer.join();
+
+  // Forks taken concurrently get distinct keys.
+  std::mutex keys_mu;
+  std::set<std::string> keys;
+  std::vector<std::thread> forkers;
+  for (int t = 0; t < 16; t++) {
+    forkers.emplace_back([&]() {
+      for (int i = 0; i < 4; i++) {
+        auto fork = client.fork();
+        std::lock_guard<std::mutex> lock(keys_mu);
+        keys.insert(fork->getKey());
+      }
+    });
+  }
+  for (auto &forker : forkers)
+    forker.join();
+  EXPECT_EQ(keys.size(), 64);
+
+  client.cancel();
+  EXPECT_EQ(client_impl->SendImpl(std::string("late")), retcode::FAIL);
+}
+
+TEST(channel, phase_test) {
+  auto client_phases = std::make_shared<PhaseAccounting>();
+  auto server_phases = std::make_shared<PhaseAccounting>();
+  Channel client(std::make_shared<PhaseChannel>(
+                     std::make_shared<MemoryChannel>(ChannelRole::CLIENT),
+                     client_phases),
+                 "phase_test");
+  Channel server(std::make_shared<PhaseChannel>(
+                     std::make_shared<MemoryChannel>(ChannelRole::SERVER),
+                     server_phases),
+                 "phase_test");
+
+  std::string reply;
+  EXPECT_EQ(client.send(std::string("hello")).IsOK(), true);
+  EXPECT_EQ(server.recv(reply).IsOK(), true);
+  {
+    PhaseScope setup(client_phases, "setup");
+    PhaseScope server_setup(server_phases, "setup");
+    EXPECT_EQ(client.send(std::string(100, 'a')).IsOK(), true);
+    EXPECT_EQ(server.recv(reply).IsOK(), true);
+    EXPECT_EQ(server.send(std::string(50, 'b')).IsOK(), true);
+    EXPECT_EQ(client.recv(reply).IsOK(), true);
+  }
+  auto client_fork = client.fork();
+  auto server_fork = server.fork();
+  {
+    PhaseScope online(client_phases, "online");
+    // Nested phases take the traffic, the outer one keeps the rest.
+    for (int layer = 0; layer < 2; layer++) {
+      PhaseScope mul(client_phases, "mul-gate layer");
+      for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(client.send(std::string(8, 'c')).IsOK(), true);
+        EXPECT_EQ(server.recv(reply).IsOK(), true);
+        EXPECT_EQ(server.send(std::string(8, 'd')).IsOK(), true);
+        EXPECT_EQ(client.recv(reply).IsOK(), true);
+      }
+    }
+    // Traffic of forks goes to the phase of the channel they came from.
+    std::vector<uint64_t> shares(16, 7);
+    EXPECT_EQ(client_fork->send(shares).IsOK(), true);
+    EXPECT_EQ(server_fork->recv(shares.data(), shares.size()).IsOK(), true);
+    EXPECT_EQ(server_fork->send(shares).IsOK(), true);
+    EXPECT_EQ(client_fork->recv(shares.data(), shares.size()).IsOK(), true);
+  }
+
+  auto none = client_phases->phase(PhaseAccounting::kNoPhase);
+  EXPECT_EQ(none.messages_sent, 1);
+  EXPECT_EQ(none.bytes_sent, 5);
+  EXPECT_EQ(none.rounds, 0);
+  auto setup = client_phases->phase("setup");
+  EXPECT_EQ(setup.rounds, 1);
+  EXPECT_EQ(setup.bytes_sent, 100);
+  EXPECT_EQ(setup.bytes_received, 50);
+  auto mul = client_phases->phase("mul-gate layer");
+  EXPECT_EQ(mul.rounds, 6);
+  EXPECT_EQ(mul.messages_sent, 6);
+  EXPECT_EQ(mul.messages_received, 6);
+  EXPECT_EQ(mul.bytes_received, 48);
+  auto online = client_phases->phase("online");
+  EXPECT_EQ(online.rounds, 1);
+  EXPECT_EQ(online.bytes_sent, 128);
+  EXPECT_EQ(online.bytes_received, 128);
+  EXPECT_EQ(client_phases->phase("unknown").messages_sent, 0);
+
+  auto phases = client_phases->phases();
+  ASSERT_EQ(phases.size(), 4);
+  EXPECT_EQ(phases[0].label, PhaseAccounting::kNoPhase);
+  EXPECT_EQ(phases[1].label, "setup");
+  EXPECT_EQ(phases[2].label, "online");
+  EXPECT_EQ(phases[3].label, "mul-gate layer");
+  // The server only entered "setup", the rest is unattributed.
+  EXPECT_EQ(server_phases->phase("setup").rounds, 1);
+  EXPECT_EQ(server_phases->phase(PhaseAccounting::kNoPhase).messages_received,
+            8);
+  std::string report = client_phases->report();
+  EXPECT_NE(report.find("mul-gate layer"), std::string::npos);
+  EXPECT_NE(report.find("total"), std::string::npos);
+  client_phases->reset();
+  EXPECT_EQ(client_phases->phase("setup").bytes_sent, 0);
+
+  // Threads keep phases of their own, scopes entered side by side neither
+  // take each other's traffic nor merge each other's rounds.
+  constexpr int kThreads = 4;
+  constexpr int kRounds = 20;
+  auto parallel_phases = std::make_shared<PhaseAccounting>();
+  Channel parallel_client(
+      std::make_shared<PhaseChannel>(
+          std::make_shared<MemoryChannel>(ChannelRole::CLIENT),
+          parallel_phases),
+      "phase_test_parallel");
+  Channel parallel_server(std::make_shared<MemoryChannel>(ChannelRole::SERVER),
+                          "phase_test_parallel");
+  std::vector<std::shared_ptr<Channel>> client_forks, server_forks;
+  for (int t = 0; t < kThreads; t++) {
+    client_forks.push_back(parallel_client.fork());
+    server_forks.push_back(parallel_server.fork());
+  }
+  std::atomic<int> entered{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&, t]() {
+      PhaseScope scope(parallel_phases, "worker " + std::to_string(t));
+      entered++;
+      while (entered.load() < kThreads)
+        std::this_thread::yield();
+      std::string reply;
+      for (int i = 0; i < kRounds; i++) {
+        EXPECT_EQ(client_forks[t]->send(std::string(t + 1, 'p')).IsOK(), true);
+        EXPECT_EQ(client_forks[t]->recv(reply).IsOK(), true);
+      }
+      // Ends only once every thread is done, so all scopes overlap.
+      entered++;
+      while (entered.load() < 2 * kThreads)
+        std::this_thread::yield();
+    });
+    threads.emplace_back([&, t]() {
+      std::string message;
+      for (int i = 0; i < kRounds; i++) {
+        EXPECT_EQ(server_forks[t]->recv(message).IsOK(), true);
+        EXPECT_EQ(server_forks[t]->send(message).IsOK(), true);
+      }
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+  for (int t = 0; t < kThreads; t++) {
+    auto worker = parallel_phases->phase("worker " + std::to_string(t));
+    EXPECT_EQ(worker.messages_sent, kRounds);
+    EXPECT_EQ(worker.bytes_sent, kRounds * (t + 1));
+    EXPECT_EQ(worker.messages_received, kRounds);
+    EXPECT_EQ(worker.rounds, kRounds);
+  }
+  EXPECT_EQ(parallel_phases->phase(PhaseAccounting::kNoPhase).messages_sent, 0);
+}
+
+TEST(channel, trace_test) {
+  Channel client(std::make_shared<MemoryChannel>(ChannelRole::CLIENT),
+                 "trace_test");
+  Channel server(std::make_shared<MemoryChannel>(ChannelRole::SERVER),
+                 "trace_test");
+  auto count = [](const std::string &json, const std::string &needle) {
+    size_t n = 0;
+    for (size_t pos = json.find(needle); pos != std::string::npos;
+         pos = json.find(needle, pos + 1))
+      n++;
+    return n;
+  };
+
+  // Off by default, nothing is recorded.
+  Tracer::Clear();
+  std::string reply;
+  EXPECT_EQ(client.send(std::string("untraced")).IsOK(), true);
+  EXPECT_EQ(server.recv(reply).IsOK(), true);
+  EXPECT_EQ(Tracer::recordedEvents(), 0);
+
+  Tracer::Enable();
+  auto fork_client = client.fork();
+  auto fork_server = server.fork();
+  std::vector<uint64_t> values(16, 7);
+  std::vector<uint64_t> received(16);
+  auto receiver = std::async(std::launch::async, [&]() {
+    EXPECT_EQ(server.recv(received.data(), received.size()).IsOK(), true);
+  });
+  // Let the receiver block, its wait shows up as a span.
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_EQ(client.send(values).IsOK(), true);
+  receiver.get();
+  std::promise<Status> done;
+  fork_server->asyncRecv(reply, [&](Status status) {
+    done.set_value(std::move(status));
+  });
+  EXPECT_EQ(fork_client->send(std::string("forked")).IsOK(), true);
+  EXPECT_EQ(done.get_future().get().IsOK(), true);
+  Tracer::Disable();
+  EXPECT_EQ(client.send(std::string("untraced")).IsOK(), true);
+  EXPECT_EQ(server.recv(reply).IsOK(), true);
+
+  std::string json = Tracer::ChromeTraceJson();
+  EXPECT_EQ(json.find("{\"displayTimeUnit\":\"ns\",\"traceEvents\":["), 0);
+  EXPECT_EQ(count(json, "\"name\":\"Channel::send\""), 2);
+  EXPECT_EQ(count(json, "\"name\":\"Channel::recv\""), 1);
+  EXPECT_EQ(count(json, "\"name\":\"Channel::asyncRecv\""), 1);
+  EXPECT_EQ(count(json, "\"name\":\"MemoryChannel::SendImpl\""), 2);
+  EXPECT_EQ(count(json, "\"name\":\"MemoryChannel::RecvImpl\""), 2);
+  EXPECT_GE(count(json, "\"name\":\"enqueue\""), 2);
+  EXPECT_GE(count(json, "\"name\":\"wait\""), 1);
+  // send, SendImpl, enqueue, asyncRecv, RecvImpl and dequeue of the fork.
+  EXPECT_EQ(count(json, "\"key\":\"trace_test_fork_1\",\"bytes\":6"), 6);
+  EXPECT_GE(count(json, "\"key\":\"trace_test\",\"bytes\":128"), 5);
+  EXPECT_EQ(Tracer::droppedEvents(), 0);
+
+  std::string path = "/tmp/primihub_trace_test.json";
+  EXPECT_EQ(Tracer::ExportChromeTrace(path), true);
+  std::ifstream file(path);
+  std::string exported((std::istreambuf_iterator<char>(file)),
+                       std::istreambuf_iterator<char>());
+  EXPECT_EQ(exported, json);
+  unlink(path.c_str());
+
+  // A full ring keeps the latest events.
+  Tracer::Clear();
+  EXPECT_EQ(Tracer::recordedEvents(), 0);
+  Tracer::Enable(4);
+  std::thread([]() {
+    for (int i = 0; i < 10; i++)
+      primihub::link::TraceInstant("tick", "trace_test", i);
+  }).join();
+  Tracer::Disable();
+  EXPECT_EQ(Tracer::recordedEvents(), 4);
+  EXPECT_EQ(Tracer::droppedEvents(), 6);
+  json = Tracer::ChromeTraceJson();
+  EXPECT_EQ(count(json, "\"name\":\"tick\""), 4);
+  EXPECT_EQ(count(json, "\"bytes\":9}"), 1);
+
+  // Threads that come and go, like those of asyncRecv, share their rings.
+  Tracer::Clear();
+  Tracer::Enable(4);
+  size_t rings = Tracer::rings();
+  for (int i = 0; i < 10; i++) {
+    std::thread([]() {
+      primihub::link::TraceInstant("short", "trace_test");
+    }).join();
+  }
+  Tracer::Disable();
+  EXPECT_LE(Tracer::rings(), rings + 1);
+  EXPECT_EQ(Tracer::recordedEvents(), 4);
+  json = Tracer::ChromeTraceJson();
+  EXPECT_EQ(count(json, "\"name\":\"short\""), 4);
+  EXPECT_GE(count(json, "\"name\":\"thread_name\""), 1);
+  Tracer::Enable(Tracer::kDefaultEventsPerThread);
+  Tracer::Disable();
+  Tracer::Clear();
+}
@@ -0,0 +1,589 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "util/aead.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PH_AEAD_X86 1
+#endif
+
+namespace primihub {
+namespace {
+inline uint32_t Load32Le(const uint8_t *p) {
+  return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) |
+         (uint32_t(p[3]) << 24);
+}
+
+inline uint64_t Load64Le(const uint8_t *p) {
+  return uint64_t(Load32Le(p)) | (uint64_t(Load32Le(p + 4)) << 32);
+}
+
+inline void Store32Le(uint8_t *p, uint32_t v) {
+  p[0] = static_cast<uint8_t>(v);
+  p[1] = static_cast<uint8_t>(v >> 8);
+  p[2] = static_cast<uint8_t>(v >> 16);
+  p[3] = static_cast<uint8_t>(v >> 24);
+}
+
+inline void Store64Le(uint8_t *p, uint64_t v) {
+  Store32Le(p, static_cast<uint32_t>(v));
+  Store32Le(p + 4, static_cast<uint32_t>(v >> 32));
+}
+
+// Compares in time independent of the contents.
+bool TagEqual(const uint8_t *a, const uint8_t *b) {
+  uint8_t diff = 0;
+  for (size_t i = 0; i < Aead::kTagSize; i++)
+    diff |= a[i] ^ b[i];
+  return diff == 0;
+}
+
+void Wipe(void *p, size_t size) {
+  volatile uint8_t *v = static_cast<volatile uint8_t *>(p);
+  while (size-- > 0)
+    *v++ = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// ChaCha20-Poly1305, RFC 8439.
+inline uint32_t Rotl(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+
+inline void QuarterRound(uint32_t &a, uint32_t &b, uint32_t &c, uint32_t &d) {
+  a += b;
+  d = Rotl(d ^ a, 16);
+  c += d;
+  b = Rotl(b ^ c, 12);
+  a += b;
+  d = Rotl(d ^ a, 8);
+  c += d;
+  b = Rotl(b ^ c, 7);
+}
+
+void ChaChaInit(uint32_t state[16], const uint8_t *key, uint32_t counter,
+                const uint8_t *nonce) {
+  state[0] = 0x61707865;
+  state[1] = 0x3320646e;
+  state[2] = 0x79622d32;
+  state[3] = 0x6b206574;
+  for (int i = 0; i < 8; i++)
+    state[4 + i] = Load32Le(key + 4 * i);
+  state[12] = counter;
+  for (int i = 0; i < 3; i++)
+    state[13 + i] = Load32Le(nonce + 4 * i);
+}
+
+void ChaChaBlock(const uint32_t state[16], uint8_t out[64]) {
+  uint32_t x[16];
+  memcpy(x, state, sizeof(x));
+  for (int i = 0; i < 10; i++) {
+    QuarterRound(x[0], x[4], x[8], x[12]);
+    QuarterRound(x[1], x[5], x[9], x[13]);
+    QuarterRound(x[2], x[6], x[10], x[14]);
+    QuarterRound(x[3], x[7], x[11], x[15]);
+    QuarterRound(x[0], x[5], x[10], x[15]);
+    QuarterRound(x[1], x[6], x[11], x[12]);
+    QuarterRound(x[2], x[7], x[8], x[13]);
+    QuarterRound(x[3], x[4], x[9], x[14]);
+  }
+  for (int i = 0; i < 16; i++)
+    Store32Le(out + 4 * i, x[i] + state[i]);
+}
+
+void ChaChaXor(const uint8_t *key, uint32_t counter, const uint8_t *nonce,
+               const uint8_t *in, size_t size, uint8_t *out) {
+  uint32_t state[16];
+  ChaChaInit(state, key, counter, nonce);
+  uint8_t block[64];
+  for (size_t offset = 0; offset < size; offset += 64) {
+    ChaChaBlock(state, block);
+    state[12]++;
+    size_t n = std::min<size_t>(64, size - offset);
+    if (n == 64) {
+      for (size_t i = 0; i < 64; i += 8) {
+        uint64_t word, stream;
+        memcpy(&word, in + offset + i, 8);
+        memcpy(&stream, block + i, 8);
+        word ^= stream;
+        memcpy(out + offset + i, &word, 8);
+      }
+      continue;
+    }
+    for (size_t i = 0; i < n; i++)
+      out[offset + i] = in[offset + i] ^ block[i];
+  }
+  Wipe(block, sizeof(block));
+  Wipe(state, sizeof(state));
+}
+
+// Poly1305 with 44/44/42 bit limbs.
+class Poly1305 {
+ public:
+  explicit Poly1305(const uint8_t key[32]) {
+    uint64_t t0 = Load64Le(key);
+    uint64_t t1 = Load64Le(key + 8);
+    r_[0] = t0 & 0xffc0fffffff;
+    r_[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffff;
+    r_[2] = (t1 >> 24) & 0x00ffffffc0f;
+    pad_[0] = Load64Le(key + 16);
+    pad_[1] = Load64Le(key + 24);
+  }
+
+  ~Poly1305() {
+    Wipe(r_, sizeof(r_));
+    Wipe(pad_, sizeof(pad_));
+  }
+
+  // Absorbs data followed by zero padding to a multiple of 16 bytes.
+  void UpdatePadded(const uint8_t *data, size_t size) {
+    size_t full = size / 16 * 16;
+    Blocks(data, full, uint64_t(1) << 40);
+    if (full < size) {
+      uint8_t block[16] = {0};
+      memcpy(block, data + full, size - full);
+      Blocks(block, 16, uint64_t(1) << 40);
+    }
+  }
+
+  void Final(uint8_t mac[16]) {
+    constexpr uint64_t kMask44 = 0xfffffffffff;
+    constexpr uint64_t kMask42 = 0x3ffffffffff;
+    uint64_t h0 = h_[0], h1 = h_[1], h2 = h_[2];
+    uint64_t c = h1 >> 44;
+    h1 &= kMask44;
+    h2 += c;
+    c = h2 >> 42;
+    h2 &= kMask42;
+    h0 += c * 5;
+    c = h0 >> 44;
+    h0 &= kMask44;
+    h1 += c;
+    c = h1 >> 44;
+    h1 &= kMask44;
+    h2 += c;
+    c = h2 >> 42;
+    h2 &= kMask42;
+    h0 += c * 5;
+    c = h0 >> 44;
+    h0 &= kMask44;
+    h1 += c;
+
+    // h - p, taken if it does not underflow.
+    uint64_t g0 = h0 + 5;
+    c = g0 >> 44;
+    g0 &= kMask44;
+    uint64_t g1 = h1 + c;
+    c = g1 >> 44;
+    g1 &= kMask44;
+    uint64_t g2 = h2 + c - (uint64_t(1) << 42);
+    c = (g2 >> 63) - 1;
+    g0 &= c;
+    g1 &= c;
+    g2 &= c;
+    c = ~c;
+    h0 = (h0 & c) | g0;
+    h1 = (h1 & c) | g1;
+    h2 = (h2 & c) | g2;
+
+    uint64_t t0 = pad_[0];
+    uint64_t t1 = pad_[1];
+    h0 += t0 & kMask44;
+    c = h0 >> 44;
+    h0 &= kMask44;
+    h1 += (((t0 >> 44) | (t1 << 20)) & kMask44) + c;
+    c = h1 >> 44;
+    h1 &= kMask44;
+    h2 += ((t1 >> 24) & kMask42) + c;
+    h2 &= kMask42;
+
+    Store64Le(mac, h0 | (h1 << 44));
+    Store64Le(mac + 8, (h1 >> 20) | (h2 << 24));
+  }
+
+ private:
+  void Blocks(const uint8_t *m, size_t bytes, uint64_t hibit) {
+    using u128 = unsigned __int128;
+    constexpr uint64_t kMask44 = 0xfffffffffff;
+    constexpr uint64_t kMask42 = 0x3ffffffffff;
+    uint64_t r0 = r_[0], r1 = r_[1], r2 = r_[2];
+    uint64_t s1 = r1 * (5 << 2);
+    uint64_t s2 = r2 * (5 << 2);
+    uint64_t h0 = h_[0], h1 = h_[1], h2 = h_[2];
+    for (; bytes >= 16; bytes -= 16, m += 16) {
+      uint64_t t0 = Load64Le(m);
+      uint64_t t1 = Load64Le(m + 8);
+      h0 += t0 & kMask44;
+      h1 += ((t0 >> 44) | (t1 << 20)) & kMask44;
+      h2 += ((t1 >> 24) & kMask42) | hibit;
+
+      u128 d0 = u128(h0) * r0 + u128(h1) * s2 + u128(h2) * s1;
+      u128 d1 = u128(h0) * r1 + u128(h1) * r0 + u128(h2) * s2;
+      u128 d2 = u128(h0) * r2 + u128(h1) * r1 + u128(h2) * r0;
+      uint64_t c = static_cast<uint64_t>(d0 >> 44);
+      h0 = static_cast<uint64_t>(d0) & kMask44;
+      d1 += c;
+      c = static_cast<uint64_t>(d1 >> 44);
+      h1 = static_cast<uint64_t>(d1) & kMask44;
+      d2 += c;
+      c = static_cast<uint64_t>(d2 >> 42);
+      h2 = static_cast<uint64_t>(d2) & kMask42;
+      h0 += c * 5;
+      c = h0 >> 44;
+      h0 &= kMask44;
+      h1 += c;
+    }
+    h_[0] = h0;
+    h_[1] = h1;
+    h_[2] = h2;
+  }
+
+  uint64_t r_[3];
+  uint64_t h_[3] = {0, 0, 0};
+  uint64_t pad_[2];
+};
+
+void ChaChaPolyTag(const uint8_t *key, const uint8_t *nonce,
+                   const uint8_t *aad, size_t aad_size,
+                   const uint8_t *ciphertext, size_t size, uint8_t *tag) {
+  uint32_t state[16];
+  ChaChaInit(state, key, 0, nonce);
+  uint8_t poly_key[64];
+  ChaChaBlock(state, poly_key);
+
+  Poly1305 mac(poly_key);
+  mac.UpdatePadded(aad, aad_size);
+  mac.UpdatePadded(ciphertext, size);
+  uint8_t lengths[16];
+  Store64Le(lengths, aad_size);
+  Store64Le(lengths + 8, size);
+  mac.UpdatePadded(lengths, sizeof(lengths));
+  mac.Final(tag);
+  Wipe(poly_key, sizeof(poly_key));
+  Wipe(state, sizeof(state));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// AES-256-GCM on AES-NI and PCLMULQDQ. GHASH works on byte reversed blocks,
+// eight blocks are encrypted at a time and their GHASH products summed
+// before a single reduction.
+#ifdef PH_AEAD_X86
+#define PH_AES_TARGET __attribute__((target("aes,pclmul,ssse3,sse4.1")))
+
+PH_AES_TARGET inline __m128i Bswap128(__m128i x) {
+  return _mm_shuffle_epi8(
+      x, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+PH_AES_TARGET inline __m128i KeyAssist1(__m128i t1, __m128i t2) {
+  t2 = _mm_shuffle_epi32(t2, 0xff);
+  __m128i t4 = _mm_slli_si128(t1, 4);
+  t1 = _mm_xor_si128(t1, t4);
+  t4 = _mm_slli_si128(t4, 4);
+  t1 = _mm_xor_si128(t1, t4);
+  t4 = _mm_slli_si128(t4, 4);
+  t1 = _mm_xor_si128(t1, t4);
+  return _mm_xor_si128(t1, t2);
+}
+
+PH_AES_TARGET inline __m128i KeyAssist2(__m128i t1, __m128i t3) {
+  __m128i t2 = _mm_shuffle_epi32(_mm_aeskeygenassist_si128(t1, 0x0), 0xaa);
+  __m128i t4 = _mm_slli_si128(t3, 4);
+  t3 = _mm_xor_si128(t3, t4);
+  t4 = _mm_slli_si128(t4, 4);
+  t3 = _mm_xor_si128(t3, t4);
+  t4 = _mm_slli_si128(t4, 4);
+  t3 = _mm_xor_si128(t3, t4);
+  return _mm_xor_si128(t3, t2);
+}
+
+PH_AES_TARGET void AesExpandKey256(const uint8_t *key, __m128i ks[15]) {
+  __m128i t1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(key));
+  __m128i t3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(key + 16));
+  ks[0] = t1;
+  ks[1] = t3;
+  t1 = KeyAssist1(t1, _mm_aeskeygenassist_si128(t3, 0x01));
+  ks[2] = t1;
+  t3 = KeyAssist2(t1, t3);
+  ks[3] = t3;
+  t1 = KeyAssist1(t1, _mm_aeskeygenassist_si128(t3, 0x02));
+  ks[4] = t1;
+  t3 = KeyAssist2(t1, t3);
+  ks[5] = t3;
+  t1 = KeyAssist1(t1, _mm_aeskeygenassist_si128(t3, 0x04));
+  ks[6] = t1;
+  t3 = KeyAssist2(t1, t3);
+  ks[7] = t3;
+  t1 = KeyAssist1(t1, _mm_aeskeygenassist_si128(t3, 0x08));
+  ks[8] = t1;
+  t3 = KeyAssist2(t1, t3);
+  ks[9] = t3;
+  t1 = KeyAssist1(t1, _mm_aeskeygenassist_si128(t3, 0x10));
+  ks[10] = t1;
+  t3 = KeyAssist2(t1, t3);
+  ks[11] = t3;
+  t1 = KeyAssist1(t1, _mm_aeskeygenassist_si128(t3, 0x20));
+  ks[12] = t1;
+  t3 = KeyAssist2(t1, t3);
+  ks[13] = t3;
+  t1 = KeyAssist1(t1, _mm_aeskeygenassist_si128(t3, 0x40));
+  ks[14] = t1;
+}
+
+PH_AES_TARGET inline __m128i AesEncrypt(const __m128i ks[15], __m128i block) {
+  block = _mm_xor_si128(block, ks[0]);
+  for (int r = 1; r < 14; r++)
+    block = _mm_aesenc_si128(block, ks[r]);
+  return _mm_aesenclast_si128(block, ks[14]);
+}
+
+PH_AES_TARGET inline __m128i CounterBlock(__m128i j0, uint32_t counter) {
+  return _mm_insert_epi32(j0, static_cast<int>(__builtin_bswap32(counter)), 3);
+}
+
+// Adds the unreduced 256 bit product a * b to lo, mid and hi.
+PH_AES_TARGET inline void ClmulAccumulate(__m128i a, __m128i b, __m128i *lo,
+                                          __m128i *mid, __m128i *hi) {
+  *lo = _mm_xor_si128(*lo, _mm_clmulepi64_si128(a, b, 0x00));
+  *hi = _mm_xor_si128(*hi, _mm_clmulepi64_si128(a, b, 0x11));
+  *mid = _mm_xor_si128(*mid, _mm_clmulepi64_si128(a, b, 0x10));
+  *mid = _mm_xor_si128(*mid, _mm_clmulepi64_si128(a, b, 0x01));
+}
+
+// Shifts the product left by one bit, the blocks are bit reflected, and
+// reduces it modulo x^128 + x^7 + x^2 + x + 1.
+PH_AES_TARGET inline __m128i GhashReduce(__m128i lo, __m128i mid,
+                                         __m128i hi) {
+  __m128i t3 = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+  __m128i t6 = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+  __m128i t7 = _mm_srli_epi32(t3, 31);
+  __m128i t8 = _mm_srli_epi32(t6, 31);
+  t3 = _mm_slli_epi32(t3, 1);
+  t6 = _mm_slli_epi32(t6, 1);
+  __m128i t9 = _mm_srli_si128(t7, 12);
+  t8 = _mm_slli_si128(t8, 4);
+  t7 = _mm_slli_si128(t7, 4);
+  t3 = _mm_or_si128(t3, t7);
+  t6 = _mm_or_si128(t6, t8);
+  t6 = _mm_or_si128(t6, t9);
+
+  t7 = _mm_slli_epi32(t3, 31);
+  t8 = _mm_slli_epi32(t3, 30);
+  t9 = _mm_slli_epi32(t3, 25);
+  t7 = _mm_xor_si128(t7, t8);
+  t7 = _mm_xor_si128(t7, t9);
+  t8 = _mm_srli_si128(t7, 4);
+  t7 = _mm_slli_si128(t7, 12);
+  t3 = _mm_xor_si128(t3, t7);
+
+  __m128i t2 = _mm_srli_epi32(t3, 1);
+  __m128i t4 = _mm_srli_epi32(t3, 2);
+  __m128i t5 = _mm_srli_epi32(t3, 7);
+  t2 = _mm_xor_si128(t2, t4);
+  t2 = _mm_xor_si128(t2, t5);
+  t2 = _mm_xor_si128(t2, t8);
+  t3 = _mm_xor_si128(t3, t2);
+  return _mm_xor_si128(t6, t3);
+}
+
+PH_AES_TARGET inline __m128i GhashMul(__m128i a, __m128i b) {
+  __m128i lo = _mm_setzero_si128();
+  __m128i mid = _mm_setzero_si128();
+  __m128i hi = _mm_setzero_si128();
+  ClmulAccumulate(a, b, &lo, &mid, &hi);
+  return GhashReduce(lo, mid, hi);
+}
+
+PH_AES_TARGET void AesGcmInit(const uint8_t *key, uint8_t *round_keys,
+                              uint8_t *h_powers) {
+  __m128i ks[15];
+  AesExpandKey256(key, ks);
+  __m128i h = Bswap128(AesEncrypt(ks, _mm_setzero_si128()));
+  __m128i power = h;
+  for (int i = 0; i < 8; i++) {
+    _mm_store_si128(reinterpret_cast<__m128i *>(h_powers) + i, power);
+    power = GhashMul(power, h);
+  }
+  for (int i = 0; i < 15; i++)
+    _mm_store_si128(reinterpret_cast<__m128i *>(round_keys) + i, ks[i]);
+}
+
+PH_AES_TARGET __m128i GhashPadded(__m128i y, __m128i h, const uint8_t *data,
+                                  size_t size) {
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+    y = GhashMul(_mm_xor_si128(y, Bswap128(block)), h);
+  }
+  if (i < size) {
+    uint8_t buf[16] = {0};
+    memcpy(buf, data + i, size - i);
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf));
+    y = GhashMul(_mm_xor_si128(y, Bswap128(block)), h);
+  }
+  return y;
+}
+
+// Runs CTR mode from in to out and computes the tag over the ciphertext,
+// which is out when encrypting and in when decrypting.
+PH_AES_TARGET void AesGcmCrypt(bool encrypt, const uint8_t *round_keys,
+                               const uint8_t *h_powers, const uint8_t *nonce,
+                               const uint8_t *aad, size_t aad_size,
+                               const uint8_t *in, size_t size, uint8_t *out,
+                               uint8_t *tag) {
+  __m128i ks[15];
+  for (int i = 0; i < 15; i++)
+    ks[i] = _mm_load_si128(reinterpret_cast<const __m128i *>(round_keys) + i);
+  __m128i h[8];
+  for (int i = 0; i < 8; i++)
+    h[i] = _mm_load_si128(reinterpret_cast<const __m128i *>(h_powers) + i);
+
+  uint8_t j0_bytes[16] = {0};
+  memcpy(j0_bytes, nonce, Aead::kNonceSize);
+  __m128i j0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(j0_bytes));
+
+  __m128i y = GhashPadded(_mm_setzero_si128(), h[0], aad, aad_size);
+  uint32_t counter = 2;
+  size_t i = 0;
+  for (; i + 128 <= size; i += 128, counter += 8) {
+    __m128i b[8];
+    for (int k = 0; k < 8; k++)
+      b[k] = _mm_xor_si128(CounterBlock(j0, counter + k), ks[0]);
+    for (int r = 1; r < 14; r++) {
+      for (int k = 0; k < 8; k++)
+        b[k] = _mm_aesenc_si128(b[k], ks[r]);
+    }
+    __m128i lo = _mm_setzero_si128();
+    __m128i mid = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+    for (int k = 0; k < 8; k++) {
+      b[k] = _mm_aesenclast_si128(b[k], ks[14]);
+      __m128i data =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i) + k);
+      __m128i result = _mm_xor_si128(data, b[k]);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i) + k, result);
+      __m128i cipher = Bswap128(encrypt ? result : data);
+      if (k == 0)
+        cipher = _mm_xor_si128(cipher, y);
+      ClmulAccumulate(cipher, h[7 - k], &lo, &mid, &hi);
+    }
+    y = GhashReduce(lo, mid, hi);
+  }
+  for (; i + 16 <= size; i += 16, counter++) {
+    __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    __m128i result =
+        _mm_xor_si128(data, AesEncrypt(ks, CounterBlock(j0, counter)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), result);
+    __m128i cipher = Bswap128(encrypt ? result : data);
+    y = GhashMul(_mm_xor_si128(y, cipher), h[0]);
+  }
+  if (i < size) {
+    size_t rest = size - i;
+    uint8_t buf[16] = {0};
+    memcpy(buf, in + i, rest);
+    __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf));
+    __m128i result =
+        _mm_xor_si128(data, AesEncrypt(ks, CounterBlock(j0, counter)));
+    uint8_t result_bytes[16];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(result_bytes), result);
+    memcpy(out + i, result_bytes, rest);
+    // The ciphertext is zero padded for GHASH.
+    memset(result_bytes + rest, 0, sizeof(result_bytes) - rest);
+    __m128i cipher = Bswap128(
+        encrypt ? _mm_loadu_si128(reinterpret_cast<__m128i *>(result_bytes))
+                : data);
+    y = GhashMul(_mm_xor_si128(y, cipher), h[0]);
+  }
+
+  __m128i lengths = _mm_set_epi64x(static_cast<int64_t>(aad_size * 8),
+                                   static_cast<int64_t>(size * 8));
+  y = GhashMul(_mm_xor_si128(y, lengths), h[0]);
+  __m128i t = _mm_xor_si128(Bswap128(y), AesEncrypt(ks, CounterBlock(j0, 1)));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(tag), t);
+}
+#endif  // PH_AEAD_X86
+}  // namespace
+
+bool AesGcmSupported() {
+#ifdef PH_AEAD_X86
+  static const bool supported = __builtin_cpu_supports("aes") &&
+                                __builtin_cpu_supports("pclmul") &&
+                                __builtin_cpu_supports("sse4.1");
+  return supported;
+#else
+  return false;
+#endif
+}
+
+Aead::~Aead() {
+  Wipe(key_, sizeof(key_));
+  Wipe(round_keys_, sizeof(round_keys_));
+  Wipe(h_powers_, sizeof(h_powers_));
+}
+
+bool Aead::Init(AeadSuite suite, const uint8_t *key) {
+  if (suite == AeadSuite::kAes256Gcm) {
+    if (!AesGcmSupported())
+      return false;
+#ifdef PH_AEAD_X86
+    AesGcmInit(key, round_keys_, h_powers_);
+#endif
+  } else if (suite != AeadSuite::kChaCha20Poly1305) {
+    return false;
+  }
+  suite_ = suite;
+  memcpy(key_, key, kKeySize);
+  return true;
+}
+
+void Aead::Seal(const uint8_t *nonce, const uint8_t *aad, size_t aad_size,
+                const uint8_t *in, size_t size, uint8_t *out,
+                uint8_t *tag) const {
+#ifdef PH_AEAD_X86
+  if (suite_ == AeadSuite::kAes256Gcm) {
+    AesGcmCrypt(true, round_keys_, h_powers_, nonce, aad, aad_size, in, size,
+                out, tag);
+    return;
+  }
+#endif
+  ChaChaXor(key_, 1, nonce, in, size, out);
+  ChaChaPolyTag(key_, nonce, aad, aad_size, out, size, tag);
+}
+
+bool Aead::Open(const uint8_t *nonce, const uint8_t *aad, size_t aad_size,
+                const uint8_t *in, size_t size, uint8_t *out,
+                const uint8_t *tag) const {
+  uint8_t expected[kTagSize];
+#ifdef PH_AEAD_X86
+  if (suite_ == AeadSuite::kAes256Gcm) {
+    // Decrypting and hashing in one pass, a forgery is wiped afterwards.
+    AesGcmCrypt(false, round_keys_, h_powers_, nonce, aad, aad_size, in, size,
+                out, expected);
+    if (TagEqual(expected, tag))
+      return true;
+    memset(out, 0, size);
+    return false;
+  }
+#endif
+  ChaChaPolyTag(key_, nonce, aad, aad_size, in, size, expected);
+  if (!TagEqual(expected, tag))
+    return false;
+  ChaChaXor(key_, 1, nonce, in, size, out);
+  return true;
+}
+}  // namespace primihub
@@ -0,0 +1,74 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef UTIL_AEAD_H_
+#define UTIL_AEAD_H_
+#include <cstddef>
+#include <cstdint>
+
+namespace primihub {
+/// Authenticated encryption with associated data.
+///
+///   * kAes256Gcm: AES-256-GCM (NIST SP 800-38D) on AES-NI and PCLMULQDQ,
+///     available only on CPUs that have both.
+///   * kChaCha20Poly1305: RFC 8439, portable C++ for every other CPU.
+///
+/// Keys are 32 bytes, nonces 12 bytes and tags 16 bytes. A nonce must never
+/// be used twice with the same key.
+enum class AeadSuite : uint8_t {
+  kAes256Gcm = 1,
+  kChaCha20Poly1305 = 2,
+};
+
+/// Whether this CPU runs kAes256Gcm.
+bool AesGcmSupported();
+
+class Aead {
+ public:
+  static constexpr size_t kKeySize = 32;
+  static constexpr size_t kNonceSize = 12;
+  static constexpr size_t kTagSize = 16;
+
+  Aead() = default;
+  ~Aead();
+  Aead(const Aead &) = delete;
+  Aead &operator=(const Aead &) = delete;
+
+  /// Expands key for suite, returns false if the CPU does not support it.
+  bool Init(AeadSuite suite, const uint8_t *key);
+  AeadSuite suite() const { return suite_; }
+
+  /// Encrypts size bytes of in into out, which may be the same buffer, and
+  /// computes the tag over aad and the ciphertext.
+  void Seal(const uint8_t *nonce, const uint8_t *aad, size_t aad_size,
+            const uint8_t *in, size_t size, uint8_t *out,
+            uint8_t *tag) const;
+
+  /// Verifies tag and decrypts size bytes of in into out, which may be the
+  /// same buffer. On a wrong tag it returns false and out holds no
+  /// plaintext.
+  bool Open(const uint8_t *nonce, const uint8_t *aad, size_t aad_size,
+            const uint8_t *in, size_t size, uint8_t *out,
+            const uint8_t *tag) const;
+
+ private:
+  AeadSuite suite_{AeadSuite::kChaCha20Poly1305};
+  uint8_t key_[kKeySize] = {0};
+  // AES-256 round keys and H^1..H^8 in GHASH byte order.
+  alignas(16) uint8_t round_keys_[15 * 16] = {0};
+  alignas(16) uint8_t h_powers_[8 * 16] = {0};
+};
+}  // namespace primihub
+#endif  // UTIL_AEAD_H_
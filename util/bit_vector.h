@@ -0,0 +1,180 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef UTIL_BIT_VECTOR_H_
+#define UTIL_BIT_VECTOR_H_
+#include <bitset>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "util/int_codec.h"
+
+namespace primihub {
+/// Conversion between bit containers and the wire layout used for them:
+/// ceil(nbits / 64) little-endian 64-bit words, bit i is bit (i % 64) of word
+/// (i / 64) and the unused high bits of the last word are zero.
+
+// Number of 64-bit words needed for nbits bits.
+inline size_t BitWords(size_t nbits) { return (nbits + 63) / 64; }
+
+template <typename Alloc>
+inline size_t BitSize(const std::vector<bool, Alloc> &bits) {
+  return bits.size();
+}
+
+template <size_t N> inline size_t BitSize(const std::bitset<N> &bits) {
+  return N;
+}
+
+// Makes the container hold nbits bits, returns false for fixed size
+// containers of another size.
+template <typename Alloc>
+inline bool ResizeBits(std::vector<bool, Alloc> *bits, size_t nbits) {
+  bits->resize(nbits);
+  return true;
+}
+
+template <size_t N> inline bool ResizeBits(std::bitset<N> *bits, size_t nbits) {
+  return nbits == N;
+}
+
+// libstdc++ stores vector<bool> as unsigned long words, which on
+// little-endian LP64 targets is exactly the wire layout, so the words are
+// copied as they are. That relies on library internals, every other
+// library (or -DPH_PORTABLE_BIT_VECTOR) takes the portable byte-wise path.
+#if defined(__GLIBCXX__) && defined(__LP64__) &&                   \
+    defined(__BYTE_ORDER__) &&                                     \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ &&                   \
+    !defined(PH_PORTABLE_BIT_VECTOR)
+#define PH_VECTOR_BOOL_WORDS 1
+#endif
+
+// Folds n <= 64 bits staged one per byte into a word, a loop without
+// dependencies between iterations that compilers vectorize.
+inline uint64_t FoldByteWord(const uint8_t *staged, size_t n) {
+  uint64_t word = 0;
+  for (size_t i = 0; i < n; i++)
+    word |= static_cast<uint64_t>(staged[i] & 1) << i;
+  return word;
+}
+
+// Portable packing for any container with a bool operator[], bits are
+// staged 64 at a time as bytes and folded into words.
+template <typename Bits>
+void PackBitsByByte(const Bits &bits, size_t nbits, uint64_t *words) {
+  uint8_t staged[64];
+  for (size_t w = 0; w < BitWords(nbits); w++) {
+    size_t begin = w * 64;
+    size_t n = nbits - begin < 64 ? nbits - begin : 64;
+    for (size_t i = 0; i < n; i++)
+      staged[i] = bits[begin + i];
+    words[w] = FoldByteWord(staged, n);
+  }
+}
+
+template <typename Bits>
+void UnpackBitsByByte(const uint64_t *words, size_t nbits, Bits *bits) {
+  for (size_t w = 0; w < BitWords(nbits); w++) {
+    size_t begin = w * 64;
+    size_t n = nbits - begin < 64 ? nbits - begin : 64;
+    uint64_t word = words[w];
+    for (size_t i = 0; i < n; i++)
+      (*bits)[begin + i] = (word >> i) & 1;
+  }
+}
+
+template <typename Alloc>
+void PackBitWords(const std::vector<bool, Alloc> &bits, uint64_t *words) {
+  size_t nbits = bits.size();
+  size_t nwords = BitWords(nbits);
+  if (nwords == 0)
+    return;
+#ifdef PH_VECTOR_BOOL_WORDS
+  static_assert(sizeof(std::_Bit_type) == sizeof(uint64_t),
+                "unexpected vector<bool> word size");
+  memcpy(words, bits.begin()._M_p, nwords * sizeof(uint64_t));
+  if (nbits % 64)
+    words[nwords - 1] &= (1ULL << (nbits % 64)) - 1;
+#else
+  PackBitsByByte(bits, nbits, words);
+#endif
+}
+
+template <typename Alloc>
+void UnpackBitWords(const uint64_t *words, size_t nbits,
+                    std::vector<bool, Alloc> *bits) {
+  size_t nwords = BitWords(nbits);
+  if (nwords == 0)
+    return;
+#ifdef PH_VECTOR_BOOL_WORDS
+  memcpy(bits->begin()._M_p, words, nwords * sizeof(uint64_t));
+  if (nbits % 64)
+    bits->begin()._M_p[nwords - 1] &= (1ULL << (nbits % 64)) - 1;
+#else
+  UnpackBitsByByte(words, nbits, bits);
+#endif
+}
+
+// Up to this size a bitset is converted 64 bits at a time with shifts and
+// to_ullong. Every shift walks the whole bitset, larger ones are packed
+// byte-wise instead.
+constexpr size_t kBitsetShiftMaxBits = 1024;
+
+template <size_t N>
+void PackBitWords(const std::bitset<N> &bits, uint64_t *words) {
+  if constexpr (N <= kBitsetShiftMaxBits) {
+    const std::bitset<N> mask(~0ULL);
+    std::bitset<N> rest = bits;
+    for (size_t w = 0; w < BitWords(N); w++) {
+      words[w] = (rest & mask).to_ullong();
+      rest >>= 64;
+    }
+  } else {
+    PackBitsByByte(bits, N, words);
+  }
+}
+
+template <size_t N>
+void UnpackBitWords(const uint64_t *words, size_t nbits,
+                    std::bitset<N> *bits) {
+  if constexpr (N <= kBitsetShiftMaxBits) {
+    bits->reset();
+    for (size_t w = BitWords(N); w-- > 0;) {
+      *bits <<= 64;
+      *bits |= std::bitset<N>(words[w]);
+    }
+  } else {
+    UnpackBitsByByte(words, N, bits);
+  }
+}
+
+// Packs nbits boolean shares stored one per byte (only bit 0 is used) into
+// words, SIMD accelerated through BitPack.
+inline void PackBoolBytes(const uint8_t *src, size_t nbits, uint64_t *words) {
+  size_t nwords = BitWords(nbits);
+  if (nwords == 0)
+    return;
+  words[nwords - 1] = 0;
+  BitPack(src, 1, nbits, 1, reinterpret_cast<uint8_t *>(words));
+}
+
+// Expands nbits bits from words into one byte (0 or 1) per bit.
+inline void UnpackBoolBytes(const uint64_t *words, size_t nbits,
+                            uint8_t *dst) {
+  BitUnpack(reinterpret_cast<const uint8_t *>(words), nbits, 1, dst, 1);
+}
+}  // namespace primihub
+#endif  // UTIL_BIT_VECTOR_H_
@@ -0,0 +1,217 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "util/crc32c.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define PH_CRC32C_X86 1
+#endif
+
+namespace primihub {
+namespace {
+// Bit reflected Castagnoli polynomial.
+constexpr uint32_t kPoly = 0x82f63b78;
+
+struct Tables {
+  uint32_t t[8][256];
+
+  Tables() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+      for (int k = 0; k < 8; k++)
+        crc = crc & 1 ? (crc >> 1) ^ kPoly : crc >> 1;
+      t[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+      for (int k = 1; k < 8; k++)
+        t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+    }
+  }
+};
+
+const Tables &GetTables() {
+  static const Tables tables;
+  return tables;
+}
+
+// Runs the raw CRC register over size bytes, without pre and post
+// inversion.
+uint32_t UpdatePortable(uint32_t state, const uint8_t *p, size_t size) {
+  const auto &t = GetTables().t;
+  for (; size >= 8; size -= 8, p += 8) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    word ^= state;
+    state = t[7][word & 0xff] ^ t[6][(word >> 8) & 0xff] ^
+            t[5][(word >> 16) & 0xff] ^ t[4][(word >> 24) & 0xff] ^
+            t[3][(word >> 32) & 0xff] ^ t[2][(word >> 40) & 0xff] ^
+            t[1][(word >> 48) & 0xff] ^ t[0][word >> 56];
+  }
+  for (; size > 0; size--, p++)
+    state = (state >> 8) ^ t[0][(state ^ *p) & 0xff];
+  return state;
+}
+
+#ifdef PH_CRC32C_X86
+// a * b modulo the polynomial, both bit reflected.
+uint32_t MultModP(uint32_t a, uint32_t b) {
+  uint32_t m = 1u << 31;
+  uint32_t p = 0;
+  for (;;) {
+    if (a & m) {
+      p ^= b;
+      if ((a & (m - 1)) == 0)
+        break;
+    }
+    m >>= 1;
+    b = b & 1 ? (b >> 1) ^ kPoly : b >> 1;
+  }
+  return p;
+}
+
+// x^(8 * bytes) modulo the polynomial, the factor that moves a CRC register
+// past bytes zero bytes.
+uint32_t ShiftFactor(size_t bytes) {
+  uint32_t result = 1u << 31;  // x^0
+  uint32_t square = 1u << 30;  // x^1
+  for (uint64_t bits = uint64_t(bytes) * 8; bits > 0; bits >>= 1) {
+    if (bits & 1)
+      result = MultModP(result, square);
+    square = MultModP(square, square);
+  }
+  return result;
+}
+
+// Each of the three streams covers kLane bytes. The crc32 instruction has a
+// latency of three cycles and a throughput of one, so three independent
+// streams keep it busy, and their registers are combined with one shift
+// per block.
+constexpr size_t kLane = 4096;
+
+__attribute__((target("sse4.2"))) uint32_t UpdateSse42(uint32_t state,
+                                                       const uint8_t *p,
+                                                       size_t size) {
+  for (; size > 0 && (reinterpret_cast<uintptr_t>(p) & 7) != 0; size--, p++)
+    state = _mm_crc32_u8(state, *p);
+
+  static const uint32_t lane_shift = ShiftFactor(kLane);
+  for (; size >= 3 * kLane; size -= 3 * kLane, p += 3 * kLane) {
+    uint64_t a = state;
+    uint64_t b = 0;
+    uint64_t c = 0;
+    for (size_t i = 0; i < kLane; i += 8) {
+      uint64_t wa, wb, wc;
+      memcpy(&wa, p + i, 8);
+      memcpy(&wb, p + kLane + i, 8);
+      memcpy(&wc, p + 2 * kLane + i, 8);
+      a = _mm_crc32_u64(a, wa);
+      b = _mm_crc32_u64(b, wb);
+      c = _mm_crc32_u64(c, wc);
+    }
+    state = MultModP(lane_shift, MultModP(lane_shift, static_cast<uint32_t>(a)) ^
+                                     static_cast<uint32_t>(b)) ^
+            static_cast<uint32_t>(c);
+  }
+
+  uint64_t state64 = state;
+  for (; size >= 8; size -= 8, p += 8) {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    state64 = _mm_crc32_u64(state64, word);
+  }
+  state = static_cast<uint32_t>(state64);
+  for (; size > 0; size--, p++)
+    state = _mm_crc32_u8(state, *p);
+  return state;
+}
+
+// UpdateSse42 that also stores every word it reads to dst, one pass over
+// memory for the copy and the checksum.
+__attribute__((target("sse4.2"))) uint32_t CopySse42(uint32_t state,
+                                                     uint8_t *dst,
+                                                     const uint8_t *p,
+                                                     size_t size) {
+  for (; size > 0 && (reinterpret_cast<uintptr_t>(p) & 7) != 0;
+       size--, p++, dst++) {
+    *dst = *p;
+    state = _mm_crc32_u8(state, *p);
+  }
+
+  static const uint32_t lane_shift = ShiftFactor(kLane);
+  for (; size >= 3 * kLane;
+       size -= 3 * kLane, p += 3 * kLane, dst += 3 * kLane) {
+    uint64_t a = state;
+    uint64_t b = 0;
+    uint64_t c = 0;
+    for (size_t i = 0; i < kLane; i += 8) {
+      uint64_t wa, wb, wc;
+      memcpy(&wa, p + i, 8);
+      memcpy(&wb, p + kLane + i, 8);
+      memcpy(&wc, p + 2 * kLane + i, 8);
+      memcpy(dst + i, &wa, 8);
+      memcpy(dst + kLane + i, &wb, 8);
+      memcpy(dst + 2 * kLane + i, &wc, 8);
+      a = _mm_crc32_u64(a, wa);
+      b = _mm_crc32_u64(b, wb);
+      c = _mm_crc32_u64(c, wc);
+    }
+    state = MultModP(lane_shift, MultModP(lane_shift, static_cast<uint32_t>(a)) ^
+                                     static_cast<uint32_t>(b)) ^
+            static_cast<uint32_t>(c);
+  }
+  memcpy(dst, p, size);
+  return UpdateSse42(state, p, size);
+}
+#endif  // PH_CRC32C_X86
+}  // namespace
+
+uint32_t Crc32cPortable(const void *data, size_t size, uint32_t crc) {
+  return ~UpdatePortable(~crc, static_cast<const uint8_t *>(data), size);
+}
+
+uint32_t Crc32c(const void *data, size_t size, uint32_t crc) {
+#ifdef PH_CRC32C_X86
+  static const bool has_sse42 = __builtin_cpu_supports("sse4.2");
+  if (has_sse42)
+    return ~UpdateSse42(~crc, static_cast<const uint8_t *>(data), size);
+#endif
+  return Crc32cPortable(data, size, crc);
+}
+
+uint32_t Crc32cCopy(void *dst, const void *src, size_t size) {
+#ifdef PH_CRC32C_X86
+  static const bool has_sse42 = __builtin_cpu_supports("sse4.2");
+  if (has_sse42) {
+    return ~CopySse42(~0u, static_cast<uint8_t *>(dst),
+                      static_cast<const uint8_t *>(src), size);
+  }
+#endif
+  // Small enough for both passes to hit L2.
+  constexpr size_t kChunkSize = 64 * 1024;
+  auto *out = static_cast<char *>(dst);
+  const auto *in = static_cast<const char *>(src);
+  uint32_t crc = 0;
+  for (size_t offset = 0; offset < size; offset += kChunkSize) {
+    size_t n = std::min(kChunkSize, size - offset);
+    memcpy(out + offset, in + offset, n);
+    crc = Crc32cPortable(out + offset, n, crc);
+  }
+  return crc;
+}
+}  // namespace primihub
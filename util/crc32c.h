@@ -0,0 +1,37 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef UTIL_CRC32C_H_
+#define UTIL_CRC32C_H_
+#include <cstddef>
+#include <cstdint>
+
+namespace primihub {
+/// CRC32C (Castagnoli, as in iSCSI and ext4) of size bytes at data. Pass the
+/// CRC of the preceding bytes as crc to extend it, so that
+///   Crc32c(b, nb, Crc32c(a, na)) == Crc32c(ab, na + nb).
+/// Uses the SSE4.2 crc32 instruction on three interleaved streams when the
+/// CPU has it, slicing-by-8 tables otherwise.
+uint32_t Crc32c(const void *data, size_t size, uint32_t crc = 0);
+
+/// Copies size bytes from src to dst and returns their Crc32c. The data is
+/// checksummed in chunks right after they were copied, while they are still
+/// in cache, so this costs little more than the memcpy for large buffers.
+uint32_t Crc32cCopy(void *dst, const void *src, size_t size);
+
+/// The table driven fallback of Crc32c, exposed for tests and benchmarks.
+uint32_t Crc32cPortable(const void *data, size_t size, uint32_t crc = 0);
+}  // namespace primihub
+#endif  // UTIL_CRC32C_H_
@@ -0,0 +1,174 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "util/hkdf.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+namespace primihub {
+namespace {
+constexpr uint32_t kRoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+inline uint32_t Rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+}  // namespace
+
+Sha256::Sha256()
+    : state_{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f,
+             0x9b05688c, 0x1f83d9ab, 0x5be0cd19} {}
+
+void Sha256::Compress(const uint8_t *block) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++) {
+    w[i] = (uint32_t(block[4 * i]) << 24) | (uint32_t(block[4 * i + 1]) << 16) |
+           (uint32_t(block[4 * i + 2]) << 8) | uint32_t(block[4 * i + 3]);
+  }
+  for (int i = 16; i < 64; i++) {
+    uint32_t s0 = Rotr(w[i - 15], 7) ^ Rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = Rotr(w[i - 2], 17) ^ Rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+  uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+  for (int i = 0; i < 64; i++) {
+    uint32_t s1 = Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25);
+    uint32_t ch = (e & f) ^ (~e & g);
+    uint32_t t1 = h + s1 + ch + kRoundConstants[i] + w[i];
+    uint32_t s0 = Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22);
+    uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+    uint32_t t2 = s0 + maj;
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  state_[0] += a;
+  state_[1] += b;
+  state_[2] += c;
+  state_[3] += d;
+  state_[4] += e;
+  state_[5] += f;
+  state_[6] += g;
+  state_[7] += h;
+}
+
+void Sha256::Update(const void *data, size_t size) {
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  length_ += size;
+  while (size > 0) {
+    if (buffered_ == 0 && size >= kBlockSize) {
+      Compress(p);
+      p += kBlockSize;
+      size -= kBlockSize;
+      continue;
+    }
+    size_t n = std::min(size, kBlockSize - buffered_);
+    memcpy(buffer_ + buffered_, p, n);
+    buffered_ += n;
+    p += n;
+    size -= n;
+    if (buffered_ == kBlockSize) {
+      Compress(buffer_);
+      buffered_ = 0;
+    }
+  }
+}
+
+void Sha256::Final(uint8_t digest[kDigestSize]) {
+  uint64_t bits = length_ * 8;
+  uint8_t pad = 0x80;
+  Update(&pad, 1);
+  pad = 0;
+  while (buffered_ != kBlockSize - 8)
+    Update(&pad, 1);
+  uint8_t be_bits[8];
+  for (int i = 0; i < 8; i++)
+    be_bits[i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+  Update(be_bits, 8);
+  for (int i = 0; i < 8; i++) {
+    digest[4 * i] = static_cast<uint8_t>(state_[i] >> 24);
+    digest[4 * i + 1] = static_cast<uint8_t>(state_[i] >> 16);
+    digest[4 * i + 2] = static_cast<uint8_t>(state_[i] >> 8);
+    digest[4 * i + 3] = static_cast<uint8_t>(state_[i]);
+  }
+}
+
+void HmacSha256(std::string_view key, std::string_view data,
+                uint8_t mac[Sha256::kDigestSize]) {
+  uint8_t block[Sha256::kBlockSize] = {0};
+  if (key.size() > Sha256::kBlockSize) {
+    Sha256 hash;
+    hash.Update(key.data(), key.size());
+    hash.Final(block);
+  } else {
+    memcpy(block, key.data(), key.size());
+  }
+
+  uint8_t pad[Sha256::kBlockSize];
+  for (size_t i = 0; i < Sha256::kBlockSize; i++)
+    pad[i] = block[i] ^ 0x36;
+  uint8_t inner[Sha256::kDigestSize];
+  Sha256 inner_hash;
+  inner_hash.Update(pad, sizeof(pad));
+  inner_hash.Update(data.data(), data.size());
+  inner_hash.Final(inner);
+
+  for (size_t i = 0; i < Sha256::kBlockSize; i++)
+    pad[i] = block[i] ^ 0x5c;
+  Sha256 outer_hash;
+  outer_hash.Update(pad, sizeof(pad));
+  outer_hash.Update(inner, sizeof(inner));
+  outer_hash.Final(mac);
+}
+
+void HkdfSha256(std::string_view ikm, std::string_view salt,
+                std::string_view info, uint8_t *out, size_t out_size) {
+  uint8_t prk[Sha256::kDigestSize];
+  HmacSha256(salt, ikm, prk);
+
+  std::string_view prk_view(reinterpret_cast<const char *>(prk), sizeof(prk));
+  uint8_t block[Sha256::kDigestSize];
+  std::string input;
+  for (uint8_t counter = 1; out_size > 0; counter++) {
+    // T(i) = HMAC(PRK, T(i - 1) | info | i)
+    input.assign(counter == 1 ? "" : reinterpret_cast<const char *>(block),
+                 counter == 1 ? 0 : sizeof(block));
+    input.append(info.data(), info.size());
+    input.push_back(static_cast<char>(counter));
+    HmacSha256(prk_view, input, block);
+    size_t n = std::min(out_size, sizeof(block));
+    memcpy(out, block, n);
+    out += n;
+    out_size -= n;
+  }
+}
+}  // namespace primihub
@@ -0,0 +1,50 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef UTIL_HKDF_H_
+#define UTIL_HKDF_H_
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace primihub {
+/// SHA-256 (FIPS 180-4), only used to derive keys so it stays portable.
+class Sha256 {
+ public:
+  static constexpr size_t kDigestSize = 32;
+  static constexpr size_t kBlockSize = 64;
+
+  Sha256();
+  void Update(const void *data, size_t size);
+  void Final(uint8_t digest[kDigestSize]);
+
+ private:
+  void Compress(const uint8_t *block);
+
+  uint32_t state_[8];
+  uint8_t buffer_[kBlockSize];
+  size_t buffered_{0};
+  uint64_t length_{0};
+};
+
+/// HMAC-SHA256 (RFC 2104).
+void HmacSha256(std::string_view key, std::string_view data,
+                uint8_t mac[Sha256::kDigestSize]);
+
+/// HKDF-SHA256 (RFC 5869), fills out_size bytes of out, at most 255 * 32.
+void HkdfSha256(std::string_view ikm, std::string_view salt,
+                std::string_view info, uint8_t *out, size_t out_size);
+}  // namespace primihub
+#endif  // UTIL_HKDF_H_
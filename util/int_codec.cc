@@ -0,0 +1,508 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "util/int_codec.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PH_CODEC_X86 1
+#endif
+
+namespace primihub {
+namespace {
+inline uint64_t LoadUnsigned(const uint8_t *p, size_t elem_size) {
+  switch (elem_size) {
+  case 1:
+    return *p;
+  case 2: {
+    uint16_t v;
+    memcpy(&v, p, 2);
+    return v;
+  }
+  case 4: {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+  }
+  default: {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+  }
+  }
+}
+
+inline int64_t LoadSigned(const uint8_t *p, size_t elem_size) {
+  switch (elem_size) {
+  case 1:
+    return static_cast<int8_t>(*p);
+  case 2: {
+    int16_t v;
+    memcpy(&v, p, 2);
+    return v;
+  }
+  case 4: {
+    int32_t v;
+    memcpy(&v, p, 4);
+    return v;
+  }
+  default: {
+    int64_t v;
+    memcpy(&v, p, 8);
+    return v;
+  }
+  }
+}
+
+inline void Store(uint8_t *p, size_t elem_size, uint64_t v) {
+  switch (elem_size) {
+  case 1:
+    *p = static_cast<uint8_t>(v);
+    break;
+  case 2: {
+    uint16_t t = static_cast<uint16_t>(v);
+    memcpy(p, &t, 2);
+    break;
+  }
+  case 4: {
+    uint32_t t = static_cast<uint32_t>(v);
+    memcpy(p, &t, 4);
+    break;
+  }
+  default:
+    memcpy(p, &v, 8);
+    break;
+  }
+}
+
+inline uint64_t Load(const uint8_t *p, size_t elem_size, bool is_signed) {
+  return is_signed ? static_cast<uint64_t>(LoadSigned(p, elem_size))
+                   : LoadUnsigned(p, elem_size);
+}
+
+inline uint64_t ZigZag(int64_t v) {
+  return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+inline int64_t UnZigZag(uint64_t v) {
+  return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+inline uint64_t BitMask(uint32_t bits) {
+  return bits >= 64 ? ~0ULL : ((1ULL << bits) - 1);
+}
+
+bool ValidElemSize(size_t elem_size) {
+  return elem_size == 1 || elem_size == 2 || elem_size == 4 || elem_size == 8;
+}
+
+void BitPackScalar(const uint8_t *src, size_t elem_size, size_t count,
+                   uint32_t bits, uint8_t *dst) {
+  if (bits % 8 == 0) {
+    size_t width = bits / 8;
+    if (width == elem_size) {
+      memcpy(dst, src, count * elem_size);
+      return;
+    }
+    for (size_t i = 0; i < count; i++)
+      memcpy(dst + i * width, src + i * elem_size, width);
+    return;
+  }
+
+  uint64_t mask = BitMask(bits);
+  uint64_t acc = 0;
+  uint32_t nacc = 0;
+  for (size_t i = 0; i < count; i++) {
+    uint64_t v = LoadUnsigned(src + i * elem_size, elem_size) & mask;
+    acc |= v << nacc;
+    uint32_t used = nacc + bits;
+    if (used >= 64) {
+      memcpy(dst, &acc, 8);
+      dst += 8;
+      used -= 64;
+      acc = used ? (v >> (bits - used)) : 0;
+    }
+    nacc = used;
+  }
+  memcpy(dst, &acc, (nacc + 7) / 8);
+}
+
+void BitUnpackScalar(const uint8_t *src, size_t count, uint32_t bits,
+                     uint8_t *dst, size_t elem_size) {
+  if (bits % 8 == 0) {
+    size_t width = bits / 8;
+    if (width == elem_size) {
+      memcpy(dst, src, count * elem_size);
+      return;
+    }
+    for (size_t i = 0; i < count; i++) {
+      memset(dst + i * elem_size, 0, elem_size);
+      memcpy(dst + i * elem_size, src + i * width, width);
+    }
+    return;
+  }
+
+  uint64_t mask = BitMask(bits);
+  size_t total = BitPackedSize(count, bits);
+  for (size_t i = 0; i < count; i++) {
+    size_t pos = i * bits;
+    size_t byte = pos >> 3;
+    uint32_t shift = pos & 7;
+    uint64_t lo = 0;
+    uint8_t hi = 0;
+    if (byte + 9 <= total) {
+      memcpy(&lo, src + byte, 8);
+      hi = src[byte + 8];
+    } else {
+      size_t n = total - byte;
+      memcpy(&lo, src + byte, n < 8 ? n : 8);
+      if (n > 8)
+        hi = src[byte + 8];
+    }
+    uint64_t v = lo >> shift;
+    if (shift + bits > 64)
+      v |= static_cast<uint64_t>(hi) << (64 - shift);
+    Store(dst + i * elem_size, elem_size, v & mask);
+  }
+}
+
+#ifdef PH_CODEC_X86
+// One bit shares, the kernels return how many values they consumed (always a
+// multiple of 8) and leave the tail to the scalar path.
+__attribute__((target("avx2"))) size_t Pack1Avx2(const uint8_t *src,
+                                                 size_t elem_size, size_t count,
+                                                 uint8_t *dst) {
+  size_t i = 0;
+  if (elem_size == 1) {
+    for (; i + 32 <= count; i += 32) {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+      uint32_t m = static_cast<uint32_t>(
+          _mm256_movemask_epi8(_mm256_slli_epi16(v, 7)));
+      memcpy(dst + i / 8, &m, 4);
+    }
+  } else if (elem_size == 4) {
+    for (; i + 8 <= count; i += 8) {
+      __m256i v = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(src + i * 4));
+      dst[i / 8] = static_cast<uint8_t>(
+          _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_slli_epi32(v, 31))));
+    }
+  } else if (elem_size == 8) {
+    for (; i + 8 <= count; i += 8) {
+      __m256i v0 = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(src + i * 8));
+      __m256i v1 = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(src + i * 8 + 32));
+      int m0 = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_slli_epi64(v0, 63)));
+      int m1 = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_slli_epi64(v1, 63)));
+      dst[i / 8] = static_cast<uint8_t>(m0 | (m1 << 4));
+    }
+  }
+  return i;
+}
+
+size_t Pack1Sse2(const uint8_t *src, size_t elem_size, size_t count,
+                 uint8_t *dst) {
+  size_t i = 0;
+  if (elem_size != 1)
+    return 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    uint16_t m = static_cast<uint16_t>(_mm_movemask_epi8(_mm_slli_epi16(v, 7)));
+    memcpy(dst + i / 8, &m, 2);
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) size_t Unpack1Avx2(const uint8_t *src,
+                                                   size_t count, uint8_t *dst,
+                                                   size_t elem_size) {
+  size_t i = 0;
+  if (elem_size == 1) {
+    const __m256i shuf = _mm256_setr_epi8(
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+        2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i sel = _mm256_set1_epi64x(0x8040201008040201LL);
+    const __m256i one = _mm256_set1_epi8(1);
+    for (; i + 32 <= count; i += 32) {
+      uint32_t m;
+      memcpy(&m, src + i / 8, 4);
+      __m256i v = _mm256_shuffle_epi8(_mm256_set1_epi32(static_cast<int>(m)),
+                                      shuf);
+      v = _mm256_cmpeq_epi8(_mm256_and_si256(v, sel), sel);
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i),
+                          _mm256_and_si256(v, one));
+    }
+  } else if (elem_size == 4) {
+    const __m256i sel = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    for (; i + 8 <= count; i += 8) {
+      __m256i v = _mm256_set1_epi32(src[i / 8]);
+      v = _mm256_cmpeq_epi32(_mm256_and_si256(v, sel), sel);
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i * 4),
+                          _mm256_srli_epi32(v, 31));
+    }
+  } else if (elem_size == 8) {
+    const __m256i sel_lo = _mm256_setr_epi64x(1, 2, 4, 8);
+    const __m256i sel_hi = _mm256_setr_epi64x(16, 32, 64, 128);
+    for (; i + 8 <= count; i += 8) {
+      __m256i v = _mm256_set1_epi64x(src[i / 8]);
+      __m256i lo = _mm256_cmpeq_epi64(_mm256_and_si256(v, sel_lo), sel_lo);
+      __m256i hi = _mm256_cmpeq_epi64(_mm256_and_si256(v, sel_hi), sel_hi);
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i * 8),
+                          _mm256_srli_epi64(lo, 63));
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i * 8 + 32),
+                          _mm256_srli_epi64(hi, 63));
+    }
+  }
+  return i;
+}
+
+__attribute__((target("ssse3"))) size_t Unpack1Ssse3(const uint8_t *src,
+                                                     size_t count, uint8_t *dst,
+                                                     size_t elem_size) {
+  size_t i = 0;
+  if (elem_size != 1)
+    return 0;
+  const __m128i shuf =
+      _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1);
+  const __m128i sel = _mm_set1_epi64x(0x8040201008040201LL);
+  const __m128i one = _mm_set1_epi8(1);
+  for (; i + 16 <= count; i += 16) {
+    uint16_t m;
+    memcpy(&m, src + i / 8, 2);
+    __m128i v = _mm_shuffle_epi8(_mm_set1_epi16(static_cast<int16_t>(m)), shuf);
+    v = _mm_cmpeq_epi8(_mm_and_si128(v, sel), sel);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                     _mm_and_si128(v, one));
+  }
+  return i;
+}
+#endif  // PH_CODEC_X86
+
+size_t Pack1Simd(const uint8_t *src, size_t elem_size, size_t count,
+                 uint8_t *dst) {
+#ifdef PH_CODEC_X86
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  if (has_avx2)
+    return Pack1Avx2(src, elem_size, count, dst);
+  return Pack1Sse2(src, elem_size, count, dst);
+#else
+  return 0;
+#endif
+}
+
+size_t Unpack1Simd(const uint8_t *src, size_t count, uint8_t *dst,
+                   size_t elem_size) {
+#ifdef PH_CODEC_X86
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  static const bool has_ssse3 = __builtin_cpu_supports("ssse3");
+  if (has_avx2)
+    return Unpack1Avx2(src, count, dst, elem_size);
+  if (has_ssse3)
+    return Unpack1Ssse3(src, count, dst, elem_size);
+#endif
+  return 0;
+}
+
+inline uint8_t *PutVarint(uint8_t *p, uint64_t v) {
+  while (v >= 0x80) {
+    *p++ = static_cast<uint8_t>(v | 0x80);
+    v >>= 7;
+  }
+  *p++ = static_cast<uint8_t>(v);
+  return p;
+}
+}  // namespace
+
+void BitPack(const void *src, size_t elem_size, size_t count, uint32_t bits,
+             uint8_t *dst) {
+  auto in = reinterpret_cast<const uint8_t *>(src);
+  size_t done = 0;
+  if (bits == 1)
+    done = Pack1Simd(in, elem_size, count, dst);
+  BitPackScalar(in + done * elem_size, elem_size, count - done, bits,
+                dst + done * bits / 8);
+}
+
+void BitUnpack(const uint8_t *src, size_t count, uint32_t bits, void *dst,
+               size_t elem_size) {
+  auto out = reinterpret_cast<uint8_t *>(dst);
+  size_t done = 0;
+  if (bits == 1)
+    done = Unpack1Simd(src, count, out, elem_size);
+  BitUnpackScalar(src + done * bits / 8, count - done, bits,
+                  out + done * elem_size, elem_size);
+}
+
+void VarintEncode(const void *src, size_t elem_size, bool is_signed,
+                  size_t count, bool delta, std::string *out) {
+  auto in = reinterpret_cast<const uint8_t *>(src);
+  size_t offset = out->size();
+  out->resize(offset + count * 10);
+  auto begin = reinterpret_cast<uint8_t *>(&(*out)[0]) + offset;
+  auto p = begin;
+  uint64_t prev = 0;
+  for (size_t i = 0; i < count; i++) {
+    uint64_t v = Load(in + i * elem_size, elem_size, is_signed);
+    if (delta) {
+      p = PutVarint(p, ZigZag(static_cast<int64_t>(v - prev)));
+      prev = v;
+    } else if (is_signed) {
+      p = PutVarint(p, ZigZag(static_cast<int64_t>(v)));
+    } else {
+      p = PutVarint(p, v);
+    }
+  }
+  out->resize(offset + (p - begin));
+}
+
+bool VarintDecode(std::string_view src, size_t count, bool delta,
+                  bool is_signed, void *dst, size_t elem_size) {
+  auto p = reinterpret_cast<const uint8_t *>(src.data());
+  auto end = p + src.size();
+  auto out = reinterpret_cast<uint8_t *>(dst);
+  bool zigzag = delta || is_signed;
+  uint64_t prev = 0;
+  size_t i = 0;
+  while (i < count) {
+    // Runs of one byte values are common for small shares and deltas, take
+    // eight of them at a time when no continuation bit is set.
+    if (!zigzag && i + 8 <= count && end - p >= 8) {
+      uint64_t word;
+      memcpy(&word, p, 8);
+      if ((word & 0x8080808080808080ULL) == 0) {
+        for (size_t k = 0; k < 8; k++)
+          Store(out + (i + k) * elem_size, elem_size, p[k]);
+        p += 8;
+        i += 8;
+        continue;
+      }
+    }
+
+    uint64_t v = 0;
+    uint32_t shift = 0;
+    while (true) {
+      if (p == end || shift > 63)
+        return false;
+      uint8_t byte = *p++;
+      v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0)
+        break;
+      shift += 7;
+    }
+
+    if (delta) {
+      prev += static_cast<uint64_t>(UnZigZag(v));
+      v = prev;
+    } else if (is_signed) {
+      v = static_cast<uint64_t>(UnZigZag(v));
+    }
+    Store(out + i * elem_size, elem_size, v);
+    i++;
+  }
+  return p == end;
+}
+
+bool EncodeInts(const void *src, size_t elem_size, bool is_signed,
+                size_t count, IntCodec codec, uint32_t bits,
+                std::string *frame) {
+  if (!ValidElemSize(elem_size))
+    return false;
+
+  PackedHeader header;
+  memset(&header, 0, sizeof(header));
+  header.codec = static_cast<uint8_t>(codec);
+  header.elem_size = static_cast<uint8_t>(elem_size);
+  header.count = count;
+
+  switch (codec) {
+  case IntCodec::kBitPack: {
+    if (bits == 0 || bits > 8 * elem_size)
+      return false;
+    header.bits = static_cast<uint8_t>(bits);
+    frame->resize(sizeof(header) + BitPackedSize(count, bits));
+    memcpy(&(*frame)[0], &header, sizeof(header));
+    BitPack(src, elem_size, count, bits,
+            reinterpret_cast<uint8_t *>(&(*frame)[sizeof(header)]));
+    return true;
+  }
+  case IntCodec::kVarint:
+  case IntCodec::kDeltaVarint:
+    frame->assign(reinterpret_cast<const char *>(&header), sizeof(header));
+    VarintEncode(src, elem_size, is_signed, count,
+                 codec == IntCodec::kDeltaVarint, frame);
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool ParsePackedHeader(std::string_view frame, PackedHeader *header) {
+  if (frame.size() < sizeof(PackedHeader))
+    return false;
+  memcpy(header, frame.data(), sizeof(PackedHeader));
+  if (!ValidElemSize(header->elem_size))
+    return false;
+
+  size_t payload = frame.size() - sizeof(PackedHeader);
+  switch (static_cast<IntCodec>(header->codec)) {
+  case IntCodec::kBitPack:
+    if (header->bits == 0 || header->bits > 8 * header->elem_size)
+      return false;
+    if (header->count > (payload * 8) / header->bits)
+      return false;
+    return payload == BitPackedSize(header->count, header->bits);
+  case IntCodec::kVarint:
+  case IntCodec::kDeltaVarint:
+    // Every value takes at least one byte.
+    return header->count <= payload;
+  default:
+    return false;
+  }
+}
+
+bool DecodeInts(std::string_view frame, const PackedHeader &header,
+                bool is_signed, void *dst, size_t elem_size) {
+  if (header.elem_size != elem_size)
+    return false;
+
+  std::string_view payload = frame.substr(sizeof(PackedHeader));
+  switch (static_cast<IntCodec>(header.codec)) {
+  case IntCodec::kBitPack:
+    BitUnpack(reinterpret_cast<const uint8_t *>(payload.data()), header.count,
+              header.bits, dst, elem_size);
+    if (is_signed && header.bits < 8 * elem_size) {
+      // Restore the sign of values that were packed from a signed type.
+      auto out = reinterpret_cast<uint8_t *>(dst);
+      uint64_t sign = 1ULL << (header.bits - 1);
+      for (size_t i = 0; i < header.count; i++) {
+        uint64_t v = LoadUnsigned(out + i * elem_size, elem_size);
+        Store(out + i * elem_size, elem_size, (v ^ sign) - sign);
+      }
+    }
+    return true;
+  case IntCodec::kVarint:
+  case IntCodec::kDeltaVarint:
+    return VarintDecode(payload, header.count,
+                        header.codec ==
+                            static_cast<uint8_t>(IntCodec::kDeltaVarint),
+                        is_signed, dst, elem_size);
+  default:
+    return false;
+  }
+}
+}  // namespace primihub
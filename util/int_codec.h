@@ -0,0 +1,88 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef UTIL_INT_CODEC_H_
+#define UTIL_INT_CODEC_H_
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace primihub {
+/// Wire codecs for integer shares.
+///
+///   * kBitPack: every value keeps only its low `bits` bits, values are laid
+///     out back to back LSB first. Signed types are sign extended again on
+///     decode.
+///   * kVarint: LEB128, signed types are zigzag mapped first.
+///   * kDeltaVarint: zigzag(x[i] - x[i-1]) as LEB128, for sorted or slowly
+///     changing sequences such as indices.
+enum class IntCodec : uint8_t {
+  kBitPack = 0,
+  kVarint = 1,
+  kDeltaVarint = 2,
+};
+
+/// Header in front of every encoded frame, lets the receiver size its
+/// container exactly and reject a frame written for another element type.
+struct PackedHeader {
+  uint8_t codec;
+  uint8_t bits;
+  uint8_t elem_size;
+  uint8_t reserved[5];
+  uint64_t count;
+};
+static_assert(sizeof(PackedHeader) == 16, "PackedHeader must be 16 bytes");
+
+// Number of bytes BitPack writes for count values of the given bit width.
+inline size_t BitPackedSize(size_t count, uint32_t bits) {
+  return (count * bits + 7) / 8;
+}
+
+// Packs the low `bits` bits of count little-endian integers of elem_size
+// bytes (1, 2, 4 or 8) into dst, which must hold BitPackedSize() bytes.
+void BitPack(const void *src, size_t elem_size, size_t count, uint32_t bits,
+             uint8_t *dst);
+
+// Inverse of BitPack, the values are zero extended to elem_size bytes.
+void BitUnpack(const uint8_t *src, size_t count, uint32_t bits, void *dst,
+               size_t elem_size);
+
+// Appends count LEB128 encoded integers to out. When delta is set the
+// zigzagged difference to the previous value is encoded instead.
+void VarintEncode(const void *src, size_t elem_size, bool is_signed,
+                  size_t count, bool delta, std::string *out);
+
+// Decodes exactly count integers from src, returns false if src is truncated
+// or holds trailing bytes.
+bool VarintDecode(std::string_view src, size_t count, bool delta,
+                  bool is_signed, void *dst, size_t elem_size);
+
+// Builds a complete frame (PackedHeader followed by the encoded payload).
+// bits is only used by kBitPack and must be in [1, 8 * elem_size], returns
+// false if the codec or the bit width is invalid.
+bool EncodeInts(const void *src, size_t elem_size, bool is_signed,
+                size_t count, IntCodec codec, uint32_t bits,
+                std::string *frame);
+
+// Validates the header of a frame produced by EncodeInts.
+bool ParsePackedHeader(std::string_view frame, PackedHeader *header);
+
+// Decodes the payload of frame into dst, which must have room for
+// header.count elements of elem_size bytes.
+bool DecodeInts(std::string_view frame, const PackedHeader &header,
+                bool is_signed, void *dst, size_t elem_size);
+}  // namespace primihub
+#endif  // UTIL_INT_CODEC_H_
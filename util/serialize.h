@@ -0,0 +1,343 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef UTIL_SERIALIZE_H_
+#define UTIL_SERIALIZE_H_
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "util/type_trait.h"
+
+/// Lists the fields of a struct for SerializeFields and Channel::send, in
+/// wire order:
+///
+///   struct TripleBatch {
+///     uint64_t round;
+///     std::vector<uint64_t> a, b, c;
+///     PH_SERIALIZE_FIELDS(round, a, b, c)
+///   };
+#define PH_SERIALIZE_FIELDS(...)                                             \
+  auto serialFields() { return std::tie(__VA_ARGS__); }                      \
+  auto serialFields() const { return std::tie(__VA_ARGS__); }
+
+namespace primihub {
+/// Read-only view of count elements inside a received frame, valid while
+/// the frame lives. On the wire it is the same as std::vector<T>, so a
+/// sender's vector may be received as a view.
+template<typename T>
+struct ConstView {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "ConstView needs trivially copyable elements");
+  const T *data{nullptr};
+  size_t size{0};
+
+  const T *begin() const { return data; }
+  const T *end() const { return data + size; }
+  const T &operator[](size_t i) const { return data[i]; }
+};
+
+/// Wire format of one field, fields are written back to back:
+///   * trivially copyable values as their bytes
+///   * strings as a u64 length and the bytes
+///   * vectors of trivially copyable T as a u64 count, padding up to
+///     alignof(T) from the start of the frame, then the elements, so a
+///     view of them is aligned
+///   * other vectors as a u64 count followed by every element
+///   * structs with PH_SERIALIZE_FIELDS as their fields
+/// Integers are in host byte order, like every other Channel message.
+template<typename T, typename = void>
+struct SerialField;
+
+namespace serial_detail {
+template<typename T>
+using Bare = std::remove_cv_t<std::remove_reference_t<T>>;
+
+template<typename T>
+struct is_view : std::false_type {};
+template<typename T>
+struct is_view<ConstView<T>> : std::true_type {};
+template<>
+struct is_view<std::string_view> : std::true_type {};
+
+template<typename T>
+constexpr bool kRaw = std::is_trivially_copyable<T>::value &&
+                      !is_view<T>::value && !has_serial_fields<T>::value;
+
+inline size_t AlignUp(size_t offset, size_t align) {
+  return (offset + align - 1) / align * align;
+}
+
+inline bool ReadCount(const char *frame, size_t size, size_t *offset,
+                      uint64_t *count) {
+  if (size - *offset < sizeof(*count))
+    return false;
+  memcpy(count, frame + *offset, sizeof(*count));
+  *offset += sizeof(*count);
+  return true;
+}
+
+inline size_t WriteCount(char *frame, size_t offset, uint64_t count) {
+  memcpy(frame + offset, &count, sizeof(count));
+  return offset + sizeof(count);
+}
+
+// Locates count elements of T after the count, checks bounds and
+// alignment against the frame.
+template<typename T>
+bool LocateArray(const char *frame, size_t size, size_t *offset,
+                 uint64_t count, const T **data) {
+  size_t begin = AlignUp(*offset, alignof(T));
+  if (begin > size || count > (size - begin) / sizeof(T))
+    return false;
+  *data = reinterpret_cast<const T *>(frame + begin);
+  *offset = begin + count * sizeof(T);
+  return true;
+}
+
+template<typename Tuple, size_t... I>
+constexpr bool AnyView(std::index_sequence<I...>) {
+  return (SerialField<Bare<std::tuple_element_t<I, Tuple>>>::kHasViews ||
+          ...);
+}
+}  // namespace serial_detail
+
+template<typename T>
+struct SerialField<T, std::enable_if_t<serial_detail::kRaw<T>>> {
+  static constexpr bool kHasViews = false;
+  static size_t Size(size_t offset, const T &) { return offset + sizeof(T); }
+  static size_t Write(char *frame, size_t offset, const T &value) {
+    memcpy(frame + offset, &value, sizeof(T));
+    return offset + sizeof(T);
+  }
+  static bool Read(const char *frame, size_t size, size_t *offset, T *value) {
+    if (size - *offset < sizeof(T))
+      return false;
+    memcpy(value, frame + *offset, sizeof(T));
+    *offset += sizeof(T);
+    return true;
+  }
+};
+
+template<typename Traits, typename Alloc>
+struct SerialField<std::basic_string<char, Traits, Alloc>> {
+  using String = std::basic_string<char, Traits, Alloc>;
+  static constexpr bool kHasViews = false;
+  static size_t Size(size_t offset, const String &value) {
+    return offset + sizeof(uint64_t) + value.size();
+  }
+  static size_t Write(char *frame, size_t offset, const String &value) {
+    offset = serial_detail::WriteCount(frame, offset, value.size());
+    memcpy(frame + offset, value.data(), value.size());
+    return offset + value.size();
+  }
+  static bool Read(const char *frame, size_t size, size_t *offset,
+                   String *value) {
+    uint64_t length = 0;
+    const char *data = nullptr;
+    if (!serial_detail::ReadCount(frame, size, offset, &length) ||
+        !serial_detail::LocateArray(frame, size, offset, length, &data))
+      return false;
+    value->assign(data, length);
+    return true;
+  }
+};
+
+template<>
+struct SerialField<std::string_view> {
+  static constexpr bool kHasViews = true;
+  static size_t Size(size_t offset, std::string_view value) {
+    return offset + sizeof(uint64_t) + value.size();
+  }
+  static size_t Write(char *frame, size_t offset, std::string_view value) {
+    offset = serial_detail::WriteCount(frame, offset, value.size());
+    memcpy(frame + offset, value.data(), value.size());
+    return offset + value.size();
+  }
+  static bool Read(const char *frame, size_t size, size_t *offset,
+                   std::string_view *value) {
+    uint64_t length = 0;
+    const char *data = nullptr;
+    if (!serial_detail::ReadCount(frame, size, offset, &length) ||
+        !serial_detail::LocateArray(frame, size, offset, length, &data))
+      return false;
+    *value = std::string_view(data, length);
+    return true;
+  }
+};
+
+template<typename T>
+struct SerialField<ConstView<T>> {
+  static constexpr bool kHasViews = true;
+  static size_t Size(size_t offset, const ConstView<T> &value) {
+    offset = serial_detail::AlignUp(offset + sizeof(uint64_t), alignof(T));
+    return offset + value.size * sizeof(T);
+  }
+  static size_t Write(char *frame, size_t offset, const ConstView<T> &value) {
+    offset = serial_detail::WriteCount(frame, offset, value.size);
+    offset = serial_detail::AlignUp(offset, alignof(T));
+    if (value.size > 0)
+      memcpy(frame + offset, value.data, value.size * sizeof(T));
+    return offset + value.size * sizeof(T);
+  }
+  static bool Read(const char *frame, size_t size, size_t *offset,
+                   ConstView<T> *value) {
+    uint64_t count = 0;
+    const T *data = nullptr;
+    if (!serial_detail::ReadCount(frame, size, offset, &count) ||
+        !serial_detail::LocateArray(frame, size, offset, count, &data))
+      return false;
+    // Pointing into the frame needs the frame itself to be aligned.
+    if (reinterpret_cast<uintptr_t>(data) % alignof(T) != 0)
+      return false;
+    value->data = data;
+    value->size = count;
+    return true;
+  }
+};
+
+template<typename T, typename Alloc>
+struct SerialField<std::vector<T, Alloc>,
+                   std::enable_if_t<serial_detail::kRaw<T> &&
+                                    !std::is_same<T, bool>::value>> {
+  static constexpr bool kHasViews = false;
+  static size_t Size(size_t offset, const std::vector<T, Alloc> &value) {
+    offset = serial_detail::AlignUp(offset + sizeof(uint64_t), alignof(T));
+    return offset + value.size() * sizeof(T);
+  }
+  static size_t Write(char *frame, size_t offset,
+                      const std::vector<T, Alloc> &value) {
+    offset = serial_detail::WriteCount(frame, offset, value.size());
+    offset = serial_detail::AlignUp(offset, alignof(T));
+    if (!value.empty())
+      memcpy(frame + offset, value.data(), value.size() * sizeof(T));
+    return offset + value.size() * sizeof(T);
+  }
+  static bool Read(const char *frame, size_t size, size_t *offset,
+                   std::vector<T, Alloc> *value) {
+    uint64_t count = 0;
+    const T *data = nullptr;
+    if (!serial_detail::ReadCount(frame, size, offset, &count) ||
+        !serial_detail::LocateArray(frame, size, offset, count, &data))
+      return false;
+    value->resize(count);
+    if (count > 0)
+      memcpy(value->data(), data, count * sizeof(T));
+    return true;
+  }
+};
+
+template<typename T, typename Alloc>
+struct SerialField<std::vector<T, Alloc>,
+                   std::enable_if_t<!serial_detail::kRaw<T>>> {
+  static constexpr bool kHasViews = SerialField<T>::kHasViews;
+  static size_t Size(size_t offset, const std::vector<T, Alloc> &value) {
+    offset += sizeof(uint64_t);
+    for (const auto &item : value)
+      offset = SerialField<T>::Size(offset, item);
+    return offset;
+  }
+  static size_t Write(char *frame, size_t offset,
+                      const std::vector<T, Alloc> &value) {
+    offset = serial_detail::WriteCount(frame, offset, value.size());
+    for (const auto &item : value)
+      offset = SerialField<T>::Write(frame, offset, item);
+    return offset;
+  }
+  static bool Read(const char *frame, size_t size, size_t *offset,
+                   std::vector<T, Alloc> *value) {
+    uint64_t count = 0;
+    if (!serial_detail::ReadCount(frame, size, offset, &count))
+      return false;
+    // Every element takes at least one byte, a corrupt count can not make
+    // us allocate more than the frame holds.
+    if (count > size - *offset)
+      return false;
+    value->resize(count);
+    for (auto &item : *value) {
+      if (!SerialField<T>::Read(frame, size, offset, &item))
+        return false;
+    }
+    return true;
+  }
+};
+
+template<typename T>
+struct SerialField<T, std::enable_if_t<has_serial_fields<T>::value &&
+                                       !serial_detail::kRaw<T> &&
+                                       !serial_detail::is_view<T>::value>> {
+  using Fields = decltype(std::declval<T &>().serialFields());
+  static constexpr bool kHasViews = serial_detail::AnyView<Fields>(
+      std::make_index_sequence<std::tuple_size<Fields>::value>());
+
+  static size_t Size(size_t offset, const T &value) {
+    std::apply(
+        [&](const auto &...fields) {
+          ((offset = SerialField<serial_detail::Bare<decltype(fields)>>::Size(
+                offset, fields)),
+           ...);
+        },
+        value.serialFields());
+    return offset;
+  }
+  static size_t Write(char *frame, size_t offset, const T &value) {
+    std::apply(
+        [&](const auto &...fields) {
+          ((offset = SerialField<serial_detail::Bare<decltype(fields)>>::Write(
+                frame, offset, fields)),
+           ...);
+        },
+        value.serialFields());
+    return offset;
+  }
+  static bool Read(const char *frame, size_t size, size_t *offset, T *value) {
+    return std::apply(
+        [&](auto &...fields) {
+          return (SerialField<serial_detail::Bare<decltype(fields)>>::Read(
+                      frame, size, offset, &fields) &&
+                  ...);
+        },
+        value->serialFields());
+  }
+};
+
+/// Size of the frame SerializeFields writes for value.
+template<typename T>
+size_t SerializedSize(const T &value) {
+  return SerialField<T>::Size(0, value);
+}
+
+/// Writes value into frame, which holds SerializedSize(value) bytes, with
+/// every field copied once.
+template<typename T>
+void SerializeFields(const T &value, char *frame) {
+  SerialField<T>::Write(frame, 0, value);
+}
+
+/// Reads value from the size byte frame, false if the frame is truncated or
+/// has bytes left over. View fields point into the frame afterwards.
+template<typename T>
+bool DeserializeFields(const char *frame, size_t size, T *value) {
+  size_t offset = 0;
+  return SerialField<T>::Read(frame, size, &offset, value) && offset == size;
+}
+}  // namespace primihub
+#endif  // UTIL_SERIALIZE_H_
@@ -0,0 +1,182 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "util/strided.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PH_STRIDED_X86 1
+#endif
+
+namespace primihub {
+namespace {
+// A run is n elements that are step elements apart, e.g. one column of a
+// matrix or one row of its transpose.
+template <size_t kSize>
+void GatherRunFixed(const char *src, size_t n, size_t step, char *dst) {
+  for (size_t i = 0; i < n; i++)
+    memcpy(dst + i * kSize, src + i * step * kSize, kSize);
+}
+
+template <size_t kSize>
+void ScatterRunFixed(const char *src, size_t n, size_t step, char *dst) {
+  for (size_t i = 0; i < n; i++)
+    memcpy(dst + i * step * kSize, src + i * kSize, kSize);
+}
+
+#ifdef PH_STRIDED_X86
+__attribute__((target("avx2"))) size_t GatherRun8Avx2(const char *src,
+                                                      size_t n, size_t step,
+                                                      char *dst) {
+  const __m256i idx = _mm256_setr_epi64x(0, step, 2 * step, 3 * step);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i v = _mm256_i64gather_epi64(
+        reinterpret_cast<const long long *>(src + i * step * 8), idx, 8);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i * 8), v);
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) size_t GatherRun4Avx2(const char *src,
+                                                      size_t n, size_t step,
+                                                      char *dst) {
+  // The gather takes 32-bit indices, 7 * step must fit.
+  if (step >= (1u << 28))
+    return 0;
+  int s = static_cast<int>(step);
+  const __m256i idx =
+      _mm256_setr_epi32(0, s, 2 * s, 3 * s, 4 * s, 5 * s, 6 * s, 7 * s);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i v = _mm256_i32gather_epi32(
+        reinterpret_cast<const int *>(src + i * step * 4), idx, 4);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i * 4), v);
+  }
+  return i;
+}
+#endif  // PH_STRIDED_X86
+
+void GatherRun(const char *src, size_t n, size_t step, size_t elem_size,
+               char *dst) {
+  size_t done = 0;
+#ifdef PH_STRIDED_X86
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  if (has_avx2) {
+    if (elem_size == 8)
+      done = GatherRun8Avx2(src, n, step, dst);
+    else if (elem_size == 4)
+      done = GatherRun4Avx2(src, n, step, dst);
+  }
+#endif
+  src += done * step * elem_size;
+  dst += done * elem_size;
+  n -= done;
+  switch (elem_size) {
+  case 1:
+    GatherRunFixed<1>(src, n, step, dst);
+    break;
+  case 2:
+    GatherRunFixed<2>(src, n, step, dst);
+    break;
+  case 4:
+    GatherRunFixed<4>(src, n, step, dst);
+    break;
+  case 8:
+    GatherRunFixed<8>(src, n, step, dst);
+    break;
+  case 16:
+    GatherRunFixed<16>(src, n, step, dst);
+    break;
+  default:
+    for (size_t i = 0; i < n; i++)
+      memcpy(dst + i * elem_size, src + i * step * elem_size, elem_size);
+    break;
+  }
+}
+
+// AVX2 has no scatter instruction, the fixed size stores below compile to
+// single moves which is as fast as emulating one.
+void ScatterRun(const char *src, size_t n, size_t step, size_t elem_size,
+                char *dst) {
+  switch (elem_size) {
+  case 1:
+    ScatterRunFixed<1>(src, n, step, dst);
+    break;
+  case 2:
+    ScatterRunFixed<2>(src, n, step, dst);
+    break;
+  case 4:
+    ScatterRunFixed<4>(src, n, step, dst);
+    break;
+  case 8:
+    ScatterRunFixed<8>(src, n, step, dst);
+    break;
+  case 16:
+    ScatterRunFixed<16>(src, n, step, dst);
+    break;
+  default:
+    for (size_t i = 0; i < n; i++)
+      memcpy(dst + i * step * elem_size, src + i * elem_size, elem_size);
+    break;
+  }
+}
+}  // namespace
+
+void StridedGather(const StridedView &view, char *dst) {
+  size_t elem = view.elem_size;
+  size_t row_bytes = view.cols * elem;
+  if (view.col_stride == 1) {
+    if (view.rows == 1 || view.row_stride == view.cols) {
+      memcpy(dst, view.base, view.size());
+    } else if (view.cols == 1) {
+      GatherRun(view.base, view.rows, view.row_stride, elem, dst);
+    } else {
+      for (size_t r = 0; r < view.rows; r++)
+        memcpy(dst + r * row_bytes, view.base + r * view.row_stride * elem,
+               row_bytes);
+    }
+    return;
+  }
+
+  for (size_t r = 0; r < view.rows; r++)
+    GatherRun(view.base + r * view.row_stride * elem, view.cols,
+              view.col_stride, elem, dst + r * row_bytes);
+}
+
+void StridedScatter(const char *src, const MutableStridedView &view) {
+  size_t elem = view.elem_size;
+  size_t row_bytes = view.cols * elem;
+  if (view.col_stride == 1) {
+    if (view.rows == 1 || view.row_stride == view.cols) {
+      memcpy(view.base, src, view.size());
+    } else if (view.cols == 1) {
+      ScatterRun(src, view.rows, view.row_stride, elem, view.base);
+    } else {
+      for (size_t r = 0; r < view.rows; r++)
+        memcpy(view.base + r * view.row_stride * elem, src + r * row_bytes,
+               row_bytes);
+    }
+    return;
+  }
+
+  for (size_t r = 0; r < view.rows; r++)
+    ScatterRun(src + r * row_bytes, view.cols, view.col_stride, elem,
+               view.base + r * view.row_stride * elem);
+}
+}  // namespace primihub
@@ -0,0 +1,72 @@
+/*
+* Copyright (c) 2023 by PrimiHub
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      https://www.apache.org/licenses/
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef UTIL_STRIDED_H_
+#define UTIL_STRIDED_H_
+#include <cstddef>
+#include <type_traits>
+
+namespace primihub {
+/// A 2-D view over row-major data without copying it. Element (r, c) lives at
+///   base + (r * row_stride + c * col_stride) * elem_size
+/// so a row, a column, a sub-block or the transpose of a matrix m with ld
+/// columns are all views over the same storage:
+///   row i:      MakeStridedView(&m[i * ld], 1, ld, ld)
+///   column j:   MakeStridedView(&m[j], rows, 1, ld)
+///   block:      MakeStridedView(&m[r0 * ld + c0], nrows, ncols, ld)
+///   transpose:  MakeStridedView(m, ld, rows, 1, ld)
+/// On the wire a view is its rows * cols elements, packed row by row.
+template <typename Pointer> struct BasicStridedView {
+  Pointer base;
+  size_t rows;
+  size_t cols;
+  size_t row_stride;  // in elements
+  size_t col_stride;  // in elements, 1 for contiguous rows
+  size_t elem_size;
+
+  size_t size() const { return rows * cols * elem_size; }
+
+  // A mutable view can be sent as well.
+  template <typename P = Pointer,
+            typename = std::enable_if_t<!std::is_same<P, const char *>::value>>
+  operator BasicStridedView<const char *>() const {
+    return {base, rows, cols, row_stride, col_stride, elem_size};
+  }
+};
+
+using StridedView = BasicStridedView<const char *>;
+using MutableStridedView = BasicStridedView<char *>;
+
+template <typename T>
+StridedView MakeStridedView(const T *base, size_t rows, size_t cols,
+                            size_t row_stride, size_t col_stride = 1) {
+  return StridedView{reinterpret_cast<const char *>(base), rows, cols,
+                     row_stride, col_stride, sizeof(T)};
+}
+
+template <typename T>
+MutableStridedView MakeStridedView(T *base, size_t rows, size_t cols,
+                                   size_t row_stride, size_t col_stride = 1) {
+  return MutableStridedView{reinterpret_cast<char *>(base), rows, cols,
+                            row_stride, col_stride, sizeof(T)};
+}
+
+// Copies the elements of view into dst, which must hold view.size() bytes.
+void StridedGather(const StridedView &view, char *dst);
+
+// Copies view.size() packed bytes from src into the elements of view.
+void StridedScatter(const char *src, const MutableStridedView &view);
+}  // namespace primihub
+#endif  // UTIL_STRIDED_H_
@@ -15,8 +15,11 @@
 */
 #ifndef UTIL_TYPE_TRAIT_H_
 #define UTIL_TYPE_TRAIT_H_
+#include <bitset>
 #include <memory>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 namespace primihub {
 /// type trait that defines what is considered a STL like Container
@@ -68,5 +71,36 @@ public:
     static constexpr bool value = type::value;
 };
 
+/// type trait for containers of single bits, which can not meet is_container
+/// because they have no POD value_type and no data()
+///    * std::vector<bool>
+///    * std::bitset<N>
+template<typename T>
+struct is_bit_container : std::false_type {};
+
+template<typename Alloc>
+struct is_bit_container<std::vector<bool, Alloc>> : std::true_type {};
+
+template<size_t N>
+struct is_bit_container<std::bitset<N>> : std::true_type {};
+
+/// type trait for structs that list their fields with PH_SERIALIZE_FIELDS
+/// (util/serialize.h) and are sent as one serialized frame. POD structs
+/// keep being sent as they are.
+///    * T::serialFields() const returns a tuple of references to the fields
+template<typename T, typename = void>
+struct has_serial_fields : std::false_type {};
+
+template<typename T>
+struct has_serial_fields<
+    T, std::void_t<decltype(std::declval<const T&>().serialFields())>>
+    : std::true_type {};
+
+template<typename T>
+struct is_serializable
+    : std::integral_constant<bool,
+                             has_serial_fields<T>::value &&
+                             !std::is_pod<T>::value> {};
+
 }  // namespace primihub
 #endif  // UTIL_TYPE_TRAIT_H_